@@ -21,6 +21,17 @@ MSG_CRYPTO_LIB_NS_BEGIN
 		static int Encrypt(const std::string &plain, /* out */std::string &cipher,
 						   const std::string &key);
 
+		// rc4 is symmetric, so this both encrypts and decrypts data where it lies
+		static int CryptInPlace(unsigned char *data, unsigned long datalen,
+								const std::string &key);
+
+		// runs the key schedule once, the result can be reused for any number of messages under that key
+		static int SetKey(RC4_KEY *schedule, const std::string &key);
+
+		// works on a copy of the schedule, so the cached one stays at its post key schedule state
+		static void CryptInPlace(unsigned char *data, unsigned long datalen,
+								 const RC4_KEY &schedule);
+
 	private:
 		CryptoRC4Util()
 		{
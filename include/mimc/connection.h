@@ -2,8 +2,16 @@
 #define MIMC_CPP_SDK_CONNECTION_H
 
 #include <string>
+#include <deque>
+#include <map>
+#include <vector>
+#include <openssl/rc4.h>
 #include <mimc/user.h>
 #include <mimc/utils.h>
+#include <mimc/frame_buffer.h>
+
+class EventLoop;
+class EventHandler;
 
 enum FEConnState {
     NOT_CONNECTED,
@@ -13,14 +21,33 @@ enum FEConnState {
 class Connection {
 public:
     Connection();
+    // races non-blocking connects to every fe address, the next one starting after a stagger or as soon as one fails
     bool connect();
+    // true once fd completed its handshake and won the race, every other attempt is closed then
+    bool finishConnect(int fd);
+    // starts staggered attempts that are due and drops the ones past their deadline
+    void checkConnect(int64_t nowMs);
+    // steady clock time checkConnect next has work to do, -1 if no race is running
+    int64_t nextConnectTimestamp() const;
+    void abortConnect();
+    // FE_DOMAIN's records from a lookup that finished during the race join its end
+    void addFeDomainCandidates();
+    // blocking getaddrinfo of FE_DOMAIN, never on the loop thread
+    static bool resolveFeDomain(std::vector<std::string> &addresses);
     void resetSock();
-    ssize_t writen(const void *buf, size_t nbytes);
-    ssize_t readn(void *buf, size_t nbytes);
+    int readAvailable();
+    // takes ownership of frame, it is delete[]d once written
+    void queueFrame(unsigned char *frame, int size);
+    int flush();
+    // stops asking the loop for readable events, a hangup is still reported
+    void setReadPaused(bool paused);
+    bool isReadPaused() const { return readPaused; }
 
     void setState(FEConnState state) { this->state = state; }
     void setUser(User * user) { this->user = user; }
+    void setEventLoop(EventLoop * eventLoop, EventHandler * eventHandler) { this->eventLoop = eventLoop; this->eventHandler = eventHandler; }
     void setChallengeAndBodyKey(const std::string &challenge);
+    void setConnectRace(int64_t staggerMs, int64_t attemptTimeoutMs) { this->connectStaggerMs = staggerMs; this->connectAttemptTimeoutMs = attemptTimeoutMs; }
 
     unsigned int getVersion() { return version; }
     int getSdk() { return sdk; }
@@ -35,22 +62,48 @@ public:
     std::string getLocale() const{ return locale; }
     std::string getChallenge() const{ return challenge; }
     std::string getBodyKey() const{ return body_key; }
+    const RC4_KEY * getBodyKeySchedule() const{ return body_key.empty() ? NULL : &body_key_schedule; }
     User * getUser() const{ return user; }
     FEConnState getState() { return state; }
+    bool isConnecting() const { return connecting; }
+    const std::string& getConnectedAddr() const { return connectedAddr; }
+    bool hasPendingOutput() const { return !sendFrames.empty(); }
+    FrameBuffer& getRecvBuffer() { return recvBuffer; }
 
     time_t getNextResetSockTs() { return nextResetSockTimestamp; }
     void clearNextResetSockTs() { this->nextResetSockTimestamp = -1; }
     void trySetNextResetTs();
 private:
+    struct SendFrame {
+        unsigned char * data;
+        int size;
+    };
+#ifdef _WIN32
+    typedef SOCKET SocketFd;
+#else
+    typedef int SocketFd;
+#endif // _WIN32
+    struct ConnectAttempt {
+        SocketFd fd;
+        std::string addr;
+        int64_t deadline;
+    };
+
+    void collectConnectCandidates();
+    void appendFeDomainCandidates();
+    SocketFd startConnect(const std::string &addr);
+    void failConnectAttempt(size_t index, const char * reason);
+    void closeConnectAttempts();
+    void scoreAddress(const std::string &addr, int delta);
+    void closeSock();
+    void consumeSent(size_t nbytes);
+    void updateInterest();
+
     unsigned int version;
     int sdk;
     int andver;
 
-#ifdef _WIN32
-	SOCKET socketfd;
-#else
-	int socketfd;
-#endif // _WIN32
+	SocketFd socketfd;
 
 	time_t nextResetSockTimestamp;
 
@@ -63,8 +116,26 @@ private:
     std::string locale;
     std::string challenge;
     std::string body_key;
+    RC4_KEY body_key_schedule;
     FEConnState state;
     User * user;
+
+    bool connecting;
+    bool readPaused;
+    std::string connectedAddr;
+    std::vector<ConnectAttempt> connectAttempts;
+    std::vector<std::string> connectCandidates;
+    size_t nextConnectCandidate;
+    int64_t nextConnectAttemptTimestamp;
+    int64_t connectStaggerMs;
+    int64_t connectAttemptTimeoutMs;
+    // loop thread only, outlives every race so addresses that keep failing sink to the back instead of being dropped
+    std::map<std::string, int> addressScores;
+    FrameBuffer recvBuffer;
+    std::deque<SendFrame> sendFrames;
+    size_t sendFrameOffset;
+    EventLoop * eventLoop;
+    EventHandler * eventHandler;
 };
 
 #endif //MIMC_CPP_SDK_CONNECTION_H
\ No newline at end of file
@@ -19,6 +19,58 @@ enum MessageDirection {
 	C2S_DOUBLE_DIRECTION
 };
 
+enum LoginState {
+	LOGIN_IDLE,
+	LOGIN_PREPARING,
+	LOGIN_CONNECTING,
+	LOGIN_CONN_SENT,
+	LOGIN_HANDSHAKED,
+	LOGIN_BIND_SENT,
+	LOGIN_ONLINE
+};
+
+// time to online of the last successful login, in milliseconds
+struct LoginTimeline {
+	// token and resolver (http dns) fetch, plus connect races that failed
+	int64_t resolveMs;
+	// tcp connect race that won
+	int64_t tcpMs;
+	// CONN request to challenge
+	int64_t connMs;
+	// BIND request to bind response
+	int64_t bindMs;
+	int64_t totalMs;
+};
+
+enum SendLane {
+	SEND_LANE_CONTROL,
+	SEND_LANE_ACK,
+	SEND_LANE_MESSAGE,
+	SEND_LANE_COUNT
+};
+
+struct SendLaneStats {
+	unsigned int depth;
+	unsigned int peakDepth;
+	uint64_t sent;
+};
+
+enum DeliveryLane {
+	DELIVERY_LANE_MESSAGE,
+	DELIVERY_LANE_RTS,
+	DELIVERY_LANE_COUNT
+};
+
+struct DeliveryLaneStats {
+	unsigned int depth;
+	unsigned int peakDepth;
+	uint64_t delivered;
+	uint64_t dropped;
+	// time from queued to started, over every delivered callback
+	int64_t totalQueueMicros;
+	int64_t maxQueueMicros;
+};
+
 enum RelayLinkState {
 	NOT_CREATED,
 	BEING_CREATED,
@@ -48,6 +100,12 @@ const short BODY_HEADER_PAYLOADTYPE = PROTOBUF;
 const unsigned int BODY_PAYLOAD_CONN_VERSION = 106;
 const int BODY_PAYLOAD_CONN_SDK = 33;
 const char* const RESOLVER_URL = "resolver.msg.xiaomi.net/gslb/";
+const int64_t RESOLVER_CACHE_TTL_MS = 10 * 60 * 1000;
+const int64_t RESOLVER_REFETCH_INTERVAL_MS = 5000;
+const long HTTP_REQUEST_TIMEOUT_MS = 10000;
+const long HTTP_CLIENT_MAX_CONNECTS = 16;
+const int HTTP_CLIENT_IDLE_WAIT_MS = 1000;
+const int HTTP_CLIENT_POLL_INTERVAL_MS = 20;
 #ifndef STAGING
 const char* const FE_DOMAIN = "app.chat.xiaomi.net";
 #else
@@ -56,10 +114,20 @@ const char* const FE_IP = "10.38.162.154";
 #endif
 const int FE_PORT = 5222;
 const int LOGIN_TIMEOUT = 10;
+// tokens without a tokenExpireTime in their response are replaced after this long
+const int64_t TOKEN_DEFAULT_REFRESH_MS = 6 * 60 * 60 * 1000;
+const int64_t TOKEN_REFRESH_AHEAD_MS = 10 * 60 * 1000;
+const int64_t TOKEN_REFRESH_RETRY_MS = 60 * 1000;
 const int CONNECT_TIMEOUT = 10;
+const int64_t FE_CONNECT_STAGGER_MS = 250;
+const int64_t FE_CONNECT_ATTEMPT_TIMEOUT_MS = 5000;
+const int FE_ADDRESS_SCORE_SUCCESS = 1;
+const int FE_ADDRESS_SCORE_FAILURE = -2;
+const int FE_ADDRESS_SCORE_LIMIT = 8;
 const int RESETSOCK_TIMEOUT = 5;
 const int HTTP_TIMEOUT = CONNECT_TIMEOUT;
 const int SEND_TIMEOUT = CONNECT_TIMEOUT * 2;
+const int64_t SEND_TIMEOUT_MS = SEND_TIMEOUT * 1000;
 const int PING_TIMEINTERVAL = 15;
 const int XMD_TRAN_TIMEOUT = 60;
 const int RELAY_CONN_TIMEOUT = 30;
@@ -93,7 +161,43 @@ const int BODY_CRC_LEN = 4;
 const int MIMC_CHID = 9;
 
 const int MIMC_MAX_PAYLOAD_SIZE = 10 * 1024;
+const char* const PAYLOAD_COMPRESS_MAGIC = "\0MZC";
+const unsigned int PAYLOAD_COMPRESS_MAGIC_LENGTH = 4;
+const unsigned int PAYLOAD_COMPRESS_HEADER_LENGTH = PAYLOAD_COMPRESS_MAGIC_LENGTH + 4;
+const unsigned int PAYLOAD_COMPRESS_THRESHOLD = 1024;
+const int PAYLOAD_COMPRESS_LEVEL = 6;
 const int RTS_MAX_PAYLOAD_SIZE = 500 * 1024;
+const int MAX_PACKET_BODY_SIZE = 1024 * 1024;
+
+const int RECV_BUFFER_SIZE = 16 * 1024;
+const int FRAME_BUFFER_INITIAL_SIZE = 1024;
+const int FRAME_BUFFER_RETAIN_SIZE = 2 * RECV_BUFFER_SIZE;
+const int CHECK_TIMEOUT_INTERVAL_MS = 1000;
+const int SEND_TIMEOUT_WHEEL_TICK_MS = 10;
+const int SEND_TIMEOUT_WHEEL_SLOTS = 256;
+const int SEND_BATCH_BYTES = 64 * 1024;
+const int SEND_IOV_MAX = 64;
+const unsigned int SEND_QUEUE_CAPACITY = 100;
+const unsigned int SEND_COMPOUND_MAX_PACKETS = 32;
+const unsigned int SEQUENCE_WINDOW_SIZE = 2048;
+// PULLs kept in flight while the server reports messages beyond the last COMPOUND, a
+// PULL names no range so more than one would only fetch the same page again
+const unsigned int SYNC_PULL_PIPELINE_DEPTH = 1;
+const int64_t SYNC_PULL_TIMEOUT_MS = 5000;
+const int64_t SEQUENCE_ACK_DELAY_MS = 50;
+// callbacks a delivery lane holds before the loop stops reading, or RTS data is dropped
+const unsigned int DELIVERY_QUEUE_CAPACITY = 1024;
+const unsigned int SEND_LANE_CONTROL_WEIGHT = 8;
+const unsigned int SEND_LANE_ACK_WEIGHT = 4;
+const unsigned int SEND_LANE_MESSAGE_WEIGHT = 1;
+const unsigned int MAPPED_LOG_INITIAL_SIZE = 64 * 1024;
+// an outbox is rewritten once its acknowledged records take more room than this and than the pending ones
+const unsigned int OUTBOX_COMPACT_MIN_BYTES = 256 * 1024;
+// sends are refused once this many messages wait in the outbox for their ack
+const unsigned int OUTBOX_MAX_PENDING_MESSAGES = 10000;
+// the inbound log drops its older half once it holds this many messages
+const unsigned int INBOUND_LOG_MAX_MESSAGES = 20000;
+const unsigned int INBOUND_LOG_CONVERSATION_HISTORY = 100;
 
 const char* const MIMC_SERVER = "xiaomi.com";
 
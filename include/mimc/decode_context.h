@@ -0,0 +1,43 @@
+#ifndef MIMC_CPP_SDK_DECODE_CONTEXT_H
+#define MIMC_CPP_SDK_DECODE_CONTEXT_H
+
+#include <mimc/ims_push_service.pb.h>
+#include <mimc/mimc.pb.h>
+#include <mimc/rts_signal.pb.h>
+#include <mimc/rts_data.pb.h>
+#include <mimc/message_view.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+/*
+ * The protobuf messages the receive path parses into, one set per thread.
+ * Parsing clears a message first but keeps its strings, nested messages and
+ * repeated fields allocated, so a thread that has decoded a few frames
+ * decodes the next ones of the same shape without touching the heap. Every
+ * User on an event loop shares that loop's context, the XMD thread has its
+ * own for relay and p2p packets. Whatever points into a context, the views
+ * handed to the handlers included, is only valid until the thread decodes
+ * its next frame.
+ */
+struct DecodeContext {
+	ims::ClientHeader header;
+	std::string payloadKey;
+	mimc::MIMCPacket packet;
+	mimc::MIMCPacketAck packetAck;
+	mimc::RTSMessage rtsMessage;
+	mimc::UserPacket userPacket;
+
+	// handleCompound, messages and payload buffers are taken in order and only ever added to
+	mimc::MIMCPacketList packetList;
+	std::deque<mimc::MIMCP2PMessage> p2pMessages;
+	std::deque<mimc::MIMCP2TMessage> p2tMessages;
+	std::deque<std::string> p2pPayloadBuffers;
+	std::deque<std::string> p2tPayloadBuffers;
+	std::vector<MIMCMessageView> p2pMessageViews;
+	std::vector<MIMCGroupMessageView> p2tMessageViews;
+
+	static DecodeContext& current();
+};
+
+#endif //MIMC_CPP_SDK_DECODE_CONTEXT_H
@@ -0,0 +1,135 @@
+#ifndef MIMC_CPP_SDK_DELIVERY_EXECUTOR_H
+#define MIMC_CPP_SDK_DELIVERY_EXECUTOR_H
+
+#include <mimc/constant.h>
+#include <mimc/message_handler.h>
+#include <mimc/message_batch_handler.h>
+#include <mimc/rts_callevent_handler.h>
+#include <mimc/mimc_runtime.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+
+class User;
+class DeliveryExecutor;
+
+// stands in for the registered MessageHandler, every callback is queued on DELIVERY_LANE_MESSAGE
+class QueuedMessageHandler : public MessageHandler {
+public:
+	QueuedMessageHandler(DeliveryExecutor* executor) : executor(executor), target(NULL) {}
+	void setTarget(MessageHandler* target) {this->target = target;}
+
+	void handleMessage(std::vector<MIMCMessage> packets);
+	void handleGroupMessage(std::vector<MIMCGroupMessage> packets);
+	void handleServerAck(std::string packetId, int64_t sequence, time_t timestamp, std::string desc);
+	void handleSendMsgTimeout(MIMCMessage message);
+	void handleSendGroupMsgTimeout(MIMCGroupMessage groupMessage);
+
+private:
+	DeliveryExecutor* executor;
+	MessageHandler* target;
+};
+
+// the views only live until the call returns, so a queued batch owns copies and views them again on the worker
+class QueuedMessageBatchHandler : public MessageBatchHandler {
+public:
+	QueuedMessageBatchHandler(DeliveryExecutor* executor) : executor(executor), target(NULL) {}
+	void setTarget(MessageBatchHandler* target) {this->target = target;}
+
+	void handleMessageBatch(const std::vector<MIMCMessageView>& messages);
+	void handleGroupMessageBatch(const std::vector<MIMCGroupMessageView>& messages);
+
+private:
+	DeliveryExecutor* executor;
+	MessageBatchHandler* target;
+};
+
+/*
+ * Queues RTS callbacks on DELIVERY_LANE_RTS. onData is dropped while the
+ * lane is full, a late media frame is worth less than a live transport.
+ * Call state changes and send results are queued past capacity, they are
+ * few and losing one leaves the application with a call it cannot end.
+ * onLaunched answers the caller, so it stays synchronous, it already runs
+ * on a thread of its own.
+ */
+class QueuedRTSCallEventHandler : public RTSCallEventHandler {
+public:
+	QueuedRTSCallEventHandler(DeliveryExecutor* executor) : executor(executor), target(NULL) {}
+	void setTarget(RTSCallEventHandler* target) {this->target = target;}
+
+	LaunchedResponse onLaunched(uint64_t callId, const std::string fromAccount, const std::string appContent, const std::string fromResource);
+	void onAnswered(uint64_t callId, bool accepted, const std::string desc);
+	void onClosed(uint64_t callId, const std::string desc);
+	void onData(uint64_t callId, const std::string fromAccount, const std::string resource, const std::string data, RtsDataType dataType, RtsChannelType channelType);
+	void onSendDataSuccess(uint64_t callId, int dataId, const std::string ctx);
+	void onSendDataFailure(uint64_t callId, int dataId, const std::string ctx);
+
+private:
+	DeliveryExecutor* executor;
+	RTSCallEventHandler* target;
+};
+
+/*
+ * Runs the application callbacks of one User off the threads that receive
+ * them, so a slow handler no longer holds up the event loop or the XMD
+ * thread. Each lane is a bounded FIFO drained by one worker thread, which
+ * keeps every peer's messages and every call's events in arrival order.
+ * The loop stops reading the FE socket while the message lane is
+ * backlogged and the owner is woken once it has drained to half, so a
+ * slow consumer pushes back on the server instead of piling up in memory.
+ */
+class DeliveryExecutor {
+public:
+	DeliveryExecutor(const User* owner, unsigned int capacity);
+	// runs what is still queued, then joins the workers
+	~DeliveryExecutor();
+
+	// the workers stop waking the owner, call before the owner leaves its event loop
+	void detachOwner();
+
+	// takes ownership of task, a full lane refuses it unless force
+	bool execute(DeliveryLane lane, MimcRuntimeTask* task, bool force);
+	// set once a lane reaches capacity, cleared when it has drained to half
+	bool isBacklogged(DeliveryLane lane) const;
+	DeliveryLaneStats getStats(DeliveryLane lane) const;
+	unsigned int getCapacity() const {return this->capacity;}
+
+	MessageHandler* getMessageHandler() {return &this->messageHandler;}
+	MessageBatchHandler* getMessageBatchHandler() {return &this->messageBatchHandler;}
+	RTSCallEventHandler* getRTSCallEventHandler() {return &this->rtsCallEventHandler;}
+	void setMessageHandler(MessageHandler* handler) {this->messageHandler.setTarget(handler);}
+	void setMessageBatchHandler(MessageBatchHandler* handler) {this->messageBatchHandler.setTarget(handler);}
+	void setRTSCallEventHandler(RTSCallEventHandler* handler) {this->rtsCallEventHandler.setTarget(handler);}
+
+private:
+	struct QueuedTask {
+		MimcRuntimeTask* task;
+		int64_t enqueuedAt;
+	};
+	struct DeliveryLaneQueue {
+		DeliveryExecutor* executor;
+		DeliveryLane lane;
+		pthread_t thread;
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+		std::deque<QueuedTask> tasks;
+		bool backlogged;
+		DeliveryLaneStats stats;
+	};
+
+	static void* runLane(void* arg);
+	void drain(DeliveryLaneQueue* queue);
+
+	// guarded by ownerMutex, NULL once detached
+	const User* owner;
+	pthread_mutex_t ownerMutex;
+	unsigned int capacity;
+	std::atomic<bool> stopping;
+	DeliveryLaneQueue* lanes[DELIVERY_LANE_COUNT];
+	QueuedMessageHandler messageHandler;
+	QueuedMessageBatchHandler messageBatchHandler;
+	QueuedRTSCallEventHandler rtsCallEventHandler;
+};
+
+#endif //MIMC_CPP_SDK_DELIVERY_EXECUTOR_H
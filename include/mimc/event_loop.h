@@ -0,0 +1,99 @@
+#ifndef MIMC_CPP_SDK_EVENT_LOOP_H
+#define MIMC_CPP_SDK_EVENT_LOOP_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <map>
+#include <set>
+#include <vector>
+
+enum LoopEventType {
+	LOOP_EVENT_READ = 0x01,
+	LOOP_EVENT_WRITE = 0x02,
+	LOOP_EVENT_ERROR = 0x04
+};
+
+class EventHandler {
+public:
+	virtual void handleIOEvent(int fd, int events) {}
+	virtual void handleTimer(int64_t timerId) {}
+	virtual void handleNotify() {}
+	virtual ~EventHandler() {}
+};
+
+/*
+ * Single threaded reactor. On linux it waits on epoll, with an eventfd for
+ * cross thread wakeups and a timerfd armed to the earliest pending timer;
+ * other platforms fall back to select() with a loopback socket for wakeups.
+ * All handler callbacks run on the loop thread.
+ */
+class EventLoop {
+public:
+	EventLoop();
+	~EventLoop();
+
+	bool start();
+	void stop();
+	bool isInLoopThread() const;
+
+	bool addFd(int fd, int events, EventHandler* handler);
+	bool modifyFd(int fd, int events);
+	void removeFd(int fd);
+
+	// one shot timer, re-arm from handleTimer for periodic work
+	int64_t addTimer(int64_t delayMs, EventHandler* handler);
+	void cancelTimer(int64_t timerId);
+
+	// thread safe, handler->handleNotify() runs once on the loop thread however often it is notified
+	void notify(EventHandler* handler);
+	// drops every fd, timer and pending notify of handler, waiting for a running callback to return
+	void removeHandler(EventHandler* handler);
+
+private:
+	struct FdEntry {
+		int events;
+		EventHandler* handler;
+	};
+	struct TimerEntry {
+		int64_t deadline;
+		EventHandler* handler;
+	};
+	struct ReadyEvent {
+		int fd;
+		int events;
+	};
+
+	static void* run(void* arg);
+	void loop();
+	void poll(int64_t timeoutMs, std::vector<ReadyEvent>& readyEvents);
+	void wakeup();
+	void drainWakeup();
+	int64_t nextTimeout();
+	void dispatchTimers();
+	void dispatchNotifies();
+
+	bool running;
+	bool started;
+	pthread_t loopThread;
+	pthread_mutex_t mutex;
+	pthread_mutex_t dispatchMutex;
+
+	std::map<int, FdEntry> fds;
+	std::map<int64_t, TimerEntry> timers;
+	std::multimap<int64_t, int64_t> timerQueue;
+	int64_t nextTimerId;
+	std::set<EventHandler*> pendingNotifies;
+	std::set<EventHandler*> removedHandlers;
+
+#ifdef __linux__
+	int epollFd;
+	int wakeupFd;
+	int timerFd;
+	int64_t armedDeadline;
+#else
+	int wakeupRecvFd;
+	int wakeupSendFd;
+#endif
+};
+
+#endif //MIMC_CPP_SDK_EVENT_LOOP_H
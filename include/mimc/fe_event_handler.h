@@ -0,0 +1,53 @@
+#ifndef MIMC_CPP_SDK_FE_EVENTHANDLER_H
+#define MIMC_CPP_SDK_FE_EVENTHANDLER_H
+
+#include <mimc/event_loop.h>
+#include <mimc/mimc_runtime.h>
+#include <mimc/user.h>
+
+class FeEventHandler : public EventHandler, public MimcRuntimeTask {
+public:
+	FeEventHandler(User* user) {
+		this->user = user;
+	}
+	void handleIOEvent(int fd, int events) {
+		this->user->handleConnEvent(fd, events);
+	}
+	void handleTimer(int64_t timerId) {
+		this->user->handleLoopTimer(timerId);
+	}
+	void handleNotify() {
+		this->user->handleLoopNotify();
+	}
+	void run() {
+		this->user->prepareConnection();
+	}
+private:
+	User* user;
+};
+
+class ServerAddrPrepareTask : public MimcRuntimeTask {
+public:
+	ServerAddrPrepareTask(User* user) {
+		this->user = user;
+	}
+	void run() {
+		this->user->prepareServerAddr();
+	}
+private:
+	User* user;
+};
+
+class FeDomainResolveTask : public MimcRuntimeTask {
+public:
+	FeDomainResolveTask(User* user) {
+		this->user = user;
+	}
+	void run() {
+		this->user->resolveFeDomain();
+	}
+private:
+	User* user;
+};
+
+#endif //MIMC_CPP_SDK_FE_EVENTHANDLER_H
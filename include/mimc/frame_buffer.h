@@ -0,0 +1,41 @@
+#ifndef MIMC_CPP_SDK_FRAME_BUFFER_H
+#define MIMC_CPP_SDK_FRAME_BUFFER_H
+
+#include <stddef.h>
+
+/*
+ * Receive buffer of one FE connection. Bytes are appended at the write end
+ * and consumed from the read end; when the write end runs out of room the
+ * unread tail (at most one partial frame) wraps back to the front instead of
+ * the buffer growing, so every complete frame stays contiguous and can be
+ * checked, decrypted and parsed where it lies.
+ */
+class FrameBuffer {
+public:
+	FrameBuffer();
+	~FrameBuffer();
+
+	size_t readableBytes() const { return writeIndex - readIndex; }
+	size_t writableBytes() const { return capacity - writeIndex; }
+	unsigned char* peek() const { return data + readIndex; }
+	unsigned char* beginWrite() const { return data + writeIndex; }
+
+	// makes at least len bytes writable, wrapping the unread bytes to the front or growing
+	void ensureWritable(size_t len);
+	void hasWritten(size_t len) { writeIndex += len; }
+	void append(const unsigned char* buf, size_t len);
+	void retrieve(size_t len);
+	void clear();
+
+private:
+	FrameBuffer(const FrameBuffer&);
+	FrameBuffer& operator=(const FrameBuffer&);
+	void release();
+
+	unsigned char* data;
+	size_t capacity;
+	size_t readIndex;
+	size_t writeIndex;
+};
+
+#endif //MIMC_CPP_SDK_FRAME_BUFFER_H
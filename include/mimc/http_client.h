@@ -0,0 +1,69 @@
+#ifndef MIMC_CPP_SDK_HTTP_CLIENT_H
+#define MIMC_CPP_SDK_HTTP_CLIENT_H
+
+#include <pthread.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+struct HttpRequest {
+	std::string url;
+	// sent as a POST when not empty, a GET otherwise
+	std::string body;
+	std::vector<std::string> headers;
+	long timeoutMs;
+
+	HttpRequest() : timeoutMs(0) {}
+};
+
+class HttpCallback {
+public:
+	// curlCode is a CURLcode, status the http status or 0 when no response arrived
+	virtual void handleResponse(int curlCode, long status, const std::string& body) = 0;
+	virtual ~HttpCallback() {}
+};
+
+/*
+ * Process wide http client for the resolver and token requests. Every
+ * request runs on one curl multi handle driven by a thread of its own, so
+ * connections are kept alive and reused across requests and users, and dns
+ * results and tls sessions are shared. Easy handles are pooled.
+ */
+class HttpClient {
+public:
+	static HttpClient* instance();
+
+	// callback runs on the client thread and must not block
+	void request(const HttpRequest& request, HttpCallback* callback);
+	// blocks until the response arrives, false on transport errors
+	bool perform(const HttpRequest& request, std::string& body, long* status = NULL);
+
+private:
+	struct PendingRequest {
+		HttpRequest request;
+		HttpCallback* callback;
+	};
+	struct Transfer;
+
+	HttpClient();
+	static void* run(void* arg);
+	static size_t writeBody(char* ptr, size_t size, size_t nmemb, void* userdata);
+	void startTransfers();
+	void finishTransfers();
+	void wakeup();
+
+	static pthread_mutex_t instanceMutex;
+	static HttpClient* client;
+
+	pthread_mutex_t mutex;
+	std::deque<PendingRequest> pendingRequests;
+	// owned by the client thread
+	void* multi;
+	void* share;
+	std::vector<void*> idleHandles;
+#ifndef _WIN32
+	int wakeupFds[2];
+#endif
+};
+
+#endif //MIMC_CPP_SDK_HTTP_CLIENT_H
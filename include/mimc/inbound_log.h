@@ -0,0 +1,65 @@
+#ifndef MIMC_CPP_SDK_INBOUND_LOG_H
+#define MIMC_CPP_SDK_INBOUND_LOG_H
+
+#include <mimc/constant.h>
+#include <mimc/mapped_log.h>
+#include <mimc/mimc_runtime.h>
+#include <mimc/message_view.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Received messages of one User, logged before they are handed to the
+ * MessageHandler. The sequence index makes duplicate detection exact for
+ * everything still in the log, across restarts too, and the newest
+ * messages of each peer and topic can be read back without the server.
+ * Once the log holds INBOUND_LOG_MAX_MESSAGES it is rewritten with the
+ * newer half on the blocking pool of MimcRuntime.
+ */
+class InboundLog : public MimcRuntimeTask {
+public:
+	InboundLog();
+	~InboundLog();
+
+	// maps the log at path, P2P messages are indexed by the peer of selfAccount
+	bool open(const std::string& path, const std::string& selfAccount);
+	bool contains(int64_t sequence);
+	bool add(const MIMCMessageView& message);
+	bool add(const MIMCGroupMessageView& message);
+	// at most limit of the newest messages, oldest first
+	size_t getRecentMessages(const std::string& peer, size_t limit, std::vector<MIMCMessage>& messages);
+	size_t getRecentGroupMessages(int64_t topicId, size_t limit, std::vector<MIMCGroupMessage>& messages);
+	// every logged message with a sequence above sequence, in the order they were received
+	void getMessagesAfter(int64_t sequence, std::vector<MIMCMessage>& messages, std::vector<MIMCGroupMessage>& groupMessages);
+	size_t getMessageCount();
+
+	// compaction, runs on the blocking pool of MimcRuntime
+	void run();
+
+private:
+	InboundLog(const InboundLog&);
+	InboundLog& operator=(const InboundLog&);
+	static std::string encode(const MIMCMessageView& message);
+	static std::string encode(const MIMCGroupMessageView& message);
+	static bool decode(const std::string& record, MIMCMessage* message, MIMCGroupMessage* groupMessage, bool& isGroup);
+	static std::string topicKey(int64_t topicId);
+	std::string peerKey(const MIMCMessageView& message) const;
+	bool append(int64_t sequence, const std::string& key, const std::string& record);
+	void index(int64_t sequence, const std::string& key, int64_t offset);
+
+	pthread_mutex_t mutex;
+	MappedLog log;
+	std::string selfAccount;
+	// sequence to log offset
+	std::unordered_map<int64_t, int64_t> offsets;
+	// newest sequences of each peer and topic, oldest first
+	std::map<std::string, std::deque<int64_t> > conversations;
+	bool compacting;
+};
+
+#endif //MIMC_CPP_SDK_INBOUND_LOG_H
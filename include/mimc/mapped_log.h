@@ -0,0 +1,56 @@
+#ifndef MIMC_CPP_SDK_MAPPED_LOG_H
+#define MIMC_CPP_SDK_MAPPED_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+/*
+ * Append only file of length and crc framed records, mapped into memory so
+ * that an append is a memcpy. Records written before a crash of the process
+ * are found again by open, a torn last record is dropped. Not thread safe,
+ * owners serialize access. Not available on Windows, where open fails.
+ */
+class MappedLog {
+public:
+	MappedLog();
+	~MappedLog();
+
+	// maps path, creating it when missing, and restores the end of the intact records
+	bool open(const std::string& path);
+	void close();
+	bool isOpen() const {return this->data != NULL;}
+	const std::string& getPath() const {return this->path;}
+
+	// offset of the appended record, -1 when the file could not grow
+	int64_t append(const std::string& record);
+	bool read(int64_t offset, std::string& record) const;
+	// reads the record at offset and returns the offset of the one after it, -1 past the last record
+	int64_t next(int64_t offset, std::string& record) const;
+	int64_t begin() const;
+	int64_t end() const {return (int64_t)this->writeOffset;}
+
+	// renames the file over path, used to replace a log by its compacted copy
+	bool renameTo(const std::string& path);
+	void swap(MappedLog& other);
+
+	// little endian fields and length prefixed strings, for owners building record bodies
+	static void putInt(std::string& out, uint64_t value, size_t bytes);
+	static void putString(std::string& out, const std::string& value);
+	static void putString(std::string& out, const char* data, size_t size);
+	static bool getInt(const std::string& in, size_t& pos, uint64_t& value, size_t bytes);
+	static bool getString(const std::string& in, size_t& pos, std::string& value);
+
+private:
+	MappedLog(const MappedLog&);
+	MappedLog& operator=(const MappedLog&);
+	bool grow(size_t minCapacity);
+
+	std::string path;
+	int fd;
+	char* data;
+	size_t capacity;
+	size_t writeOffset;
+};
+
+#endif //MIMC_CPP_SDK_MAPPED_LOG_H
@@ -0,0 +1,20 @@
+#ifndef MIMC_CPP_SDK_MESSAGEBATCHHANDLER_H
+#define MIMC_CPP_SDK_MESSAGEBATCHHANDLER_H
+
+#include <mimc/message_view.h>
+#include <vector>
+
+/*
+ * Takes over incoming messages from MessageHandler when registered, each
+ * batch by reference and without copying a single field. The views are
+ * valid until the call returns, toMessage() keeps one for longer. Acks and
+ * send timeouts still go to the MessageHandler.
+ */
+class MessageBatchHandler {
+public:
+	virtual void handleMessageBatch(const std::vector<MIMCMessageView>& messages) = 0;
+	virtual void handleGroupMessageBatch(const std::vector<MIMCGroupMessageView>& messages) = 0;
+	virtual ~MessageBatchHandler() {}
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef MIMC_CPP_SDK_MESSAGE_OUTBOX_H
+#define MIMC_CPP_SDK_MESSAGE_OUTBOX_H
+
+#include <mimc/mapped_log.h>
+#include <mimc/mimc_runtime.h>
+#include <mimc/outgoing_message.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * Persistent outbox of one User. A message is logged before it is queued
+ * and stays in the log until the server acks it or its send timeout fires,
+ * so messages sent while offline, or still unacknowledged at a crash or
+ * restart, go out again on the next connection. The send timeout is armed
+ * when a message is taken for sending, not when it is added, and a message
+ * the app was told timed out is removed for good, it is never replayed.
+ * Removals are appended too, and the log is rewritten with only the pending
+ * messages on the blocking pool of MimcRuntime once the removed ones
+ * dominate it. At most OUTBOX_MAX_PENDING_MESSAGES are kept, add fails
+ * beyond that.
+ */
+class MessageOutbox : public MimcRuntimeTask {
+public:
+	MessageOutbox();
+	~MessageOutbox();
+
+	// maps the log at path and restores the messages that were never acked
+	bool open(const std::string& path);
+	bool add(const std::string& packetId, const OutgoingMessage& message);
+	// up to maxMessages pending messages not yet sent on the current connection, oldest first
+	size_t takeUnsent(std::vector<std::pair<std::string, OutgoingMessage> >& messages, size_t maxMessages);
+	// the message could not be queued, it goes out on a later pass
+	void markUnsent(const std::string& packetId);
+	// a new connection sends every pending message again
+	void markAllUnsent();
+	bool hasUnsent();
+	void ack(const std::string& packetId);
+	// the send timed out and the app was told so, the message is dropped as an acked one is
+	void expire(const std::string& packetId);
+	size_t getPendingCount();
+
+	// compaction, runs on the blocking pool of MimcRuntime
+	void run();
+
+private:
+	MessageOutbox(const MessageOutbox&);
+	MessageOutbox& operator=(const MessageOutbox&);
+	static std::string encodeMessage(const std::string& packetId, const OutgoingMessage& message);
+	static std::string encodeAck(const std::string& packetId);
+	static bool decode(const std::string& record, bool& isAck, std::string& packetId, OutgoingMessage* message);
+	void remove(const std::string& packetId);
+	void appendRemoval(const std::string& packetId);
+
+	pthread_mutex_t mutex;
+	MappedLog log;
+	// pending messages by log offset, which is also the order they were sent in
+	std::map<int64_t, std::string> pending;
+	std::map<std::string, int64_t> offsets;
+	std::set<int64_t> unsent;
+	int64_t liveBytes;
+	bool compacting;
+};
+
+#endif //MIMC_CPP_SDK_MESSAGE_OUTBOX_H
@@ -0,0 +1,36 @@
+#ifndef MIMC_CPP_SDK_MESSAGE_SYNC_H
+#define MIMC_CPP_SDK_MESSAGE_SYNC_H
+
+#include <mimc/constant.h>
+#include <stdint.h>
+#include <deque>
+
+/*
+ * Catch up of one connection. Every bind starts with a PULL, and while a
+ * COMPOUND announces a maxsequence beyond the newest packet it carries the
+ * server still holds messages, so the next PULL goes out as soon as the
+ * answer arrives instead of waiting for pushes. MIMCPull carries no range,
+ * PULLs in flight together are all answered with the same page, so
+ * SYNC_PULL_PIPELINE_DEPTH keeps a single one and catch up is a chain of
+ * PULL, COMPOUND and sequence ack. Loop thread only.
+ */
+class MessageSync {
+public:
+	MessageSync();
+
+	// the connection is online, returns how many PULLs to send
+	unsigned int start(int64_t now);
+	// a COMPOUND arrived, lastSequence is the newest packet in it, returns how many PULLs to send
+	unsigned int handlePacketList(int64_t maxSequence, int64_t lastSequence, int64_t now);
+	bool isSyncing() const {return this->maxSequence > this->lastSequence;}
+
+private:
+	unsigned int topUp(int64_t now);
+
+	// send times of the PULLs not answered yet, oldest first
+	std::deque<int64_t> inflight;
+	int64_t maxSequence;
+	int64_t lastSequence;
+};
+
+#endif //MIMC_CPP_SDK_MESSAGE_SYNC_H
@@ -0,0 +1,98 @@
+#ifndef MIMC_CPP_SDK_MESSAGE_VIEW_H
+#define MIMC_CPP_SDK_MESSAGE_VIEW_H
+
+#include <mimc/mimcmessage.h>
+#include <mimc/mimc_group_message.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+// non owning bytes, valid as long as the string it was taken from
+class StringView {
+public:
+	StringView() : ptr(""), length(0) {}
+	StringView(const std::string& str) : ptr(str.data()), length(str.size()) {}
+	StringView(const char* data, size_t size) : ptr(data), length(size) {}
+	const char* data() const { return this->ptr; }
+	size_t size() const { return this->length; }
+	bool empty() const { return this->length == 0; }
+	std::string toString() const { return std::string(this->ptr, this->length); }
+	bool operator==(const StringView& other) const { return this->length == other.length && memcmp(this->ptr, other.ptr, this->length) == 0; }
+	bool operator!=(const StringView& other) const { return !(*this == other); }
+private:
+	const char* ptr;
+	size_t length;
+};
+
+/*
+ * MIMCMessage without the copies, its fields point into the decoded packet
+ * a MessageBatchHandler is called with. toMessage() makes an owning copy.
+ */
+class MIMCMessageView {
+public:
+	MIMCMessageView() : sequence(0), timestamp(0) {}
+	MIMCMessageView(StringView packetId, int64_t sequence, StringView fromAccount, StringView fromResource, StringView toAccount, StringView toResource, StringView payload, StringView bizType, time_t timestamp)
+		: packetId(packetId), sequence(sequence), fromAccount(fromAccount), fromResource(fromResource), toAccount(toAccount), toResource(toResource), payload(payload), bizType(bizType), timestamp(timestamp) {}
+	MIMCMessageView(const MIMCMessage& message)
+		: packetId(message.getPacketId()), sequence(message.getSequence()), fromAccount(message.getFromAccount()), fromResource(message.getFromResource()), toAccount(message.getToAccount()), toResource(message.getToResource()), payload(message.getPayload()), bizType(message.getBizType()), timestamp(message.getTimeStamp()) {}
+	StringView getPacketId() const { return this->packetId; }
+	int64_t getSequence() const { return this->sequence; }
+	StringView getFromAccount() const { return this->fromAccount; }
+	StringView getFromResource() const { return this->fromResource; }
+	StringView getToAccount() const { return this->toAccount; }
+	StringView getToResource() const { return this->toResource; }
+	StringView getPayload() const { return this->payload; }
+	StringView getBizType() const { return this->bizType; }
+	time_t getTimeStamp() const { return this->timestamp; }
+	MIMCMessage toMessage() const {
+		return MIMCMessage(packetId.toString(), sequence, fromAccount.toString(), fromResource.toString(), toAccount.toString(), toResource.toString(), payload.toString(), bizType.toString(), timestamp);
+	}
+	static bool sortBySequence(const MIMCMessageView &m1, const MIMCMessageView &m2) {
+		return m1.sequence < m2.sequence;
+	}
+private:
+	StringView packetId;
+	int64_t sequence;
+	StringView fromAccount;
+	StringView fromResource;
+	StringView toAccount;
+	StringView toResource;
+	StringView payload;
+	StringView bizType;
+	time_t timestamp;
+};
+
+class MIMCGroupMessageView {
+public:
+	MIMCGroupMessageView() : sequence(0), timestamp(0), topicId(0) {}
+	MIMCGroupMessageView(StringView packetId, int64_t sequence, StringView fromAccount, StringView fromResource, uint64_t topicId, StringView payload, StringView bizType, time_t timestamp)
+		: packetId(packetId), sequence(sequence), timestamp(timestamp), fromAccount(fromAccount), fromResource(fromResource), topicId(topicId), payload(payload), bizType(bizType) {}
+	MIMCGroupMessageView(const MIMCGroupMessage& message)
+		: packetId(message.getPacketId()), sequence(message.getSequence()), timestamp(message.getTimeStamp()), fromAccount(message.getFromAccount()), fromResource(message.getFromResource()), topicId(message.getTopicId()), payload(message.getPayload()), bizType(message.getBizType()) {}
+	StringView getPacketId() const { return this->packetId; }
+	int64_t getSequence() const { return this->sequence; }
+	StringView getFromAccount() const { return this->fromAccount; }
+	StringView getFromResource() const { return this->fromResource; }
+	StringView getPayload() const { return this->payload; }
+	StringView getBizType() const { return this->bizType; }
+	time_t getTimeStamp() const { return this->timestamp; }
+	uint64_t getTopicId() const { return this->topicId; }
+	MIMCGroupMessage toMessage() const {
+		return MIMCGroupMessage(packetId.toString(), sequence, fromAccount.toString(), fromResource.toString(), topicId, payload.toString(), bizType.toString(), timestamp);
+	}
+	static bool sortBySequence(const MIMCGroupMessageView &m1, const MIMCGroupMessageView &m2) {
+		return m1.sequence < m2.sequence;
+	}
+private:
+	StringView packetId;
+	int64_t sequence;
+	time_t timestamp;
+	StringView fromAccount;
+	StringView fromResource;
+	uint64_t topicId;
+	StringView payload;
+	StringView bizType;
+};
+
+#endif //MIMC_CPP_SDK_MESSAGE_VIEW_H
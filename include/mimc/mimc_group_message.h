@@ -16,12 +16,12 @@ public:
 		this->bizType = bizType;
 		this->timestamp = timestamp;
 	}
-	std::string getPacketId() const { return this->packetId; }
+	const std::string& getPacketId() const { return this->packetId; }
 	int64_t getSequence() const { return this->sequence; }
-	std::string getFromAccount() const { return this->fromAccount; }
-	std::string getFromResource() const { return this->fromResource; }
-	std::string getPayload() const { return this->payload; }
-	std::string getBizType() const { return this->bizType; }
+	const std::string& getFromAccount() const { return this->fromAccount; }
+	const std::string& getFromResource() const { return this->fromResource; }
+	const std::string& getPayload() const { return this->payload; }
+	const std::string& getBizType() const { return this->bizType; }
 	time_t getTimeStamp() const { return this->timestamp; }
 	uint64_t getTopicId() const { return this->topicId; }
 	static bool sortBySequence(const MIMCGroupMessage &m1, const MIMCGroupMessage &m2) {
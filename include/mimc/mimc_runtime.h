@@ -0,0 +1,59 @@
+#ifndef MIMC_CPP_SDK_MIMC_RUNTIME_H
+#define MIMC_CPP_SDK_MIMC_RUNTIME_H
+
+#include <pthread.h>
+#include <deque>
+#include <set>
+#include <vector>
+
+class EventLoop;
+
+class MimcRuntimeTask {
+public:
+	virtual void run() = 0;
+	virtual ~MimcRuntimeTask() {}
+};
+
+/*
+ * Process wide pool shared by every User: the FE connections, timers and
+ * callbacks of all users are spread over a fixed set of event loops, and
+ * work that may block (token fetch, resolver http) runs on a few separate
+ * threads so that it never stalls a loop.
+ */
+class MimcRuntime {
+public:
+	static MimcRuntime* instance();
+
+	// only takes effect before the first User is created, 0 means one loop per core
+	void setWorkerCount(unsigned int workerCount);
+	void setBlockingWorkerCount(unsigned int blockingWorkerCount);
+	unsigned int getWorkerCount();
+
+	EventLoop* acquireEventLoop();
+	void releaseEventLoop(EventLoop* eventLoop);
+
+	void runBlockingTask(MimcRuntimeTask* task);
+	// drops task if it is still queued, otherwise waits until it has finished
+	void cancelBlockingTask(MimcRuntimeTask* task);
+
+private:
+	MimcRuntime();
+	void startWorkers();
+	static void* runBlockingWorker(void* arg);
+
+	static pthread_mutex_t instanceMutex;
+	static MimcRuntime* runtime;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t taskCond;
+	pthread_cond_t taskDoneCond;
+	bool started;
+	unsigned int workerCount;
+	unsigned int blockingWorkerCount;
+	std::vector<EventLoop*> eventLoops;
+	std::vector<unsigned int> eventLoopUsers;
+	std::deque<MimcRuntimeTask*> blockingTasks;
+	std::multiset<MimcRuntimeTask*> runningTasks;
+};
+
+#endif //MIMC_CPP_SDK_MIMC_RUNTIME_H
@@ -17,14 +17,14 @@ public:
 		this->bizType = bizType;
 		this->timestamp = timestamp;
 	}
-	std::string getPacketId() const { return this->packetId; }
+	const std::string& getPacketId() const { return this->packetId; }
 	int64_t getSequence() const { return this->sequence; }
-	std::string getFromAccount() const { return this->fromAccount; }
-	std::string getFromResource() const { return this->fromResource; }
-	std::string getToAccount() const { return this->toAccount; }
-	std::string getToResource() const { return this->toResource; }
-	std::string getPayload() const { return this->payload; }
-	std::string getBizType() const { return this->bizType; }
+	const std::string& getFromAccount() const { return this->fromAccount; }
+	const std::string& getFromResource() const { return this->fromResource; }
+	const std::string& getToAccount() const { return this->toAccount; }
+	const std::string& getToResource() const { return this->toResource; }
+	const std::string& getPayload() const { return this->payload; }
+	const std::string& getBizType() const { return this->bizType; }
 	time_t getTimeStamp() const { return this->timestamp; }
 	static bool sortBySequence(const MIMCMessage &m1, const MIMCMessage &m2) {
 		return m1.sequence < m2.sequence;
@@ -0,0 +1,40 @@
+#ifndef MIMC_CPP_SDK_OUTGOING_MESSAGE_H
+#define MIMC_CPP_SDK_OUTGOING_MESSAGE_H
+
+#include <mimc/constant.h>
+#include <string>
+
+class OutgoingMessage {
+public:
+	OutgoingMessage(const std::string& toAppAccount, const std::string& payload, const std::string& bizType = "", bool isStore = true, int64_t timeoutMs = SEND_TIMEOUT_MS) {
+		this->toAppAccount = toAppAccount;
+		this->topicId = 0;
+		this->payload = payload;
+		this->bizType = bizType;
+		this->isStore = isStore;
+		this->timeoutMs = timeoutMs;
+	}
+	OutgoingMessage(int64_t topicId, const std::string& payload, const std::string& bizType = "", bool isStore = true, int64_t timeoutMs = SEND_TIMEOUT_MS) {
+		this->topicId = topicId;
+		this->payload = payload;
+		this->bizType = bizType;
+		this->isStore = isStore;
+		this->timeoutMs = timeoutMs;
+	}
+	const std::string& getToAppAccount() const { return this->toAppAccount; }
+	int64_t getTopicId() const { return this->topicId; }
+	const std::string& getPayload() const { return this->payload; }
+	const std::string& getBizType() const { return this->bizType; }
+	bool getIsStore() const { return this->isStore; }
+	int64_t getTimeoutMs() const { return this->timeoutMs; }
+	bool isGroupMessage() const { return this->topicId != 0; }
+private:
+	std::string toAppAccount;
+	int64_t topicId;
+	std::string payload;
+	std::string bizType;
+	bool isStore;
+	int64_t timeoutMs;
+};
+
+#endif
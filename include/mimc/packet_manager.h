@@ -2,12 +2,18 @@
 #define MIMC_CPP_SDK_PACKET_H
 
 #include <map>
-#include <set>
+#include <deque>
+#include <atomic>
 #include <mimc/connection.h>
+#include <mimc/constant.h>
 #include <mimc/utils.h>
 #include <mimc/ims_push_service.pb.h>
 #include <mimc/mimc.pb.h>
 #include <mimc/threadsafe_queue.h>
+#include <mimc/sequence_window.h>
+#include <mimc/message_sync.h>
+#include <mimc/send_timeout_wheel.h>
+#include <mimc/payload_codec.h>
 #include <mimc/mimcmessage.h>
 #include <crypto/base64.h>
 #include <pthread.h>
@@ -23,6 +29,8 @@ class User;
 
 class PacketManager {
 public:
+	PacketManager(unsigned int sendQueueCapacity = SEND_QUEUE_CAPACITY);
+	~PacketManager();
 	int encodeConnectionPacket(unsigned char * &packet, const Connection * connection);
 	int encodeBindPacket(unsigned char * &packet, const Connection * connection);
 	int encodeSecMsgPacket(unsigned char * &packet, const Connection * connection, const google::protobuf::MessageLite * message);
@@ -33,25 +41,96 @@ public:
 	int32_t char2int(const unsigned char* result, int index);
 	std::string createPacketId();
 	void checkMessageSendTimeout(const User * user);
+	// -1 while paused, otherwise the steady time the next deadline comes due
+	int64_t nextMessageSendTimeout();
+	// while reads are paused no PACKET_ACK can arrive, so the timeout clock stops and every deadline moves out by the pause
+	void setMessageSendTimeoutPaused(bool paused);
+	// inLoopThread packets skip the ring, the loop thread must never wait for room in its own queue
+	void pushPacketWaitToSend(const struct waitToSendContent& obj, SendLane lane, bool inLoopThread);
+	bool tryPushPacketWaitToSend(const struct waitToSendContent& obj, SendLane lane, bool inLoopThread);
+	bool popPacketWaitToSend(struct waitToSendContent& obj);
+	bool hasPacketsWaitToSend() const;
+	bool isSendLaneFull(SendLane lane) const;
+	void setSendLaneWeight(SendLane lane, unsigned int weight);
+	SendLaneStats getSendLaneStats(SendLane lane) const;
+	bool hasPacketsWaitToTimeout();
+	void addPacketWaitToTimeout(const MIMCMessage& message, int64_t timeoutMs);
+	void addPacketWaitToTimeout(const MIMCGroupMessage& groupMessage, int64_t timeoutMs);
+	void removePacketWaitToTimeout(const std::string& packetId);
+	// SEQUENCE_ACKs wait up to SEQUENCE_ACK_DELAY_MS for later batches, only the highest sequence of each uuid and resource goes out
+	void flushSequenceAcks(const User * user);
+	// steady time the pending SEQUENCE_ACKs are due, -1 when there are none, loop thread only
+	int64_t nextSequenceAckTimestamp() const {return this->sequenceAckTimestamp;}
+	uint64_t getSequenceAcksSaved() const {return this->sequenceAcksSaved;}
+	// keeps the highest acknowledged sequence in file so a restart does not redeliver old messages
+	void enableSequencePersistence(const std::string& file);
+	// writes the file only, runs wherever the handlers of the batch ran once they returned
+	void saveSequenceHighWaterMark(int64_t sequence);
+	// payloads of at least threshold bytes are deflated before sending, 0 turns it off
+	void setPayloadCompressThreshold(unsigned int threshold) {this->payloadCompressThreshold = threshold;}
+	const std::string& encodePayload(const std::string& payload, std::string& buffer) const;
+	const std::string& decodePayload(const std::string& payload, std::string& buffer);
 private:
+	/*
+	 * One strict priority lane of the outbound queue. A lane may send up to
+	 * weight packets per round while lower lanes wait, so control and acks
+	 * overtake a message backlog without starving it.
+	 */
+	struct SendLaneQueue {
+		SendLaneQueue(unsigned int capacity, unsigned int weight)
+			: packetsWaitToSend(capacity), loopDepth(0), peakDepth(0), sent(0), weight(weight), credit(weight) {}
+
+		ThreadSafeQueue<struct waitToSendContent> packetsWaitToSend;
+		std::deque<struct waitToSendContent> loopPacketsWaitToSend;
+		std::atomic<unsigned int> loopDepth;
+		std::atomic<unsigned int> peakDepth;
+		std::atomic<uint64_t> sent;
+		std::atomic<unsigned int> weight;
+		unsigned int credit;
+	};
+
+	PacketManager(const PacketManager&);
+	PacketManager& operator=(const PacketManager&);
+	bool popSendLane(SendLaneQueue* sendLane, struct waitToSendContent& obj);
+	int handleCompound(User * user, const std::string& payload);
+	void sendPulls(const User * user, unsigned int count);
+	void addSequenceAck(int64_t uuid, const std::string& resource, int64_t sequence);
+	void updatePeakDepth(SendLaneQueue* sendLane);
 	ims::ClientHeader * createClientHeader(const User * user, std::string cmd, int cipher);
-	int encodePacket(unsigned char * &packet, const ims::ClientHeader * header, const google::protobuf::MessageLite * message, const std::string &body_key="", const std::string &payload_key="");
+	int encodePacket(unsigned char * &packet, const ims::ClientHeader * header, const google::protobuf::MessageLite * message, const RC4_KEY * body_key_schedule=NULL, const std::string &payload_key="");
 	void short2char(int16_t data, unsigned char* result, int index);
 	void int2char(int32_t data, unsigned char* result, int index);
 
 	uint32_t compute_crc32(const unsigned char *data, size_t len); 
 	std::string generateSig(const ims::ClientHeader * header, const ims::XMMsgBind * bindmsg, const Connection * connection);
-	std::string generatePayloadKey(const std::string &securityKey, const std::string &headerId);
+	std::string generatePayloadKey(const std::string &securityKeyBytes, const std::string &headerId);
+	// the same key written into result, which keeps its capacity from one packet to the next
+	void generatePayloadKey(const std::string &securityKeyBytes, const std::string &headerId, std::string &result);
 private:
-	std::string packetIdPrefix = Utils::generateRandomString(15);
-	int packetIdSeq = 0;
-	pthread_mutex_t packetIdMutex = PTHREAD_MUTEX_INITIALIZER;
+	// the "_" separator is part of the prefix so only the sequence is formatted per id
+	const std::string packetIdPrefix = Utils::generateRandomString(15) + "_";
+	std::atomic<int64_t> packetIdSeq{0};
+	// steady time less the time spent paused, the clock the wheel runs on
+	int64_t sendTimeoutClock(int64_t nowMs) const;
+
 	pthread_mutex_t packetsTimeoutMutex = PTHREAD_MUTEX_INITIALIZER;
+	// guarded by packetsTimeoutMutex, pausedAt is -1 while the clock runs
+	int64_t sendTimeoutPausedMs = 0;
+	int64_t sendTimeoutPausedAt = -1;
+	std::map<std::pair<int64_t, std::string>, int64_t> pendingSequenceAcks;
+	int64_t sequenceAckTimestamp = -1;
+	std::atomic<uint64_t> sequenceAcksSaved{0};
+public:
+	SendLaneQueue* sendLanes[SEND_LANE_COUNT];
+	SendTimeoutWheel packetsWaitToTimeout;
+	std::string sequenceFile;
+	std::atomic<unsigned int> payloadCompressThreshold;
+	PayloadCodec payloadCodec;
+	// the highest mark handed on for saving, loop thread only
+	int64_t sequenceHighWaterMark = 0;
 public:
-	ThreadSafeQueue<struct waitToSendContent> packetsWaitToSend;
-	std::map<std::string, MIMCMessage> packetsWaitToTimeout;
-	std::map<std::string, MIMCGroupMessage> groupPacketWaitToTimeout;
-	std::set<int64_t> sequencesReceived;
+	SequenceWindow sequencesReceived;
+	MessageSync messageSync;
 };
 
 #endif
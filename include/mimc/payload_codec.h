@@ -0,0 +1,33 @@
+#ifndef MIMC_CPP_SDK_PAYLOAD_CODEC_H
+#define MIMC_CPP_SDK_PAYLOAD_CODEC_H
+
+#include <string>
+
+typedef struct z_stream_s z_stream;
+
+/*
+ * Optional raw deflate of message payloads. A compressed payload starts with
+ * PAYLOAD_COMPRESS_MAGIC and the original length, so receivers recognise it
+ * whatever their own setting is; JSON or text payloads never start with the
+ * NUL byte of the magic. Each sending thread keeps its own deflate stream,
+ * each connection keeps one inflate stream for the messages it receives.
+ */
+class PayloadCodec {
+public:
+	PayloadCodec();
+	~PayloadCodec();
+
+	// thread safe, false when deflate would not make the payload smaller unless force is set
+	static bool compress(const std::string& payload, std::string& compressed, bool force = false);
+	static bool isCompressed(const std::string& payload);
+	// false for a corrupt payload, one thread at a time per codec
+	bool decompress(const std::string& payload, std::string& decompressed);
+
+private:
+	PayloadCodec(const PayloadCodec&);
+	PayloadCodec& operator=(const PayloadCodec&);
+
+	z_stream* inflater;
+};
+
+#endif //MIMC_CPP_SDK_PAYLOAD_CODEC_H
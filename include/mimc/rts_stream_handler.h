@@ -7,6 +7,7 @@
 #include <mimc/rts_context.h>
 #include <mimc/rts_send_signal.h>
 #include <mimc/rts_data.pb.h>
+#include <mimc/decode_context.h>
 
 class RtsStreamHandler : public StreamHandler {
 public:
@@ -20,7 +21,8 @@ public:
 		
 	}
 	virtual void RecvStreamData(uint64_t conn_id, uint16_t stream_id, uint32_t groupId, char* data, int len) {
-		mimc::UserPacket userPacket;
+		// every media packet is parsed into the same object, its payload string keeps the capacity of the largest so far
+		mimc::UserPacket& userPacket = DecodeContext::current().userPacket;
 		if (!userPacket.ParseFromArray(data, len)) {
 			XMDLoggerWrapper::instance()->error("In RecvStreamData, parse failed");
 			return;
@@ -0,0 +1,58 @@
+#ifndef MIMC_CPP_SDK_SEND_TIMEOUT_WHEEL_H
+#define MIMC_CPP_SDK_SEND_TIMEOUT_WHEEL_H
+
+#include <mimc/mimcmessage.h>
+#include <mimc/mimc_group_message.h>
+#include <mimc/constant.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/*
+ * Hashed timing wheel of the P2P and group messages waiting for a server
+ * ack. Each entry hangs in the slot of its deadline tick and is indexed by
+ * packetId, so an ack cancels it in O(1) and advancing the wheel only walks
+ * the occupied slots that came due. Deadlines further out than one turn of
+ * the wheel stay in their slot until their own tick comes round.
+ */
+class SendTimeoutWheel {
+public:
+	SendTimeoutWheel();
+	~SendTimeoutWheel();
+
+	void add(const MIMCMessage& message, int64_t nowMs, int64_t timeoutMs);
+	void add(const MIMCGroupMessage& groupMessage, int64_t nowMs, int64_t timeoutMs);
+	bool cancel(const std::string& packetId);
+	// moves every entry whose deadline passed by nowMs to the output vectors
+	void expire(int64_t nowMs, std::vector<MIMCMessage>& messages, std::vector<MIMCGroupMessage>& groupMessages);
+	// -1 when empty, otherwise when the next occupied slot comes due
+	int64_t nextExpireTimestamp() const;
+	bool empty() const { return entries.empty(); }
+	size_t size() const { return entries.size(); }
+
+private:
+	struct Entry {
+		std::string packetId;
+		int64_t tick;
+		MIMCMessage* message;
+		MIMCGroupMessage* groupMessage;
+		Entry* prev;
+		Entry* next;
+	};
+
+	SendTimeoutWheel(const SendTimeoutWheel&);
+	SendTimeoutWheel& operator=(const SendTimeoutWheel&);
+	void insert(Entry* entry, int64_t nowMs, int64_t timeoutMs);
+	void link(Entry* entry);
+	void unlink(Entry* entry);
+	void release(Entry* entry);
+	void expireSlot(unsigned int slot, int64_t nowTick, std::vector<MIMCMessage>& messages, std::vector<MIMCGroupMessage>& groupMessages);
+
+	Entry** slots;
+	uint64_t occupied[SEND_TIMEOUT_WHEEL_SLOTS / 64];
+	int64_t currentTick;
+	std::unordered_map<std::string, Entry*> entries;
+};
+
+#endif //MIMC_CPP_SDK_SEND_TIMEOUT_WHEEL_H
@@ -0,0 +1,33 @@
+#ifndef MIMC_CPP_SDK_SEQUENCE_WINDOW_H
+#define MIMC_CPP_SDK_SEQUENCE_WINDOW_H
+
+#include <mimc/constant.h>
+#include <stdint.h>
+
+/*
+ * Remembers which of the most recent SEQUENCE_WINDOW_SIZE sequences were
+ * received, one bit each, in a ring that slides forward with the highest
+ * sequence seen. Anything older than the window, or at or below the floor
+ * restored from a previous run, is treated as already delivered.
+ */
+class SequenceWindow {
+public:
+	SequenceWindow();
+
+	// true the first time a sequence shows up
+	bool checkAndMark(int64_t sequence);
+	void setFloor(int64_t sequence);
+	void clear();
+
+private:
+	bool testAndSet(int64_t sequence);
+	void slideTo(int64_t sequence);
+
+	uint64_t bits[SEQUENCE_WINDOW_SIZE / 64];
+	int64_t highest;
+	int64_t floor;
+	bool hasFloor;
+	bool started;
+};
+
+#endif //MIMC_CPP_SDK_SEQUENCE_WINDOW_H
@@ -0,0 +1,66 @@
+#ifndef MIMC_CPP_SDK_SERVER_ADDR_CACHE_H
+#define MIMC_CPP_SDK_SERVER_ADDR_CACHE_H
+
+#include <mimc/mimc_runtime.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+struct json_object;
+
+/*
+ * Process wide cache of the resolver's fe and relay address lists, shared by
+ * every User that asks for the same domains. An entry older than
+ * RESOLVER_CACHE_TTL_MS is still served while a blocking worker refreshes it,
+ * so only the very first login of a process waits on the resolver. Every
+ * fetched entry is written to the cache files of the users sharing it.
+ */
+class ServerAddrCache : public MimcRuntimeTask {
+public:
+	static ServerAddrCache* instance();
+
+	// never blocks on http, false if nothing is cached for the domains yet
+	bool lookup(const std::string& feDomain, const std::string& relayDomain, std::vector<std::string>& feAddresses, std::vector<std::string>& relayAddresses);
+	// asks the resolver, blocks on http unless another caller fetched the same domains within RESOLVER_REFETCH_INTERVAL_MS
+	bool fetch(const std::string& feDomain, const std::string& relayDomain, std::vector<std::string>& feAddresses, std::vector<std::string>& relayAddresses);
+	// restores an entry written by an earlier process, unless a newer one is cached already
+	void seed(const std::string& feDomain, const std::string& relayDomain, const std::string& cacheFile);
+	// fetched entries for the domains are persisted to cacheFile until it is detached
+	void attachCacheFile(const std::string& cacheFile, const std::string& feDomain, const std::string& relayDomain);
+	void detachCacheFile(const std::string& cacheFile);
+
+	// refresh worker, runs on the blocking pool of MimcRuntime
+	void run();
+
+private:
+	struct Entry {
+		std::vector<std::string> feAddresses;
+		std::vector<std::string> relayAddresses;
+		// wall clock, so that it stays meaningful once persisted
+		int64_t fetchedAt;
+		bool refreshing;
+	};
+
+	ServerAddrCache();
+	static std::string entryKey(const std::string& feDomain, const std::string& relayDomain);
+	static bool parseAddresses(json_object* pobj, const std::string& feDomain, const std::string& relayDomain, std::vector<std::string>& feAddresses, std::vector<std::string>& relayAddresses);
+	bool fetchEntry(const std::string& key, Entry& entry);
+	void persist(const std::string& key, const Entry& entry);
+	void scheduleRefresh(const std::string& key, Entry& entry);
+
+	static pthread_mutex_t instanceMutex;
+	static ServerAddrCache* cache;
+
+	pthread_mutex_t mutex;
+	// one resolver request at a time, a caller that waited here finds the entry its predecessor fetched
+	pthread_mutex_t fetchMutex;
+	std::map<std::string, Entry> entries;
+	std::map<std::string, std::string> cacheFiles;
+	std::deque<std::string> pendingRefreshes;
+	bool refreshScheduled;
+};
+
+#endif //MIMC_CPP_SDK_SERVER_ADDR_CACHE_H
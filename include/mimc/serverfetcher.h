@@ -6,9 +6,6 @@
 class ServerFetcher {
 public:
 	static std::string fetchServerAddr(const char* const &url, std::string list);
-
-private:
-	static size_t writeRecData(char* ptr, size_t size, size_t nmemb, void* userdata);
 };
 
 #endif
\ No newline at end of file
@@ -1,24 +1,39 @@
 #ifndef MIMC_CPP_SDK_SAFEQUEUE_H
 #define MIMC_CPP_SDK_SAFEQUEUE_H
 
-#ifdef _WIN32
-#else
-#include <unistd.h>
-#endif // _WIN32
-
 #include <pthread.h>
 #include <time.h>
-#include <thread>
+#include <stddef.h>
+#include <errno.h>
+#include <atomic>
 #include <chrono>
 
 const int QUEUE_SIZE = 100;
+const int QUEUE_CACHE_LINE_SIZE = 64;
+
+enum QueuePushResult {
+	QUEUE_PUSHED,
+	QUEUE_WOULD_BLOCK
+};
 
+/*
+ * Bounded lock free ring in the style of Vyukov's queue: every slot carries a
+ * sequence number, producers claim slots with a CAS on the tail and consumers
+ * with a CAS on the head, so the data path never takes a lock. The mutex and
+ * condition variables are only touched when someone actually has to sleep
+ * (push on a full queue, pop with a timeout on an empty one).
+ */
 template <class T>
 class ThreadSafeQueue
 {
 public:
+	// at least two slots, with one a full cell and a free one carry the same sequence
 	ThreadSafeQueue(unsigned int capacity = QUEUE_SIZE);
+	// blocks while the queue is full
 	void push(const T& new_data);
+	// never blocks, QUEUE_WOULD_BLOCK tells the caller to back off
+	QueuePushResult tryPush(const T& new_data);
+	// waits up to timeout seconds for an element
 	bool pop(long timeout, T& result);
 	bool pop(T& result);
 	bool empty();
@@ -28,73 +43,161 @@ public:
 	~ThreadSafeQueue();
 
 private:
-	T* queue;
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T data;
+	};
+
+	ThreadSafeQueue(const ThreadSafeQueue&);
+	ThreadSafeQueue& operator=(const ThreadSafeQueue&);
+	bool enqueue(const T& new_data);
+	bool dequeue(T& result);
+	void wakeWaiters(std::atomic<int>& waiters, pthread_cond_t& cond);
+
+	Cell* queue;
 	unsigned int capacity_;
-	int head, tail;
+	char pad0[QUEUE_CACHE_LINE_SIZE];
+	std::atomic<size_t> tail;
+	char pad1[QUEUE_CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> head;
+	char pad2[QUEUE_CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+	std::atomic<int> waitingProducers;
+	std::atomic<int> waitingConsumers;
 	pthread_mutex_t mutex;
+	pthread_cond_t notFull;
+	pthread_cond_t notEmpty;
 };
 
-template<class T>
-void ThreadSafeQueue<T>::push(const T& new_data) {
-	while ((tail + 1) % capacity_ == head) {
-		//usleep(10000);
-		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+template <class T>
+bool ThreadSafeQueue<T>::enqueue(const T& new_data) {
+	size_t pos = tail.load(std::memory_order_relaxed);
+	while (true) {
+		Cell* cell = &queue[pos % capacity_];
+		size_t seq = cell->sequence.load(std::memory_order_acquire);
+		if (seq == pos) {
+			if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				cell->data = new_data;
+				cell->sequence.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+		} else if ((ptrdiff_t)(seq - pos) < 0) {
+			return false;
+		} else {
+			pos = tail.load(std::memory_order_relaxed);
+		}
 	}
-	pthread_mutex_lock(&mutex);
-	queue[tail] = new_data;
-	tail = (tail + 1) % capacity_;
-	pthread_mutex_unlock(&mutex);
 }
 
 template <class T>
-bool ThreadSafeQueue<T>::pop(long timeout, T& result) {
-	time_t start = time(NULL);
-	while (empty()) {
-		if (time(NULL) - start >= timeout) {
+bool ThreadSafeQueue<T>::dequeue(T& result) {
+	size_t pos = head.load(std::memory_order_relaxed);
+	while (true) {
+		Cell* cell = &queue[pos % capacity_];
+		size_t seq = cell->sequence.load(std::memory_order_acquire);
+		if (seq == pos + 1) {
+			if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				result = cell->data;
+				cell->data = T();
+				cell->sequence.store(pos + capacity_, std::memory_order_release);
+				return true;
+			}
+		} else if ((ptrdiff_t)(seq - (pos + 1)) < 0) {
 			return false;
 		} else {
-			//usleep(100000);
-			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			pos = head.load(std::memory_order_relaxed);
 		}
 	}
-	int pos = head;
-	head = (head + 1) % capacity_;
-	result = queue[pos];
-	return true;
+}
+
+template <class T>
+QueuePushResult ThreadSafeQueue<T>::tryPush(const T& new_data) {
+	if (!enqueue(new_data)) {
+		return QUEUE_WOULD_BLOCK;
+	}
+	wakeWaiters(waitingConsumers, notEmpty);
+	return QUEUE_PUSHED;
+}
+
+template <class T>
+void ThreadSafeQueue<T>::push(const T& new_data) {
+	if (!enqueue(new_data)) {
+		pthread_mutex_lock(&mutex);
+		waitingProducers++;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		while (!enqueue(new_data)) {
+			pthread_cond_wait(&notFull, &mutex);
+		}
+		waitingProducers--;
+		pthread_mutex_unlock(&mutex);
+	}
+	wakeWaiters(waitingConsumers, notEmpty);
 }
 
 template <class T>
 bool ThreadSafeQueue<T>::pop(T& result) {
-	if (empty()) {
+	if (!dequeue(result)) {
 		return false;
 	}
-	int pos = head;
-	head = (head + 1) % capacity_;
-	result = queue[pos];
+	wakeWaiters(waitingProducers, notFull);
 	return true;
 }
 
 template <class T>
-bool ThreadSafeQueue<T>::empty() {
-	if (head == tail) {
+bool ThreadSafeQueue<T>::pop(long timeout, T& result) {
+	if (pop(result)) {
 		return true;
 	}
-	return false;
+	struct timespec deadline;
+	std::chrono::nanoseconds now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch());
+	deadline.tv_sec = (time_t)(now.count() / 1000000000) + timeout;
+	deadline.tv_nsec = (long)(now.count() % 1000000000);
+
+	bool popped = false;
+	pthread_mutex_lock(&mutex);
+	waitingConsumers++;
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	while (!(popped = dequeue(result))) {
+		if (pthread_cond_timedwait(&notEmpty, &mutex, &deadline) == ETIMEDOUT) {
+			popped = dequeue(result);
+			break;
+		}
+	}
+	waitingConsumers--;
+	pthread_mutex_unlock(&mutex);
+	if (popped) {
+		wakeWaiters(waitingProducers, notFull);
+	}
+	return popped;
+}
+
+template <class T>
+void ThreadSafeQueue<T>::wakeWaiters(std::atomic<int>& waiters, pthread_cond_t& cond) {
+	// pairs with the increment a sleeper makes before its last check of the ring
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (waiters.load(std::memory_order_relaxed) > 0) {
+		pthread_mutex_lock(&mutex);
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&mutex);
+	}
+}
+
+template <class T>
+bool ThreadSafeQueue<T>::empty() {
+	return size() == 0;
 }
 
 template <class T>
 void ThreadSafeQueue<T>::clear() {
-	head = 0;
-	tail = 0;
+	T result;
+	while (pop(result)) {
+	}
 }
 
 template <class T>
 unsigned int ThreadSafeQueue<T>::size() {
-	if (tail >= head) {
-		return tail - head;
-	} else {
-		return head - tail;
-	}
+	size_t consumed = head.load(std::memory_order_acquire);
+	size_t produced = tail.load(std::memory_order_acquire);
+	return produced > consumed ? (unsigned int)(produced - consumed) : 0;
 }
 
 template <class T>
@@ -104,15 +207,24 @@ unsigned int ThreadSafeQueue<T>::capacity() {
 
 template <class T>
 ThreadSafeQueue<T>::ThreadSafeQueue(unsigned int capacity)
-	: capacity_(capacity), head(0), tail(0), mutex(PTHREAD_MUTEX_INITIALIZER)
+	: capacity_(capacity > 1 ? capacity : 2), tail(0), head(0), waitingProducers(0), waitingConsumers(0)
 {
-	queue = new T[capacity_];
+	queue = new Cell[capacity_];
+	for (unsigned int i = 0; i < capacity_; i++) {
+		queue[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&notFull, NULL);
+	pthread_cond_init(&notEmpty, NULL);
 }
 
 template <class T>
 ThreadSafeQueue<T>::~ThreadSafeQueue() {
 	delete[] queue;
 	queue = NULL;
+	pthread_cond_destroy(&notEmpty);
+	pthread_cond_destroy(&notFull);
+	pthread_mutex_destroy(&mutex);
 }
 
-#endif
\ No newline at end of file
+#endif
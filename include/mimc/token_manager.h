@@ -0,0 +1,61 @@
+#ifndef MIMC_CPP_SDK_TOKEN_MANAGER_H
+#define MIMC_CPP_SDK_TOKEN_MANAGER_H
+
+#include <mimc/mimc_runtime.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+class User;
+struct json_object;
+
+/*
+ * Fetches the token of one User through its MIMCTokenFetcher. A refresh runs
+ * on the blocking pool of MimcRuntime ahead of the token's expiry and parks
+ * the response until the next bind takes it, so a kick for token-expired is
+ * answered with a new BIND instead of a fetch round trip. Every valid
+ * response is merged into the user's cache file.
+ */
+class TokenManager : public MimcRuntimeTask {
+public:
+	// cacheFile is empty when the user has no usable cache path
+	TokenManager(User* user, const std::string& cacheFile);
+
+	// blocks on http unless a refreshed response is waiting, fetchedAt is wall clock ms
+	bool fetch(std::string& response, int64_t& fetchedAt);
+	// starts a background fetch unless one is queued or running, the user is woken once it lands
+	void refresh();
+	// hands over the response of the last refresh, at most once
+	bool takeReady(std::string& response, int64_t& fetchedAt);
+	// false while a refreshed response is waiting that is not yet due for refresh itself
+	bool needsRefresh(int64_t now);
+
+	// refresh worker, runs on the blocking pool of MimcRuntime
+	void run();
+
+	// wall clock ms at which a token fetched at fetchedAt should be replaced
+	static int64_t refreshTimestamp(json_object* pobj, int64_t fetchedAt);
+
+private:
+	bool fetchLocked();
+	bool copyLastResponse(std::string& response, int64_t& fetchedAt);
+
+	User* user;
+	std::string cacheFile;
+	pthread_mutex_t mutex;
+	// one token request at a time, shared by the blocking fetch and the refresh worker
+	pthread_mutex_t fetchMutex;
+	// the last valid response, ready until a bind or the prepare task takes it
+	std::string lastResponse;
+	int64_t lastFetchedAt;
+	int64_t lastRefreshTimestamp;
+	bool lastFetchSucceed;
+	bool ready;
+	std::atomic<bool> refreshing;
+	// steady clock, a request made before the last fetch finished is served by that fetch
+	int64_t refreshRequestTimestamp;
+	int64_t lastFetchTimestamp;
+};
+
+#endif //MIMC_CPP_SDK_TOKEN_MANAGER_H
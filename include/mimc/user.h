@@ -4,9 +4,11 @@
 #include <mimc/tokenfetcher.h>
 #include <mimc/onlinestatus_handler.h>
 #include <mimc/message_handler.h>
+#include <mimc/message_batch_handler.h>
 #include <mimc/rts_callevent_handler.h>
 #include <mimc/constant.h>
 #include <mimc/rts_stream_config.h>
+#include <mimc/outgoing_message.h>
 #include <XMDCommonData.h>
 #include <XMDLoggerWrapper.h>
 #include <atomic>
@@ -18,6 +20,15 @@
 #include <vector>
 
 class Connection;
+class EventLoop;
+class FeEventHandler;
+class ServerAddrPrepareTask;
+class FeDomainResolveTask;
+class TokenManager;
+class MessageOutbox;
+class InboundLog;
+class DeliveryExecutor;
+class MimcRuntimeTask;
 class PacketManager;
 class P2PCallSession;
 class RtsConnectionHandler;
@@ -25,28 +36,40 @@ class RtsStreamHandler;
 class XMDTransceiver;
 namespace mimc {
 	class BindRelayResponse;
+	class MIMCPacket;
 }
 struct json_object;
+struct waitToSendContent;
 
 class User {
 public:
-	User(int64_t appId, std::string appAccount, std::string resource = "", std::string cachePath = "");
+	User(int64_t appId, std::string appAccount, std::string resource = "", std::string cachePath = "", unsigned int sendQueueCapacity = SEND_QUEUE_CAPACITY);
 	~User();
 
 	void registerTokenFetcher(MIMCTokenFetcher* tokenFetcher) {this->tokenFetcher = tokenFetcher;}
 	void registerOnlineStatusHandler(OnlineStatusHandler* handler) {this->statusHandler = handler;}
-	void registerMessageHandler(MessageHandler* handler) {this->messageHandler = handler;}
-	void registerRTSCallEventHandler(RTSCallEventHandler* handler) {this->rtsCallEventHandler = handler;}
+	void registerMessageHandler(MessageHandler* handler);
+	// optional, receives incoming messages instead of the MessageHandler, without copying them
+	void registerMessageBatchHandler(MessageBatchHandler* handler);
+	void registerRTSCallEventHandler(RTSCallEventHandler* handler);
 
 	MIMCTokenFetcher* getTokenFetcher() const {return this->tokenFetcher;}
 	OnlineStatusHandler* getStatusHandler() const {return this->statusHandler;}
-	MessageHandler* getMessageHandler() const {return this->messageHandler;}
-	RTSCallEventHandler* getRTSCallEventHandler() const {return this->rtsCallEventHandler;}
+	// the handlers callbacks go through, queued ones once the delivery executor is enabled
+	MessageHandler* getMessageHandler() const;
+	MessageBatchHandler* getMessageBatchHandler() const;
+	// hands a received batch to the MessageBatchHandler, or copies it for the MessageHandler
+	void dispatchMessages(const std::vector<MIMCMessageView>& messages) const;
+	void dispatchGroupMessages(const std::vector<MIMCGroupMessageView>& messages) const;
+	// takes ownership of task, runs it once the batches dispatched before it reached their handlers
+	void runAfterDispatch(MimcRuntimeTask* task) const;
+	RTSCallEventHandler* getRTSCallEventHandler() const;
 
 	void setTestPacketLoss(int testPacketLoss);
 	void setLastLoginTimestamp(time_t ts) {this->lastLoginTimestamp = ts;}
 	void setLastCreateConnTimestamp(time_t ts) {this->lastCreateConnTimestamp = ts;}
 	void setOnlineStatus(OnlineStatus status) {this->onlineStatus = status;}
+	void setLoginState(LoginState state);
 	void setRelayLinkState(RelayLinkState state) {this->relayLinkState = state;}
 	void setRelayConnId(uint64_t relayConnId) {this->relayConnId = relayConnId;}
 	void setRelayControlStreamId(uint16_t relayControlStreamId) {this->relayControlStreamId = relayControlStreamId;}
@@ -64,6 +87,7 @@ public:
 	std::string getResource() const {return this->resource;}
 	std::string getToken() const {return this->token;}
 	std::string getSecurityKey() const {return this->securityKey;}
+	const std::string& getSecurityKeyBytes() const {return this->securityKeyBytes;}
 	std::string getAppAccount() const {return this->appAccount;}
 	int64_t getAppId() const {return this->appId;}
 	std::string getAppPackage() const {return this->appPackage;}
@@ -71,6 +95,8 @@ public:
 	std::string getFeDomain() const {return this->feDomain;}
 	std::string getRelayDomain() const {return this->relayDomain;}
 	std::vector<std::string>& getFeAddresses() {return this->feAddresses;}
+	// FE_DOMAIN's own records from the last fallback lookup, under the address mutex like getFeAddresses
+	std::vector<std::string>& getFeDomainAddresses() {return this->feDomainAddresses;}
 	std::vector<std::string>& getRelayAddresses() {return this->relayAddresses;}
 	pthread_rwlock_t& getCallsRwlock() { return this->mutex_0; }
 	pthread_mutex_t& getAddressMutex() { return this->mutex_1; }
@@ -79,6 +105,36 @@ public:
 	std::string getClientAttrs() const {return join(clientAttrs);}
 	std::string getCloudAttrs() const {return join(cloudAttrs);}
 	PacketManager* getPacketManager() const {return this->packetManager;}
+	// snapshot of the send queue, lets a caller tell backpressure from a rejected message when sendMessage returns ""
+	bool isSendQueueFull() const;
+	// control and acks overtake queued messages, weight is how many packets a lane sends per round
+	void setSendLaneWeight(SendLane lane, unsigned int weight);
+	SendLaneStats getSendLaneStats(SendLane lane) const;
+	// SEQUENCE_ACKs folded into a later one of the same uuid and resource instead of sent on their own
+	uint64_t getSequenceAcksSaved() const;
+	// deflates P2P and group payloads of at least threshold bytes, receivers inflate them whatever their setting.
+	// The sender cannot negotiate this, so enable it only when every receiver runs an SDK that knows the
+	// compressed payload prefix. Off, payloads are sent untouched, one that starts with the prefix included
+	void setPayloadCompression(bool enable, unsigned int threshold = PAYLOAD_COMPRESS_THRESHOLD);
+	// sends queued within windowMs go out together as one COMPOUND packet, 0 sends each message at once
+	void setSendBatchWindow(int64_t windowMs, unsigned int maxMessages = SEND_COMPOUND_MAX_PACKETS);
+	// call before login, fe addresses are dialed staggerMs apart and each attempt gets attemptTimeoutMs to complete
+	void setConnectRace(int64_t staggerMs, int64_t attemptTimeoutMs = FE_CONNECT_ATTEMPT_TIMEOUT_MS);
+	// call before login, restores and keeps the received sequence high water mark under cachePath
+	bool enableSequencePersistence();
+	// call before login, messages are logged under cachePath until acked or timed out, sent while offline and resent after a restart
+	bool enableOutbox();
+	MessageOutbox* getOutbox() const {return this->outbox;}
+	// call before login, received messages are logged under cachePath, deduplicated against it and kept for history
+	bool enableInboundLog();
+	InboundLog* getInboundLog() const {return this->inboundLog;}
+	std::vector<MIMCMessage> getRecentMessages(const std::string& peer, size_t limit = INBOUND_LOG_CONVERSATION_HISTORY) const;
+	std::vector<MIMCGroupMessage> getRecentGroupMessages(int64_t topicId, size_t limit = INBOUND_LOG_CONVERSATION_HISTORY) const;
+	// hands every logged message above sequence to the MessageHandler again, on the calling thread unless callbacks are queued
+	bool replayInboundLog(int64_t sequence);
+	// call before login, message and RTS callbacks run on threads of their own, capacity callbacks deep per lane
+	bool enableDeliveryExecutor(unsigned int capacity = DELIVERY_QUEUE_CAPACITY);
+	DeliveryLaneStats getDeliveryLaneStats(DeliveryLane lane) const;
 	RelayLinkState getRelayLinkState() const {return this->relayLinkState;}
 	uint64_t getRelayConnId() const {return this->relayConnId;}
 	uint16_t getRelayControlStreamId() const {return this->relayControlStreamId;}
@@ -99,11 +155,33 @@ public:
 	void resetRelayLinkState();
 	void handleXMDConnClosed(uint64_t connId, ConnCloseType type);
 
+	EventLoop* getEventLoop() const {return this->eventLoop;}
+	void enqueuePacket(const struct waitToSendContent& obj, SendLane lane) const;
+	bool tryEnqueuePacket(const struct waitToSendContent& obj, SendLane lane) const;
+	void wakeup() const;
+	void handleConnEvent(int fd, int events);
+	void handleLoopTimer(int64_t timerId);
+	void handleLoopNotify();
+	void prepareConnection();
+	void prepareServerAddr();
+	// loop thread, looks FE_DOMAIN up on the blocking pool unless a lookup is already running
+	void startFeDomainResolve();
+	void resolveFeDomain();
+	// CONN response decoded, BIND goes out from here without waiting for the next loop pass
+	void handleConnResp();
+	void handleBindResp(OnlineStatus status);
+	LoginState getLoginState() const {return this->loginState;}
+	// zeroes until the first login succeeded
+	LoginTimeline getLoginTimeline() const;
+
 	bool login();
 	bool logout();
 
-	std::string sendMessage(const std::string& toAppAccount, const std::string& payload, const std::string& bizType = "", const bool isStore = true);
-	std::string sendGroupMessage(int64_t topicId, const std::string& payload, const std::string& bizType = "", const bool isStore = true);
+	// handleSendMsgTimeout / handleSendGroupMsgTimeout fire timeoutMs after the send unless the server acked first
+	std::string sendMessage(const std::string& toAppAccount, const std::string& payload, const std::string& bizType = "", const bool isStore = true, const int64_t timeoutMs = SEND_TIMEOUT_MS);
+	std::string sendGroupMessage(int64_t topicId, const std::string& payload, const std::string& bizType = "", const bool isStore = true, const int64_t timeoutMs = SEND_TIMEOUT_MS);
+	// packs the messages into as few COMPOUND packets as possible, "" marks a message that was not sent
+	std::vector<std::string> sendMessages(const std::vector<OutgoingMessage>& messages);
 
 	uint64_t dialCall(const std::string& toAppAccount, const std::string& appContent = "", const std::string& toResource = "");
 	int sendRtsData(uint64_t callId, const std::string& data, const RtsDataType dataType, const RtsChannelType channelType = RELAY, const std::string& ctx = "", const bool canBeDropped = false, const DataPriority priority = P1, const unsigned int resendCount = 2);
@@ -137,13 +215,13 @@ private:
 	bool tokenFetchSucceed;
 	bool serverFetchSucceed;
 	bool parseToken(const char* str, json_object*& pobj);
-	bool parseServerAddr(const char* str, json_object*& pobj);
 	static void createCacheFileIfNotExist(User* user);
 	static bool fetchToken(User* user);
 	const std::string& getCachePath() const {return this->cachePath;}
 	const std::string& getCacheFile() const {return this->cacheFile;} 
 
 	std::vector<std::string> feAddresses;
+	std::vector<std::string> feDomainAddresses;
 	std::vector<std::string> relayAddresses;
 
 	int chid;
@@ -151,6 +229,7 @@ private:
 	std::string resource;
 	std::string token;
 	std::string securityKey;
+	std::string securityKeyBytes;
 	int64_t appId;
 	std::string appAccount;
 	std::string appPackage;
@@ -181,14 +260,79 @@ private:
 
 	Connection* conn;
 	PacketManager* packetManager;
-	static void* sendPacket(void *arg);
-	static void* receivePacket(void *arg);
-	static void* checkTimeout(void *arg);
+	EventLoop* eventLoop;
+	FeEventHandler* feEventHandler;
+	int64_t checkTimerId;
+	int64_t pingTimerId;
+	int64_t sendTimeoutTimerId;
+	int64_t sendTimeoutTimestamp;
+	int64_t connectTimerId;
+	int64_t connectTimestamp;
+	int64_t sendBatchTimerId;
+	int64_t sendBatchWindowMs;
+	unsigned int sendBatchMaxMessages;
+	std::vector<mimc::MIMCPacket*> sendBatch;
+	pthread_mutex_t sendBatchMutex;
+	ServerAddrPrepareTask* serverAddrPrepareTask;
+	FeDomainResolveTask* feDomainResolveTask;
+	std::atomic<bool> resolvingFeDomain;
+	// set by the lookup, the loop adds the addresses to a running race and clears it
+	std::atomic<bool> feDomainResolved;
+	TokenManager* tokenManager;
+	MessageOutbox* outbox;
+	InboundLog* inboundLog;
+	int64_t tokenRefreshTimerId;
+	int64_t sequenceAckTimerId;
+	// wall clock, written by the prepare task as well as the loop
+	std::atomic<int64_t> tokenRefreshTimestamp;
+	// token and resolver fetches in flight, the resolver runs beside the token fetch when the domains are already known
+	std::atomic<int> preparingTasks;
+	bool prepareServerAddrConcurrently;
+	std::atomic<int64_t> nextPrepareTimestamp;
+	std::atomic<LoginState> loginState;
+	int64_t loginStartTimestamp;
+	int64_t connectStartTimestamp;
+	int64_t tcpConnectedTimestamp;
+	int64_t connRespTimestamp;
+	int64_t bindSentTimestamp;
+	LoginTimeline loginTimeline;
+	mutable pthread_mutex_t loginTimelineMutex;
+	// set first thing in ~User, wakeup() stops notifying the loop so a finishing task cannot requeue a removed handler
+	bool detached;
+	mutable pthread_mutex_t wakeupMutex;
+	bool isTokenReady() const {return this->tokenFetchSucceed && !this->tokenInvalid;}
+	bool isServerAddrReady() const {return this->serverFetchSucceed && !this->addressInvalid;}
+	void startPrepare();
+	void finishPrepare(bool prepared);
+	void tryBind();
+	bool adoptToken(const std::string& response, int64_t fetchedAt);
+	void checkTokenRefresh();
+	void loadServerAddrFromCache();
+	void driveConnection();
+	void connectFe();
+	void sendPacket(unsigned char* packetBuffer, int packet_size, MessageDirection msgType);
+	void sendPacketsWaitToSend();
+	void receivePackets();
+	// false once the connection was reset
+	bool processReceivedFrames();
+	void resumeReads();
+	void checkTimeout();
+	bool needCheckTimeout();
+	void scheduleTimers();
+	std::string addToOutbox(const OutgoingMessage& message);
+	void flushOutbox();
+	mimc::MIMCPacket* createMessagePacket(const OutgoingMessage& outgoingMessage, const std::string& outboxPacketId = "");
+	bool enqueueMessagePacket(mimc::MIMCPacket* packet);
+	bool tryEnqueueCompound(std::vector<mimc::MIMCPacket*>& packets);
+	size_t nextCompoundEnd(const std::vector<mimc::MIMCPacket*>& packets, size_t begin) const;
+	bool flushSendBatch();
 
 	MIMCTokenFetcher* tokenFetcher;
 	OnlineStatusHandler* statusHandler;
 	MessageHandler* messageHandler;
+	MessageBatchHandler* messageBatchHandler;
 	RTSCallEventHandler* rtsCallEventHandler;
+	DeliveryExecutor* deliveryExecutor;
 
 	RtsConnectionHandler* rtsConnectionHandler;
 	RtsStreamHandler* rtsStreamHandler;
@@ -204,7 +348,6 @@ private:
 
 	mimc::BindRelayResponse* bindRelayResponse;
 
-	pthread_t sendThread, receiveThread, checkThread;
 	pthread_rwlock_t mutex_0;
 	pthread_mutex_t mutex_1;
 #ifdef __ANDROID__
@@ -44,20 +44,34 @@ typedef SSIZE_T ssize_t;
 #define MKDIR(a) _mkdir((a))
 #endif
 
+struct json_object;
+
 const int MAXPATHLEN = 80;
+// "-9223372036854775808" plus the terminating '\0'
+const int INT64_STR_LEN = 21;
 
 class Utils {
 public:
     static std::string generateRandomString(int length);
     static int64_t generateRandomLong();
+    // per thread generator, seeded once per thread and never shared, so it needs no lock
+    static uint64_t nextRandom();
     static std::string int2str(const int64_t& int_temp);
+    // writes the decimal digits and a '\0' into str (INT64_STR_LEN bytes always suffice), returns the digit count
+    static int int2chars(int64_t value, char* str);
     static std::string hexToAscii(const char* src, int srcLen);
     static std::string hash4SHA1AndBase64(const std::string& plain);
     static std::string getLocalIp();
     static int64_t currentTimeMillis();
     static int64_t currentTimeMicros();
+    static int64_t steadyTimeMillis();
+    static int64_t steadyTimeMicros();
     static void getCwd(char* currentPath, int maxLen);
     static bool createDirIfNotExist(const std::string& pDir);
+    // whole file, "" if it cannot be read
+    static std::string readFile(const std::string& path);
+    // sets the top level keys of update in the json object stored at path, written to a temp file and renamed over it
+    static bool mergeJsonFile(const std::string& path, json_object* update);
     static char* ltoa(int64_t value, char* str);
 
 };
@@ -1113,22 +1113,22 @@ public:
     int buildConnResp(uint64_t connId, unsigned char* key, int len);
     int buildConnClose(uint64_t connId);
     int buildDatagram(unsigned char* data, int len);
-    int buildStreamClose(uint64_t connId, uint16_t streamId, bool isEncrypt, std::string key);
-    int buildFECStreamData(XMDFECStreamData stData, unsigned char* data, int len, bool isEncrypt, std::string key);
-    int buildAckStreamData(XMDACKStreamData stData, unsigned char* data, int len, bool isEncrypt, std::string key);
-    int buildStreamDataAck(uint64_t connId, uint64_t packetid, uint64_t ackPacketId, bool isEncrypt, std::string key);
-    int buildXMDPing(uint64_t connId, bool isEncrypt, std::string key, uint64_t packetid);
-    int buildXMDPong(XMDPong pongData, bool isEncrypt, std::string key);
+    int buildStreamClose(uint64_t connId, uint16_t streamId, bool isEncrypt, const std::string& key);
+    int buildFECStreamData(XMDFECStreamData stData, unsigned char* data, int len, bool isEncrypt, const std::string& key);
+    int buildAckStreamData(XMDACKStreamData stData, unsigned char* data, int len, bool isEncrypt, const std::string& key);
+    int buildStreamDataAck(uint64_t connId, uint64_t packetid, uint64_t ackPacketId, bool isEncrypt, const std::string& key);
+    int buildXMDPing(uint64_t connId, bool isEncrypt, const std::string& key, uint64_t packetid);
+    int buildXMDPong(XMDPong pongData, bool isEncrypt, const std::string& key);
     XMDConnection* decodeNewConn(unsigned char* data, int len);
     XMDConnResp* decodeConnResp(unsigned char* data, int len);
     XMDConnClose* decodeConnClose(unsigned char* data, int len);
-    XMDStreamClose* decodeStreamClose(unsigned char* data, int len, bool isEncrypt, std::string key);
-    XMDFECStreamData* decodeFECStreamData(unsigned char* data, int len, bool isEncrypt, std::string key);
-    XMDACKStreamData* decodeAckStreamData(unsigned char* data, int len, bool isEncrypt, std::string key);
-    XMDStreamDataAck* decodeStreamDataAck(unsigned char* data, int len, bool isEncrypt, std::string key);
+    XMDStreamClose* decodeStreamClose(unsigned char* data, int len, bool isEncrypt, const std::string& key);
+    XMDFECStreamData* decodeFECStreamData(unsigned char* data, int len, bool isEncrypt, const std::string& key);
+    XMDACKStreamData* decodeAckStreamData(unsigned char* data, int len, bool isEncrypt, const std::string& key);
+    XMDStreamDataAck* decodeStreamDataAck(unsigned char* data, int len, bool isEncrypt, const std::string& key);
     XMDConnReset* decodeConnReset(unsigned char* data, int len);
-    XMDPing* decodeXMDPing(unsigned char* data, int len, bool isEncrypt, std::string key);
-    XMDPong* decodeXMDPong(unsigned char* data, int len, bool isEncrypt, std::string key);
+    XMDPing* decodeXMDPing(unsigned char* data, int len, bool isEncrypt, const std::string& key);
+    XMDPong* decodeXMDPong(unsigned char* data, int len, bool isEncrypt, const std::string& key);
     int encode(XMDPacket* &data, int& len);
     XMDPacket* decode(char* data, int len);
 };
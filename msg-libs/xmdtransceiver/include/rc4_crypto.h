@@ -12,6 +12,10 @@ public:
 	static int Encrypt(std::string &plain, /* out */std::string &cipher,
 					   const std::string &key);
 
+	// same contract as Encrypt/Decrypt but works on the caller's buffer, no string copies
+	static int CryptInPlace(unsigned char *data, unsigned long datalen,
+							const std::string &key);
+
 private:
 	CryptoRC4Util()
 	{
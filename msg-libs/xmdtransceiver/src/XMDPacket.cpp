@@ -124,7 +124,7 @@ int XMDPacketManager::buildDatagram(unsigned char* data, int len) {
     return 0;
 }
 
-int XMDPacketManager::buildStreamClose(uint64_t connId, uint16_t streamId, bool isEncrypt, std::string key) {
+int XMDPacketManager::buildStreamClose(uint64_t connId, uint16_t streamId, bool isEncrypt, const std::string& key) {
     int packetLen = sizeof(XMDPacket) + sizeof(XMDStreamClose) + XMD_CRC_LEN;
     XMDPacket* xmdPakcet_t = (XMDPacket*) ::operator new(packetLen);
     xmdPakcet_t->SetMagic();
@@ -135,18 +135,11 @@ int XMDPacketManager::buildStreamClose(uint64_t connId, uint16_t streamId, bool
     streamClose->SetStreamId(streamId);
 
     if (isEncrypt) {
-        std::string tmpMSg((char*)xmdPakcet_t + sizeof(XMDPacket) + CONN_LEN, 
-                           packetLen - sizeof(XMDPacket) - CONN_LEN - XMD_CRC_LEN);
-    
-        std::string encryptedData;
-        if (CryptoRC4Util::Encrypt(tmpMSg, encryptedData, key) != 0) {
+        if (CryptoRC4Util::CryptInPlace((unsigned char*)xmdPakcet_t + sizeof(XMDPacket) + CONN_LEN, 
+                                        packetLen - sizeof(XMDPacket) - CONN_LEN - XMD_CRC_LEN, key) != 0) {
             XMDLoggerWrapper::instance()->warn("buildStreamClose rc4 encrypt failed.");
             return -1;
         }
-    
-        memcpy((char*)xmdPakcet_t + sizeof(XMDPacket) + CONN_LEN, 
-               encryptedData.c_str(), 
-               packetLen - sizeof(XMDPacket) - CONN_LEN - XMD_CRC_LEN);
     }
 
     char* crc32 = (char*)xmdPakcet_t + packetLen - XMD_CRC_LEN;
@@ -163,7 +156,7 @@ int XMDPacketManager::buildStreamClose(uint64_t connId, uint16_t streamId, bool
     return 0;
 }
 
-int XMDPacketManager::buildFECStreamData(XMDFECStreamData stData, unsigned char* data, int len, bool isEncrypt, std::string key) {
+int XMDPacketManager::buildFECStreamData(XMDFECStreamData stData, unsigned char* data, int len, bool isEncrypt, const std::string& key) {
     int packetLen = sizeof(XMDPacket) + sizeof(XMDFECStreamData) + XMD_CRC_LEN + len;
     XMDPacket* xmdPakcet_t = (XMDPacket*) ::operator new(packetLen);
     xmdPakcet_t->SetMagic();
@@ -184,18 +177,11 @@ int XMDPacketManager::buildFECStreamData(XMDFECStreamData stData, unsigned char*
     streamData->SetPayload(data, len);
 
     if (isEncrypt) {
-        std::string tmpMSg((char*)xmdPakcet_t + sizeof(XMDPacket) + CONN_LEN, 
-                           packetLen - sizeof(XMDPacket) - CONN_LEN - XMD_CRC_LEN);
-    
-        std::string encryptedData;
-        if (CryptoRC4Util::Encrypt(tmpMSg, encryptedData, key) != 0) {
+        if (CryptoRC4Util::CryptInPlace((unsigned char*)xmdPakcet_t + sizeof(XMDPacket) + CONN_LEN, 
+                                        packetLen - sizeof(XMDPacket) - CONN_LEN - XMD_CRC_LEN, key) != 0) {
             XMDLoggerWrapper::instance()->warn("buildFECStreamData rc4 encrypt failed.");
             return -1;
         }
-    
-        memcpy((char*)xmdPakcet_t + sizeof(XMDPacket) + CONN_LEN, 
-               encryptedData.c_str(), 
-               packetLen - sizeof(XMDPacket) - CONN_LEN - XMD_CRC_LEN);
     }
 
     char* crc32 = (char*)xmdPakcet_t + packetLen - XMD_CRC_LEN;
@@ -212,7 +198,7 @@ int XMDPacketManager::buildFECStreamData(XMDFECStreamData stData, unsigned char*
     return 0;
 }
 
-int XMDPacketManager::buildAckStreamData(XMDACKStreamData stData, unsigned char* data, int len, bool isEncrypt, std::string key) {
+int XMDPacketManager::buildAckStreamData(XMDACKStreamData stData, unsigned char* data, int len, bool isEncrypt, const std::string& key) {
     int packetLen = sizeof(XMDPacket) + sizeof(XMDACKStreamData) + XMD_CRC_LEN + len;
     XMDPacket* xmdPakcet_t = (XMDPacket*) ::operator new(packetLen);
     xmdPakcet_t->SetMagic();
@@ -231,18 +217,11 @@ int XMDPacketManager::buildAckStreamData(XMDACKStreamData stData, unsigned char*
     streamData->SetPayload(data, len);
 
     if (isEncrypt) {
-        std::string tmpMSg((char*)xmdPakcet_t + sizeof(XMDPacket) + CONN_LEN, 
-                           packetLen - sizeof(XMDPacket) - CONN_LEN - XMD_CRC_LEN);
-    
-        std::string encryptedData;
-        if (CryptoRC4Util::Encrypt(tmpMSg, encryptedData, key) != 0) {
+        if (CryptoRC4Util::CryptInPlace((unsigned char*)xmdPakcet_t + sizeof(XMDPacket) + CONN_LEN, 
+                                        packetLen - sizeof(XMDPacket) - CONN_LEN - XMD_CRC_LEN, key) != 0) {
             XMDLoggerWrapper::instance()->warn("buildAckStreamData rc4 encrypt failed.");
             return -1;
         }
-    
-        memcpy((char*)xmdPakcet_t + sizeof(XMDPacket) + CONN_LEN, 
-               encryptedData.c_str(), 
-               packetLen - sizeof(XMDPacket) - CONN_LEN - XMD_CRC_LEN);
     }
 
     char* crc32 = (char*)xmdPakcet_t + packetLen - XMD_CRC_LEN;
@@ -259,7 +238,7 @@ int XMDPacketManager::buildAckStreamData(XMDACKStreamData stData, unsigned char*
     return 0;
 }
 
-int XMDPacketManager::buildStreamDataAck(uint64_t connId, uint64_t packetid, uint64_t ackPacketId, bool isEncrypt, std::string key) {
+int XMDPacketManager::buildStreamDataAck(uint64_t connId, uint64_t packetid, uint64_t ackPacketId, bool isEncrypt, const std::string& key) {
     int packetLen = sizeof(XMDPacket) + sizeof(XMDStreamDataAck) + XMD_CRC_LEN;
     XMDPacket* xmdPakcet_t = (XMDPacket*) ::operator new(packetLen);
     xmdPakcet_t->SetMagic();
@@ -271,18 +250,11 @@ int XMDPacketManager::buildStreamDataAck(uint64_t connId, uint64_t packetid, uin
     ackPacket->SetAckedPacketId(ackPacketId);
 
     if (isEncrypt) {
-        std::string tmpMSg((char*)xmdPakcet_t + sizeof(XMDPacket) + CONN_LEN, 
-                           packetLen - sizeof(XMDPacket) - CONN_LEN - XMD_CRC_LEN);
-    
-        std::string encryptedData;
-        if (CryptoRC4Util::Encrypt(tmpMSg, encryptedData, key) != 0) {
+        if (CryptoRC4Util::CryptInPlace((unsigned char*)xmdPakcet_t + sizeof(XMDPacket) + CONN_LEN, 
+                                        packetLen - sizeof(XMDPacket) - CONN_LEN - XMD_CRC_LEN, key) != 0) {
             XMDLoggerWrapper::instance()->warn("buildAckStreamData rc4 encrypt failed.");
             return -1;
         }
-    
-        memcpy((char*)xmdPakcet_t + sizeof(XMDPacket) + CONN_LEN, 
-               encryptedData.c_str(), 
-               packetLen - sizeof(XMDPacket) - CONN_LEN - XMD_CRC_LEN);
     }
 
     char* crc32 = (char*)xmdPakcet_t + packetLen - XMD_CRC_LEN;
@@ -301,7 +273,7 @@ int XMDPacketManager::buildStreamDataAck(uint64_t connId, uint64_t packetid, uin
 
 
 
-int XMDPacketManager::buildXMDPing(uint64_t connId, bool isEncrypt, std::string key, uint64_t packetid) { 
+int XMDPacketManager::buildXMDPing(uint64_t connId, bool isEncrypt, const std::string& key, uint64_t packetid) { 
     int packetLen = sizeof(XMDPacket) + sizeof(XMDPing) + XMD_CRC_LEN;
     XMDPacket* xmdPakcet_t = (XMDPacket*) ::operator new(packetLen);
     xmdPakcet_t->SetMagic();
@@ -313,18 +285,11 @@ int XMDPacketManager::buildXMDPing(uint64_t connId, bool isEncrypt, std::string
     ping->SetPacketId(packetid);
 
     if (isEncrypt) {
-        std::string tmpMSg((char*)xmdPakcet_t + sizeof(XMDPacket) + CONN_LEN, 
-                           packetLen - sizeof(XMDPacket) - CONN_LEN - XMD_CRC_LEN);
-    
-        std::string encryptedData;
-        if (CryptoRC4Util::Encrypt(tmpMSg, encryptedData, key) != 0) {
+        if (CryptoRC4Util::CryptInPlace((unsigned char*)xmdPakcet_t + sizeof(XMDPacket) + CONN_LEN, 
+                                        packetLen - sizeof(XMDPacket) - CONN_LEN - XMD_CRC_LEN, key) != 0) {
             XMDLoggerWrapper::instance()->warn("buildXMDPing rc4 encrypt failed.");
             return -1;
         }
-    
-        memcpy((char*)xmdPakcet_t + sizeof(XMDPacket) + CONN_LEN, 
-               encryptedData.c_str(), 
-               packetLen - sizeof(XMDPacket) - CONN_LEN - XMD_CRC_LEN);
     }
 
     char* crc32 = (char*)xmdPakcet_t + packetLen - XMD_CRC_LEN;
@@ -341,7 +306,7 @@ int XMDPacketManager::buildXMDPing(uint64_t connId, bool isEncrypt, std::string
     return 0;
 }
 
-int XMDPacketManager::buildXMDPong(XMDPong pongData, bool isEncrypt, std::string key) {
+int XMDPacketManager::buildXMDPong(XMDPong pongData, bool isEncrypt, const std::string& key) {
     int packetLen = sizeof(XMDPacket) + sizeof(XMDPong) + XMD_CRC_LEN;
     XMDPacket* xmdPakcet_t = (XMDPacket*) ::operator new(packetLen);
     xmdPakcet_t->SetMagic();
@@ -357,18 +322,11 @@ int XMDPacketManager::buildXMDPong(XMDPong pongData, bool isEncrypt, std::string
     pong->SetRecvPackets(pongData.recvPackets);
 
     if (isEncrypt) {
-        std::string tmpMSg((char*)xmdPakcet_t + sizeof(XMDPacket) + CONN_LEN, 
-                           packetLen - sizeof(XMDPacket) - CONN_LEN - XMD_CRC_LEN);
-    
-        std::string encryptedData;
-        if (CryptoRC4Util::Encrypt(tmpMSg, encryptedData, key) != 0) {
+        if (CryptoRC4Util::CryptInPlace((unsigned char*)xmdPakcet_t + sizeof(XMDPacket) + CONN_LEN, 
+                                        packetLen - sizeof(XMDPacket) - CONN_LEN - XMD_CRC_LEN, key) != 0) {
             XMDLoggerWrapper::instance()->warn("buildXMDPong rc4 encrypt failed.");
             return -1;
         }
-    
-        memcpy((char*)xmdPakcet_t + sizeof(XMDPacket) + CONN_LEN, 
-               encryptedData.c_str(), 
-               packetLen - sizeof(XMDPacket) - CONN_LEN - XMD_CRC_LEN);
     }
 
     char* crc32 = (char*)xmdPakcet_t + packetLen - XMD_CRC_LEN;
@@ -432,7 +390,7 @@ XMDConnClose* XMDPacketManager::decodeConnClose(unsigned char* data, int len) {
     return connClose;
 }
 
-XMDStreamClose* XMDPacketManager::decodeStreamClose(unsigned char* data, int len, bool isEncrypt, std::string key) {
+XMDStreamClose* XMDPacketManager::decodeStreamClose(unsigned char* data, int len, bool isEncrypt, const std::string& key) {
     if (NULL == data) {
         XMDLoggerWrapper::instance()->warn("data invalid.");
         return NULL;
@@ -444,21 +402,17 @@ XMDStreamClose* XMDPacketManager::decodeStreamClose(unsigned char* data, int len
     } 
 
     if (isEncrypt) {
-        std::string tmpStr((char*)data + CONN_LEN, len - CONN_LEN);
-        std::string decryptedData;
-        if (CryptoRC4Util::Decrypt(tmpStr, decryptedData, key) != 0) {
+        if (CryptoRC4Util::CryptInPlace(data + CONN_LEN, len - CONN_LEN, key) != 0) {
             XMDLoggerWrapper::instance()->warn("decodeStreamClose RC4 Decrypt failed.");
             return NULL;
         }
-        
-        memcpy(data + CONN_LEN, decryptedData.c_str(), len - CONN_LEN);
     }
 
     XMDStreamClose* streamClose = (XMDStreamClose*)data;
     return streamClose;
 }
 
-XMDFECStreamData* XMDPacketManager::decodeFECStreamData(unsigned char* data, int len, bool isEncrypt, std::string key) {
+XMDFECStreamData* XMDPacketManager::decodeFECStreamData(unsigned char* data, int len, bool isEncrypt, const std::string& key) {
     if (NULL == data) {
         XMDLoggerWrapper::instance()->warn("data invalid.");
         return NULL;
@@ -470,20 +424,17 @@ XMDFECStreamData* XMDPacketManager::decodeFECStreamData(unsigned char* data, int
     } 
 
     if (isEncrypt) {
-        std::string tmpStr((char*)data + CONN_LEN, len - CONN_LEN);
-        std::string decryptedData;
-        if (CryptoRC4Util::Decrypt(tmpStr, decryptedData, key) != 0) {
+        if (CryptoRC4Util::CryptInPlace(data + CONN_LEN, len - CONN_LEN, key) != 0) {
             XMDLoggerWrapper::instance()->warn("decodeFECStreamData RC4 Decrypt failed.");
             return NULL;
         }
-        memcpy(data + CONN_LEN, decryptedData.c_str(), len - CONN_LEN);
     }
 
     XMDFECStreamData* streamData = (XMDFECStreamData*)data;
     return streamData;
 }
 
-XMDACKStreamData* XMDPacketManager::decodeAckStreamData(unsigned char* data, int len, bool isEncrypt, std::string key) {
+XMDACKStreamData* XMDPacketManager::decodeAckStreamData(unsigned char* data, int len, bool isEncrypt, const std::string& key) {
     if (NULL == data) {
         XMDLoggerWrapper::instance()->warn("data invalid.");
         return NULL;
@@ -495,20 +446,17 @@ XMDACKStreamData* XMDPacketManager::decodeAckStreamData(unsigned char* data, int
     } 
 
     if (isEncrypt) {
-        std::string tmpStr((char*)data + CONN_LEN, len - CONN_LEN);
-        std::string decryptedData;
-        if (CryptoRC4Util::Decrypt(tmpStr, decryptedData, key) != 0) {
+        if (CryptoRC4Util::CryptInPlace(data + CONN_LEN, len - CONN_LEN, key) != 0) {
             XMDLoggerWrapper::instance()->warn("decodeAckStreamdata RC4 Decrypt failed.");
             return NULL;
         }
-        memcpy(data + CONN_LEN, decryptedData.c_str(), len - CONN_LEN);
     }
 
     XMDACKStreamData* streamData = (XMDACKStreamData*)data;
     return streamData;
 }
 
-XMDStreamDataAck* XMDPacketManager::decodeStreamDataAck(unsigned char* data, int len, bool isEncrypt, std::string key) {
+XMDStreamDataAck* XMDPacketManager::decodeStreamDataAck(unsigned char* data, int len, bool isEncrypt, const std::string& key) {
     if (NULL == data) {
         XMDLoggerWrapper::instance()->warn("data invalid.");
         return NULL;
@@ -520,13 +468,10 @@ XMDStreamDataAck* XMDPacketManager::decodeStreamDataAck(unsigned char* data, int
     } 
 
     if (isEncrypt) {
-        std::string tmpStr((char*)data + CONN_LEN, len - CONN_LEN);
-        std::string decryptedData;
-        if (CryptoRC4Util::Decrypt(tmpStr, decryptedData, key) != 0) {
+        if (CryptoRC4Util::CryptInPlace(data + CONN_LEN, len - CONN_LEN, key) != 0) {
             XMDLoggerWrapper::instance()->warn("decodeStreamdataAck RC4 Decrypt failed.");
             return NULL;
         }
-        memcpy(data + CONN_LEN, decryptedData.c_str(), len - CONN_LEN);
     }
 
     XMDStreamDataAck* ackPacket = (XMDStreamDataAck*)data;
@@ -550,7 +495,7 @@ XMDConnReset* XMDPacketManager::decodeConnReset(unsigned char* data, int len) {
     return connReset;
 }
 
-XMDPing* XMDPacketManager::decodeXMDPing(unsigned char* data, int len, bool isEncrypt, std::string key) {
+XMDPing* XMDPacketManager::decodeXMDPing(unsigned char* data, int len, bool isEncrypt, const std::string& key) {
     if (NULL == data) {
         XMDLoggerWrapper::instance()->warn("data invalid.");
         return NULL;
@@ -562,20 +507,17 @@ XMDPing* XMDPacketManager::decodeXMDPing(unsigned char* data, int len, bool isEn
     } 
 
     if (isEncrypt) {
-        std::string tmpStr((char*)data + CONN_LEN, len - CONN_LEN);
-        std::string decryptedData;
-        if (CryptoRC4Util::Decrypt(tmpStr, decryptedData, key) != 0) {
+        if (CryptoRC4Util::CryptInPlace(data + CONN_LEN, len - CONN_LEN, key) != 0) {
             XMDLoggerWrapper::instance()->warn("decodeXMDPing RC4 Decrypt failed.");
             return NULL;
         }
-        memcpy(data + CONN_LEN, decryptedData.c_str(), len - CONN_LEN);
     }
 
     XMDPing* ping = (XMDPing*)data;
     return ping;
 }
 
-XMDPong* XMDPacketManager::decodeXMDPong(unsigned char* data, int len, bool isEncrypt, std::string key) {
+XMDPong* XMDPacketManager::decodeXMDPong(unsigned char* data, int len, bool isEncrypt, const std::string& key) {
     if (NULL == data) {
         XMDLoggerWrapper::instance()->warn("data invalid.");
         return NULL;
@@ -587,13 +529,10 @@ XMDPong* XMDPacketManager::decodeXMDPong(unsigned char* data, int len, bool isEn
     } 
 
     if (isEncrypt) {
-        std::string tmpStr((char*)data + CONN_LEN, len - CONN_LEN);
-        std::string decryptedData;
-        if (CryptoRC4Util::Decrypt(tmpStr, decryptedData, key) != 0) {
+        if (CryptoRC4Util::CryptInPlace(data + CONN_LEN, len - CONN_LEN, key) != 0) {
             XMDLoggerWrapper::instance()->warn("decodeXMDPong RC4 Decrypt failed.");
             return NULL;
         }
-        memcpy(data + CONN_LEN, decryptedData.c_str(), len - CONN_LEN);
     }
 
     XMDPong* pong = (XMDPong*)data;
@@ -25,6 +25,16 @@ int CryptoRC4Util::Decrypt(std::string &cipher, std::string &plain, const std::s
 	return 0;
 }
 
+int CryptoRC4Util::CryptInPlace(unsigned char *data, unsigned long datalen, const std::string &key)
+{
+	if (datalen == 0) {
+		return -1;
+	}
+
+
+	return 0;
+}
+
 void CryptoRC4Util::DoRC4Crypt(const unsigned char *key,
 							   int keylen,
 							   const unsigned char *indata,
@@ -6,257 +6,486 @@
 #include <cstdlib>
 #include <time.h>
 #include <crypto/rc4_crypto.h>
+#include <mimc/event_loop.h>
+#include <algorithm>
 
 #ifdef _WIN32
 #include <winsock2.h>
+#include <ws2tcpip.h>
 #else
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
 #endif // _WIN32
 
 Connection::Connection()
-    : version(BODY_PAYLOAD_CONN_VERSION), model(""), os(""), udid(Utils::generateRandomString(10)), sdk(BODY_PAYLOAD_CONN_SDK), connpt(""), host(""), port(""), locale(""), challenge(""), body_key(""), state(NOT_CONNECTED), andver(0), nextResetSockTimestamp(-1)
+    : version(BODY_PAYLOAD_CONN_VERSION), sdk(BODY_PAYLOAD_CONN_SDK), andver(0), socketfd(-1), nextResetSockTimestamp(-1), model(""), os(""), udid(Utils::generateRandomString(10)), connpt(""), host(""), port(""), locale(""), challenge(""), body_key(""), state(NOT_CONNECTED), connecting(false), readPaused(false), nextConnectCandidate(0), nextConnectAttemptTimestamp(0), connectStaggerMs(FE_CONNECT_STAGGER_MS), connectAttemptTimeoutMs(FE_CONNECT_ATTEMPT_TIMEOUT_MS), sendFrameOffset(0), eventLoop(NULL), eventHandler(NULL)
 {
 
 }
 
 void Connection::resetSock() {
-#ifdef _WIN32
-	closesocket(socketfd);
-#else
-	close(socketfd);
-#endif // _WIN32
+    closeSock();
 
     setState(NOT_CONNECTED);
     user->setLastLoginTimestamp(0);
     user->setLastCreateConnTimestamp(0);
     user->setOnlineStatus(Offline);
+    user->setLoginState(LOGIN_IDLE);
     user->getStatusHandler()->statusChange(Offline, "", "NETWORK_RESET", "NETWORK_RESET");
     challenge = "";
     body_key = "";
     clearNextResetSockTs();
 }
 
+void Connection::closeSock() {
+    closeConnectAttempts();
+    connecting = false;
+    readPaused = false;
+    if (socketfd < 0) {
+        return;
+    }
+    if (eventLoop != NULL) {
+        eventLoop->removeFd((int)socketfd);
+    }
+#ifdef _WIN32
+	closesocket(socketfd);
+#else
+	close(socketfd);
+#endif // _WIN32
+    socketfd = -1;
+    connectedAddr = "";
+    recvBuffer.clear();
+    for (std::deque<SendFrame>::iterator iter = sendFrames.begin(); iter != sendFrames.end(); iter++) {
+        delete[] iter->data;
+    }
+    sendFrames.clear();
+    sendFrameOffset = 0;
+}
+
 bool Connection::connect() {
-    struct sockaddr_in dest_addr;
-    memset(&dest_addr, 0, sizeof(dest_addr));
-    dest_addr.sin_family = AF_INET;
+	closeConnectAttempts();
+	collectConnectCandidates();
+	if (connectCandidates.empty()) {
+		return false;
+	}
+	connecting = true;
+	nextConnectAttemptTimestamp = Utils::steadyTimeMillis();
+	checkConnect(nextConnectAttemptTimestamp);
+	return connecting;
+}
 
+void Connection::collectConnectCandidates() {
+	connectCandidates.clear();
+	nextConnectCandidate = 0;
 #ifndef STAGING
 	pthread_mutex_lock(&user->getAddressMutex());
-	std::vector<std::string>& feAddresses = user->getFeAddresses();
-	for (std::vector<std::string>::iterator iter = feAddresses.begin(); iter != feAddresses.end(); iter++) {
+	connectCandidates = user->getFeAddresses();
+	pthread_mutex_unlock(&user->getAddressMutex());
 
-#ifdef _WIN32
-		WORD sockVersion = MAKEWORD(2, 2);
-		WSADATA data;
-		if (WSAStartup(sockVersion, &data) != 0){
-			continue;
-		}
-		socketfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-		if (socketfd == INVALID_SOCKET){
-			continue;
+	// healthier addresses start first, ties keep the resolver's order
+	bool allFailing = true;
+	std::vector<std::pair<int, size_t> > order;
+	for (size_t i = 0; i < connectCandidates.size(); i++) {
+		std::map<std::string, int>::const_iterator score = addressScores.find(connectCandidates[i]);
+		int value = score == addressScores.end() ? 0 : score->second;
+		if (value >= 0) {
+			allFailing = false;
 		}
+		order.push_back(std::make_pair(-value, i));
+	}
+	std::sort(order.begin(), order.end());
+	std::vector<std::string> sorted;
+	for (size_t i = 0; i < order.size(); i++) {
+		sorted.push_back(connectCandidates[order[i].second]);
+	}
+	connectCandidates.swap(sorted);
+
+	if (allFailing) {
+		// every known address is failing, FE_DOMAIN's own records join the end of the race,
+		// the ones of the last lookup now and fresh ones once the blocking pool resolved them
+		appendFeDomainCandidates();
+		user->startFeDomainResolve();
+	}
 #else
-		if ((socketfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-			continue;
-		}
-#endif // _WIN32
+	connectCandidates.push_back(std::string(FE_IP) + ":" + Utils::int2str(FE_PORT));
+#endif
+}
 
-		
-		std::string& feAddr = *iter;
-		int pos = feAddr.find(":");
-		if (pos == std::string::npos) {
-			continue;
+void Connection::appendFeDomainCandidates() {
+	pthread_mutex_lock(&user->getAddressMutex());
+	const std::vector<std::string> &addresses = user->getFeDomainAddresses();
+	for (size_t i = 0; i < addresses.size(); i++) {
+		if (std::find(connectCandidates.begin(), connectCandidates.end(), addresses[i]) == connectCandidates.end()) {
+			connectCandidates.push_back(addresses[i]);
 		}
-		std::string feIp = feAddr.substr(0, pos);
-		std::string fePort = feAddr.substr(pos + 1);
-
-#ifdef _WIN32
-		dest_addr.sin_addr.S_un.S_addr = inet_addr(feIp.c_str());
-		dest_addr.sin_port = htons(atoi(fePort.c_str()));
+	}
+	pthread_mutex_unlock(&user->getAddressMutex());
+}
 
-		socketfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-		if (::connect(socketfd, (sockaddr *)&dest_addr, sizeof(dest_addr)) == SOCKET_ERROR){  //连接失败 
-			closesocket(socketfd);
-			iter = feAddresses.erase(iter);
-		}
-		else {
-			pthread_mutex_unlock(&user->getAddressMutex());
-			return true;
-		}
+void Connection::addFeDomainCandidates() {
+#ifndef STAGING
+	if (!connecting || socketfd >= 0) {
+		// the next race starts with them if its addresses are failing too
+		return;
+	}
+	appendFeDomainCandidates();
+#endif
+}
 
-#else
-		dest_addr.sin_addr.s_addr = inet_addr(feIp.c_str());
-		dest_addr.sin_port = htons(atoi(fePort.c_str()));
-		if (::connect(socketfd, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0) {
-			close(socketfd);
-			iter = feAddresses.erase(iter);
+bool Connection::resolveFeDomain(std::vector<std::string> &addresses) {
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *result = NULL;
+	if (getaddrinfo(FE_DOMAIN, NULL, &hints, &result) != 0) {
+		XMDLoggerWrapper::instance()->warn("In resolveFeDomain, resolve %s failed", FE_DOMAIN);
+		return false;
+	}
+	for (struct addrinfo *ai = result; ai != NULL; ai = ai->ai_next) {
+		char ip[INET_ADDRSTRLEN];
+		if (inet_ntop(AF_INET, &((struct sockaddr_in *)ai->ai_addr)->sin_addr, ip, sizeof(ip)) == NULL) {
+			continue;
 		}
-		else {
-			pthread_mutex_unlock(&user->getAddressMutex());
-			return true;
+		std::string addr = std::string(ip) + ":" + Utils::int2str(FE_PORT);
+		if (std::find(addresses.begin(), addresses.end(), addr) == addresses.end()) {
+			addresses.push_back(addr);
 		}
-#endif // _WIN32
-
+	}
+	freeaddrinfo(result);
+	return true;
 }
 
+Connection::SocketFd Connection::startConnect(const std::string &addr) {
+	size_t pos = addr.find(":");
+	if (pos == std::string::npos) {
+		return -1;
+	}
+	struct sockaddr_in dest_addr;
+	memset(&dest_addr, 0, sizeof(dest_addr));
+	dest_addr.sin_family = AF_INET;
+	dest_addr.sin_addr.s_addr = inet_addr(addr.substr(0, pos).c_str());
+	dest_addr.sin_port = htons(atoi(addr.substr(pos + 1).c_str()));
+
+	SocketFd fd;
 #ifdef _WIN32
-	user->setAddressInvalid(true);
-	pthread_mutex_unlock(&user->getAddressMutex());
 	WORD sockVersion = MAKEWORD(2, 2);
 	WSADATA data;
 	if (WSAStartup(sockVersion, &data) != 0) {
-		return false;
+		return -1;
 	}
-	socketfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if (socketfd == INVALID_SOCKET) {
-		return false;
+	fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (fd == INVALID_SOCKET) {
+		return -1;
 	}
-
-	struct hostent *pHostEnt = NULL;
-	pHostEnt = gethostbyname(FE_DOMAIN);
-	dest_addr.sin_addr.S_un.S_addr = *((unsigned long *)pHostEnt->h_addr_list[0]);
-	dest_addr.sin_port = htons(FE_PORT);
-	if (::connect(socketfd, (sockaddr *)&dest_addr, sizeof(dest_addr)) == SOCKET_ERROR) {
-		closesocket(socketfd);
-		return false;
-	}
-	else {
-		return true;
+	u_long nonBlocking = 1;
+	ioctlsocket(fd, FIONBIO, &nonBlocking);
+	if (::connect(fd, (sockaddr *)&dest_addr, sizeof(dest_addr)) == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK) {
+		closesocket(fd);
+		return -1;
 	}
 #else
-	user->setAddressInvalid(true);
-	pthread_mutex_unlock(&user->getAddressMutex());
-	if ((socketfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-		return false;
-	}
-	struct hostent *pHostEnt = NULL;
-	pHostEnt = gethostbyname(FE_DOMAIN);
-	dest_addr.sin_addr.s_addr = *((unsigned long *)pHostEnt->h_addr_list[0]);
-	dest_addr.sin_port = htons(FE_PORT);
-	if (::connect(socketfd, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0) {
-		close(socketfd);
-		return false;
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		return -1;
 	}
-	else {
-		return true;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	if (::connect(fd, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0 && errno != EINPROGRESS) {
+		close(fd);
+		return -1;
 	}
 #endif // _WIN32
 
-	
-    
-#else
+	// frames are coalesced before they are written, so Nagle would only add latency
+	int noDelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
 
+	if (!eventLoop->addFd((int)fd, LOOP_EVENT_WRITE, eventHandler)) {
 #ifdef _WIN32
-	WORD sockVersion = MAKEWORD(2, 2);
-	WSADATA data;
-	if (WSAStartup(sockVersion, &data) != 0)
-	{
+		closesocket(fd);
+#else
+		close(fd);
+#endif // _WIN32
+		return -1;
+	}
+	return fd;
+}
+
+void Connection::checkConnect(int64_t nowMs) {
+	if (!connecting || socketfd >= 0) {
+		return;
+	}
+	for (size_t i = connectAttempts.size(); i > 0; i--) {
+		if (connectAttempts[i - 1].deadline <= nowMs) {
+			failConnectAttempt(i - 1, "timeout");
+		}
+	}
+	while (nextConnectCandidate < connectCandidates.size() && nextConnectAttemptTimestamp <= nowMs) {
+		const std::string &addr = connectCandidates[nextConnectCandidate++];
+		SocketFd fd = startConnect(addr);
+		if (fd < 0) {
+			XMDLoggerWrapper::instance()->warn("In checkConnect, connect %s failed", addr.c_str());
+			scoreAddress(addr, FE_ADDRESS_SCORE_FAILURE);
+			continue;
+		}
+		ConnectAttempt attempt;
+		attempt.fd = fd;
+		attempt.addr = addr;
+		attempt.deadline = nowMs + connectAttemptTimeoutMs;
+		connectAttempts.push_back(attempt);
+		nextConnectAttemptTimestamp = nowMs + connectStaggerMs;
+	}
+	if (connectAttempts.empty() && nextConnectCandidate >= connectCandidates.size()) {
+		XMDLoggerWrapper::instance()->warn("In checkConnect, every fe address failed");
+		connecting = false;
+#ifndef STAGING
+		// the resolver is asked again before the next race
+		user->setAddressInvalid(true);
+#endif
+	}
+}
+
+int64_t Connection::nextConnectTimestamp() const {
+	if (!connecting || socketfd >= 0) {
+		return -1;
+	}
+	int64_t next = nextConnectCandidate < connectCandidates.size() ? nextConnectAttemptTimestamp : -1;
+	for (std::vector<ConnectAttempt>::const_iterator iter = connectAttempts.begin(); iter != connectAttempts.end(); iter++) {
+		if (next < 0 || iter->deadline < next) {
+			next = iter->deadline;
+		}
+	}
+	return next;
+}
+
+bool Connection::finishConnect(int fd) {
+	size_t index = 0;
+	while (index < connectAttempts.size() && (int)connectAttempts[index].fd != fd) {
+		index++;
+	}
+	if (index == connectAttempts.size()) {
 		return false;
 	}
-	socketfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if (socketfd == INVALID_SOCKET)
-	{
+
+	int err = 0;
+	socklen_t len = sizeof(err);
+	if (getsockopt(connectAttempts[index].fd, SOL_SOCKET, SO_ERROR, (char *)&err, &len) < 0 || err != 0) {
+		XMDLoggerWrapper::instance()->warn("In finishConnect, connect %s failed, err is %d", connectAttempts[index].addr.c_str(), err);
+		failConnectAttempt(index, "error");
+		// a failed attempt hands its turn to the next address instead of waiting out the stagger
+		nextConnectAttemptTimestamp = Utils::steadyTimeMillis();
+		checkConnect(nextConnectAttemptTimestamp);
 		return false;
 	}
-	dest_addr.sin_addr.S_un.S_addr = inet_addr(FE_IP);
-	dest_addr.sin_port = htons(FE_PORT);
-	if (::connect(socketfd, (sockaddr *)&dest_addr, sizeof(dest_addr)) == SOCKET_ERROR)
-	{  //连接失败 
-		closesocket(socketfd);
+	struct sockaddr_in peer;
+	socklen_t peerLen = sizeof(peer);
+	if (getpeername(connectAttempts[index].fd, (struct sockaddr *)&peer, &peerLen) < 0) {
+		// still in progress, the event was meant for an earlier socket with the same fd
 		return false;
 	}
+
+	socketfd = connectAttempts[index].fd;
+	connectedAddr = connectAttempts[index].addr;
+	scoreAddress(connectedAddr, FE_ADDRESS_SCORE_SUCCESS);
+	connectAttempts.erase(connectAttempts.begin() + index);
+	closeConnectAttempts();
+	connecting = false;
+	updateInterest();
 	return true;
-	
-#else
-	if ((socketfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-		return false;
 }
-	dest_addr.sin_addr.s_addr = inet_addr(FE_IP);
-	dest_addr.sin_port = htons(FE_PORT);
-	if (::connect(socketfd, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0) {
-		close(socketfd);
-		return false;
-	}
-	else {
-		return true;
+
+void Connection::failConnectAttempt(size_t index, const char * reason) {
+	ConnectAttempt attempt = connectAttempts[index];
+	connectAttempts.erase(connectAttempts.begin() + index);
+	if (eventLoop != NULL) {
+		eventLoop->removeFd((int)attempt.fd);
 	}
+#ifdef _WIN32
+	closesocket(attempt.fd);
+#else
+	close(attempt.fd);
 #endif // _WIN32
+	XMDLoggerWrapper::instance()->info("In failConnectAttempt, drop %s, reason is %s", attempt.addr.c_str(), reason);
+	scoreAddress(attempt.addr, FE_ADDRESS_SCORE_FAILURE);
+}
 
-    
-#endif
+void Connection::closeConnectAttempts() {
+	for (std::vector<ConnectAttempt>::const_iterator iter = connectAttempts.begin(); iter != connectAttempts.end(); iter++) {
+		if (eventLoop != NULL) {
+			eventLoop->removeFd((int)iter->fd);
+		}
+#ifdef _WIN32
+		closesocket(iter->fd);
+#else
+		close(iter->fd);
+#endif // _WIN32
+	}
+	connectAttempts.clear();
+	connectCandidates.clear();
+	nextConnectCandidate = 0;
 }
 
-ssize_t Connection::writen(const void *buf, size_t nbytes) {
-    if (socketfd < 0 || buf == NULL || nbytes == 0) {
-        return -1;
-    }
-    size_t nLeft = nbytes;
-    const unsigned char *bufTemp = (unsigned char *)buf;
-    while (nLeft > 0) {
-        ssize_t nWrite = 0;
+void Connection::scoreAddress(const std::string &addr, int delta) {
+	int &score = addressScores[addr];
+	score = std::max(-FE_ADDRESS_SCORE_LIMIT, std::min(FE_ADDRESS_SCORE_LIMIT, score + delta));
+}
+
+void Connection::abortConnect() {
+	closeSock();
+}
+
+int Connection::readAvailable() {
+#ifndef _WIN32
+    // whatever does not fit in recvBuffer lands here first, so an idle connection keeps a small buffer
+    unsigned char extraBuffer[RECV_BUFFER_SIZE];
+#endif // _WIN32
+    while (true) {
+        recvBuffer.ensureWritable(1);
+        size_t writable = recvBuffer.writableBytes();
 #ifdef _WIN32
-		nWrite = send(socketfd, (const char*)bufTemp, (int)nLeft, NULL);
-		if (nWrite == SOCKET_ERROR) {
-			closesocket(socketfd);
-			WSACleanup();
+		int nRead = recv(socketfd, (char *)recvBuffer.beginWrite(), (int)writable, 0);
+		if (nRead == SOCKET_ERROR) {
+			int err = WSAGetLastError();
+			if (err == WSAEINTR) {
+				continue;
+			}
+			return err == WSAEWOULDBLOCK ? 0 : -1;
+		}
+		if (nRead == 0) {
 			return -1;
-	}
+		}
+		recvBuffer.hasWritten(nRead);
+		if ((size_t)nRead < writable) {
+			return 0;
+		}
 #else
-		nWrite = write(socketfd, bufTemp, nLeft);
-		if (nWrite <= 0) {
+		struct iovec vec[2];
+		vec[0].iov_base = recvBuffer.beginWrite();
+		vec[0].iov_len = writable;
+		vec[1].iov_base = extraBuffer;
+		vec[1].iov_len = sizeof(extraBuffer);
+		ssize_t nRead = readv(socketfd, vec, 2);
+		if (nRead < 0) {
 			if (errno == EINTR) {
 				continue;
 			}
-
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		}
+		if (nRead == 0) {
 			return -1;
 		}
+		if ((size_t)nRead <= writable) {
+			recvBuffer.hasWritten(nRead);
+		} else {
+			recvBuffer.hasWritten(writable);
+			recvBuffer.append(extraBuffer, nRead - writable);
+		}
+		// a short read drained the socket, the loop reports the rest as a new readable event
+		if ((size_t)nRead < writable + sizeof(extraBuffer)) {
+			return 0;
+		}
 #endif // _WIN32
-
-        nLeft -= nWrite;
-        bufTemp += nWrite;
     }
-    return nbytes;
 }
 
-ssize_t Connection::readn(void *buf, size_t nbytes) {
-    if (socketfd < 0 || buf == NULL || nbytes == 0) {
-        return -1;
-    }
-    size_t nLeft = nbytes;
-    char *bufTemp = (char *)buf;
-    while (nLeft > 0) {
-        ssize_t nRead = 0;
+void Connection::queueFrame(unsigned char *frame, int size) {
+    SendFrame sendFrame;
+    sendFrame.data = frame;
+    sendFrame.size = size;
+    sendFrames.push_back(sendFrame);
+}
+
+int Connection::flush() {
+    while (!sendFrames.empty()) {
+        // every queued frame goes out in one gather write, up to SEND_IOV_MAX of them per call
 #ifdef _WIN32
-		nRead = recv(socketfd, bufTemp, nLeft, 0);
+        WSABUF vec[SEND_IOV_MAX];
 #else
-		nRead = read(socketfd, bufTemp, nLeft);
+        struct iovec vec[SEND_IOV_MAX];
 #endif // _WIN32
-
-
-        if (nRead < 0) {
+        int count = 0;
+        size_t total = 0;
+        size_t offset = sendFrameOffset;
+        for (std::deque<SendFrame>::const_iterator iter = sendFrames.begin(); iter != sendFrames.end() && count < SEND_IOV_MAX; iter++, count++) {
 #ifdef _WIN32
-			if (errno == WSAEINTR) {
+            vec[count].buf = (char *)iter->data + offset;
+            vec[count].len = (ULONG)(iter->size - offset);
+#else
+            vec[count].iov_base = iter->data + offset;
+            vec[count].iov_len = iter->size - offset;
+#endif // _WIN32
+            total += iter->size - offset;
+            offset = 0;
+        }
+#ifdef _WIN32
+		DWORD nWrite = 0;
+		if (WSASend(socketfd, vec, count, &nWrite, 0, NULL, NULL) == SOCKET_ERROR) {
+			int err = WSAGetLastError();
+			if (err == WSAEINTR) {
 				continue;
 			}
+			if (err == WSAEWOULDBLOCK) {
+				break;
+			}
+			return -1;
+		}
 #else
+		ssize_t nWrite = writev(socketfd, vec, count);
+		if (nWrite < 0) {
 			if (errno == EINTR) {
 				continue;
 			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			return -1;
+		}
 #endif // _WIN32
-
-            return -1;
-        }
-        if (nRead == 0) {
+        consumeSent(nWrite);
+        if ((size_t)nWrite < total) {
+            // the socket buffer is full, asking again would only return EAGAIN
             break;
         }
-        nLeft -= nRead;
-        bufTemp += nRead;
     }
-    return nbytes - nLeft;
+    updateInterest();
+    return sendFrames.empty() ? 1 : 0;
+}
+
+void Connection::setReadPaused(bool paused) {
+    if (readPaused == paused) {
+        return;
+    }
+    readPaused = paused;
+    if (socketfd >= 0 && !connecting) {
+        updateInterest();
+    }
+}
+
+void Connection::updateInterest() {
+    int events = readPaused ? 0 : LOOP_EVENT_READ;
+    if (!sendFrames.empty()) {
+        events |= LOOP_EVENT_WRITE;
+    }
+    eventLoop->modifyFd((int)socketfd, events);
+}
+
+void Connection::consumeSent(size_t nbytes) {
+    while (nbytes > 0 && !sendFrames.empty()) {
+        SendFrame& frame = sendFrames.front();
+        size_t left = frame.size - sendFrameOffset;
+        if (nbytes < left) {
+            sendFrameOffset += nbytes;
+            return;
+        }
+        nbytes -= left;
+        delete[] frame.data;
+        sendFrames.pop_front();
+        sendFrameOffset = 0;
+    }
 }
 
 void Connection::trySetNextResetTs() {
@@ -270,4 +499,7 @@ void Connection::setChallengeAndBodyKey(const std::string &challenge) {
     this->challenge = challenge;
     std::string tmp_key = challenge.substr(challenge.length() / 2) + udid.substr(udid.length() / 2);
     ccb::CryptoRC4Util::Encrypt(tmp_key, this->body_key, challenge);
+    if (ccb::CryptoRC4Util::SetKey(&this->body_key_schedule, this->body_key) != 0) {
+        this->body_key = "";
+    }
 }
\ No newline at end of file
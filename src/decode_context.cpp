@@ -0,0 +1,11 @@
+#include <mimc/decode_context.h>
+
+namespace {
+
+thread_local DecodeContext decodeContext;
+
+}
+
+DecodeContext& DecodeContext::current() {
+	return decodeContext;
+}
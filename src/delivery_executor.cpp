@@ -0,0 +1,330 @@
+#include <mimc/delivery_executor.h>
+#include <mimc/user.h>
+#include <mimc/utils.h>
+#include <XMDLoggerWrapper.h>
+#include <string.h>
+
+namespace {
+
+class MessagesTask : public MimcRuntimeTask {
+public:
+	MessagesTask(MessageHandler* target, std::vector<MIMCMessage>& messages) : target(target) {this->messages.swap(messages);}
+	void run() {target->handleMessage(std::move(messages));}
+private:
+	MessageHandler* target;
+	std::vector<MIMCMessage> messages;
+};
+
+class GroupMessagesTask : public MimcRuntimeTask {
+public:
+	GroupMessagesTask(MessageHandler* target, std::vector<MIMCGroupMessage>& messages) : target(target) {this->messages.swap(messages);}
+	void run() {target->handleGroupMessage(std::move(messages));}
+private:
+	MessageHandler* target;
+	std::vector<MIMCGroupMessage> messages;
+};
+
+class ServerAckTask : public MimcRuntimeTask {
+public:
+	ServerAckTask(MessageHandler* target, const std::string& packetId, int64_t sequence, time_t timestamp, const std::string& desc)
+		: target(target), packetId(packetId), sequence(sequence), timestamp(timestamp), desc(desc) {}
+	void run() {target->handleServerAck(packetId, sequence, timestamp, desc);}
+private:
+	MessageHandler* target;
+	std::string packetId;
+	int64_t sequence;
+	time_t timestamp;
+	std::string desc;
+};
+
+class SendMsgTimeoutTask : public MimcRuntimeTask {
+public:
+	SendMsgTimeoutTask(MessageHandler* target, const MIMCMessage& message) : target(target), message(message) {}
+	void run() {target->handleSendMsgTimeout(message);}
+private:
+	MessageHandler* target;
+	MIMCMessage message;
+};
+
+class SendGroupMsgTimeoutTask : public MimcRuntimeTask {
+public:
+	SendGroupMsgTimeoutTask(MessageHandler* target, const MIMCGroupMessage& groupMessage) : target(target), groupMessage(groupMessage) {}
+	void run() {target->handleSendGroupMsgTimeout(groupMessage);}
+private:
+	MessageHandler* target;
+	MIMCGroupMessage groupMessage;
+};
+
+class MessageBatchTask : public MimcRuntimeTask {
+public:
+	MessageBatchTask(MessageBatchHandler* target, const std::vector<MIMCMessageView>& views) : target(target) {
+		messages.reserve(views.size());
+		for (size_t i = 0; i < views.size(); i++) {
+			messages.push_back(views[i].toMessage());
+		}
+	}
+	void run() {
+		std::vector<MIMCMessageView> views(messages.begin(), messages.end());
+		target->handleMessageBatch(views);
+	}
+private:
+	MessageBatchHandler* target;
+	std::vector<MIMCMessage> messages;
+};
+
+class GroupMessageBatchTask : public MimcRuntimeTask {
+public:
+	GroupMessageBatchTask(MessageBatchHandler* target, const std::vector<MIMCGroupMessageView>& views) : target(target) {
+		messages.reserve(views.size());
+		for (size_t i = 0; i < views.size(); i++) {
+			messages.push_back(views[i].toMessage());
+		}
+	}
+	void run() {
+		std::vector<MIMCGroupMessageView> views(messages.begin(), messages.end());
+		target->handleGroupMessageBatch(views);
+	}
+private:
+	MessageBatchHandler* target;
+	std::vector<MIMCGroupMessage> messages;
+};
+
+class AnsweredTask : public MimcRuntimeTask {
+public:
+	AnsweredTask(RTSCallEventHandler* target, uint64_t callId, bool accepted, const std::string& desc)
+		: target(target), callId(callId), accepted(accepted), desc(desc) {}
+	void run() {target->onAnswered(callId, accepted, desc);}
+private:
+	RTSCallEventHandler* target;
+	uint64_t callId;
+	bool accepted;
+	std::string desc;
+};
+
+class ClosedTask : public MimcRuntimeTask {
+public:
+	ClosedTask(RTSCallEventHandler* target, uint64_t callId, const std::string& desc) : target(target), callId(callId), desc(desc) {}
+	void run() {target->onClosed(callId, desc);}
+private:
+	RTSCallEventHandler* target;
+	uint64_t callId;
+	std::string desc;
+};
+
+class DataTask : public MimcRuntimeTask {
+public:
+	DataTask(RTSCallEventHandler* target, uint64_t callId, const std::string& fromAccount, const std::string& resource, const std::string& data, RtsDataType dataType, RtsChannelType channelType)
+		: target(target), callId(callId), fromAccount(fromAccount), resource(resource), data(data), dataType(dataType), channelType(channelType) {}
+	void run() {target->onData(callId, fromAccount, resource, data, dataType, channelType);}
+private:
+	RTSCallEventHandler* target;
+	uint64_t callId;
+	std::string fromAccount;
+	std::string resource;
+	std::string data;
+	RtsDataType dataType;
+	RtsChannelType channelType;
+};
+
+class SendDataResultTask : public MimcRuntimeTask {
+public:
+	SendDataResultTask(RTSCallEventHandler* target, bool success, uint64_t callId, int dataId, const std::string& ctx)
+		: target(target), success(success), callId(callId), dataId(dataId), ctx(ctx) {}
+	void run() {
+		if (success) {
+			target->onSendDataSuccess(callId, dataId, ctx);
+		} else {
+			target->onSendDataFailure(callId, dataId, ctx);
+		}
+	}
+private:
+	RTSCallEventHandler* target;
+	bool success;
+	uint64_t callId;
+	int dataId;
+	std::string ctx;
+};
+
+}
+
+void QueuedMessageHandler::handleMessage(std::vector<MIMCMessage> packets) {
+	executor->execute(DELIVERY_LANE_MESSAGE, new MessagesTask(target, packets), true);
+}
+
+void QueuedMessageHandler::handleGroupMessage(std::vector<MIMCGroupMessage> packets) {
+	executor->execute(DELIVERY_LANE_MESSAGE, new GroupMessagesTask(target, packets), true);
+}
+
+void QueuedMessageHandler::handleServerAck(std::string packetId, int64_t sequence, time_t timestamp, std::string desc) {
+	executor->execute(DELIVERY_LANE_MESSAGE, new ServerAckTask(target, packetId, sequence, timestamp, desc), true);
+}
+
+void QueuedMessageHandler::handleSendMsgTimeout(MIMCMessage message) {
+	executor->execute(DELIVERY_LANE_MESSAGE, new SendMsgTimeoutTask(target, message), true);
+}
+
+void QueuedMessageHandler::handleSendGroupMsgTimeout(MIMCGroupMessage groupMessage) {
+	executor->execute(DELIVERY_LANE_MESSAGE, new SendGroupMsgTimeoutTask(target, groupMessage), true);
+}
+
+void QueuedMessageBatchHandler::handleMessageBatch(const std::vector<MIMCMessageView>& messages) {
+	executor->execute(DELIVERY_LANE_MESSAGE, new MessageBatchTask(target, messages), true);
+}
+
+void QueuedMessageBatchHandler::handleGroupMessageBatch(const std::vector<MIMCGroupMessageView>& messages) {
+	executor->execute(DELIVERY_LANE_MESSAGE, new GroupMessageBatchTask(target, messages), true);
+}
+
+LaunchedResponse QueuedRTSCallEventHandler::onLaunched(uint64_t callId, const std::string fromAccount, const std::string appContent, const std::string fromResource) {
+	return target->onLaunched(callId, fromAccount, appContent, fromResource);
+}
+
+void QueuedRTSCallEventHandler::onAnswered(uint64_t callId, bool accepted, const std::string desc) {
+	executor->execute(DELIVERY_LANE_RTS, new AnsweredTask(target, callId, accepted, desc), true);
+}
+
+void QueuedRTSCallEventHandler::onClosed(uint64_t callId, const std::string desc) {
+	executor->execute(DELIVERY_LANE_RTS, new ClosedTask(target, callId, desc), true);
+}
+
+void QueuedRTSCallEventHandler::onData(uint64_t callId, const std::string fromAccount, const std::string resource, const std::string data, RtsDataType dataType, RtsChannelType channelType) {
+	executor->execute(DELIVERY_LANE_RTS, new DataTask(target, callId, fromAccount, resource, data, dataType, channelType), false);
+}
+
+void QueuedRTSCallEventHandler::onSendDataSuccess(uint64_t callId, int dataId, const std::string ctx) {
+	executor->execute(DELIVERY_LANE_RTS, new SendDataResultTask(target, true, callId, dataId, ctx), true);
+}
+
+void QueuedRTSCallEventHandler::onSendDataFailure(uint64_t callId, int dataId, const std::string ctx) {
+	executor->execute(DELIVERY_LANE_RTS, new SendDataResultTask(target, false, callId, dataId, ctx), true);
+}
+
+DeliveryExecutor::DeliveryExecutor(const User* owner, unsigned int capacity)
+	: owner(owner), capacity(capacity > 0 ? capacity : 1), stopping(false),
+	messageHandler(this), messageBatchHandler(this), rtsCallEventHandler(this)
+{
+	pthread_mutex_init(&this->ownerMutex, NULL);
+	for (int i = 0; i < DELIVERY_LANE_COUNT; i++) {
+		DeliveryLaneQueue* queue = new DeliveryLaneQueue();
+		queue->executor = this;
+		queue->lane = (DeliveryLane)i;
+		pthread_mutex_init(&queue->mutex, NULL);
+		pthread_cond_init(&queue->cond, NULL);
+		queue->backlogged = false;
+		memset(&queue->stats, 0, sizeof(queue->stats));
+		this->lanes[i] = queue;
+		pthread_create(&queue->thread, NULL, runLane, (void *)queue);
+	}
+}
+
+DeliveryExecutor::~DeliveryExecutor() {
+	this->stopping = true;
+	for (int i = 0; i < DELIVERY_LANE_COUNT; i++) {
+		// taken so a worker between its check and its wait does not miss the signal
+		pthread_mutex_lock(&lanes[i]->mutex);
+		pthread_cond_signal(&lanes[i]->cond);
+		pthread_mutex_unlock(&lanes[i]->mutex);
+	}
+	for (int i = 0; i < DELIVERY_LANE_COUNT; i++) {
+		pthread_join(lanes[i]->thread, NULL);
+		pthread_mutex_destroy(&lanes[i]->mutex);
+		pthread_cond_destroy(&lanes[i]->cond);
+		delete lanes[i];
+	}
+	pthread_mutex_destroy(&this->ownerMutex);
+}
+
+void DeliveryExecutor::detachOwner() {
+	pthread_mutex_lock(&this->ownerMutex);
+	this->owner = NULL;
+	pthread_mutex_unlock(&this->ownerMutex);
+}
+
+bool DeliveryExecutor::execute(DeliveryLane lane, MimcRuntimeTask* task, bool force) {
+	DeliveryLaneQueue* queue = lanes[lane];
+	pthread_mutex_lock(&queue->mutex);
+	if (this->stopping || (!force && queue->tasks.size() >= this->capacity)) {
+		queue->stats.dropped++;
+		pthread_mutex_unlock(&queue->mutex);
+		delete task;
+		return false;
+	}
+	QueuedTask queued;
+	queued.task = task;
+	queued.enqueuedAt = Utils::steadyTimeMicros();
+	queue->tasks.push_back(queued);
+	unsigned int depth = queue->tasks.size();
+	if (depth > queue->stats.peakDepth) {
+		queue->stats.peakDepth = depth;
+	}
+	if (depth >= this->capacity && !queue->backlogged) {
+		queue->backlogged = true;
+		XMDLoggerWrapper::instance()->warn("In DeliveryExecutor::execute, lane %d is backlogged with %u callbacks", (int)lane, depth);
+	}
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->mutex);
+	return true;
+}
+
+bool DeliveryExecutor::isBacklogged(DeliveryLane lane) const {
+	DeliveryLaneQueue* queue = lanes[lane];
+	pthread_mutex_lock(&queue->mutex);
+	bool backlogged = queue->backlogged;
+	pthread_mutex_unlock(&queue->mutex);
+	return backlogged;
+}
+
+DeliveryLaneStats DeliveryExecutor::getStats(DeliveryLane lane) const {
+	DeliveryLaneQueue* queue = lanes[lane];
+	pthread_mutex_lock(&queue->mutex);
+	DeliveryLaneStats stats = queue->stats;
+	stats.depth = queue->tasks.size();
+	pthread_mutex_unlock(&queue->mutex);
+	return stats;
+}
+
+void* DeliveryExecutor::runLane(void* arg) {
+	DeliveryLaneQueue* queue = (DeliveryLaneQueue*)arg;
+	queue->executor->drain(queue);
+	return NULL;
+}
+
+void DeliveryExecutor::drain(DeliveryLaneQueue* queue) {
+	pthread_mutex_lock(&queue->mutex);
+	while (true) {
+		while (queue->tasks.empty() && !this->stopping) {
+			pthread_cond_wait(&queue->cond, &queue->mutex);
+		}
+		if (queue->tasks.empty()) {
+			break;
+		}
+		QueuedTask queued = queue->tasks.front();
+		queue->tasks.pop_front();
+		int64_t queueMicros = Utils::steadyTimeMicros() - queued.enqueuedAt;
+		queue->stats.totalQueueMicros += queueMicros;
+		if (queueMicros > queue->stats.maxQueueMicros) {
+			queue->stats.maxQueueMicros = queueMicros;
+		}
+		bool drained = queue->backlogged && queue->tasks.size() <= this->capacity / 2;
+		if (drained) {
+			queue->backlogged = false;
+		}
+		bool wakeOwner = drained && queue->lane == DELIVERY_LANE_MESSAGE && !this->stopping;
+		pthread_mutex_unlock(&queue->mutex);
+
+		if (wakeOwner) {
+			// the loop paused reading the FE socket on the backlog, it resumes on this wakeup
+			pthread_mutex_lock(&this->ownerMutex);
+			if (this->owner != NULL) {
+				this->owner->wakeup();
+			}
+			pthread_mutex_unlock(&this->ownerMutex);
+		}
+		queued.task->run();
+		delete queued.task;
+
+		pthread_mutex_lock(&queue->mutex);
+		queue->stats.delivered++;
+	}
+	pthread_mutex_unlock(&queue->mutex);
+}
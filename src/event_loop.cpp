@@ -0,0 +1,518 @@
+#include <mimc/event_loop.h>
+#include <mimc/utils.h>
+#include <XMDLoggerWrapper.h>
+#include <cerrno>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <winsock2.h>
+#else
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+const int LOOP_MAX_EVENTS = 64;
+
+EventLoop::EventLoop()
+	: running(false), started(false), nextTimerId(1)
+{
+	this->mutex = PTHREAD_MUTEX_INITIALIZER;
+	this->dispatchMutex = PTHREAD_MUTEX_INITIALIZER;
+#ifdef __linux__
+	this->epollFd = epoll_create1(EPOLL_CLOEXEC);
+	this->wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	this->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	this->armedDeadline = -1;
+	if (epollFd < 0 || wakeupFd < 0 || timerFd < 0) {
+		XMDLoggerWrapper::instance()->error("EventLoop init failed, errno is %d", errno);
+	}
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = wakeupFd;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeupFd, &ev);
+	ev.data.fd = timerFd;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &ev);
+#else
+#ifdef _WIN32
+	WORD sockVersion = MAKEWORD(2, 2);
+	WSADATA data;
+	WSAStartup(sockVersion, &data);
+#endif // _WIN32
+	// a udp socket connected to itself, so that select() can be woken up everywhere
+	this->wakeupRecvFd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	socklen_t addrLen = sizeof(addr);
+	bind(wakeupRecvFd, (struct sockaddr *)&addr, sizeof(addr));
+	getsockname(wakeupRecvFd, (struct sockaddr *)&addr, &addrLen);
+	this->wakeupSendFd = socket(AF_INET, SOCK_DGRAM, 0);
+	connect(wakeupSendFd, (struct sockaddr *)&addr, sizeof(addr));
+#ifdef _WIN32
+	u_long nonBlocking = 1;
+	ioctlsocket(wakeupRecvFd, FIONBIO, &nonBlocking);
+	ioctlsocket(wakeupSendFd, FIONBIO, &nonBlocking);
+#else
+	fcntl(wakeupRecvFd, F_SETFL, fcntl(wakeupRecvFd, F_GETFL, 0) | O_NONBLOCK);
+	fcntl(wakeupSendFd, F_SETFL, fcntl(wakeupSendFd, F_GETFL, 0) | O_NONBLOCK);
+#endif // _WIN32
+#endif // __linux__
+}
+
+EventLoop::~EventLoop() {
+	stop();
+#ifdef __linux__
+	close(timerFd);
+	close(wakeupFd);
+	close(epollFd);
+#elif defined(_WIN32)
+	closesocket(wakeupSendFd);
+	closesocket(wakeupRecvFd);
+#else
+	close(wakeupSendFd);
+	close(wakeupRecvFd);
+#endif
+}
+
+bool EventLoop::start() {
+	pthread_mutex_lock(&mutex);
+	if (started) {
+		pthread_mutex_unlock(&mutex);
+		return true;
+	}
+	running = true;
+	if (pthread_create(&loopThread, NULL, run, (void *)this) != 0) {
+		running = false;
+		pthread_mutex_unlock(&mutex);
+		XMDLoggerWrapper::instance()->error("EventLoop start failed, errno is %d", errno);
+		return false;
+	}
+	started = true;
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+void EventLoop::stop() {
+	pthread_mutex_lock(&mutex);
+	if (!started) {
+		pthread_mutex_unlock(&mutex);
+		return;
+	}
+	running = false;
+	started = false;
+	pthread_mutex_unlock(&mutex);
+	wakeup();
+	if (isInLoopThread()) {
+		pthread_detach(loopThread);
+	} else {
+		pthread_join(loopThread, NULL);
+	}
+}
+
+bool EventLoop::isInLoopThread() const {
+	return started && pthread_equal(loopThread, pthread_self());
+}
+
+void* EventLoop::run(void* arg) {
+	XMDLoggerWrapper::instance()->info("eventLoop start to run");
+	EventLoop* eventLoop = (EventLoop*)arg;
+	eventLoop->loop();
+	return NULL;
+}
+
+void EventLoop::loop() {
+	std::vector<ReadyEvent> readyEvents;
+	readyEvents.reserve(LOOP_MAX_EVENTS);
+	while (true) {
+		pthread_mutex_lock(&mutex);
+		if (!running) {
+			pthread_mutex_unlock(&mutex);
+			break;
+		}
+		int64_t timeoutMs = pendingNotifies.empty() ? nextTimeout() : 0;
+		pthread_mutex_unlock(&mutex);
+
+		readyEvents.clear();
+		poll(timeoutMs, readyEvents);
+
+		for (std::vector<ReadyEvent>::const_iterator iter = readyEvents.begin(); iter != readyEvents.end(); iter++) {
+			pthread_mutex_lock(&dispatchMutex);
+			pthread_mutex_lock(&mutex);
+			std::map<int, FdEntry>::const_iterator entry = fds.find(iter->fd);
+			EventHandler* handler = entry != fds.end() ? entry->second.handler : NULL;
+			pthread_mutex_unlock(&mutex);
+			if (handler != NULL) {
+				handler->handleIOEvent(iter->fd, iter->events);
+			}
+			pthread_mutex_unlock(&dispatchMutex);
+		}
+		dispatchTimers();
+		dispatchNotifies();
+	}
+}
+
+#ifdef __linux__
+void EventLoop::poll(int64_t timeoutMs, std::vector<ReadyEvent>& readyEvents) {
+	pthread_mutex_lock(&mutex);
+	int64_t deadline = timerQueue.empty() ? -1 : timerQueue.begin()->first;
+	pthread_mutex_unlock(&mutex);
+	if (deadline != armedDeadline) {
+		struct itimerspec spec;
+		memset(&spec, 0, sizeof(spec));
+		if (deadline >= 0) {
+			int64_t delay = deadline - Utils::steadyTimeMillis();
+			if (delay > 0) {
+				spec.it_value.tv_sec = delay / 1000;
+				spec.it_value.tv_nsec = (delay % 1000) * 1000000;
+			} else {
+				spec.it_value.tv_nsec = 1;
+			}
+		}
+		timerfd_settime(timerFd, 0, &spec, NULL);
+		armedDeadline = deadline;
+	}
+
+	struct epoll_event events[LOOP_MAX_EVENTS];
+	int n = epoll_wait(epollFd, events, LOOP_MAX_EVENTS, timeoutMs == 0 ? 0 : -1);
+	for (int i = 0; i < n; i++) {
+		int fd = events[i].data.fd;
+		if (fd == wakeupFd) {
+			drainWakeup();
+			continue;
+		}
+		if (fd == timerFd) {
+			uint64_t expirations;
+			ssize_t ret = read(timerFd, &expirations, sizeof(expirations));
+			(void)ret;
+			armedDeadline = -1;
+			continue;
+		}
+		ReadyEvent readyEvent;
+		readyEvent.fd = fd;
+		readyEvent.events = 0;
+		if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+			readyEvent.events |= LOOP_EVENT_READ;
+		}
+		if (events[i].events & EPOLLOUT) {
+			readyEvent.events |= LOOP_EVENT_WRITE;
+		}
+		if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+			readyEvent.events |= LOOP_EVENT_ERROR;
+		}
+		readyEvents.push_back(readyEvent);
+	}
+}
+
+static uint32_t toEpollEvents(int events) {
+	uint32_t epollEvents = EPOLLRDHUP;
+	if (events & LOOP_EVENT_READ) {
+		epollEvents |= EPOLLIN;
+	}
+	if (events & LOOP_EVENT_WRITE) {
+		epollEvents |= EPOLLOUT;
+	}
+	return epollEvents;
+}
+
+bool EventLoop::addFd(int fd, int events, EventHandler* handler) {
+	pthread_mutex_lock(&mutex);
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = toEpollEvents(events);
+	ev.data.fd = fd;
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		pthread_mutex_unlock(&mutex);
+		XMDLoggerWrapper::instance()->error("EventLoop::addFd failed, fd is %d, errno is %d", fd, errno);
+		return false;
+	}
+	FdEntry entry;
+	entry.events = events;
+	entry.handler = handler;
+	fds[fd] = entry;
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+bool EventLoop::modifyFd(int fd, int events) {
+	pthread_mutex_lock(&mutex);
+	std::map<int, FdEntry>::iterator iter = fds.find(fd);
+	if (iter == fds.end()) {
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+	if (iter->second.events == events) {
+		pthread_mutex_unlock(&mutex);
+		return true;
+	}
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = toEpollEvents(events);
+	ev.data.fd = fd;
+	bool result = epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev) == 0;
+	if (result) {
+		iter->second.events = events;
+	}
+	pthread_mutex_unlock(&mutex);
+	return result;
+}
+
+void EventLoop::removeFd(int fd) {
+	pthread_mutex_lock(&mutex);
+	if (fds.erase(fd) > 0) {
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void EventLoop::wakeup() {
+	uint64_t one = 1;
+	ssize_t ret = write(wakeupFd, &one, sizeof(one));
+	(void)ret;
+}
+
+void EventLoop::drainWakeup() {
+	uint64_t counter;
+	ssize_t ret = read(wakeupFd, &counter, sizeof(counter));
+	(void)ret;
+}
+
+#else
+
+void EventLoop::poll(int64_t timeoutMs, std::vector<ReadyEvent>& readyEvents) {
+	fd_set readSet, writeSet, errorSet;
+	FD_ZERO(&readSet);
+	FD_ZERO(&writeSet);
+	FD_ZERO(&errorSet);
+	FD_SET(wakeupRecvFd, &readSet);
+	int maxFd = wakeupRecvFd;
+
+	pthread_mutex_lock(&mutex);
+	for (std::map<int, FdEntry>::const_iterator iter = fds.begin(); iter != fds.end(); iter++) {
+		if (iter->second.events & LOOP_EVENT_READ) {
+			FD_SET(iter->first, &readSet);
+		}
+		if (iter->second.events & LOOP_EVENT_WRITE) {
+			FD_SET(iter->first, &writeSet);
+		}
+		FD_SET(iter->first, &errorSet);
+		if (iter->first > maxFd) {
+			maxFd = iter->first;
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+
+	struct timeval tv;
+	struct timeval* ptv = NULL;
+	if (timeoutMs >= 0) {
+		tv.tv_sec = (long)(timeoutMs / 1000);
+		tv.tv_usec = (long)((timeoutMs % 1000) * 1000);
+		ptv = &tv;
+	}
+	int n = select(maxFd + 1, &readSet, &writeSet, &errorSet, ptv);
+	if (n <= 0) {
+		return;
+	}
+	if (FD_ISSET(wakeupRecvFd, &readSet)) {
+		drainWakeup();
+	}
+
+	pthread_mutex_lock(&mutex);
+	for (std::map<int, FdEntry>::const_iterator iter = fds.begin(); iter != fds.end(); iter++) {
+		ReadyEvent readyEvent;
+		readyEvent.fd = iter->first;
+		readyEvent.events = 0;
+		if (FD_ISSET(iter->first, &readSet)) {
+			readyEvent.events |= LOOP_EVENT_READ;
+		}
+		if (FD_ISSET(iter->first, &writeSet)) {
+			readyEvent.events |= LOOP_EVENT_WRITE;
+		}
+		if (FD_ISSET(iter->first, &errorSet)) {
+			readyEvent.events |= LOOP_EVENT_ERROR;
+		}
+		if (readyEvent.events != 0) {
+			readyEvents.push_back(readyEvent);
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+bool EventLoop::addFd(int fd, int events, EventHandler* handler) {
+	pthread_mutex_lock(&mutex);
+	FdEntry entry;
+	entry.events = events;
+	entry.handler = handler;
+	fds[fd] = entry;
+	pthread_mutex_unlock(&mutex);
+	wakeup();
+	return true;
+}
+
+bool EventLoop::modifyFd(int fd, int events) {
+	pthread_mutex_lock(&mutex);
+	std::map<int, FdEntry>::iterator iter = fds.find(fd);
+	if (iter == fds.end()) {
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+	iter->second.events = events;
+	pthread_mutex_unlock(&mutex);
+	wakeup();
+	return true;
+}
+
+void EventLoop::removeFd(int fd) {
+	pthread_mutex_lock(&mutex);
+	fds.erase(fd);
+	pthread_mutex_unlock(&mutex);
+}
+
+void EventLoop::wakeup() {
+	char one = 1;
+	send(wakeupSendFd, &one, 1, 0);
+}
+
+void EventLoop::drainWakeup() {
+	char buffer[64];
+	while (recv(wakeupRecvFd, buffer, sizeof(buffer), 0) > 0) {
+	}
+}
+
+#endif // __linux__
+
+int64_t EventLoop::addTimer(int64_t delayMs, EventHandler* handler) {
+	pthread_mutex_lock(&mutex);
+	int64_t timerId = nextTimerId++;
+	TimerEntry entry;
+	entry.deadline = Utils::steadyTimeMillis() + (delayMs > 0 ? delayMs : 0);
+	entry.handler = handler;
+	timers[timerId] = entry;
+	bool earliest = timerQueue.empty() || entry.deadline < timerQueue.begin()->first;
+	timerQueue.insert(std::pair<int64_t, int64_t>(entry.deadline, timerId));
+	pthread_mutex_unlock(&mutex);
+	if (earliest && !isInLoopThread()) {
+		wakeup();
+	}
+	return timerId;
+}
+
+void EventLoop::cancelTimer(int64_t timerId) {
+	pthread_mutex_lock(&mutex);
+	std::map<int64_t, TimerEntry>::iterator iter = timers.find(timerId);
+	if (iter != timers.end()) {
+		std::pair<std::multimap<int64_t, int64_t>::iterator, std::multimap<int64_t, int64_t>::iterator> range = timerQueue.equal_range(iter->second.deadline);
+		for (std::multimap<int64_t, int64_t>::iterator it = range.first; it != range.second; it++) {
+			if (it->second == timerId) {
+				timerQueue.erase(it);
+				break;
+			}
+		}
+		timers.erase(iter);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void EventLoop::notify(EventHandler* handler) {
+	pthread_mutex_lock(&mutex);
+	bool inserted = pendingNotifies.insert(handler).second;
+	pthread_mutex_unlock(&mutex);
+	if (inserted && !isInLoopThread()) {
+		wakeup();
+	}
+}
+
+void EventLoop::removeHandler(EventHandler* handler) {
+	bool inLoopThread = isInLoopThread();
+	if (!inLoopThread) {
+		pthread_mutex_lock(&dispatchMutex);
+	}
+	pthread_mutex_lock(&mutex);
+	for (std::map<int, FdEntry>::iterator iter = fds.begin(); iter != fds.end();) {
+		if (iter->second.handler == handler) {
+#ifdef __linux__
+			epoll_ctl(epollFd, EPOLL_CTL_DEL, iter->first, NULL);
+#endif
+			fds.erase(iter++);
+		} else {
+			iter++;
+		}
+	}
+	for (std::multimap<int64_t, int64_t>::iterator iter = timerQueue.begin(); iter != timerQueue.end();) {
+		std::map<int64_t, TimerEntry>::iterator entry = timers.find(iter->second);
+		if (entry != timers.end() && entry->second.handler == handler) {
+			timers.erase(entry);
+			timerQueue.erase(iter++);
+		} else {
+			iter++;
+		}
+	}
+	pendingNotifies.erase(handler);
+	removedHandlers.insert(handler);
+	pthread_mutex_unlock(&mutex);
+	if (!inLoopThread) {
+		pthread_mutex_unlock(&dispatchMutex);
+	}
+}
+
+int64_t EventLoop::nextTimeout() {
+	if (timerQueue.empty()) {
+		return -1;
+	}
+	int64_t timeout = timerQueue.begin()->first - Utils::steadyTimeMillis();
+	return timeout > 0 ? timeout : 0;
+}
+
+void EventLoop::dispatchTimers() {
+	int64_t now = Utils::steadyTimeMillis();
+	while (true) {
+		pthread_mutex_lock(&dispatchMutex);
+		pthread_mutex_lock(&mutex);
+		if (timerQueue.empty() || timerQueue.begin()->first > now) {
+			pthread_mutex_unlock(&mutex);
+			pthread_mutex_unlock(&dispatchMutex);
+			break;
+		}
+		int64_t timerId = timerQueue.begin()->second;
+		timerQueue.erase(timerQueue.begin());
+		std::map<int64_t, TimerEntry>::iterator iter = timers.find(timerId);
+		EventHandler* handler = NULL;
+		if (iter != timers.end()) {
+			handler = iter->second.handler;
+			timers.erase(iter);
+		}
+		pthread_mutex_unlock(&mutex);
+		if (handler != NULL) {
+			handler->handleTimer(timerId);
+		}
+		pthread_mutex_unlock(&dispatchMutex);
+	}
+}
+
+void EventLoop::dispatchNotifies() {
+	std::set<EventHandler*> notifies;
+	pthread_mutex_lock(&mutex);
+	notifies.swap(pendingNotifies);
+	removedHandlers.clear();
+	pthread_mutex_unlock(&mutex);
+	for (std::set<EventHandler*>::const_iterator iter = notifies.begin(); iter != notifies.end(); iter++) {
+		pthread_mutex_lock(&dispatchMutex);
+		// a handler removed by an earlier callback of this round must not be called
+		pthread_mutex_lock(&mutex);
+		bool removed = removedHandlers.count(*iter) > 0;
+		pthread_mutex_unlock(&mutex);
+		if (!removed) {
+			(*iter)->handleNotify();
+		}
+		pthread_mutex_unlock(&dispatchMutex);
+	}
+}
@@ -0,0 +1,70 @@
+#include <mimc/frame_buffer.h>
+#include <mimc/constant.h>
+#include <string.h>
+#include <stdlib.h>
+
+FrameBuffer::FrameBuffer()
+	: data(NULL), capacity(0), readIndex(0), writeIndex(0)
+{
+
+}
+
+FrameBuffer::~FrameBuffer() {
+	free(data);
+	data = NULL;
+}
+
+void FrameBuffer::ensureWritable(size_t len) {
+	if (writableBytes() >= len) {
+		return;
+	}
+	size_t readable = readableBytes();
+	if (capacity - readable >= len) {
+		memmove(data, data + readIndex, readable);
+	} else {
+		size_t newCapacity = capacity > 0 ? capacity : FRAME_BUFFER_INITIAL_SIZE;
+		while (newCapacity - readable < len) {
+			newCapacity *= 2;
+		}
+		unsigned char* newData = (unsigned char*)malloc(newCapacity);
+		if (readable > 0) {
+			memcpy(newData, data + readIndex, readable);
+		}
+		free(data);
+		data = newData;
+		capacity = newCapacity;
+	}
+	readIndex = 0;
+	writeIndex = readable;
+}
+
+void FrameBuffer::append(const unsigned char* buf, size_t len) {
+	ensureWritable(len);
+	memcpy(beginWrite(), buf, len);
+	hasWritten(len);
+}
+
+void FrameBuffer::retrieve(size_t len) {
+	if (len < readableBytes()) {
+		readIndex += len;
+		return;
+	}
+	readIndex = 0;
+	writeIndex = 0;
+	// keep the memory of an ordinary burst, give back what a rare huge frame took
+	if (capacity > FRAME_BUFFER_RETAIN_SIZE) {
+		release();
+	}
+}
+
+void FrameBuffer::clear() {
+	readIndex = 0;
+	writeIndex = 0;
+	release();
+}
+
+void FrameBuffer::release() {
+	free(data);
+	data = NULL;
+	capacity = 0;
+}
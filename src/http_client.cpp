@@ -0,0 +1,234 @@
+#include <mimc/http_client.h>
+#include <mimc/constant.h>
+#include <XMDLoggerWrapper.h>
+#include <curl/curl.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+struct HttpClient::Transfer {
+	CURL* curl;
+	struct curl_slist* headers;
+	HttpRequest request;
+	HttpCallback* callback;
+	std::string body;
+};
+
+pthread_mutex_t HttpClient::instanceMutex = PTHREAD_MUTEX_INITIALIZER;
+HttpClient* HttpClient::client = NULL;
+
+HttpClient* HttpClient::instance() {
+	pthread_mutex_lock(&instanceMutex);
+	if (client == NULL) {
+		client = new HttpClient();
+	}
+	pthread_mutex_unlock(&instanceMutex);
+	return client;
+}
+
+HttpClient::HttpClient() {
+	pthread_mutex_init(&mutex, NULL);
+	curl_global_init(CURL_GLOBAL_ALL);
+	this->multi = curl_multi_init();
+	curl_multi_setopt((CURLM*)this->multi, CURLMOPT_MAXCONNECTS, (long)HTTP_CLIENT_MAX_CONNECTS);
+	// only the client thread touches the handles, so the share needs no lock callbacks
+	this->share = curl_share_init();
+	curl_share_setopt((CURLSH*)this->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt((CURLSH*)this->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#ifndef _WIN32
+	if (pipe(wakeupFds) == 0) {
+		fcntl(wakeupFds[0], F_SETFL, fcntl(wakeupFds[0], F_GETFL) | O_NONBLOCK);
+		fcntl(wakeupFds[1], F_SETFL, fcntl(wakeupFds[1], F_GETFL) | O_NONBLOCK);
+	} else {
+		wakeupFds[0] = wakeupFds[1] = -1;
+	}
+#endif
+
+	pthread_t thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_create(&thread, &attr, run, (void *)this);
+	pthread_attr_destroy(&attr);
+}
+
+void HttpClient::request(const HttpRequest& request, HttpCallback* callback) {
+	PendingRequest pending;
+	pending.request = request;
+	pending.callback = callback;
+	pthread_mutex_lock(&mutex);
+	pendingRequests.push_back(pending);
+	pthread_mutex_unlock(&mutex);
+	wakeup();
+}
+
+namespace {
+class BlockingCallback : public HttpCallback {
+public:
+	BlockingCallback(std::string& body) : body(body), curlCode(CURLE_OK), status(0), done(false) {
+		pthread_mutex_init(&mutex, NULL);
+		pthread_cond_init(&cond, NULL);
+	}
+	~BlockingCallback() {
+		pthread_cond_destroy(&cond);
+		pthread_mutex_destroy(&mutex);
+	}
+	void handleResponse(int curlCode, long status, const std::string& body) {
+		pthread_mutex_lock(&mutex);
+		this->body = body;
+		this->curlCode = curlCode;
+		this->status = status;
+		this->done = true;
+		pthread_cond_signal(&cond);
+		pthread_mutex_unlock(&mutex);
+	}
+	void wait() {
+		pthread_mutex_lock(&mutex);
+		while (!done) {
+			pthread_cond_wait(&cond, &mutex);
+		}
+		pthread_mutex_unlock(&mutex);
+	}
+
+	std::string& body;
+	int curlCode;
+	long status;
+
+private:
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool done;
+};
+}
+
+bool HttpClient::perform(const HttpRequest& request, std::string& body, long* status) {
+	BlockingCallback callback(body);
+	this->request(request, &callback);
+	callback.wait();
+	if (status != NULL) {
+		*status = callback.status;
+	}
+	if (callback.curlCode != CURLE_OK) {
+		XMDLoggerWrapper::instance()->error("In HttpClient::perform, curl perform error, error code is %d, url is %s", callback.curlCode, request.url.c_str());
+		return false;
+	}
+	return true;
+}
+
+void HttpClient::wakeup() {
+#ifndef _WIN32
+	if (wakeupFds[1] >= 0) {
+		char c = 0;
+		(void)!write(wakeupFds[1], &c, 1);
+	}
+#endif
+}
+
+void* HttpClient::run(void* arg) {
+	HttpClient* httpClient = (HttpClient*)arg;
+	CURLM* multi = (CURLM*)httpClient->multi;
+	while (true) {
+		httpClient->startTransfers();
+		int running = 0;
+		curl_multi_perform(multi, &running);
+		httpClient->finishTransfers();
+#ifndef _WIN32
+		struct curl_waitfd extraFd;
+		extraFd.fd = httpClient->wakeupFds[0];
+		extraFd.events = CURL_WAIT_POLLIN;
+		extraFd.revents = 0;
+		curl_multi_wait(multi, &extraFd, extraFd.fd >= 0 ? 1 : 0, HTTP_CLIENT_IDLE_WAIT_MS, NULL);
+		if (extraFd.revents != 0) {
+			char buffer[64];
+			while (read(extraFd.fd, buffer, sizeof(buffer)) > 0) {}
+		}
+#else
+		// no wakeup fd, new requests are picked up after a short wait
+		curl_multi_wait(multi, NULL, 0, HTTP_CLIENT_POLL_INTERVAL_MS, NULL);
+#endif
+	}
+	return NULL;
+}
+
+void HttpClient::startTransfers() {
+	std::deque<PendingRequest> requests;
+	pthread_mutex_lock(&mutex);
+	requests.swap(pendingRequests);
+	pthread_mutex_unlock(&mutex);
+
+	for (std::deque<PendingRequest>::iterator iter = requests.begin(); iter != requests.end(); iter++) {
+		CURL* curl = NULL;
+		if (!idleHandles.empty()) {
+			curl = (CURL*)idleHandles.back();
+			idleHandles.pop_back();
+			curl_easy_reset(curl);
+		} else {
+			curl = curl_easy_init();
+		}
+		if (curl == NULL) {
+			iter->callback->handleResponse(CURLE_FAILED_INIT, 0, "");
+			continue;
+		}
+		Transfer* transfer = new Transfer();
+		transfer->curl = curl;
+		transfer->headers = NULL;
+		transfer->request = iter->request;
+		transfer->callback = iter->callback;
+		const HttpRequest& request = transfer->request;
+		for (std::vector<std::string>::const_iterator header = request.headers.begin(); header != request.headers.end(); header++) {
+			transfer->headers = curl_slist_append(transfer->headers, header->c_str());
+		}
+
+		curl_easy_setopt(curl, CURLOPT_URL, request.url.c_str());
+		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+		curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+		curl_easy_setopt(curl, CURLOPT_SHARE, (CURLSH*)share);
+		curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+		curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, request.timeoutMs > 0 ? request.timeoutMs : (long)HTTP_REQUEST_TIMEOUT_MS);
+		if (!request.body.empty()) {
+			curl_easy_setopt(curl, CURLOPT_POST, 1L);
+			curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request.body.c_str());
+			curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)request.body.size());
+		} else {
+			curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+		}
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, transfer->headers);
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeBody);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)(&transfer->body));
+		curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *)transfer);
+		curl_multi_add_handle((CURLM*)multi, curl);
+	}
+}
+
+void HttpClient::finishTransfers() {
+	CURLMsg* msg = NULL;
+	int queued = 0;
+	while ((msg = curl_multi_info_read((CURLM*)multi, &queued)) != NULL) {
+		if (msg->msg != CURLMSG_DONE) {
+			continue;
+		}
+		CURL* curl = msg->easy_handle;
+		CURLcode result = msg->data.result;
+		Transfer* transfer = NULL;
+		curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char**)&transfer);
+		long status = 0;
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+		curl_multi_remove_handle((CURLM*)multi, curl);
+		curl_slist_free_all(transfer->headers);
+		// the connection stays in the multi handle's cache, the easy handle is kept for the next request
+		if (idleHandles.size() < (size_t)HTTP_CLIENT_MAX_CONNECTS) {
+			idleHandles.push_back(curl);
+		} else {
+			curl_easy_cleanup(curl);
+		}
+		transfer->callback->handleResponse(result, status, transfer->body);
+		delete transfer;
+	}
+}
+
+size_t HttpClient::writeBody(char* ptr, size_t size, size_t nmemb, void* userdata) {
+	std::string* body = (std::string *)userdata;
+	body->append(ptr, size*nmemb);
+	return size*nmemb;
+}
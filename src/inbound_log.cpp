@@ -0,0 +1,299 @@
+#include <mimc/inbound_log.h>
+#include <XMDLoggerWrapper.h>
+#include <algorithm>
+#include <sstream>
+#include <stdio.h>
+
+static const char INBOUND_RECORD_P2P = 'P';
+static const char INBOUND_RECORD_P2T = 'T';
+
+static void putView(std::string& out, StringView value) {
+	MappedLog::putString(out, value.data(), value.size());
+}
+
+InboundLog::InboundLog()
+	: compacting(false)
+{
+	pthread_mutex_init(&mutex, NULL);
+}
+
+InboundLog::~InboundLog() {
+	pthread_mutex_destroy(&mutex);
+}
+
+bool InboundLog::open(const std::string& path, const std::string& selfAccount) {
+	pthread_mutex_lock(&mutex);
+	this->selfAccount = selfAccount;
+	if (!this->log.open(path)) {
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+	std::string record;
+	for (int64_t offset = this->log.begin(), next = 0; (next = this->log.next(offset, record)) >= 0; offset = next) {
+		MIMCMessage message;
+		MIMCGroupMessage groupMessage;
+		bool isGroup = false;
+		if (!decode(record, &message, &groupMessage, isGroup)) {
+			continue;
+		}
+		if (isGroup) {
+			index(groupMessage.getSequence(), topicKey(groupMessage.getTopicId()), offset);
+		} else {
+			index(message.getSequence(), peerKey(message), offset);
+		}
+	}
+	XMDLoggerWrapper::instance()->info("In InboundLog::open, %d messages restored from %s", (int)this->offsets.size(), path.c_str());
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+bool InboundLog::contains(int64_t sequence) {
+	pthread_mutex_lock(&mutex);
+	bool result = this->offsets.count(sequence) > 0;
+	pthread_mutex_unlock(&mutex);
+	return result;
+}
+
+bool InboundLog::add(const MIMCMessageView& message) {
+	return append(message.getSequence(), peerKey(message), encode(message));
+}
+
+bool InboundLog::add(const MIMCGroupMessageView& message) {
+	return append(message.getSequence(), topicKey(message.getTopicId()), encode(message));
+}
+
+size_t InboundLog::getRecentMessages(const std::string& peer, size_t limit, std::vector<MIMCMessage>& messages) {
+	pthread_mutex_lock(&mutex);
+	std::map<std::string, std::deque<int64_t> >::const_iterator iter = this->conversations.find("p" + peer);
+	if (iter != this->conversations.end()) {
+		const std::deque<int64_t>& sequences = iter->second;
+		std::string record;
+		for (size_t i = sequences.size() > limit ? sequences.size() - limit : 0; i < sequences.size(); i++) {
+			MIMCMessage message;
+			bool isGroup = false;
+			if (this->log.read(this->offsets[sequences[i]], record) && decode(record, &message, NULL, isGroup) && !isGroup) {
+				messages.push_back(message);
+			}
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+	return messages.size();
+}
+
+size_t InboundLog::getRecentGroupMessages(int64_t topicId, size_t limit, std::vector<MIMCGroupMessage>& messages) {
+	pthread_mutex_lock(&mutex);
+	std::map<std::string, std::deque<int64_t> >::const_iterator iter = this->conversations.find(topicKey(topicId));
+	if (iter != this->conversations.end()) {
+		const std::deque<int64_t>& sequences = iter->second;
+		std::string record;
+		for (size_t i = sequences.size() > limit ? sequences.size() - limit : 0; i < sequences.size(); i++) {
+			MIMCGroupMessage message;
+			bool isGroup = false;
+			if (this->log.read(this->offsets[sequences[i]], record) && decode(record, NULL, &message, isGroup) && isGroup) {
+				messages.push_back(message);
+			}
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+	return messages.size();
+}
+
+void InboundLog::getMessagesAfter(int64_t sequence, std::vector<MIMCMessage>& messages, std::vector<MIMCGroupMessage>& groupMessages) {
+	pthread_mutex_lock(&mutex);
+	std::string record;
+	for (int64_t offset = this->log.begin(), next = 0; (next = this->log.next(offset, record)) >= 0; offset = next) {
+		MIMCMessage message;
+		MIMCGroupMessage groupMessage;
+		bool isGroup = false;
+		if (!decode(record, &message, &groupMessage, isGroup)) {
+			continue;
+		}
+		if (isGroup && groupMessage.getSequence() > sequence) {
+			groupMessages.push_back(groupMessage);
+		} else if (!isGroup && message.getSequence() > sequence) {
+			messages.push_back(message);
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+size_t InboundLog::getMessageCount() {
+	pthread_mutex_lock(&mutex);
+	size_t count = this->offsets.size();
+	pthread_mutex_unlock(&mutex);
+	return count;
+}
+
+void InboundLog::run() {
+	// the newer half is copied under the lock, the new file is written without it
+	pthread_mutex_lock(&mutex);
+	std::string path = this->log.getPath();
+	int64_t snapshotEnd = this->log.end();
+	size_t skip = this->offsets.size() > INBOUND_LOG_MAX_MESSAGES / 2 ? this->offsets.size() - INBOUND_LOG_MAX_MESSAGES / 2 : 0;
+	std::vector<std::pair<int64_t, std::string> > records;
+	std::string record;
+	for (int64_t offset = this->log.begin(), next = 0; (next = this->log.next(offset, record)) >= 0; offset = next) {
+		if (skip > 0) {
+			skip--;
+			continue;
+		}
+		records.push_back(std::make_pair(offset, record));
+	}
+	pthread_mutex_unlock(&mutex);
+
+	std::string compactPath = path + ".compact";
+	::remove(compactPath.c_str());
+	MappedLog compacted;
+	std::unordered_map<int64_t, int64_t> moved;
+	bool compactedOk = compacted.open(compactPath);
+	for (size_t i = 0; compactedOk && i < records.size(); i++) {
+		int64_t offset = compacted.append(records[i].second);
+		compactedOk = offset >= 0;
+		moved[records[i].first] = offset;
+	}
+
+	pthread_mutex_lock(&mutex);
+	// messages received meanwhile are carried over as they are
+	for (int64_t offset = snapshotEnd, next = 0; compactedOk && (next = this->log.next(offset, record)) >= 0; offset = next) {
+		int64_t newOffset = compacted.append(record);
+		compactedOk = newOffset >= 0;
+		moved[offset] = newOffset;
+	}
+	if (compactedOk && compacted.renameTo(path)) {
+		size_t before = this->offsets.size();
+		this->log.swap(compacted);
+		std::unordered_map<int64_t, int64_t> kept;
+		for (std::unordered_map<int64_t, int64_t>::const_iterator iter = this->offsets.begin(); iter != this->offsets.end(); iter++) {
+			std::unordered_map<int64_t, int64_t>::const_iterator entry = moved.find(iter->second);
+			if (entry != moved.end()) {
+				kept[iter->first] = entry->second;
+			}
+		}
+		this->offsets.swap(kept);
+		for (std::map<std::string, std::deque<int64_t> >::iterator iter = this->conversations.begin(); iter != this->conversations.end(); ) {
+			std::deque<int64_t>& sequences = iter->second;
+			while (!sequences.empty() && this->offsets.count(sequences.front()) == 0) {
+				sequences.pop_front();
+			}
+			if (sequences.empty()) {
+				this->conversations.erase(iter++);
+			} else {
+				iter++;
+			}
+		}
+		XMDLoggerWrapper::instance()->info("In InboundLog::run, compacted %s from %d to %d messages", path.c_str(), (int)before, (int)this->offsets.size());
+	} else {
+		XMDLoggerWrapper::instance()->warn("In InboundLog::run, compact %s failed", path.c_str());
+		::remove(compactPath.c_str());
+	}
+	this->compacting = false;
+	pthread_mutex_unlock(&mutex);
+}
+
+std::string InboundLog::encode(const MIMCMessageView& message) {
+	std::string record;
+	record.reserve(message.getPacketId().size() + message.getFromAccount().size() + message.getFromResource().size() + message.getToAccount().size()
+		+ message.getToResource().size() + message.getBizType().size() + message.getPayload().size() + 41);
+	record.push_back(INBOUND_RECORD_P2P);
+	MappedLog::putInt(record, (uint64_t)message.getSequence(), 8);
+	MappedLog::putInt(record, (uint64_t)message.getTimeStamp(), 8);
+	putView(record, message.getPacketId());
+	putView(record, message.getFromAccount());
+	putView(record, message.getFromResource());
+	putView(record, message.getToAccount());
+	putView(record, message.getToResource());
+	putView(record, message.getBizType());
+	putView(record, message.getPayload());
+	return record;
+}
+
+std::string InboundLog::encode(const MIMCGroupMessageView& message) {
+	std::string record;
+	record.reserve(message.getPacketId().size() + message.getFromAccount().size() + message.getFromResource().size()
+		+ message.getBizType().size() + message.getPayload().size() + 45);
+	record.push_back(INBOUND_RECORD_P2T);
+	MappedLog::putInt(record, (uint64_t)message.getSequence(), 8);
+	MappedLog::putInt(record, (uint64_t)message.getTimeStamp(), 8);
+	putView(record, message.getPacketId());
+	putView(record, message.getFromAccount());
+	putView(record, message.getFromResource());
+	MappedLog::putInt(record, message.getTopicId(), 8);
+	putView(record, message.getBizType());
+	putView(record, message.getPayload());
+	return record;
+}
+
+bool InboundLog::decode(const std::string& record, MIMCMessage* message, MIMCGroupMessage* groupMessage, bool& isGroup) {
+	if (record.empty() || (record[0] != INBOUND_RECORD_P2P && record[0] != INBOUND_RECORD_P2T)) {
+		return false;
+	}
+	isGroup = record[0] == INBOUND_RECORD_P2T;
+	size_t pos = 1;
+	uint64_t sequence = 0;
+	uint64_t timestamp = 0;
+	std::string packetId;
+	std::string fromAccount;
+	std::string fromResource;
+	if (!MappedLog::getInt(record, pos, sequence, 8) || !MappedLog::getInt(record, pos, timestamp, 8) || !MappedLog::getString(record, pos, packetId)
+		|| !MappedLog::getString(record, pos, fromAccount) || !MappedLog::getString(record, pos, fromResource)) {
+		return false;
+	}
+	std::string toAccount;
+	std::string toResource;
+	uint64_t topicId = 0;
+	if (isGroup ? !MappedLog::getInt(record, pos, topicId, 8) : (!MappedLog::getString(record, pos, toAccount) || !MappedLog::getString(record, pos, toResource))) {
+		return false;
+	}
+	std::string bizType;
+	std::string payload;
+	if (!MappedLog::getString(record, pos, bizType) || !MappedLog::getString(record, pos, payload)) {
+		return false;
+	}
+	if (isGroup && groupMessage != NULL) {
+		*groupMessage = MIMCGroupMessage(packetId, (int64_t)sequence, fromAccount, fromResource, topicId, payload, bizType, (time_t)timestamp);
+	} else if (!isGroup && message != NULL) {
+		*message = MIMCMessage(packetId, (int64_t)sequence, fromAccount, fromResource, toAccount, toResource, payload, bizType, (time_t)timestamp);
+	}
+	return true;
+}
+
+std::string InboundLog::topicKey(int64_t topicId) {
+	std::ostringstream oss;
+	oss << "t" << topicId;
+	return oss.str();
+}
+
+std::string InboundLog::peerKey(const MIMCMessageView& message) const {
+	// messages sent from another device of this account belong to the conversation with their receiver
+	return "p" + (message.getFromAccount() == StringView(this->selfAccount) ? message.getToAccount() : message.getFromAccount()).toString();
+}
+
+bool InboundLog::append(int64_t sequence, const std::string& key, const std::string& record) {
+	pthread_mutex_lock(&mutex);
+	if (this->offsets.count(sequence) > 0) {
+		pthread_mutex_unlock(&mutex);
+		return true;
+	}
+	int64_t offset = this->log.append(record);
+	if (offset >= 0) {
+		index(sequence, key, offset);
+	}
+	bool compact = !this->compacting && this->offsets.size() >= INBOUND_LOG_MAX_MESSAGES;
+	if (compact) {
+		this->compacting = true;
+	}
+	pthread_mutex_unlock(&mutex);
+	if (compact) {
+		MimcRuntime::instance()->runBlockingTask(this);
+	}
+	return offset >= 0;
+}
+
+void InboundLog::index(int64_t sequence, const std::string& key, int64_t offset) {
+	this->offsets[sequence] = offset;
+	std::deque<int64_t>& sequences = this->conversations[key];
+	sequences.push_back(sequence);
+	if (sequences.size() > INBOUND_LOG_CONVERSATION_HISTORY) {
+		sequences.pop_front();
+	}
+}
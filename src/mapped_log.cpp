@@ -0,0 +1,226 @@
+#include <mimc/mapped_log.h>
+#include <mimc/constant.h>
+#include <XMDLoggerWrapper.h>
+#include <zlib/zlib.h>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char MAPPED_LOG_MAGIC[8] = {'M', 'I', 'M', 'C', 'L', 'O', 'G', '1'};
+static const size_t MAPPED_LOG_HEADER_SIZE = sizeof(MAPPED_LOG_MAGIC);
+// uint32 length followed by the uint32 crc32 of the record
+static const size_t MAPPED_LOG_RECORD_HEADER_SIZE = 8;
+
+MappedLog::MappedLog()
+	: fd(-1), data(NULL), capacity(0), writeOffset(0)
+{
+}
+
+MappedLog::~MappedLog() {
+	close();
+}
+
+bool MappedLog::open(const std::string& path) {
+	close();
+#ifdef _WIN32
+	XMDLoggerWrapper::instance()->warn("In MappedLog::open, not supported on this platform, path is %s", path.c_str());
+	return false;
+#else
+	int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		XMDLoggerWrapper::instance()->warn("In MappedLog::open, open %s failed", path.c_str());
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+	size_t size = (size_t)st.st_size;
+	bool created = size < MAPPED_LOG_HEADER_SIZE;
+	if (created || size < MAPPED_LOG_INITIAL_SIZE) {
+		size = size < MAPPED_LOG_INITIAL_SIZE ? MAPPED_LOG_INITIAL_SIZE : size;
+		if (ftruncate(fd, size) != 0) {
+			XMDLoggerWrapper::instance()->warn("In MappedLog::open, resize %s failed", path.c_str());
+			::close(fd);
+			return false;
+		}
+	}
+	void* mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mapped == MAP_FAILED) {
+		XMDLoggerWrapper::instance()->warn("In MappedLog::open, mmap %s failed", path.c_str());
+		::close(fd);
+		return false;
+	}
+	this->path = path;
+	this->fd = fd;
+	this->data = (char*)mapped;
+	this->capacity = size;
+
+	if (created || memcmp(this->data, MAPPED_LOG_MAGIC, MAPPED_LOG_HEADER_SIZE) != 0) {
+		if (!created) {
+			XMDLoggerWrapper::instance()->warn("In MappedLog::open, %s is not a log, starting over", path.c_str());
+		}
+		memset(this->data, 0, this->capacity);
+		memcpy(this->data, MAPPED_LOG_MAGIC, MAPPED_LOG_HEADER_SIZE);
+		this->writeOffset = MAPPED_LOG_HEADER_SIZE;
+		return true;
+	}
+
+	size_t offset = MAPPED_LOG_HEADER_SIZE;
+	while (offset + MAPPED_LOG_RECORD_HEADER_SIZE <= this->capacity) {
+		uint32_t length = 0;
+		uint32_t crc = 0;
+		memcpy(&length, this->data + offset, sizeof(length));
+		memcpy(&crc, this->data + offset + sizeof(length), sizeof(crc));
+		if (length == 0 || length > this->capacity - offset - MAPPED_LOG_RECORD_HEADER_SIZE
+			|| crc != (uint32_t)crc32(0, (const Bytef*)(this->data + offset + MAPPED_LOG_RECORD_HEADER_SIZE), length)) {
+			break;
+		}
+		offset += MAPPED_LOG_RECORD_HEADER_SIZE + length;
+	}
+	// a torn record must not resurface behind the next append
+	memset(this->data + offset, 0, this->capacity - offset);
+	this->writeOffset = offset;
+	return true;
+#endif
+}
+
+void MappedLog::close() {
+#ifndef _WIN32
+	if (this->data != NULL) {
+		munmap(this->data, this->capacity);
+	}
+	if (this->fd >= 0) {
+		::close(this->fd);
+	}
+#endif
+	this->fd = -1;
+	this->data = NULL;
+	this->capacity = 0;
+	this->writeOffset = 0;
+}
+
+int64_t MappedLog::append(const std::string& record) {
+	if (this->data == NULL || record.empty()) {
+		return -1;
+	}
+	size_t needed = this->writeOffset + MAPPED_LOG_RECORD_HEADER_SIZE + record.size();
+	if (needed > this->capacity && !grow(needed)) {
+		return -1;
+	}
+	size_t offset = this->writeOffset;
+	uint32_t length = (uint32_t)record.size();
+	uint32_t crc = (uint32_t)crc32(0, (const Bytef*)record.data(), length);
+	// the length goes in last, a crash part way leaves a zero length that ends the log
+	memcpy(this->data + offset + MAPPED_LOG_RECORD_HEADER_SIZE, record.data(), length);
+	memcpy(this->data + offset + sizeof(length), &crc, sizeof(crc));
+	memcpy(this->data + offset, &length, sizeof(length));
+	this->writeOffset = needed;
+	return (int64_t)offset;
+}
+
+bool MappedLog::read(int64_t offset, std::string& record) const {
+	return next(offset, record) >= 0;
+}
+
+int64_t MappedLog::next(int64_t offset, std::string& record) const {
+	if (this->data == NULL || offset < (int64_t)MAPPED_LOG_HEADER_SIZE || offset + (int64_t)MAPPED_LOG_RECORD_HEADER_SIZE > (int64_t)this->writeOffset) {
+		return -1;
+	}
+	uint32_t length = 0;
+	memcpy(&length, this->data + offset, sizeof(length));
+	int64_t end = offset + MAPPED_LOG_RECORD_HEADER_SIZE + length;
+	if (end > (int64_t)this->writeOffset) {
+		return -1;
+	}
+	record.assign(this->data + offset + MAPPED_LOG_RECORD_HEADER_SIZE, length);
+	return end;
+}
+
+int64_t MappedLog::begin() const {
+	return (int64_t)MAPPED_LOG_HEADER_SIZE;
+}
+
+bool MappedLog::renameTo(const std::string& path) {
+	if (this->data == NULL || rename(this->path.c_str(), path.c_str()) != 0) {
+		return false;
+	}
+	this->path = path;
+	return true;
+}
+
+void MappedLog::swap(MappedLog& other) {
+	std::swap(this->path, other.path);
+	std::swap(this->fd, other.fd);
+	std::swap(this->data, other.data);
+	std::swap(this->capacity, other.capacity);
+	std::swap(this->writeOffset, other.writeOffset);
+}
+
+void MappedLog::putInt(std::string& out, uint64_t value, size_t bytes) {
+	for (size_t i = 0; i < bytes; i++) {
+		out.push_back((char)((value >> (8 * i)) & 0xff));
+	}
+}
+
+void MappedLog::putString(std::string& out, const std::string& value) {
+	putString(out, value.data(), value.size());
+}
+
+void MappedLog::putString(std::string& out, const char* data, size_t size) {
+	putInt(out, size, 4);
+	out.append(data, size);
+}
+
+bool MappedLog::getInt(const std::string& in, size_t& pos, uint64_t& value, size_t bytes) {
+	if (in.size() - pos < bytes) {
+		return false;
+	}
+	value = 0;
+	for (size_t i = 0; i < bytes; i++) {
+		value |= (uint64_t)(unsigned char)in[pos + i] << (8 * i);
+	}
+	pos += bytes;
+	return true;
+}
+
+bool MappedLog::getString(const std::string& in, size_t& pos, std::string& value) {
+	uint64_t length = 0;
+	if (!getInt(in, pos, length, 4) || in.size() - pos < length) {
+		return false;
+	}
+	value.assign(in, pos, length);
+	pos += length;
+	return true;
+}
+
+bool MappedLog::grow(size_t minCapacity) {
+#ifdef _WIN32
+	return false;
+#else
+	size_t newCapacity = this->capacity * 2;
+	while (newCapacity < minCapacity) {
+		newCapacity *= 2;
+	}
+	if (ftruncate(this->fd, newCapacity) != 0) {
+		XMDLoggerWrapper::instance()->warn("In MappedLog::grow, resize %s to %llu failed", this->path.c_str(), (unsigned long long)newCapacity);
+		return false;
+	}
+	void* mapped = mmap(NULL, newCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+	if (mapped == MAP_FAILED) {
+		XMDLoggerWrapper::instance()->warn("In MappedLog::grow, mmap %s failed", this->path.c_str());
+		return false;
+	}
+	munmap(this->data, this->capacity);
+	this->data = (char*)mapped;
+	this->capacity = newCapacity;
+	return true;
+#endif
+}
@@ -0,0 +1,263 @@
+#include <mimc/message_outbox.h>
+#include <mimc/constant.h>
+#include <XMDLoggerWrapper.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char OUTBOX_RECORD_MESSAGE = 'M';
+static const char OUTBOX_RECORD_ACK = 'A';
+
+MessageOutbox::MessageOutbox()
+	: liveBytes(0), compacting(false)
+{
+	pthread_mutex_init(&mutex, NULL);
+}
+
+MessageOutbox::~MessageOutbox() {
+	pthread_mutex_destroy(&mutex);
+}
+
+bool MessageOutbox::open(const std::string& path) {
+	pthread_mutex_lock(&mutex);
+	if (!this->log.open(path)) {
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+	std::string record;
+	for (int64_t offset = this->log.begin(), next = 0; (next = this->log.next(offset, record)) >= 0; offset = next) {
+		bool isAck = false;
+		std::string packetId;
+		if (!decode(record, isAck, packetId, NULL)) {
+			continue;
+		}
+		if (isAck) {
+			remove(packetId);
+		} else {
+			this->pending[offset] = packetId;
+			this->offsets[packetId] = offset;
+			this->liveBytes += record.size();
+		}
+	}
+	for (std::map<int64_t, std::string>::const_iterator iter = this->pending.begin(); iter != this->pending.end(); iter++) {
+		this->unsent.insert(iter->first);
+	}
+	XMDLoggerWrapper::instance()->info("In MessageOutbox::open, %d pending messages restored from %s", (int)this->pending.size(), path.c_str());
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+bool MessageOutbox::add(const std::string& packetId, const OutgoingMessage& message) {
+	std::string record = encodeMessage(packetId, message);
+	pthread_mutex_lock(&mutex);
+	if (this->pending.size() >= OUTBOX_MAX_PENDING_MESSAGES) {
+		pthread_mutex_unlock(&mutex);
+		XMDLoggerWrapper::instance()->warn("In MessageOutbox::add, %u messages pending, outbox is full", OUTBOX_MAX_PENDING_MESSAGES);
+		return false;
+	}
+	int64_t offset = this->log.append(record);
+	if (offset >= 0) {
+		this->pending[offset] = packetId;
+		this->offsets[packetId] = offset;
+		this->unsent.insert(offset);
+		this->liveBytes += record.size();
+	}
+	pthread_mutex_unlock(&mutex);
+	return offset >= 0;
+}
+
+size_t MessageOutbox::takeUnsent(std::vector<std::pair<std::string, OutgoingMessage> >& messages, size_t maxMessages) {
+	pthread_mutex_lock(&mutex);
+	std::string record;
+	while (!this->unsent.empty() && messages.size() < maxMessages) {
+		int64_t offset = *this->unsent.begin();
+		this->unsent.erase(this->unsent.begin());
+		OutgoingMessage message("", "");
+		bool isAck = false;
+		std::string packetId;
+		if (this->log.read(offset, record) && decode(record, isAck, packetId, &message) && !isAck) {
+			messages.push_back(std::make_pair(packetId, message));
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+	return messages.size();
+}
+
+void MessageOutbox::markUnsent(const std::string& packetId) {
+	pthread_mutex_lock(&mutex);
+	std::map<std::string, int64_t>::const_iterator iter = this->offsets.find(packetId);
+	if (iter != this->offsets.end()) {
+		this->unsent.insert(iter->second);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void MessageOutbox::markAllUnsent() {
+	pthread_mutex_lock(&mutex);
+	for (std::map<int64_t, std::string>::const_iterator iter = this->pending.begin(); iter != this->pending.end(); iter++) {
+		this->unsent.insert(iter->first);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+bool MessageOutbox::hasUnsent() {
+	pthread_mutex_lock(&mutex);
+	bool result = !this->unsent.empty();
+	pthread_mutex_unlock(&mutex);
+	return result;
+}
+
+void MessageOutbox::ack(const std::string& packetId) {
+	appendRemoval(packetId);
+}
+
+void MessageOutbox::expire(const std::string& packetId) {
+	appendRemoval(packetId);
+}
+
+void MessageOutbox::appendRemoval(const std::string& packetId) {
+	pthread_mutex_lock(&mutex);
+	if (this->offsets.count(packetId) == 0) {
+		pthread_mutex_unlock(&mutex);
+		return;
+	}
+	this->log.append(encodeAck(packetId));
+	remove(packetId);
+	int64_t deadBytes = this->log.end() - this->log.begin() - this->liveBytes;
+	bool compact = !this->compacting && deadBytes > (int64_t)OUTBOX_COMPACT_MIN_BYTES && deadBytes > this->liveBytes;
+	if (compact) {
+		this->compacting = true;
+	}
+	pthread_mutex_unlock(&mutex);
+	if (compact) {
+		MimcRuntime::instance()->runBlockingTask(this);
+	}
+}
+
+size_t MessageOutbox::getPendingCount() {
+	pthread_mutex_lock(&mutex);
+	size_t count = this->pending.size();
+	pthread_mutex_unlock(&mutex);
+	return count;
+}
+
+void MessageOutbox::run() {
+	// the pending records are copied under the lock, the new file is written without it
+	pthread_mutex_lock(&mutex);
+	std::string path = this->log.getPath();
+	int64_t snapshotEnd = this->log.end();
+	std::vector<std::pair<int64_t, std::string> > records;
+	for (std::map<int64_t, std::string>::const_iterator iter = this->pending.begin(); iter != this->pending.end(); iter++) {
+		std::string record;
+		if (this->log.read(iter->first, record)) {
+			records.push_back(std::make_pair(iter->first, record));
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+
+	std::string compactPath = path + ".compact";
+	::remove(compactPath.c_str());
+	MappedLog compacted;
+	std::map<int64_t, int64_t> moved;
+	bool compactedOk = compacted.open(compactPath);
+	for (size_t i = 0; compactedOk && i < records.size(); i++) {
+		int64_t offset = compacted.append(records[i].second);
+		compactedOk = offset >= 0;
+		moved[records[i].first] = offset;
+	}
+
+	pthread_mutex_lock(&mutex);
+	// whatever was appended meanwhile, messages and acks alike, is carried over as it is
+	std::string record;
+	for (int64_t offset = snapshotEnd, next = 0; compactedOk && (next = this->log.next(offset, record)) >= 0; offset = next) {
+		int64_t newOffset = compacted.append(record);
+		compactedOk = newOffset >= 0;
+		moved[offset] = newOffset;
+	}
+	if (compactedOk && compacted.renameTo(path)) {
+		int64_t before = this->log.end();
+		this->log.swap(compacted);
+		std::map<int64_t, std::string> movedPending;
+		std::set<int64_t> movedUnsent;
+		for (std::map<int64_t, std::string>::const_iterator iter = this->pending.begin(); iter != this->pending.end(); iter++) {
+			int64_t offset = moved[iter->first];
+			movedPending[offset] = iter->second;
+			this->offsets[iter->second] = offset;
+			if (this->unsent.count(iter->first) > 0) {
+				movedUnsent.insert(offset);
+			}
+		}
+		this->pending.swap(movedPending);
+		this->unsent.swap(movedUnsent);
+		XMDLoggerWrapper::instance()->info("In MessageOutbox::run, compacted %s from %lld to %lld bytes", path.c_str(), (long long)before, (long long)this->log.end());
+	} else {
+		XMDLoggerWrapper::instance()->warn("In MessageOutbox::run, compact %s failed", path.c_str());
+		::remove(compactPath.c_str());
+	}
+	this->compacting = false;
+	pthread_mutex_unlock(&mutex);
+}
+
+std::string MessageOutbox::encodeMessage(const std::string& packetId, const OutgoingMessage& message) {
+	std::string record;
+	record.reserve(packetId.size() + message.getToAppAccount().size() + message.getPayload().size() + message.getBizType().size() + 40);
+	record.push_back(OUTBOX_RECORD_MESSAGE);
+	MappedLog::putString(record, packetId);
+	MappedLog::putInt(record, (uint64_t)message.getTopicId(), 8);
+	MappedLog::putInt(record, (uint64_t)message.getTimeoutMs(), 8);
+	MappedLog::putInt(record, message.getIsStore() ? 1 : 0, 1);
+	MappedLog::putString(record, message.getToAppAccount());
+	MappedLog::putString(record, message.getBizType());
+	MappedLog::putString(record, message.getPayload());
+	return record;
+}
+
+std::string MessageOutbox::encodeAck(const std::string& packetId) {
+	std::string record;
+	record.push_back(OUTBOX_RECORD_ACK);
+	MappedLog::putString(record, packetId);
+	return record;
+}
+
+bool MessageOutbox::decode(const std::string& record, bool& isAck, std::string& packetId, OutgoingMessage* message) {
+	size_t pos = 1;
+	if (record.empty() || (record[0] != OUTBOX_RECORD_MESSAGE && record[0] != OUTBOX_RECORD_ACK) || !MappedLog::getString(record, pos, packetId)) {
+		return false;
+	}
+	isAck = record[0] == OUTBOX_RECORD_ACK;
+	if (isAck || message == NULL) {
+		return true;
+	}
+	uint64_t topicId = 0;
+	uint64_t timeoutMs = 0;
+	uint64_t isStore = 0;
+	std::string toAppAccount;
+	std::string bizType;
+	std::string payload;
+	if (!MappedLog::getInt(record, pos, topicId, 8) || !MappedLog::getInt(record, pos, timeoutMs, 8) || !MappedLog::getInt(record, pos, isStore, 1)
+		|| !MappedLog::getString(record, pos, toAppAccount) || !MappedLog::getString(record, pos, bizType) || !MappedLog::getString(record, pos, payload)) {
+		return false;
+	}
+	if (topicId != 0) {
+		*message = OutgoingMessage((int64_t)topicId, payload, bizType, isStore != 0, (int64_t)timeoutMs);
+	} else {
+		*message = OutgoingMessage(toAppAccount, payload, bizType, isStore != 0, (int64_t)timeoutMs);
+	}
+	return true;
+}
+
+void MessageOutbox::remove(const std::string& packetId) {
+	std::map<std::string, int64_t>::iterator iter = this->offsets.find(packetId);
+	if (iter == this->offsets.end()) {
+		return;
+	}
+	std::map<int64_t, std::string>::iterator entry = this->pending.find(iter->second);
+	if (entry != this->pending.end()) {
+		std::string record;
+		if (this->log.read(iter->second, record)) {
+			this->liveBytes -= record.size();
+		}
+		this->pending.erase(entry);
+	}
+	this->unsent.erase(iter->second);
+	this->offsets.erase(iter);
+}
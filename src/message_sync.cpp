@@ -0,0 +1,44 @@
+#include <mimc/message_sync.h>
+
+MessageSync::MessageSync()
+	: maxSequence(0), lastSequence(0)
+{
+}
+
+unsigned int MessageSync::start(int64_t now) {
+	// answers to PULLs of the previous connection never come
+	this->inflight.clear();
+	this->inflight.push_back(now);
+	return 1;
+}
+
+unsigned int MessageSync::handlePacketList(int64_t maxSequence, int64_t lastSequence, int64_t now) {
+	while (!this->inflight.empty() && now - this->inflight.front() > SYNC_PULL_TIMEOUT_MS) {
+		this->inflight.pop_front();
+	}
+	// pushes and answers cannot be told apart, each COMPOUND settles the oldest PULL
+	if (!this->inflight.empty()) {
+		this->inflight.pop_front();
+	}
+	if (maxSequence > this->maxSequence) {
+		this->maxSequence = maxSequence;
+	}
+	// an empty or stale answer means the server has nothing newer to give, pulling again would only spin
+	if (lastSequence <= this->lastSequence) {
+		return 0;
+	}
+	this->lastSequence = lastSequence;
+	if (!isSyncing()) {
+		return 0;
+	}
+	return topUp(now);
+}
+
+unsigned int MessageSync::topUp(int64_t now) {
+	unsigned int count = 0;
+	while (this->inflight.size() < SYNC_PULL_PIPELINE_DEPTH) {
+		this->inflight.push_back(now);
+		count++;
+	}
+	return count;
+}
@@ -0,0 +1,138 @@
+#include <mimc/mimc_runtime.h>
+#include <mimc/event_loop.h>
+#include <XMDLoggerWrapper.h>
+#include <algorithm>
+#include <thread>
+
+const unsigned int DEFAULT_BLOCKING_WORKER_COUNT = 2;
+
+pthread_mutex_t MimcRuntime::instanceMutex = PTHREAD_MUTEX_INITIALIZER;
+MimcRuntime* MimcRuntime::runtime = NULL;
+
+MimcRuntime* MimcRuntime::instance() {
+	pthread_mutex_lock(&instanceMutex);
+	if (runtime == NULL) {
+		runtime = new MimcRuntime();
+	}
+	pthread_mutex_unlock(&instanceMutex);
+	return runtime;
+}
+
+MimcRuntime::MimcRuntime()
+	: started(false), workerCount(0), blockingWorkerCount(DEFAULT_BLOCKING_WORKER_COUNT)
+{
+	this->mutex = PTHREAD_MUTEX_INITIALIZER;
+	this->taskCond = PTHREAD_COND_INITIALIZER;
+	this->taskDoneCond = PTHREAD_COND_INITIALIZER;
+}
+
+void MimcRuntime::setWorkerCount(unsigned int workerCount) {
+	pthread_mutex_lock(&mutex);
+	if (!started) {
+		this->workerCount = workerCount;
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void MimcRuntime::setBlockingWorkerCount(unsigned int blockingWorkerCount) {
+	pthread_mutex_lock(&mutex);
+	if (!started && blockingWorkerCount > 0) {
+		this->blockingWorkerCount = blockingWorkerCount;
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+unsigned int MimcRuntime::getWorkerCount() {
+	pthread_mutex_lock(&mutex);
+	unsigned int count = started ? eventLoops.size() : workerCount;
+	pthread_mutex_unlock(&mutex);
+	return count;
+}
+
+void MimcRuntime::startWorkers() {
+	if (started) {
+		return;
+	}
+	unsigned int count = workerCount;
+	if (count == 0) {
+		count = std::thread::hardware_concurrency();
+	}
+	if (count == 0) {
+		count = 1;
+	}
+	for (unsigned int i = 0; i < count; i++) {
+		EventLoop* eventLoop = new EventLoop();
+		eventLoop->start();
+		eventLoops.push_back(eventLoop);
+		eventLoopUsers.push_back(0);
+	}
+	for (unsigned int i = 0; i < blockingWorkerCount; i++) {
+		pthread_t blockingThread;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		pthread_create(&blockingThread, &attr, runBlockingWorker, (void *)this);
+		pthread_attr_destroy(&attr);
+	}
+	started = true;
+	XMDLoggerWrapper::instance()->info("MimcRuntime started, %u event loops, %u blocking workers", count, blockingWorkerCount);
+}
+
+EventLoop* MimcRuntime::acquireEventLoop() {
+	pthread_mutex_lock(&mutex);
+	startWorkers();
+	std::vector<unsigned int>::iterator iter = std::min_element(eventLoopUsers.begin(), eventLoopUsers.end());
+	(*iter)++;
+	EventLoop* eventLoop = eventLoops[iter - eventLoopUsers.begin()];
+	pthread_mutex_unlock(&mutex);
+	return eventLoop;
+}
+
+void MimcRuntime::releaseEventLoop(EventLoop* eventLoop) {
+	pthread_mutex_lock(&mutex);
+	for (size_t i = 0; i < eventLoops.size(); i++) {
+		if (eventLoops[i] == eventLoop && eventLoopUsers[i] > 0) {
+			eventLoopUsers[i]--;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void MimcRuntime::runBlockingTask(MimcRuntimeTask* task) {
+	pthread_mutex_lock(&mutex);
+	startWorkers();
+	blockingTasks.push_back(task);
+	pthread_cond_signal(&taskCond);
+	pthread_mutex_unlock(&mutex);
+}
+
+void MimcRuntime::cancelBlockingTask(MimcRuntimeTask* task) {
+	pthread_mutex_lock(&mutex);
+	blockingTasks.erase(std::remove(blockingTasks.begin(), blockingTasks.end(), task), blockingTasks.end());
+	while (runningTasks.count(task) > 0) {
+		pthread_cond_wait(&taskDoneCond, &mutex);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void* MimcRuntime::runBlockingWorker(void* arg) {
+	MimcRuntime* runtime = (MimcRuntime*)arg;
+	pthread_mutex_lock(&runtime->mutex);
+	while (true) {
+		while (runtime->blockingTasks.empty()) {
+			pthread_cond_wait(&runtime->taskCond, &runtime->mutex);
+		}
+		MimcRuntimeTask* task = runtime->blockingTasks.front();
+		runtime->blockingTasks.pop_front();
+		std::multiset<MimcRuntimeTask*>::iterator running = runtime->runningTasks.insert(task);
+		pthread_mutex_unlock(&runtime->mutex);
+
+		task->run();
+
+		pthread_mutex_lock(&runtime->mutex);
+		runtime->runningTasks.erase(running);
+		pthread_cond_broadcast(&runtime->taskDoneCond);
+	}
+	return NULL;
+}
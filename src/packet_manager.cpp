@@ -1,5 +1,9 @@
 #include <mimc/packet_manager.h>
 #include <mimc/user.h>
+#include <mimc/inbound_log.h>
+#include <mimc/decode_context.h>
+#include <mimc/message_outbox.h>
+#include <mimc/mimc_runtime.h>
 #include <mimc/constant.h>
 #include <mimc/p2p_callsession.h>
 #include <mimc/rts_send_data.h>
@@ -8,6 +12,35 @@
 #include <crypto/rc4_crypto.h>
 #include <zlib/zlib.h>
 #include <algorithm>
+#include <fstream>
+
+namespace {
+
+class SequenceMarkTask : public MimcRuntimeTask {
+public:
+	SequenceMarkTask(PacketManager* packetManager, int64_t sequence) : packetManager(packetManager), sequence(sequence) {}
+	void run() {packetManager->saveSequenceHighWaterMark(sequence);}
+private:
+	PacketManager* packetManager;
+	int64_t sequence;
+};
+
+}
+
+PacketManager::PacketManager(unsigned int sendQueueCapacity)
+	: payloadCompressThreshold(0)
+{
+	sendLanes[SEND_LANE_CONTROL] = new SendLaneQueue(sendQueueCapacity, SEND_LANE_CONTROL_WEIGHT);
+	sendLanes[SEND_LANE_ACK] = new SendLaneQueue(sendQueueCapacity, SEND_LANE_ACK_WEIGHT);
+	sendLanes[SEND_LANE_MESSAGE] = new SendLaneQueue(sendQueueCapacity, SEND_LANE_MESSAGE_WEIGHT);
+}
+
+PacketManager::~PacketManager() {
+	for (int i = 0; i < SEND_LANE_COUNT; i++) {
+		delete sendLanes[i];
+		sendLanes[i] = NULL;
+	}
+}
 
 ims::ClientHeader * PacketManager::createClientHeader(const User * user, std::string cmd, int cipher) {
 	ims::ClientHeader * header = new ims::ClientHeader();
@@ -47,117 +80,79 @@ int PacketManager::encodeBindPacket(unsigned char * &packet, const Connection *
 	payload->set_client_attrs(user->getClientAttrs());
 	payload->set_cloud_attrs(user->getCloudAttrs());
 	payload->set_sig(generateSig(header, payload, connection));
-	std::string body_key = connection->getBodyKey();
-	return encodePacket(packet, header, payload, body_key);
+	return encodePacket(packet, header, payload, connection->getBodyKeySchedule());
 }
 
 int PacketManager::encodeSecMsgPacket(unsigned char * &packet, const Connection * connection, const google::protobuf::MessageLite * message) {
 	const User * user = connection->getUser();
 	ims::ClientHeader * header = createClientHeader(user, BODY_CLIENTHEADER_CMD_SECMSG, BODY_CLIENTHEADER_CIPHER_RC4);
-	std::string body_key = connection->getBodyKey();
-	std::string payload_key = generatePayloadKey(user->getSecurityKey(), header->id());
-	return encodePacket(packet, header, message, body_key, payload_key);
+	std::string payload_key = generatePayloadKey(user->getSecurityKeyBytes(), header->id());
+	return encodePacket(packet, header, message, connection->getBodyKeySchedule(), payload_key);
 }
 
 int PacketManager::encodeUnBindPacket(unsigned char * &packet, const Connection * connection) {
 	const User * user = connection->getUser();
 	ims::ClientHeader * header = createClientHeader(user, BODY_CLIENTHEADER_CMD_UNBIND, BODY_CLIENTHEADER_CIPHER_NONE);
-	std::string body_key = connection->getBodyKey();
-	return encodePacket(packet, header, NULL, body_key);
+	return encodePacket(packet, header, NULL, connection->getBodyKeySchedule());
 }
 
 int PacketManager::encodePingPacket(unsigned char * &packet, const Connection * connection) {
 	return encodePacket(packet, NULL, NULL);
 }
 
-int PacketManager::encodePacket(unsigned char * &packet, const ims::ClientHeader * header, const google::protobuf::MessageLite * message, const std::string &body_key, const std::string &payload_key) {
-	short body_head_size = 0;
+int PacketManager::encodePacket(unsigned char * &packet, const ims::ClientHeader * header, const google::protobuf::MessageLite * message, const RC4_KEY * body_key_schedule, const std::string &payload_key) {
+	// sizes are computed once and every layer is written and encrypted inside the final packet buffer
+	int body_head_size = 0;
 	int body_message_size = 0;
 	int body_size = 0;
-	char * raw_header = NULL;
-	char * final_message = NULL;
 
 	if (header != NULL) {
 		body_head_size = header->ByteSize();
-		raw_header = new char[body_head_size];
-		memset(raw_header, 0, body_head_size);
-		header->SerializeToArray(raw_header, body_head_size);
-
 		if (message != NULL) {
 			body_message_size = message->ByteSize();
-			char * raw_message = new char[body_message_size];
-			memset(raw_message, 0, body_message_size);
-			message->SerializeToArray(raw_message, body_message_size);
-			final_message = new char[body_message_size];
-			memset(final_message, 0, body_message_size);
-			if (header->cmd() != BODY_CLIENTHEADER_CMD_SECMSG) {
-				memmove(final_message, raw_message, body_message_size);
-			} else {
-				std::string raw((char *)raw_message, body_message_size);
-				std::string message_cipher;
-				if (ccb::CryptoRC4Util::Encrypt(raw, message_cipher, payload_key) != 0) {
-					XMDLoggerWrapper::instance()->error("encodePacket failed, body_message encrypt failed");
-					return -1;
-				}
-				memmove(final_message, message_cipher.c_str(), body_message_size);
-			}
-			delete[] raw_message;
-			raw_message = NULL;
 		}
+		body_size = BODY_HEADER_LENGTH + body_head_size + body_message_size;
 	}
 
-	unsigned char * raw_body = NULL;
-	char * final_body = NULL;
-
-	if (body_head_size > 0) {
-		body_size = BODY_HEADER_LENGTH + body_head_size + body_message_size;
-		raw_body = new unsigned char[body_size];
-		memset(raw_body, 0, body_size);
-		short2char(BODY_HEADER_PAYLOADTYPE, raw_body, BODY_HEADER_PAYLOADTYPE_OFFSET);
-		short2char(body_head_size, raw_body, BODY_HEADER_HEADERLEN_OFFSET);
-		int2char(body_message_size, raw_body, BODY_HEADER_PAYLOADLEN_OFFSET);
-		memmove(raw_body + BODY_HEADER_LENGTH, raw_header, body_head_size);
+	int packet_size = HEADER_LENGTH + body_size + BODY_CRC_LEN;
+	packet = new unsigned char[packet_size];
+	short2char(HEADER_MAGIC, packet, HEADER_MAGIC_OFFSET);
+	short2char(HEADER_VERSION, packet, HEADER_VERSION_OFFSET);
+	int2char(body_size, packet, HEADER_BODYLEN_OFFSET);
 
+	int result = packet_size;
+	if (header != NULL) {
+		unsigned char * body = packet + HEADER_LENGTH;
+		unsigned char * body_message = body + BODY_HEADER_LENGTH + body_head_size;
+		short2char(BODY_HEADER_PAYLOADTYPE, body, BODY_HEADER_PAYLOADTYPE_OFFSET);
+		short2char(body_head_size, body, BODY_HEADER_HEADERLEN_OFFSET);
+		int2char(body_message_size, body, BODY_HEADER_PAYLOADLEN_OFFSET);
+		header->SerializeWithCachedSizesToArray(body + BODY_HEADER_LENGTH);
 		if (body_message_size > 0) {
-			memmove(raw_body + BODY_HEADER_LENGTH + body_head_size, final_message, body_message_size);
+			message->SerializeWithCachedSizesToArray(body_message);
 		}
 
-		final_body = new char[body_size];
-		memset(final_body, 0, body_size);
-		if (header->cmd() == BODY_CLIENTHEADER_CMD_CONN) {
-			memmove(final_body, raw_body, body_size);
-		} else {
-			std::string raw((char *)raw_body, body_size);
-			std::string body_cipher;
-			if (ccb::CryptoRC4Util::Encrypt(raw, body_cipher, body_key) != 0) {
+		if (body_message_size > 0 && header->cmd() == BODY_CLIENTHEADER_CMD_SECMSG
+			&& ccb::CryptoRC4Util::CryptInPlace(body_message, body_message_size, payload_key) != 0) {
+			XMDLoggerWrapper::instance()->error("encodePacket failed, body_message encrypt failed");
+			result = -1;
+		} else if (header->cmd() != BODY_CLIENTHEADER_CMD_CONN) {
+			if (body_key_schedule == NULL) {
 				XMDLoggerWrapper::instance()->error("encodePacket failed, body encrypt failed");
-				return -1;
+				result = -1;
+			} else {
+				ccb::CryptoRC4Util::CryptInPlace(body, body_size, *body_key_schedule);
 			}
-			memmove(final_body, body_cipher.c_str(), body_size);
 		}
 	}
 
-	delete[] raw_header;
-	raw_header = NULL;
-
-	delete[] final_message;
-	final_message = NULL;
-
-	delete[] raw_body;
-	raw_body = NULL;
-	int packet_size = HEADER_LENGTH + body_size + BODY_CRC_LEN;
-	packet = new unsigned char[packet_size];
-	memset(packet, 0, packet_size);
-	short2char(HEADER_MAGIC, packet, HEADER_MAGIC_OFFSET);
-	short2char(HEADER_VERSION, packet, HEADER_VERSION_OFFSET);
-	int2char(body_size, packet, HEADER_BODYLEN_OFFSET);
-	memmove(packet + HEADER_LENGTH, final_body, body_size);
-
-	uint32_t crc = compute_crc32(packet, packet_size - BODY_CRC_LEN);
-	int2char(crc, packet, packet_size - BODY_CRC_LEN);
-
-	delete[] final_body;
-	final_body = NULL;
+	if (result > 0) {
+		uint32_t crc = compute_crc32(packet, packet_size - BODY_CRC_LEN);
+		int2char(crc, packet, packet_size - BODY_CRC_LEN);
+	} else {
+		delete[] packet;
+		packet = NULL;
+	}
 
 	delete header;
 	header = NULL;
@@ -165,7 +160,7 @@ int PacketManager::encodePacket(unsigned char * &packet, const ims::ClientHeader
 	delete message;
 	message = NULL;
 
-	return packet_size;
+	return result;
 }
 
 int PacketManager::decodePacketAndHandle(unsigned char * packet, Connection * connection) {
@@ -187,29 +182,34 @@ int PacketManager::decodePacketAndHandle(unsigned char * packet, Connection * co
 	if (body_size == 0) {
 		return 0;
 	}
+	if (body_size < BODY_HEADER_LENGTH) {
+		XMDLoggerWrapper::instance()->error("decodePacket failed, body too short");
+		return -1;
+	}
 
-	if (connection->getBodyKey() != "") {
-		std::string raw((char *)(packet + HEADER_LENGTH), body_size);
-		std::string body_plain;
-		if (ccb::CryptoRC4Util::Decrypt(raw, body_plain, connection->getBodyKey()) != 0) {
-			XMDLoggerWrapper::instance()->error("decodePacket failed, body decrypt failed");
-			return -1;
-		}
-		memmove(packet + HEADER_LENGTH, body_plain.c_str(), body_size);
+	const RC4_KEY * body_key_schedule = connection->getBodyKeySchedule();
+	if (body_key_schedule != NULL) {
+		ccb::CryptoRC4Util::CryptInPlace(packet + HEADER_LENGTH, body_size, *body_key_schedule);
 	}
 
 	short payload_type = char2short(packet, HEADER_LENGTH + BODY_HEADER_PAYLOADTYPE_OFFSET);
 	short body_head_size = char2short(packet, HEADER_LENGTH + BODY_HEADER_HEADERLEN_OFFSET);
 	int body_message_size = char2int(packet, HEADER_LENGTH + BODY_HEADER_PAYLOADLEN_OFFSET);
+	if (body_head_size < 0 || body_message_size < 0 || (int64_t)BODY_HEADER_LENGTH + body_head_size + body_message_size > body_size) {
+		XMDLoggerWrapper::instance()->error("decodePacket failed, invalid body header");
+		return -1;
+	}
 
-	ims::ClientHeader header;
+	// the messages of every frame are parsed into the same objects, which keep their strings allocated
+	DecodeContext& context = DecodeContext::current();
+	ims::ClientHeader& header = context.header;
 	if (!header.ParseFromArray(packet + HEADER_LENGTH + BODY_HEADER_LENGTH, body_head_size)) {
 		XMDLoggerWrapper::instance()->error("decodePacket failed, header parse failed");
 		return -1;
 	}
 
 	User * user = connection->getUser();
-	std::string cmd = header.cmd();
+	const std::string& cmd = header.cmd();
 	
 	if (cmd == BODY_CLIENTHEADER_CMD_CONN) {
 		ims::XMMsgConnResp resp;
@@ -219,8 +219,8 @@ int PacketManager::decodePacketAndHandle(unsigned char * packet, Connection * co
 		}
 		std::string challenge = resp.challenge();
 		connection->setChallengeAndBodyKey(challenge);
-		connection->setState(HANDSHAKE_CONNECTED);
 		XMDLoggerWrapper::instance()->info("connresp receive succeed, connection build succeed, user is %s", user->getAppAccount().c_str());
+		user->handleConnResp();
 	}
 	else if (cmd == BODY_CLIENTHEADER_CMD_BIND) {
 		ims::XMMsgBindResp resp;
@@ -231,7 +231,11 @@ int PacketManager::decodePacketAndHandle(unsigned char * packet, Connection * co
 		OnlineStatus onlineStatus = resp.result() ? Online : Offline;
 		XMDLoggerWrapper::instance()->info("bindresp receive succeed, onlineStatus is %d, user is %s, uuid is %lld", onlineStatus, user->getAppAccount().c_str(), user->getUuid());
 
-		user->setOnlineStatus(onlineStatus);
+		user->handleBindResp(onlineStatus);
+		if (onlineStatus == Online) {
+			// whatever arrived while offline is pulled instead of waiting for the server to push it
+			sendPulls(user, this->messageSync.start(Utils::steadyTimeMillis()));
+		}
 		if (user->getStatusHandler() != NULL) {
 			user->getStatusHandler()->statusChange(onlineStatus, resp.error_type(), resp.error_reason(), resp.error_desc());
 		}
@@ -245,7 +249,7 @@ int PacketManager::decodePacketAndHandle(unsigned char * packet, Connection * co
 		OnlineStatus onlineStatus = resp.result() ? Online : Offline;
 		XMDLoggerWrapper::instance()->info("bindresp(kick) receive succeed, onlineStatus is %d, user is %s, uuid is %lld", onlineStatus, user->getAppAccount().c_str(), user->getUuid());
 
-		user->setOnlineStatus(onlineStatus);
+		user->handleBindResp(onlineStatus);
 		if (user->getStatusHandler() != NULL) {
 			user->getStatusHandler()->statusChange(onlineStatus, resp.error_type(), resp.error_reason(), resp.error_desc());
 		}
@@ -256,22 +260,19 @@ int PacketManager::decodePacketAndHandle(unsigned char * packet, Connection * co
 	}
 	else if (cmd == BODY_CLIENTHEADER_CMD_SECMSG) {
 		if (header.chid() == MIMC_CHID && header.uuid() == user->getUuid()) {
-			std::string raw((char *)(packet + HEADER_LENGTH + BODY_HEADER_LENGTH + body_head_size), body_message_size);
-			std::string body_plain;
-			std::string payload_key = generatePayloadKey(user->getSecurityKey(), header.id());
-			if (ccb::CryptoRC4Util::Decrypt(raw, body_plain, payload_key) != 0) {
+			generatePayloadKey(user->getSecurityKeyBytes(), header.id(), context.payloadKey);
+			if (ccb::CryptoRC4Util::CryptInPlace(packet + HEADER_LENGTH + BODY_HEADER_LENGTH + body_head_size, body_message_size, context.payloadKey) != 0) {
 				XMDLoggerWrapper::instance()->error("decodePacket failed, body_message decrypt failed");
 				return -1;
 			}
-			memmove(packet + HEADER_LENGTH + BODY_HEADER_LENGTH + body_head_size, body_plain.c_str(), body_message_size);
-			mimc::MIMCPacket mimcPacket;
+			mimc::MIMCPacket& mimcPacket = context.packet;
 			if (!mimcPacket.ParseFromArray(packet + HEADER_LENGTH + BODY_HEADER_LENGTH + body_head_size, body_message_size)) {
 				XMDLoggerWrapper::instance()->error("decodePacket failed, mimcPacket parse failed");
 				return -1;
 			}
 			
 			if (mimcPacket.type() == mimc::PACKET_ACK) {
-				mimc::MIMCPacketAck mimcPacketAck;
+				mimc::MIMCPacketAck& mimcPacketAck = context.packetAck;
 				if (!mimcPacketAck.ParseFromString(mimcPacket.payload())) {
 					XMDLoggerWrapper::instance()->error("decodePacket failed, mimcPacketAck parse failed");
 					return -1;
@@ -279,96 +280,18 @@ int PacketManager::decodePacketAndHandle(unsigned char * packet, Connection * co
 				if (user->getMessageHandler() != NULL) {
 					user->getMessageHandler()->handleServerAck(mimcPacketAck.packetid(), mimcPacketAck.sequence(), mimcPacketAck.timestamp(), mimcPacketAck.errormsg());
 				}
-				pthread_mutex_lock(&packetsTimeoutMutex);
-				(this->packetsWaitToTimeout).erase(mimcPacketAck.packetid());
-				(this->groupPacketWaitToTimeout).erase(mimcPacketAck.packetid());
-				pthread_mutex_unlock(&packetsTimeoutMutex);
-				
+				removePacketWaitToTimeout(mimcPacketAck.packetid());
+				if (user->getOutbox() != NULL) {
+					user->getOutbox()->ack(mimcPacketAck.packetid());
+				}
 			}
 			else if (mimcPacket.type() == mimc::COMPOUND) {
-				mimc::MIMCPacketList mimcPacketList;
-				if (!mimcPacketList.ParseFromString(mimcPacket.payload()) || mimcPacketList.packets_size() == 0) {
-					XMDLoggerWrapper::instance()->error("decodePacket failed, mimcPacketList parse failed");
+				if (handleCompound(user, mimcPacket.payload()) < 0) {
 					return -1;
 				}
-
-				XMDLoggerWrapper::instance()->info("In COMPOUND, user is %s", user->getAppAccount().c_str());
-
-				mimc::MIMCSequenceAck mimcSequenceAck;
-				mimcSequenceAck.set_uuid(mimcPacketList.uuid());
-				mimcSequenceAck.set_resource(mimcPacketList.resource());
-				mimcSequenceAck.set_sequence(mimcPacketList.maxsequence());
-
-				int message_size = mimcSequenceAck.ByteSize();
-				char * messageBytes = new char[message_size];
-				memset(messageBytes, 0, message_size);
-				mimcSequenceAck.SerializeToArray(messageBytes, message_size);
-				std::string messageBytesStr(messageBytes, message_size);
-
-				mimc::MIMCPacket * ackPacket = new mimc::MIMCPacket();
-				ackPacket->set_packetid(createPacketId());
-				ackPacket->set_package(user->getAppPackage());
-				ackPacket->set_type(mimc::SEQUENCE_ACK);
-				ackPacket->set_payload(messageBytesStr);
-				ackPacket->set_timestamp(time(NULL));
-
-				delete[] messageBytes;
-				messageBytes = NULL;
-
-				struct waitToSendContent mimc_obj;
-				mimc_obj.cmd = BODY_CLIENTHEADER_CMD_SECMSG;
-				mimc_obj.type = C2S_SINGLE_DIRECTION;
-				mimc_obj.message = ackPacket;
-				(this->packetsWaitToSend).push(mimc_obj);
-
-				int packetNum = mimcPacketList.packets_size();
-				
-				std::vector<MIMCMessage> p2pMimcMessages;
-				std::vector<MIMCGroupMessage> p2tMimcMessages;
-				for (int i = 0; i < packetNum; i++) {
-					mimc::MIMCPacket mimcMessagePacket = mimcPacketList.packets(i);
-					if ((this->sequencesReceived).count(mimcMessagePacket.sequence()) != 0) {
-						
-						continue;
-					}
-					(this->sequencesReceived).insert(mimcMessagePacket.sequence());
-					if (mimcMessagePacket.type() == mimc::P2P_MESSAGE) {
-						mimc::MIMCP2PMessage p2pMessage;
-						if (!p2pMessage.ParseFromString(mimcMessagePacket.payload())) {
-							
-							continue;
-						}
-						if (p2pMessage.to().resource() != "" && p2pMessage.to().resource() != user->getResource()) {
-							
-							continue;
-						}
-						p2pMimcMessages.push_back(MIMCMessage(mimcMessagePacket.packetid(), mimcMessagePacket.sequence(), p2pMessage.from().appaccount(), p2pMessage.from().resource(), p2pMessage.to().appaccount(), p2pMessage.to().resource(), p2pMessage.payload(), p2pMessage.biztype(), mimcMessagePacket.timestamp()));
-					}
-					else if (mimcMessagePacket.type() == mimc::P2T_MESSAGE){
-						mimc::MIMCP2TMessage p2tMessage;
-						if (!p2tMessage.ParseFromString(mimcMessagePacket.payload())) {
-							continue;
-						}
-						p2tMimcMessages.push_back(MIMCGroupMessage(mimcMessagePacket.packetid(), mimcMessagePacket.sequence(), p2tMessage.from().appaccount(), p2tMessage.from().resource(), p2tMessage.to().topicid(), p2tMessage.payload(), p2tMessage.biztype(), mimcMessagePacket.timestamp()));
-					}
-				}
-
-				if (p2pMimcMessages.size() > 0) {
-					std::sort(p2pMimcMessages.begin(), p2pMimcMessages.end(), MIMCMessage::sortBySequence);
-					if (user->getMessageHandler() != NULL) {
-						user->getMessageHandler()->handleMessage(p2pMimcMessages);
-					}
-				}
-
-				if (p2tMimcMessages.size() > 0) {
-					std::sort(p2tMimcMessages.begin(), p2tMimcMessages.end(), MIMCGroupMessage::sortBySequence);
-					if (user->getMessageHandler() != NULL) {
-						user->getMessageHandler()->handleGroupMessage(p2tMimcMessages);
-					}
-				}
 			}
 			else if (mimcPacket.type() == mimc::RTS_SIGNAL) {
-				mimc::RTSMessage rtsMessage;
+				mimc::RTSMessage& rtsMessage = context.rtsMessage;
 				if (!rtsMessage.ParseFromString(mimcPacket.payload())) {
 					XMDLoggerWrapper::instance()->error("decodePacket failed, rtsMessage parse failed");
 					return -1;
@@ -626,35 +549,390 @@ int PacketManager::decodePacketAndHandle(unsigned char * packet, Connection * co
 }
 
 std::string PacketManager::createPacketId() {
-	pthread_mutex_lock(&packetIdMutex);
-	std::string packetId = packetIdPrefix + "_" + Utils::int2str(packetIdSeq++);
-	pthread_mutex_unlock(&packetIdMutex);
+	int64_t seq = packetIdSeq.fetch_add(1, std::memory_order_relaxed);
+	char seqStr[INT64_STR_LEN];
+	int seqLen = Utils::int2chars(seq, seqStr);
+	std::string packetId;
+	packetId.reserve(packetIdPrefix.length() + seqLen);
+	packetId.append(packetIdPrefix).append(seqStr, seqLen);
 	return packetId;
 }
 
 void PacketManager::checkMessageSendTimeout(const User * user) {
+	std::vector<MIMCMessage> messages;
+	std::vector<MIMCGroupMessage> groupMessages;
+	pthread_mutex_lock(&packetsTimeoutMutex);
+	(this->packetsWaitToTimeout).expire(sendTimeoutClock(Utils::steadyTimeMillis()), messages, groupMessages);
+	pthread_mutex_unlock(&packetsTimeoutMutex);
+
+	// a message reported as timed out leaves the outbox too, a reconnect must not deliver it after all
+	if (user->getOutbox() != NULL) {
+		for (size_t i = 0; i < messages.size(); i++) {
+			user->getOutbox()->expire(messages[i].getPacketId());
+		}
+		for (size_t i = 0; i < groupMessages.size(); i++) {
+			user->getOutbox()->expire(groupMessages[i].getPacketId());
+		}
+	}
+
+	// handlers run unlocked, they may well send again
+	if (user->getMessageHandler() == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < messages.size(); i++) {
+		user->getMessageHandler()->handleSendMsgTimeout(messages[i]);
+	}
+	for (size_t i = 0; i < groupMessages.size(); i++) {
+		user->getMessageHandler()->handleSendGroupMsgTimeout(groupMessages[i]);
+	}
+}
+
+int64_t PacketManager::nextMessageSendTimeout() {
+	pthread_mutex_lock(&packetsTimeoutMutex);
+	int64_t timestamp = (this->packetsWaitToTimeout).nextExpireTimestamp();
+	if (timestamp >= 0) {
+		timestamp = this->sendTimeoutPausedAt < 0 ? timestamp + this->sendTimeoutPausedMs : -1;
+	}
+	pthread_mutex_unlock(&packetsTimeoutMutex);
+	return timestamp;
+}
+
+void PacketManager::setMessageSendTimeoutPaused(bool paused) {
+	int64_t now = Utils::steadyTimeMillis();
+	pthread_mutex_lock(&packetsTimeoutMutex);
+	if (paused && this->sendTimeoutPausedAt < 0) {
+		this->sendTimeoutPausedAt = now;
+	} else if (!paused && this->sendTimeoutPausedAt >= 0) {
+		this->sendTimeoutPausedMs += now - this->sendTimeoutPausedAt;
+		this->sendTimeoutPausedAt = -1;
+	}
+	pthread_mutex_unlock(&packetsTimeoutMutex);
+}
+
+int64_t PacketManager::sendTimeoutClock(int64_t nowMs) const {
+	return (this->sendTimeoutPausedAt < 0 ? nowMs : this->sendTimeoutPausedAt) - this->sendTimeoutPausedMs;
+}
+
+void PacketManager::pushPacketWaitToSend(const struct waitToSendContent& obj, SendLane lane, bool inLoopThread) {
+	SendLaneQueue* sendLane = sendLanes[lane];
+	if (inLoopThread) {
+		sendLane->loopPacketsWaitToSend.push_back(obj);
+		sendLane->loopDepth++;
+	} else {
+		sendLane->packetsWaitToSend.push(obj);
+	}
+	updatePeakDepth(sendLane);
+}
+
+bool PacketManager::tryPushPacketWaitToSend(const struct waitToSendContent& obj, SendLane lane, bool inLoopThread) {
+	SendLaneQueue* sendLane = sendLanes[lane];
+	if (inLoopThread) {
+		sendLane->loopPacketsWaitToSend.push_back(obj);
+		sendLane->loopDepth++;
+	} else if (sendLane->packetsWaitToSend.tryPush(obj) == QUEUE_WOULD_BLOCK) {
+		return false;
+	}
+	updatePeakDepth(sendLane);
+	return true;
+}
+
+bool PacketManager::popPacketWaitToSend(struct waitToSendContent& obj) {
+	for (int round = 0; round < 2; round++) {
+		for (int i = 0; i < SEND_LANE_COUNT; i++) {
+			SendLaneQueue* sendLane = sendLanes[i];
+			if (sendLane->credit == 0 || !popSendLane(sendLane, obj)) {
+				continue;
+			}
+			sendLane->credit--;
+			sendLane->sent++;
+			return true;
+		}
+		// every lane that still had credit is empty, start the next round
+		for (int i = 0; i < SEND_LANE_COUNT; i++) {
+			sendLanes[i]->credit = sendLanes[i]->weight.load(std::memory_order_relaxed);
+		}
+	}
+	return false;
+}
+
+bool PacketManager::popSendLane(SendLaneQueue* sendLane, struct waitToSendContent& obj) {
+	if (!sendLane->loopPacketsWaitToSend.empty()) {
+		obj = sendLane->loopPacketsWaitToSend.front();
+		sendLane->loopPacketsWaitToSend.pop_front();
+		sendLane->loopDepth--;
+		return true;
+	}
+	return sendLane->packetsWaitToSend.pop(obj);
+}
+
+void PacketManager::updatePeakDepth(SendLaneQueue* sendLane) {
+	unsigned int depth = sendLane->packetsWaitToSend.size() + sendLane->loopDepth.load(std::memory_order_relaxed);
+	unsigned int peak = sendLane->peakDepth.load(std::memory_order_relaxed);
+	while (depth > peak && !sendLane->peakDepth.compare_exchange_weak(peak, depth, std::memory_order_relaxed)) {
+	}
+}
+
+bool PacketManager::hasPacketsWaitToSend() const {
+	for (int i = 0; i < SEND_LANE_COUNT; i++) {
+		if (!sendLanes[i]->loopPacketsWaitToSend.empty() || !sendLanes[i]->packetsWaitToSend.empty()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool PacketManager::isSendLaneFull(SendLane lane) const {
+	ThreadSafeQueue<struct waitToSendContent>& queue = sendLanes[lane]->packetsWaitToSend;
+	return queue.size() >= queue.capacity();
+}
+
+void PacketManager::setSendLaneWeight(SendLane lane, unsigned int weight) {
+	// a lane without credit would never be served
+	sendLanes[lane]->weight = weight > 0 ? weight : 1;
+}
+
+SendLaneStats PacketManager::getSendLaneStats(SendLane lane) const {
+	SendLaneQueue* sendLane = sendLanes[lane];
+	SendLaneStats stats;
+	stats.depth = sendLane->packetsWaitToSend.size() + sendLane->loopDepth.load(std::memory_order_relaxed);
+	stats.peakDepth = sendLane->peakDepth.load(std::memory_order_relaxed);
+	stats.sent = sendLane->sent.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void PacketManager::addPacketWaitToTimeout(const MIMCMessage& message, int64_t timeoutMs) {
+	pthread_mutex_lock(&packetsTimeoutMutex);
+	(this->packetsWaitToTimeout).add(message, sendTimeoutClock(Utils::steadyTimeMillis()), timeoutMs);
+	pthread_mutex_unlock(&packetsTimeoutMutex);
+}
+
+void PacketManager::addPacketWaitToTimeout(const MIMCGroupMessage& groupMessage, int64_t timeoutMs) {
+	pthread_mutex_lock(&packetsTimeoutMutex);
+	(this->packetsWaitToTimeout).add(groupMessage, sendTimeoutClock(Utils::steadyTimeMillis()), timeoutMs);
+	pthread_mutex_unlock(&packetsTimeoutMutex);
+}
+
+void PacketManager::removePacketWaitToTimeout(const std::string& packetId) {
 	pthread_mutex_lock(&packetsTimeoutMutex);
-	std::vector<std::string> packetsWaitToDelete;
-	std::map<std::string, MIMCMessage>::iterator iter;
-	for (iter = (this->packetsWaitToTimeout).begin(); iter != (this->packetsWaitToTimeout).end(); iter++) {
-		MIMCMessage mimcMessage = iter->second;
-		if (time(NULL) - mimcMessage.getTimeStamp() < SEND_TIMEOUT) {
+	(this->packetsWaitToTimeout).cancel(packetId);
+	pthread_mutex_unlock(&packetsTimeoutMutex);
+}
+
+int PacketManager::handleCompound(User * user, const std::string& payload) {
+	// the list, its packets and their strings are parsed into the objects of the last batch, which keep their capacity
+	DecodeContext& context = DecodeContext::current();
+	mimc::MIMCPacketList& mimcPacketList = context.packetList;
+	if (!mimcPacketList.ParseFromString(payload)) {
+		XMDLoggerWrapper::instance()->error("decodePacket failed, mimcPacketList parse failed");
+		return -1;
+	}
+	if (mimcPacketList.packets_size() == 0) {
+		// a PULL answered when there was nothing to catch up on
+		sendPulls(user, this->messageSync.handlePacketList(mimcPacketList.maxsequence(), 0, Utils::steadyTimeMillis()));
+		return 0;
+	}
+
+	XMDLoggerWrapper::instance()->info("In COMPOUND, user is %s", user->getAppAccount().c_str());
+
+	// acked together with later batches, or along with the next outgoing frame
+	addSequenceAck(mimcPacketList.uuid(), mimcPacketList.resource(), mimcPacketList.maxsequence());
+
+	int packetNum = mimcPacketList.packets_size();
+	std::vector<MIMCMessageView>& p2pMimcMessages = context.p2pMessageViews;
+	std::vector<MIMCGroupMessageView>& p2tMimcMessages = context.p2tMessageViews;
+	p2pMimcMessages.clear();
+	p2tMimcMessages.clear();
+	size_t p2pCount = 0;
+	size_t p2tCount = 0;
+	InboundLog* inboundLog = user->getInboundLog();
+	int64_t lastSequence = 0;
+	for (int i = 0; i < packetNum; i++) {
+		const mimc::MIMCPacket& mimcMessagePacket = mimcPacketList.packets(i);
+		if (mimcMessagePacket.sequence() > lastSequence) {
+			lastSequence = mimcMessagePacket.sequence();
+		}
+		if (!(this->sequencesReceived).checkAndMark(mimcMessagePacket.sequence())) {
 			continue;
 		}
+		if (inboundLog != NULL && inboundLog->contains(mimcMessagePacket.sequence())) {
+			// delivered before the window was rebuilt, a restart or an old sequence
+			continue;
+		}
+		if (mimcMessagePacket.type() == mimc::P2P_MESSAGE) {
+			if (p2pCount == context.p2pMessages.size()) {
+				context.p2pMessages.push_back(mimc::MIMCP2PMessage());
+				context.p2pPayloadBuffers.push_back(std::string());
+			}
+			mimc::MIMCP2PMessage& p2pMessage = context.p2pMessages[p2pCount];
+			if (!p2pMessage.ParseFromString(mimcMessagePacket.payload())) {
+				continue;
+			}
+			if (p2pMessage.to().resource() != "" && p2pMessage.to().resource() != user->getResource()) {
+				continue;
+			}
+			std::string& payloadBuffer = context.p2pPayloadBuffers[p2pCount++];
+			p2pMimcMessages.push_back(MIMCMessageView(mimcMessagePacket.packetid(), mimcMessagePacket.sequence(), p2pMessage.from().appaccount(), p2pMessage.from().resource(), p2pMessage.to().appaccount(), p2pMessage.to().resource(), decodePayload(p2pMessage.payload(), payloadBuffer), p2pMessage.biztype(), mimcMessagePacket.timestamp()));
+			if (inboundLog != NULL) {
+				inboundLog->add(p2pMimcMessages.back());
+			}
+		}
+		else if (mimcMessagePacket.type() == mimc::P2T_MESSAGE) {
+			if (p2tCount == context.p2tMessages.size()) {
+				context.p2tMessages.push_back(mimc::MIMCP2TMessage());
+				context.p2tPayloadBuffers.push_back(std::string());
+			}
+			mimc::MIMCP2TMessage& p2tMessage = context.p2tMessages[p2tCount];
+			if (!p2tMessage.ParseFromString(mimcMessagePacket.payload())) {
+				continue;
+			}
+			std::string& payloadBuffer = context.p2tPayloadBuffers[p2tCount++];
+			p2tMimcMessages.push_back(MIMCGroupMessageView(mimcMessagePacket.packetid(), mimcMessagePacket.sequence(), p2tMessage.from().appaccount(), p2tMessage.from().resource(), p2tMessage.to().topicid(), decodePayload(p2tMessage.payload(), payloadBuffer), p2tMessage.biztype(), mimcMessagePacket.timestamp()));
+			if (inboundLog != NULL) {
+				inboundLog->add(p2tMimcMessages.back());
+			}
+		}
+	}
+
+	// the next pages are requested before the handlers run on this one
+	sendPulls(user, this->messageSync.handlePacketList(mimcPacketList.maxsequence(), lastSequence, Utils::steadyTimeMillis()));
+
+	if (p2pMimcMessages.size() > 0) {
+		std::sort(p2pMimcMessages.begin(), p2pMimcMessages.end(), MIMCMessageView::sortBySequence);
+		user->dispatchMessages(p2pMimcMessages);
+	}
 
-		if (user->getMessageHandler() != NULL) {
-			user->getMessageHandler()->handleSendMsgTimeout(mimcMessage);
+	if (p2tMimcMessages.size() > 0) {
+		std::sort(p2tMimcMessages.begin(), p2tMimcMessages.end(), MIMCGroupMessageView::sortBySequence);
+		user->dispatchGroupMessages(p2tMimcMessages);
+	}
+
+	if (!sequenceFile.empty() && mimcPacketList.maxsequence() > sequenceHighWaterMark) {
+		sequenceHighWaterMark = mimcPacketList.maxsequence();
+		user->runAfterDispatch(new SequenceMarkTask(this, sequenceHighWaterMark));
+	}
+	return 0;
+}
+
+void PacketManager::addSequenceAck(int64_t uuid, const std::string& resource, int64_t sequence) {
+	std::pair<std::map<std::pair<int64_t, std::string>, int64_t>::iterator, bool> inserted = this->pendingSequenceAcks.insert(std::make_pair(std::make_pair(uuid, resource), sequence));
+	if (!inserted.second) {
+		this->sequenceAcksSaved++;
+		if (sequence > inserted.first->second) {
+			inserted.first->second = sequence;
 		}
+	}
+	if (this->sequenceAckTimestamp < 0) {
+		this->sequenceAckTimestamp = Utils::steadyTimeMillis() + SEQUENCE_ACK_DELAY_MS;
+	}
+}
 
-		packetsWaitToDelete.push_back(mimcMessage.getPacketId());
+void PacketManager::flushSequenceAcks(const User * user) {
+	for (std::map<std::pair<int64_t, std::string>, int64_t>::const_iterator iter = this->pendingSequenceAcks.begin(); iter != this->pendingSequenceAcks.end(); iter++) {
+		mimc::MIMCSequenceAck mimcSequenceAck;
+		mimcSequenceAck.set_uuid(iter->first.first);
+		mimcSequenceAck.set_resource(iter->first.second);
+		mimcSequenceAck.set_sequence(iter->second);
+
+		mimc::MIMCPacket * ackPacket = new mimc::MIMCPacket();
+		ackPacket->set_packetid(createPacketId());
+		ackPacket->set_package(user->getAppPackage());
+		ackPacket->set_type(mimc::SEQUENCE_ACK);
+		mimcSequenceAck.SerializeToString(ackPacket->mutable_payload());
+		ackPacket->set_timestamp(time(NULL));
+
+		struct waitToSendContent mimc_obj;
+		mimc_obj.cmd = BODY_CLIENTHEADER_CMD_SECMSG;
+		mimc_obj.type = C2S_SINGLE_DIRECTION;
+		mimc_obj.message = ackPacket;
+		user->enqueuePacket(mimc_obj, SEND_LANE_ACK);
 	}
+	this->pendingSequenceAcks.clear();
+	this->sequenceAckTimestamp = -1;
+}
 
-	int toDeleteSize = packetsWaitToDelete.size();
-	for (int i = 0; i < toDeleteSize; i++) {
-		(this->packetsWaitToTimeout).erase(packetsWaitToDelete[i]);
+void PacketManager::sendPulls(const User * user, unsigned int count) {
+	// the server learns what arrived before it picks the next page, the PULL queues behind
+	// the acks on their lane since the control lane is drained first
+	SendLane lane = SEND_LANE_CONTROL;
+	if (count > 0 && this->sequenceAckTimestamp >= 0) {
+		flushSequenceAcks(user);
+		lane = SEND_LANE_ACK;
+	}
+	for (unsigned int i = 0; i < count; i++) {
+		mimc::MIMCPull mimcPull;
+		mimcPull.set_uuid(user->getUuid());
+		mimcPull.set_resource(user->getResource());
+
+		mimc::MIMCPacket * pullPacket = new mimc::MIMCPacket();
+		pullPacket->set_packetid(createPacketId());
+		pullPacket->set_package(user->getAppPackage());
+		pullPacket->set_type(mimc::PULL);
+		mimcPull.SerializeToString(pullPacket->mutable_payload());
+		pullPacket->set_timestamp(time(NULL));
+
+		// the answer is an ordinary COMPOUND, nothing waits for it
+		struct waitToSendContent mimc_obj;
+		mimc_obj.cmd = BODY_CLIENTHEADER_CMD_SECMSG;
+		mimc_obj.type = C2S_SINGLE_DIRECTION;
+		mimc_obj.message = pullPacket;
+		user->enqueuePacket(mimc_obj, lane);
 	}
+}
+
+void PacketManager::enableSequencePersistence(const std::string& file) {
+	this->sequenceFile = file;
+	std::ifstream in(file.c_str());
+	int64_t sequence = 0;
+	if (in.is_open() && (in >> sequence) && sequence > 0) {
+		XMDLoggerWrapper::instance()->info("In enableSequencePersistence, restored sequence high water mark %lld", (long long)sequence);
+		this->sequenceHighWaterMark = sequence;
+		(this->sequencesReceived).setFloor(sequence);
+	}
+}
+
+void PacketManager::saveSequenceHighWaterMark(int64_t sequence) {
+	// written once the handlers returned on the batch, on the message lane when callbacks are queued,
+	// a crash before this redelivers rather than drops
+	std::ofstream out(this->sequenceFile.c_str(), std::ios::out | std::ios::trunc);
+	if (!out.is_open()) {
+		XMDLoggerWrapper::instance()->warn("In saveSequenceHighWaterMark, open %s failed", this->sequenceFile.c_str());
+		return;
+	}
+	out << (long long)sequence;
+}
+
+const std::string& PacketManager::encodePayload(const std::string& payload, std::string& buffer) const {
+	unsigned int threshold = this->payloadCompressThreshold.load(std::memory_order_relaxed);
+	if (threshold == 0) {
+		// not opted in, the bytes go out exactly as the application passed them
+		return payload;
+	}
+	// a raw payload that happens to look compressed is wrapped, so receivers never misread it
+	bool mustWrap = PayloadCodec::isCompressed(payload);
+	if (payload.size() >= threshold || mustWrap) {
+		if (PayloadCodec::compress(payload, buffer, mustWrap)) {
+			return buffer;
+		}
+	}
+	return payload;
+}
+
+const std::string& PacketManager::decodePayload(const std::string& payload, std::string& buffer) {
+	if (!PayloadCodec::isCompressed(payload)) {
+		return payload;
+	}
+	if (!(this->payloadCodec).decompress(payload, buffer)) {
+		XMDLoggerWrapper::instance()->warn("In decodePayload, decompress failed, payload delivered as received");
+		return payload;
+	}
+	return buffer;
+}
 
+bool PacketManager::hasPacketsWaitToTimeout() {
+	pthread_mutex_lock(&packetsTimeoutMutex);
+	bool result = !(this->packetsWaitToTimeout).empty();
 	pthread_mutex_unlock(&packetsTimeoutMutex);
+	return result;
 }
 
 void PacketManager::short2char(int16_t data, unsigned char* result, int index) {
@@ -722,20 +1000,17 @@ std::string PacketManager::generateSig(const ims::ClientHeader * header, const i
 	return Utils::hash4SHA1AndBase64(oss.str());
 }
 
-std::string PacketManager::generatePayloadKey(const std::string &securityKey, const std::string &headerId) {
-	std::string keyBytes;
-	ccb::Base64Util::Decode(securityKey, keyBytes);
-
-	int keyBytesLen = keyBytes.length();
-	int headerIdLen = headerId.length();
-
-	char *payloadKey = new char[keyBytesLen + 1 + headerIdLen];
-	memset(payloadKey, 0, keyBytesLen + 1 + headerIdLen);
-	memmove(payloadKey, keyBytes.c_str(), keyBytesLen);
-	payloadKey[keyBytesLen] = '_';
-	memmove(payloadKey + keyBytesLen + 1, headerId.c_str(), headerIdLen);
-	std::string result(payloadKey, keyBytesLen + 1 + headerIdLen);
-	delete[] payloadKey;
-	payloadKey = NULL;
+std::string PacketManager::generatePayloadKey(const std::string &securityKeyBytes, const std::string &headerId) {
+	std::string result;
+	generatePayloadKey(securityKeyBytes, headerId, result);
 	return result;
 }
+
+void PacketManager::generatePayloadKey(const std::string &securityKeyBytes, const std::string &headerId, std::string &result) {
+	// securityKeyBytes is decoded once per login by User, only the header id changes per packet
+	result.clear();
+	result.reserve(securityKeyBytes.length() + 1 + headerId.length());
+	result.append(securityKeyBytes);
+	result.push_back('_');
+	result.append(headerId);
+}
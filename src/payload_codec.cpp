@@ -0,0 +1,116 @@
+#include <mimc/payload_codec.h>
+#include <mimc/constant.h>
+#include <zlib/zlib.h>
+#include <string.h>
+
+namespace {
+
+class Deflater {
+public:
+	Deflater() : initialized(false) {
+		memset(&stream, 0, sizeof(stream));
+	}
+	~Deflater() {
+		if (initialized) {
+			deflateEnd(&stream);
+		}
+	}
+	z_stream* get() {
+		if (!initialized) {
+			// raw deflate, the frame crc already covers the bytes
+			if (deflateInit2(&stream, PAYLOAD_COMPRESS_LEVEL, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+				return NULL;
+			}
+			initialized = true;
+		} else {
+			deflateReset(&stream);
+		}
+		return &stream;
+	}
+private:
+	z_stream stream;
+	bool initialized;
+};
+
+thread_local Deflater deflater;
+
+}
+
+PayloadCodec::PayloadCodec()
+	: inflater(NULL)
+{
+
+}
+
+PayloadCodec::~PayloadCodec() {
+	if (inflater != NULL) {
+		inflateEnd(inflater);
+		delete inflater;
+		inflater = NULL;
+	}
+}
+
+bool PayloadCodec::compress(const std::string& payload, std::string& compressed, bool force) {
+	z_stream* stream = deflater.get();
+	if (stream == NULL) {
+		return false;
+	}
+	size_t bound = deflateBound(stream, payload.size());
+	compressed.resize(PAYLOAD_COMPRESS_HEADER_LENGTH + bound);
+	unsigned char* out = (unsigned char*)&compressed[0];
+	memcpy(out, PAYLOAD_COMPRESS_MAGIC, PAYLOAD_COMPRESS_MAGIC_LENGTH);
+	uint32_t length = (uint32_t)payload.size();
+	for (int i = 0; i < 4; i++) {
+		out[PAYLOAD_COMPRESS_MAGIC_LENGTH + i] = (length >> (24 - 8 * i)) & 0xFF;
+	}
+
+	stream->next_in = (Bytef*)payload.data();
+	stream->avail_in = (uInt)payload.size();
+	stream->next_out = out + PAYLOAD_COMPRESS_HEADER_LENGTH;
+	stream->avail_out = (uInt)bound;
+	if (deflate(stream, Z_FINISH) != Z_STREAM_END) {
+		return false;
+	}
+	size_t size = PAYLOAD_COMPRESS_HEADER_LENGTH + stream->total_out;
+	if (size >= payload.size() && !force) {
+		return false;
+	}
+	compressed.resize(size);
+	return true;
+}
+
+bool PayloadCodec::isCompressed(const std::string& payload) {
+	return payload.size() > PAYLOAD_COMPRESS_HEADER_LENGTH && memcmp(payload.data(), PAYLOAD_COMPRESS_MAGIC, PAYLOAD_COMPRESS_MAGIC_LENGTH) == 0;
+}
+
+bool PayloadCodec::decompress(const std::string& payload, std::string& decompressed) {
+	if (!isCompressed(payload)) {
+		return false;
+	}
+	const unsigned char* in = (const unsigned char*)payload.data();
+	uint32_t length = 0;
+	for (int i = 0; i < 4; i++) {
+		length = (length << 8) | in[PAYLOAD_COMPRESS_MAGIC_LENGTH + i];
+	}
+	if (length == 0 || length > MAX_PACKET_BODY_SIZE) {
+		return false;
+	}
+
+	if (inflater == NULL) {
+		inflater = new z_stream();
+		memset(inflater, 0, sizeof(z_stream));
+		if (inflateInit2(inflater, -MAX_WBITS) != Z_OK) {
+			delete inflater;
+			inflater = NULL;
+			return false;
+		}
+	} else {
+		inflateReset(inflater);
+	}
+	decompressed.resize(length);
+	inflater->next_in = (Bytef*)in + PAYLOAD_COMPRESS_HEADER_LENGTH;
+	inflater->avail_in = (uInt)(payload.size() - PAYLOAD_COMPRESS_HEADER_LENGTH);
+	inflater->next_out = (Bytef*)&decompressed[0];
+	inflater->avail_out = length;
+	return inflate(inflater, Z_FINISH) == Z_STREAM_END && inflater->total_out == length;
+}
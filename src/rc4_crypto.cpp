@@ -48,6 +48,39 @@ MSG_CRYPTO_LIB_NS_BEGIN
 		return 0;
 	}
 
+	int CryptoRC4Util::CryptInPlace(unsigned char *data, unsigned long datalen, const std::string &key)
+	{
+		if (datalen == 0) {
+			return -1;
+		}
+
+		if (key.empty()) {
+			return -1;
+		}
+
+		DoRC4Crypt((const unsigned char*)key.c_str(), (int)key.size(),
+				   data, datalen,
+				   data);
+
+		return 0;
+	}
+
+	int CryptoRC4Util::SetKey(RC4_KEY *schedule, const std::string &key)
+	{
+		if (key.empty()) {
+			return -1;
+		}
+
+		RC4_set_key(schedule, (int)key.size(), (const unsigned char*)key.c_str());
+		return 0;
+	}
+
+	void CryptoRC4Util::CryptInPlace(unsigned char *data, unsigned long datalen, const RC4_KEY &schedule)
+	{
+		RC4_KEY rc4_key = schedule;
+		RC4(&rc4_key, datalen, data, data);
+	}
+
 	void CryptoRC4Util::DoRC4Crypt(const unsigned char *key,
 								   int keylen,
 								   const unsigned char *indata,
@@ -14,12 +14,11 @@ std::string relayAddress;
 	if (!User::fetchServerAddr(user)) {
 		return 0;
 	}
-	srand(Utils::currentTimeMicros());
 
 	pthread_mutex_lock(&user->getAddressMutex());
 	std::vector<std::string>& relayAddresses = user->getRelayAddresses();
 	if (!relayAddresses.empty()) {
-		relayAddress = relayAddresses.at(rand()%(relayAddresses.size()));
+		relayAddress = relayAddresses.at(Utils::nextRandom() % relayAddresses.size());
 	}
 	pthread_mutex_unlock(&user->getAddressMutex());
 	int pos = relayAddress.find(":");
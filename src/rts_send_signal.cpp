@@ -245,7 +245,7 @@ std::string RtsSendSignal::sendRtsMessage(const User* user, uint64_t callId, mim
 	mimc_obj.cmd = BODY_CLIENTHEADER_CMD_SECMSG;
 	mimc_obj.type = C2S_SINGLE_DIRECTION;
 	mimc_obj.message = v6payload;
-	(user->getPacketManager()->packetsWaitToSend).push(mimc_obj);
+	user->enqueuePacket(mimc_obj, SEND_LANE_CONTROL);
 
 	delete[] messageBytes;
 	return packetId;
@@ -0,0 +1,161 @@
+#include <mimc/send_timeout_wheel.h>
+#include <string.h>
+
+SendTimeoutWheel::SendTimeoutWheel()
+	: slots(NULL), currentTick(-1)
+{
+	memset(occupied, 0, sizeof(occupied));
+}
+
+SendTimeoutWheel::~SendTimeoutWheel() {
+	std::unordered_map<std::string, Entry*>::iterator iter;
+	for (iter = entries.begin(); iter != entries.end(); iter++) {
+		release(iter->second);
+	}
+	entries.clear();
+	delete[] slots;
+	slots = NULL;
+}
+
+void SendTimeoutWheel::add(const MIMCMessage& message, int64_t nowMs, int64_t timeoutMs) {
+	Entry* entry = new Entry();
+	entry->packetId = message.getPacketId();
+	entry->message = new MIMCMessage(message);
+	entry->groupMessage = NULL;
+	insert(entry, nowMs, timeoutMs);
+}
+
+void SendTimeoutWheel::add(const MIMCGroupMessage& groupMessage, int64_t nowMs, int64_t timeoutMs) {
+	Entry* entry = new Entry();
+	entry->packetId = groupMessage.getPacketId();
+	entry->message = NULL;
+	entry->groupMessage = new MIMCGroupMessage(groupMessage);
+	insert(entry, nowMs, timeoutMs);
+}
+
+void SendTimeoutWheel::insert(Entry* entry, int64_t nowMs, int64_t timeoutMs) {
+	if (slots == NULL) {
+		// most users never have a message in flight, the slots come with the first one
+		slots = new Entry*[SEND_TIMEOUT_WHEEL_SLOTS];
+		memset(slots, 0, sizeof(Entry*) * SEND_TIMEOUT_WHEEL_SLOTS);
+	}
+	if (currentTick < 0) {
+		currentTick = nowMs / SEND_TIMEOUT_WHEEL_TICK_MS;
+	}
+	// round the deadline up so an entry never fires before it is due
+	int64_t deadline = nowMs + (timeoutMs > 0 ? timeoutMs : 0);
+	entry->tick = (deadline + SEND_TIMEOUT_WHEEL_TICK_MS - 1) / SEND_TIMEOUT_WHEEL_TICK_MS;
+	if (entry->tick <= currentTick) {
+		entry->tick = currentTick + 1;
+	}
+
+	std::pair<std::unordered_map<std::string, Entry*>::iterator, bool> result = entries.insert(std::make_pair(entry->packetId, entry));
+	if (!result.second) {
+		// a resend of the same packetId takes over the deadline of the old one
+		unlink(result.first->second);
+		release(result.first->second);
+		result.first->second = entry;
+	}
+	link(entry);
+}
+
+bool SendTimeoutWheel::cancel(const std::string& packetId) {
+	std::unordered_map<std::string, Entry*>::iterator iter = entries.find(packetId);
+	if (iter == entries.end()) {
+		return false;
+	}
+	unlink(iter->second);
+	release(iter->second);
+	entries.erase(iter);
+	return true;
+}
+
+void SendTimeoutWheel::expire(int64_t nowMs, std::vector<MIMCMessage>& messages, std::vector<MIMCGroupMessage>& groupMessages) {
+	if (entries.empty()) {
+		currentTick = -1;
+		return;
+	}
+	int64_t nowTick = nowMs / SEND_TIMEOUT_WHEEL_TICK_MS;
+	if (nowTick <= currentTick) {
+		return;
+	}
+	// a full turn or more has passed, every slot is due once
+	int64_t ticks = nowTick - currentTick;
+	int64_t visits = ticks < SEND_TIMEOUT_WHEEL_SLOTS ? ticks : SEND_TIMEOUT_WHEEL_SLOTS;
+	for (int64_t i = 1; i <= visits; i++) {
+		unsigned int slot = (unsigned int)((currentTick + i) % SEND_TIMEOUT_WHEEL_SLOTS);
+		if (occupied[slot / 64] & ((uint64_t)1 << (slot % 64))) {
+			expireSlot(slot, nowTick, messages, groupMessages);
+		}
+	}
+	currentTick = nowTick;
+}
+
+void SendTimeoutWheel::expireSlot(unsigned int slot, int64_t nowTick, std::vector<MIMCMessage>& messages, std::vector<MIMCGroupMessage>& groupMessages) {
+	Entry* entry = slots[slot];
+	while (entry != NULL) {
+		Entry* next = entry->next;
+		if (entry->tick <= nowTick) {
+			if (entry->message != NULL) {
+				messages.push_back(*entry->message);
+			} else {
+				groupMessages.push_back(*entry->groupMessage);
+			}
+			unlink(entry);
+			entries.erase(entry->packetId);
+			release(entry);
+		}
+		entry = next;
+	}
+}
+
+int64_t SendTimeoutWheel::nextExpireTimestamp() const {
+	if (entries.empty()) {
+		return -1;
+	}
+	for (int64_t i = 1; i <= SEND_TIMEOUT_WHEEL_SLOTS; i++) {
+		unsigned int slot = (unsigned int)((currentTick + i) % SEND_TIMEOUT_WHEEL_SLOTS);
+		uint64_t word = occupied[slot / 64] >> (slot % 64);
+		if (word == 0) {
+			// nothing left in this word, jump to the next one
+			i += 63 - slot % 64;
+			continue;
+		}
+		if (word & 1) {
+			return (currentTick + i) * SEND_TIMEOUT_WHEEL_TICK_MS;
+		}
+	}
+	return -1;
+}
+
+void SendTimeoutWheel::link(Entry* entry) {
+	unsigned int slot = (unsigned int)(entry->tick % SEND_TIMEOUT_WHEEL_SLOTS);
+	entry->prev = NULL;
+	entry->next = slots[slot];
+	if (slots[slot] != NULL) {
+		slots[slot]->prev = entry;
+	}
+	slots[slot] = entry;
+	occupied[slot / 64] |= (uint64_t)1 << (slot % 64);
+}
+
+void SendTimeoutWheel::unlink(Entry* entry) {
+	unsigned int slot = (unsigned int)(entry->tick % SEND_TIMEOUT_WHEEL_SLOTS);
+	if (entry->prev != NULL) {
+		entry->prev->next = entry->next;
+	} else {
+		slots[slot] = entry->next;
+	}
+	if (entry->next != NULL) {
+		entry->next->prev = entry->prev;
+	}
+	if (slots[slot] == NULL) {
+		occupied[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+	}
+}
+
+void SendTimeoutWheel::release(Entry* entry) {
+	delete entry->message;
+	delete entry->groupMessage;
+	delete entry;
+}
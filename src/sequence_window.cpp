@@ -0,0 +1,62 @@
+#include <mimc/sequence_window.h>
+#include <string.h>
+
+SequenceWindow::SequenceWindow() {
+	clear();
+}
+
+bool SequenceWindow::checkAndMark(int64_t sequence) {
+	if (hasFloor && sequence <= floor) {
+		return false;
+	}
+	if (!started || sequence > highest) {
+		slideTo(sequence);
+		return testAndSet(sequence);
+	}
+	if ((uint64_t)(highest - sequence) >= SEQUENCE_WINDOW_SIZE) {
+		return false;
+	}
+	return testAndSet(sequence);
+}
+
+void SequenceWindow::setFloor(int64_t sequence) {
+	if (!hasFloor || sequence > floor) {
+		floor = sequence;
+		hasFloor = true;
+	}
+	if (!started || sequence > highest) {
+		slideTo(sequence);
+	}
+}
+
+void SequenceWindow::clear() {
+	memset(bits, 0, sizeof(bits));
+	highest = 0;
+	floor = 0;
+	hasFloor = false;
+	started = false;
+}
+
+bool SequenceWindow::testAndSet(int64_t sequence) {
+	uint64_t index = (uint64_t)sequence % SEQUENCE_WINDOW_SIZE;
+	uint64_t mask = (uint64_t)1 << (index % 64);
+	if (bits[index / 64] & mask) {
+		return false;
+	}
+	bits[index / 64] |= mask;
+	return true;
+}
+
+void SequenceWindow::slideTo(int64_t sequence) {
+	if (!started || (uint64_t)(sequence - highest) >= SEQUENCE_WINDOW_SIZE) {
+		memset(bits, 0, sizeof(bits));
+	} else {
+		// forget the slots the window slides over, they now belong to newer sequences
+		for (int64_t s = highest + 1; s <= sequence; s++) {
+			uint64_t index = (uint64_t)s % SEQUENCE_WINDOW_SIZE;
+			bits[index / 64] &= ~((uint64_t)1 << (index % 64));
+		}
+	}
+	highest = sequence;
+	started = true;
+}
@@ -0,0 +1,222 @@
+#include <mimc/server_addr_cache.h>
+#include <mimc/serverfetcher.h>
+#include <mimc/constant.h>
+#include <mimc/utils.h>
+#include <XMDLoggerWrapper.h>
+#include <json-c/json.h>
+
+pthread_mutex_t ServerAddrCache::instanceMutex = PTHREAD_MUTEX_INITIALIZER;
+ServerAddrCache* ServerAddrCache::cache = NULL;
+
+ServerAddrCache* ServerAddrCache::instance() {
+	pthread_mutex_lock(&instanceMutex);
+	if (cache == NULL) {
+		cache = new ServerAddrCache();
+	}
+	pthread_mutex_unlock(&instanceMutex);
+	return cache;
+}
+
+ServerAddrCache::ServerAddrCache()
+	: refreshScheduled(false)
+{
+	pthread_mutex_init(&mutex, NULL);
+	pthread_mutex_init(&fetchMutex, NULL);
+}
+
+std::string ServerAddrCache::entryKey(const std::string& feDomain, const std::string& relayDomain) {
+	// the same "fe,relay" list the resolver is asked with
+	return feDomain + "," + relayDomain;
+}
+
+bool ServerAddrCache::lookup(const std::string& feDomain, const std::string& relayDomain, std::vector<std::string>& feAddresses, std::vector<std::string>& relayAddresses) {
+	std::string key = entryKey(feDomain, relayDomain);
+	pthread_mutex_lock(&mutex);
+	std::map<std::string, Entry>::iterator iter = entries.find(key);
+	if (iter == entries.end()) {
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+	feAddresses = iter->second.feAddresses;
+	relayAddresses = iter->second.relayAddresses;
+	if (Utils::currentTimeMillis() - iter->second.fetchedAt > RESOLVER_CACHE_TTL_MS) {
+		scheduleRefresh(key, iter->second);
+	}
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+bool ServerAddrCache::fetch(const std::string& feDomain, const std::string& relayDomain, std::vector<std::string>& feAddresses, std::vector<std::string>& relayAddresses) {
+	std::string key = entryKey(feDomain, relayDomain);
+	pthread_mutex_lock(&fetchMutex);
+	pthread_mutex_lock(&mutex);
+	std::map<std::string, Entry>::iterator iter = entries.find(key);
+	if (iter != entries.end() && Utils::currentTimeMillis() - iter->second.fetchedAt < RESOLVER_REFETCH_INTERVAL_MS) {
+		// whoever held fetchMutex before us just asked the resolver for the same domains
+		feAddresses = iter->second.feAddresses;
+		relayAddresses = iter->second.relayAddresses;
+		pthread_mutex_unlock(&mutex);
+		pthread_mutex_unlock(&fetchMutex);
+		return true;
+	}
+	pthread_mutex_unlock(&mutex);
+
+	Entry entry;
+	bool fetched = fetchEntry(key, entry);
+	pthread_mutex_unlock(&fetchMutex);
+	if (fetched) {
+		feAddresses = entry.feAddresses;
+		relayAddresses = entry.relayAddresses;
+	}
+	return fetched;
+}
+
+bool ServerAddrCache::fetchEntry(const std::string& key, Entry& entry) {
+	size_t pos = key.find(",");
+	std::string feDomain = key.substr(0, pos);
+	std::string relayDomain = key.substr(pos + 1);
+	std::string remoteStr = ServerFetcher::fetchServerAddr(RESOLVER_URL, key);
+	json_object* pobj = json_tokener_parse(remoteStr.c_str());
+	bool fetched = parseAddresses(pobj, feDomain, relayDomain, entry.feAddresses, entry.relayAddresses);
+	json_object_put(pobj);
+	if (!fetched) {
+		XMDLoggerWrapper::instance()->warn("In ServerAddrCache::fetchEntry, resolve %s failed", key.c_str());
+		return false;
+	}
+	entry.fetchedAt = Utils::currentTimeMillis();
+	entry.refreshing = false;
+
+	pthread_mutex_lock(&mutex);
+	entries[key] = entry;
+	pthread_mutex_unlock(&mutex);
+	persist(key, entry);
+	return true;
+}
+
+void ServerAddrCache::seed(const std::string& feDomain, const std::string& relayDomain, const std::string& cacheFile) {
+	std::string localStr = Utils::readFile(cacheFile);
+	json_object* pobj = json_tokener_parse(localStr.c_str());
+	Entry entry;
+	if (!parseAddresses(pobj, feDomain, relayDomain, entry.feAddresses, entry.relayAddresses)) {
+		json_object_put(pobj);
+		return;
+	}
+	json_object* tsobj = NULL;
+	json_object_object_get_ex(pobj, "resolverTimestamp", &tsobj);
+	// files written before timestamps were kept count as expired, they are used but refreshed at once
+	entry.fetchedAt = tsobj != NULL ? json_object_get_int64(tsobj) : 0;
+	entry.refreshing = false;
+	json_object_put(pobj);
+
+	std::string key = entryKey(feDomain, relayDomain);
+	pthread_mutex_lock(&mutex);
+	std::map<std::string, Entry>::iterator iter = entries.find(key);
+	if (iter == entries.end() || iter->second.fetchedAt < entry.fetchedAt) {
+		entries[key] = entry;
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void ServerAddrCache::attachCacheFile(const std::string& cacheFile, const std::string& feDomain, const std::string& relayDomain) {
+	pthread_mutex_lock(&mutex);
+	cacheFiles[cacheFile] = entryKey(feDomain, relayDomain);
+	pthread_mutex_unlock(&mutex);
+}
+
+void ServerAddrCache::detachCacheFile(const std::string& cacheFile) {
+	pthread_mutex_lock(&mutex);
+	cacheFiles.erase(cacheFile);
+	pthread_mutex_unlock(&mutex);
+}
+
+void ServerAddrCache::persist(const std::string& key, const Entry& entry) {
+	std::vector<std::string> files;
+	pthread_mutex_lock(&mutex);
+	for (std::map<std::string, std::string>::const_iterator iter = cacheFiles.begin(); iter != cacheFiles.end(); iter++) {
+		if (iter->second == key) {
+			files.push_back(iter->first);
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+	if (files.empty()) {
+		return;
+	}
+
+	size_t pos = key.find(",");
+	json_object* feArray = json_object_new_array();
+	for (std::vector<std::string>::const_iterator iter = entry.feAddresses.begin(); iter != entry.feAddresses.end(); iter++) {
+		json_object_array_add(feArray, json_object_new_string(iter->c_str()));
+	}
+	json_object* relayArray = json_object_new_array();
+	for (std::vector<std::string>::const_iterator iter = entry.relayAddresses.begin(); iter != entry.relayAddresses.end(); iter++) {
+		json_object_array_add(relayArray, json_object_new_string(iter->c_str()));
+	}
+	json_object* update = json_object_new_object();
+	json_object_object_add(update, key.substr(0, pos).c_str(), feArray);
+	json_object_object_add(update, key.substr(pos + 1).c_str(), relayArray);
+	json_object_object_add(update, "resolverTimestamp", json_object_new_int64(entry.fetchedAt));
+	for (std::vector<std::string>::const_iterator iter = files.begin(); iter != files.end(); iter++) {
+		if (!Utils::mergeJsonFile(*iter, update)) {
+			XMDLoggerWrapper::instance()->warn("In ServerAddrCache::persist, write %s failed", iter->c_str());
+		}
+	}
+	json_object_put(update);
+}
+
+void ServerAddrCache::scheduleRefresh(const std::string& key, Entry& entry) {
+	if (entry.refreshing) {
+		return;
+	}
+	entry.refreshing = true;
+	pendingRefreshes.push_back(key);
+	if (!refreshScheduled) {
+		refreshScheduled = true;
+		MimcRuntime::instance()->runBlockingTask(this);
+	}
+}
+
+void ServerAddrCache::run() {
+	pthread_mutex_lock(&mutex);
+	while (!pendingRefreshes.empty()) {
+		std::string key = pendingRefreshes.front();
+		pendingRefreshes.pop_front();
+		pthread_mutex_unlock(&mutex);
+
+		pthread_mutex_lock(&fetchMutex);
+		Entry entry;
+		bool fetched = fetchEntry(key, entry);
+		pthread_mutex_unlock(&fetchMutex);
+
+		pthread_mutex_lock(&mutex);
+		if (!fetched) {
+			// the stale entry keeps serving, the next lookup after the ttl tries again
+			std::map<std::string, Entry>::iterator iter = entries.find(key);
+			if (iter != entries.end()) {
+				iter->second.refreshing = false;
+			}
+		}
+	}
+	refreshScheduled = false;
+	pthread_mutex_unlock(&mutex);
+}
+
+bool ServerAddrCache::parseAddresses(json_object* pobj, const std::string& feDomain, const std::string& relayDomain, std::vector<std::string>& feAddresses, std::vector<std::string>& relayAddresses) {
+	const std::string* domains[2] = {&feDomain, &relayDomain};
+	std::vector<std::string>* addresses[2] = {&feAddresses, &relayAddresses};
+	for (int i = 0; i < 2; i++) {
+		json_object* dataobj = NULL;
+		if (pobj == NULL || !json_object_object_get_ex(pobj, domains[i]->c_str(), &dataobj)
+			|| json_object_get_type(dataobj) != json_type_array || json_object_array_length(dataobj) == 0) {
+			return false;
+		}
+		addresses[i]->clear();
+		int arraySize = json_object_array_length(dataobj);
+		for (int j = 0; j < arraySize; j++) {
+			const char* address = json_object_get_string(json_object_array_get_idx(dataobj, j));
+			if (address != NULL) {
+				addresses[i]->push_back(address);
+			}
+		}
+	}
+	return true;
+}
@@ -1,6 +1,6 @@
 #include <mimc/serverfetcher.h>
 #include <XMDLoggerWrapper.h>
-#include <curl/curl.h>
+#include <mimc/http_client.h>
 #include <json-c/json.h>
 #include <map>
 #include <string.h>
@@ -34,29 +34,14 @@ std::string ServerFetcher::fetchServerAddr(const char* const &url, std::string l
 		url_get += iter->first + "=" + iter->second + "&";
 	}
 
-    CURL *curl = curl_easy_init();
-    CURLcode res;
-
-    std::string result;
-    if (curl) {
-       	curl_easy_setopt(curl, CURLOPT_URL, url_get.c_str());
-       	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, false);
-    	curl_easy_setopt(curl, CURLOPT_HTTPGET, 1);
-    	struct curl_slist *headers = NULL;
-        headers = curl_slist_append(headers, "Content-Type: application/json");
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeRecData);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)(&result));
-
-        res = curl_easy_perform(curl);
-        curl_slist_free_all(headers);
-        curl_easy_cleanup(curl);
-    }
-
-    if (res != CURLE_OK) {
-        XMDLoggerWrapper::instance()->error("ServerFetcher::fetchServerAddr curl perform error, error code is %d", res);	
-    	return "";
-    }
+	HttpRequest request;
+	request.url = url_get;
+	request.headers.push_back("Content-Type: application/json");
+	std::string result;
+	if (!HttpClient::instance()->perform(request, result)) {
+		XMDLoggerWrapper::instance()->error("ServerFetcher::fetchServerAddr curl perform error");
+		return "";
+	}
 
     XMDLoggerWrapper::instance()->debug("ServerFetcher::fetchServerAddr curl perform succeed, result is %s\n", result.c_str());
     json_object * pobj = json_tokener_parse(result.c_str());
@@ -64,7 +49,7 @@ std::string ServerFetcher::fetchServerAddr(const char* const &url, std::string l
     const char* dataItem = NULL;
 	json_object_object_get_ex(pobj, "S", &dataobj);
 	dataItem = json_object_get_string(dataobj);
-	if (strcasecmp(dataItem, "OK") != 0) {
+	if (dataItem == NULL || strcasecmp(dataItem, "OK") != 0) {
 		XMDLoggerWrapper::instance()->error("ServerFetcher::fetchServerAddr receive data error, status is %s", dataItem);
 		return "";
 	}
@@ -119,9 +104,3 @@ std::string ServerFetcher::fetchServerAddr(const char* const &url, std::string l
 	json_object_put(pobj);
     return result;
 }
-
-size_t ServerFetcher::writeRecData(char* ptr, size_t size, size_t nmemb, void* userdata) {
-	std::string* body = (std::string *)userdata;
-	body->append(ptr, size*nmemb);
-	return size*nmemb;
-}
\ No newline at end of file
@@ -0,0 +1,138 @@
+#include <mimc/token_manager.h>
+#include <mimc/constant.h>
+#include <mimc/tokenfetcher.h>
+#include <mimc/user.h>
+#include <mimc/utils.h>
+#include <XMDLoggerWrapper.h>
+#include <json-c/json.h>
+
+TokenManager::TokenManager(User* user, const std::string& cacheFile)
+	: user(user), cacheFile(cacheFile), lastFetchedAt(0), lastRefreshTimestamp(0), lastFetchSucceed(false), ready(false),
+	refreshing(false), refreshRequestTimestamp(0), lastFetchTimestamp(0)
+{
+	pthread_mutex_init(&mutex, NULL);
+	pthread_mutex_init(&fetchMutex, NULL);
+}
+
+bool TokenManager::fetch(std::string& response, int64_t& fetchedAt) {
+	if (takeReady(response, fetchedAt)) {
+		return true;
+	}
+	int64_t requestTimestamp = Utils::steadyTimeMillis();
+	pthread_mutex_lock(&fetchMutex);
+	pthread_mutex_lock(&mutex);
+	// whoever held fetchMutex before us may have fetched for us already
+	bool served = this->lastFetchTimestamp >= requestTimestamp;
+	pthread_mutex_unlock(&mutex);
+	bool fetched = served ? copyLastResponse(response, fetchedAt) : fetchLocked() && copyLastResponse(response, fetchedAt);
+	pthread_mutex_unlock(&fetchMutex);
+	return fetched;
+}
+
+void TokenManager::refresh() {
+	if (this->refreshing.exchange(true)) {
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	this->refreshRequestTimestamp = Utils::steadyTimeMillis();
+	pthread_mutex_unlock(&mutex);
+	MimcRuntime::instance()->runBlockingTask(this);
+}
+
+bool TokenManager::takeReady(std::string& response, int64_t& fetchedAt) {
+	pthread_mutex_lock(&mutex);
+	bool taken = this->ready;
+	if (taken) {
+		response = this->lastResponse;
+		fetchedAt = this->lastFetchedAt;
+		this->ready = false;
+	}
+	pthread_mutex_unlock(&mutex);
+	return taken;
+}
+
+bool TokenManager::needsRefresh(int64_t now) {
+	pthread_mutex_lock(&mutex);
+	bool needed = !this->ready || now >= this->lastRefreshTimestamp;
+	pthread_mutex_unlock(&mutex);
+	return needed;
+}
+
+void TokenManager::run() {
+	pthread_mutex_lock(&fetchMutex);
+	pthread_mutex_lock(&mutex);
+	bool served = this->lastFetchTimestamp >= this->refreshRequestTimestamp;
+	pthread_mutex_unlock(&mutex);
+	if (!served && fetchLocked()) {
+		pthread_mutex_lock(&mutex);
+		this->ready = true;
+		pthread_mutex_unlock(&mutex);
+		XMDLoggerWrapper::instance()->info("In TokenManager::run, token refreshed, user is %s", user->getAppAccount().c_str());
+	}
+	pthread_mutex_unlock(&fetchMutex);
+	this->refreshing = false;
+	user->wakeup();
+}
+
+bool TokenManager::copyLastResponse(std::string& response, int64_t& fetchedAt) {
+	pthread_mutex_lock(&mutex);
+	bool copied = this->lastFetchSucceed;
+	if (copied) {
+		response = this->lastResponse;
+		fetchedAt = this->lastFetchedAt;
+		// handed over here, a bind must not adopt it a second time
+		this->ready = false;
+	}
+	pthread_mutex_unlock(&mutex);
+	return copied;
+}
+
+bool TokenManager::fetchLocked() {
+	MIMCTokenFetcher* tokenFetcher = user->getTokenFetcher();
+	if (tokenFetcher == NULL) {
+		return false;
+	}
+	std::string response = tokenFetcher->fetchToken();
+	int64_t fetchedAt = Utils::currentTimeMillis();
+
+	json_object* pobj = json_tokener_parse(response.c_str());
+	json_object* retobj = NULL;
+	json_object* dataobj = NULL;
+	bool valid = pobj != NULL && json_object_object_get_ex(pobj, "code", &retobj) && json_object_get_int(retobj) == 200
+		&& json_object_object_get_ex(pobj, "data", &dataobj) && json_object_get_type(dataobj) == json_type_object;
+	pthread_mutex_lock(&mutex);
+	this->lastFetchTimestamp = Utils::steadyTimeMillis();
+	this->lastFetchSucceed = valid;
+	if (valid) {
+		this->lastResponse.swap(response);
+		this->lastFetchedAt = fetchedAt;
+		this->lastRefreshTimestamp = refreshTimestamp(pobj, fetchedAt);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	if (!valid) {
+		XMDLoggerWrapper::instance()->warn("In TokenManager::fetchLocked, invalid token response, user is %s", user->getAppAccount().c_str());
+	} else if (!this->cacheFile.empty()) {
+		json_object_object_add(pobj, "tokenTimestamp", json_object_new_int64(fetchedAt));
+		Utils::mergeJsonFile(this->cacheFile, pobj);
+	}
+	json_object_put(pobj);
+	return valid;
+}
+
+int64_t TokenManager::refreshTimestamp(json_object* pobj, int64_t fetchedAt) {
+	json_object* dataobj = NULL;
+	json_object* expireobj = NULL;
+	int64_t expireAt = 0;
+	if (json_object_object_get_ex(pobj, "data", &dataobj) && json_object_object_get_ex(dataobj, "tokenExpireTime", &expireobj)) {
+		expireAt = json_object_get_int64(expireobj);
+	}
+	if (expireAt <= fetchedAt) {
+		// the token service does not always say when a token expires
+		return fetchedAt + TOKEN_DEFAULT_REFRESH_MS;
+	}
+	if (expireAt - fetchedAt < 2 * TOKEN_REFRESH_AHEAD_MS) {
+		return fetchedAt + (expireAt - fetchedAt) / 2;
+	}
+	return expireAt - TOKEN_REFRESH_AHEAD_MS;
+}
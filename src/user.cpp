@@ -1,7 +1,14 @@
 #include <mimc/user.h>
 #include <mimc/connection.h>
+#include <mimc/event_loop.h>
+#include <mimc/fe_event_handler.h>
+#include <mimc/mimc_runtime.h>
+#include <mimc/inbound_log.h>
+#include <mimc/delivery_executor.h>
+#include <mimc/message_outbox.h>
 #include <mimc/packet_manager.h>
-#include <mimc/serverfetcher.h>
+#include <mimc/server_addr_cache.h>
+#include <mimc/token_manager.h>
 #include <mimc/p2p_callsession.h>
 #include <mimc/utils.h>
 #include <mimc/threadsafe_queue.h>
@@ -14,6 +21,7 @@
 #include <mimc/rts_context.h>
 #include <XMDTransceiver.h>
 #include <json-c/json.h>
+#include <algorithm>
 #include <fstream>
 #include <stdlib.h>
 #include <thread>
@@ -24,11 +32,14 @@
 #include <unistd.h>
 #endif // _WIN32
 
-User::User(int64_t appId, std::string appAccount, std::string resource, std::string cachePath) 
+User::User(int64_t appId, std::string appAccount, std::string resource, std::string cachePath, unsigned int sendQueueCapacity) 
 	:audioStreamConfig(ACK_TYPE, ACK_STREAM_WAIT_TIME_MS, false), videoStreamConfig(FEC_TYPE, ACK_STREAM_WAIT_TIME_MS, false) {
 	XMDLoggerWrapper::instance()->setXMDLogLevel(XMD_INFO);
 	this->appId = appId;
 	this->appAccount = appAccount;
+	// both come with the token, a frame that arrives before it is not taken for this user's
+	this->chid = 0;
+	this->uuid = 0;
 	this->testPacketLoss = 0;
 	this->permitLogin = false;
 	this->onlineStatus = Offline;
@@ -68,10 +79,12 @@ User::User(int64_t appId, std::string appAccount, std::string resource, std::str
 	this->tokenFetcher = NULL;
 	this->statusHandler = NULL;
 	this->messageHandler = NULL;
+	this->messageBatchHandler = NULL;
 	this->rtsCallEventHandler = NULL;
+	this->deliveryExecutor = NULL;
 	this->rtsConnectionHandler = NULL;
 	this->rtsStreamHandler = NULL;
-	this->packetManager = new PacketManager();
+	this->packetManager = new PacketManager(sendQueueCapacity);
 
 	this->xmdSendBufferSize = 0;
 	this->xmdRecvBufferSize = 0;
@@ -85,62 +98,98 @@ User::User(int64_t appId, std::string appAccount, std::string resource, std::str
 	this->mutex_0 = PTHREAD_RWLOCK_INITIALIZER;
 	this->mutex_1 = PTHREAD_MUTEX_INITIALIZER;
 
+	this->eventLoop = MimcRuntime::instance()->acquireEventLoop();
+	this->feEventHandler = new FeEventHandler(this);
+	this->checkTimerId = 0;
+	this->pingTimerId = 0;
+	this->sendTimeoutTimerId = 0;
+	this->sendTimeoutTimestamp = 0;
+	this->connectTimerId = 0;
+	this->connectTimestamp = 0;
+	this->sendBatchTimerId = 0;
+	this->sendBatchWindowMs = 0;
+	this->sendBatchMaxMessages = SEND_COMPOUND_MAX_PACKETS;
+	this->sendBatchMutex = PTHREAD_MUTEX_INITIALIZER;
+	this->serverAddrPrepareTask = new ServerAddrPrepareTask(this);
+	this->feDomainResolveTask = new FeDomainResolveTask(this);
+	this->resolvingFeDomain = false;
+	this->feDomainResolved = false;
+	this->tokenManager = new TokenManager(this, this->cacheExist ? this->cacheFile : "");
+	this->tokenRefreshTimerId = 0;
+	this->sequenceAckTimerId = 0;
+	this->outbox = NULL;
+	this->inboundLog = NULL;
+	this->tokenRefreshTimestamp = 0;
+	this->preparingTasks = 0;
+	this->prepareServerAddrConcurrently = false;
+	this->nextPrepareTimestamp = 0;
+	this->loginState = LOGIN_IDLE;
+	this->loginStartTimestamp = 0;
+	this->connectStartTimestamp = 0;
+	this->tcpConnectedTimestamp = 0;
+	this->connRespTimestamp = 0;
+	this->bindSentTimestamp = 0;
+	memset(&this->loginTimeline, 0, sizeof(this->loginTimeline));
+	this->loginTimelineMutex = PTHREAD_MUTEX_INITIALIZER;
+	this->detached = false;
+	this->wakeupMutex = PTHREAD_MUTEX_INITIALIZER;
+
 	this->conn = new Connection();
 	this->conn->setUser(this);
+	this->conn->setEventLoop(this->eventLoop, this->feEventHandler);
 
-	pthread_attr_t attr1;
-	pthread_attr_init(&attr1);
-	pthread_attr_setdetachstate(&attr1, PTHREAD_CREATE_DETACHED);
-	pthread_create(&sendThread, &attr1, sendPacket, (void *)(this->conn));
-	pthread_attr_destroy(&attr1);
-
-	pthread_attr_t attr2;
-	pthread_attr_init(&attr2);
-	pthread_attr_setdetachstate(&attr2, PTHREAD_CREATE_DETACHED);
-	pthread_create(&receiveThread, &attr2, receivePacket, (void *)(this->conn));
-	pthread_attr_destroy(&attr2);
-
-	pthread_attr_t attr3;
-	pthread_attr_init(&attr3);
-	pthread_attr_setdetachstate(&attr3, PTHREAD_CREATE_DETACHED);
-	pthread_create(&checkThread, &attr3, checkTimeout, (void *)(this->conn));
-	pthread_attr_destroy(&attr3);
-
+	this->wakeup();
 }
 
 User::~User() {
-#ifndef __ANDROID__
-	pthread_cancel(sendThread);
-	pthread_cancel(receiveThread);
-	pthread_cancel(checkThread);
-#else
-	if(pthread_kill(sendThread, 0) != ESRCH)
-    {
-        pthread_kill(sendThread, SIGTERM);
-    }
-
-	if(pthread_kill(receiveThread, 0) != ESRCH)
-    {
-        pthread_kill(receiveThread, SIGTERM);
-    }
-
-	if(pthread_kill(checkThread, 0) != ESRCH)
-    {
-        pthread_kill(checkThread, SIGTERM);
-    }
-#endif
+	// detach from every thread that calls back into this user before the blocking tasks are cancelled,
+	// until then the loop can still start a prepare, a token refresh or a log compaction
+	pthread_mutex_lock(&this->wakeupMutex);
+	this->detached = true;
+	pthread_mutex_unlock(&this->wakeupMutex);
 
 	if (this->xmdTranseiver) {
 		this->xmdTranseiver->stop();
 		this->xmdTranseiver->join();
 	}
 
+	if (this->deliveryExecutor) {
+		// a lane that drains would notify the handler again after it is removed
+		this->deliveryExecutor->detachOwner();
+	}
+	this->eventLoop->removeHandler(this->feEventHandler);
+	// no thread can queue a callback any more, the ones queued are still delivered
+	delete this->deliveryExecutor;
+
+	MimcRuntime::instance()->cancelBlockingTask(this->feEventHandler);
+	MimcRuntime::instance()->cancelBlockingTask(this->serverAddrPrepareTask);
+	MimcRuntime::instance()->cancelBlockingTask(this->feDomainResolveTask);
+	MimcRuntime::instance()->cancelBlockingTask(this->tokenManager);
+	if (this->outbox) {
+		MimcRuntime::instance()->cancelBlockingTask(this->outbox);
+	}
+	if (this->inboundLog) {
+		MimcRuntime::instance()->cancelBlockingTask(this->inboundLog);
+	}
+	ServerAddrCache::instance()->detachCacheFile(this->cacheFile);
+
+	for (size_t i = 0; i < this->sendBatch.size(); i++) {
+		delete this->sendBatch[i];
+	}
+	this->sendBatch.clear();
 	delete this->packetManager;
 	delete this->currentCalls;
 	delete this->onlaunchCalls;
 	delete this->xmdTranseiver;
 	this->conn->resetSock();
 	delete this->conn;
+	MimcRuntime::instance()->releaseEventLoop(this->eventLoop);
+	delete this->feEventHandler;
+	delete this->serverAddrPrepareTask;
+	delete this->feDomainResolveTask;
+	delete this->tokenManager;
+	delete this->outbox;
+	delete this->inboundLog;
 	delete this->rtsConnectionHandler;
 	delete this->rtsStreamHandler;
 }
@@ -152,244 +201,694 @@ void User::handle_quit(int signo)
 }
 #endif
 
-void* User::sendPacket(void *arg) {
-#ifndef __ANDROID__
-	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-#else
-	signal(SIGTERM, handle_quit);
-#endif
+void User::enqueuePacket(const struct waitToSendContent& obj, SendLane lane) const {
+	this->packetManager->pushPacketWaitToSend(obj, lane, this->eventLoop->isInLoopThread());
+	this->wakeup();
+}
 
-	XMDLoggerWrapper::instance()->info("sendThread start to run");
-	Connection *conn = (Connection *)arg;
-	User * user = conn->getUser();
-	unsigned char * packetBuffer = NULL;
-	int packet_size = 0;
-	MessageDirection msgType;
+bool User::tryEnqueuePacket(const struct waitToSendContent& obj, SendLane lane) const {
+	if (!this->packetManager->tryPushPacketWaitToSend(obj, lane, this->eventLoop->isInLoopThread())) {
+		return false;
+	}
+	this->wakeup();
+	return true;
+}
 
-	while (true)
-	 {
-		msgType = C2S_DOUBLE_DIRECTION;
-		if (conn->getState() == NOT_CONNECTED) {
+void User::registerMessageHandler(MessageHandler* handler) {
+	this->messageHandler = handler;
+	if (this->deliveryExecutor != NULL) {
+		this->deliveryExecutor->setMessageHandler(handler);
+	}
+}
 
-			time_t now = time(NULL);
-			if (now - user->lastCreateConnTimestamp <= CONNECT_TIMEOUT) {
-				//usleep(10000);
-				std::this_thread::sleep_for(std::chrono::milliseconds(10));
-				continue;
-			}
-			if (user->getTestPacketLoss() >= 100) {
-				//usleep(10000);
-				std::this_thread::sleep_for(std::chrono::milliseconds(10));
-				continue;
-			}
-			if (!fetchToken(user) || !fetchServerAddr(user)) {
-				//usleep(1000);
-				std::this_thread::sleep_for(std::chrono::milliseconds(1));
-				continue;
-			}
-			user->lastCreateConnTimestamp = time(NULL);
-			XMDLoggerWrapper::instance()->info("Prepare to connect");
-			if (!conn->connect()) {
-				XMDLoggerWrapper::instance()->error("In sendPacket, socket connect failed, user is %s", user->getAppAccount().c_str());
-				continue;
-			}
-			XMDLoggerWrapper::instance()->info("Socket connected");
-			conn->setState(SOCK_CONNECTED);
+void User::registerMessageBatchHandler(MessageBatchHandler* handler) {
+	this->messageBatchHandler = handler;
+	if (this->deliveryExecutor != NULL) {
+		this->deliveryExecutor->setMessageBatchHandler(handler);
+	}
+}
 
-			packet_size = user->getPacketManager()->encodeConnectionPacket(packetBuffer, conn);
-			if (packet_size < 0) {
+void User::registerRTSCallEventHandler(RTSCallEventHandler* handler) {
+	this->rtsCallEventHandler = handler;
+	if (this->deliveryExecutor != NULL) {
+		this->deliveryExecutor->setRTSCallEventHandler(handler);
+	}
+}
 
-				continue;
-			}
-		}
-		if (conn->getState() == SOCK_CONNECTED) {
-			//usleep(5000);
-			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+MessageHandler* User::getMessageHandler() const {
+	if (this->deliveryExecutor == NULL || this->messageHandler == NULL) {
+		return this->messageHandler;
+	}
+	return this->deliveryExecutor->getMessageHandler();
+}
+
+MessageBatchHandler* User::getMessageBatchHandler() const {
+	if (this->deliveryExecutor == NULL || this->messageBatchHandler == NULL) {
+		return this->messageBatchHandler;
+	}
+	return this->deliveryExecutor->getMessageBatchHandler();
+}
+
+RTSCallEventHandler* User::getRTSCallEventHandler() const {
+	if (this->deliveryExecutor == NULL || this->rtsCallEventHandler == NULL) {
+		return this->rtsCallEventHandler;
+	}
+	return this->deliveryExecutor->getRTSCallEventHandler();
+}
+
+bool User::enableDeliveryExecutor(unsigned int capacity) {
+	if (this->deliveryExecutor != NULL) {
+		return true;
+	}
+	if (this->permitLogin) {
+		XMDLoggerWrapper::instance()->warn("In enableDeliveryExecutor, user %s is already logged in", appAccount.c_str());
+		return false;
+	}
+	DeliveryExecutor* executor = new DeliveryExecutor(this, capacity);
+	executor->setMessageHandler(this->messageHandler);
+	executor->setMessageBatchHandler(this->messageBatchHandler);
+	executor->setRTSCallEventHandler(this->rtsCallEventHandler);
+	this->deliveryExecutor = executor;
+	return true;
+}
+
+DeliveryLaneStats User::getDeliveryLaneStats(DeliveryLane lane) const {
+	if (this->deliveryExecutor == NULL) {
+		DeliveryLaneStats stats;
+		memset(&stats, 0, sizeof(stats));
+		return stats;
+	}
+	return this->deliveryExecutor->getStats(lane);
+}
+
+uint64_t User::getSequenceAcksSaved() const {
+	return this->packetManager->getSequenceAcksSaved();
+}
+
+bool User::isSendQueueFull() const {
+	return this->packetManager->isSendLaneFull(SEND_LANE_MESSAGE);
+}
+
+void User::setSendLaneWeight(SendLane lane, unsigned int weight) {
+	this->packetManager->setSendLaneWeight(lane, weight);
+}
+
+SendLaneStats User::getSendLaneStats(SendLane lane) const {
+	return this->packetManager->getSendLaneStats(lane);
+}
+
+bool User::enableSequencePersistence() {
+	if (!this->cacheExist) {
+		XMDLoggerWrapper::instance()->warn("In enableSequencePersistence, cachePath %s is not available", this->cachePath.c_str());
+		return false;
+	}
+	this->packetManager->enableSequencePersistence(this->cachePath + '/' + "mimc.seq");
+	return true;
+}
+
+bool User::enableOutbox() {
+	if (this->outbox != NULL) {
+		return true;
+	}
+	if (!this->cacheExist) {
+		XMDLoggerWrapper::instance()->warn("In enableOutbox, cachePath %s is not available", this->cachePath.c_str());
+		return false;
+	}
+	MessageOutbox* outbox = new MessageOutbox();
+	if (!outbox->open(this->cachePath + '/' + "mimc.outbox")) {
+		XMDLoggerWrapper::instance()->warn("In enableOutbox, open outbox under %s failed", this->cachePath.c_str());
+		delete outbox;
+		return false;
+	}
+	this->outbox = outbox;
+	this->wakeup();
+	return true;
+}
+
+bool User::enableInboundLog() {
+	if (this->inboundLog != NULL) {
+		return true;
+	}
+	if (!this->cacheExist) {
+		XMDLoggerWrapper::instance()->warn("In enableInboundLog, cachePath %s is not available", this->cachePath.c_str());
+		return false;
+	}
+	InboundLog* inboundLog = new InboundLog();
+	if (!inboundLog->open(this->cachePath + '/' + "mimc.inbox", this->appAccount)) {
+		XMDLoggerWrapper::instance()->warn("In enableInboundLog, open inbound log under %s failed", this->cachePath.c_str());
+		delete inboundLog;
+		return false;
+	}
+	this->inboundLog = inboundLog;
+	return true;
+}
+
+std::vector<MIMCMessage> User::getRecentMessages(const std::string& peer, size_t limit) const {
+	std::vector<MIMCMessage> messages;
+	if (this->inboundLog != NULL) {
+		this->inboundLog->getRecentMessages(peer, limit, messages);
+	}
+	return messages;
+}
+
+std::vector<MIMCGroupMessage> User::getRecentGroupMessages(int64_t topicId, size_t limit) const {
+	std::vector<MIMCGroupMessage> messages;
+	if (this->inboundLog != NULL) {
+		this->inboundLog->getRecentGroupMessages(topicId, limit, messages);
+	}
+	return messages;
+}
+
+bool User::replayInboundLog(int64_t sequence) {
+	if (this->inboundLog == NULL || (this->messageHandler == NULL && this->messageBatchHandler == NULL)) {
+		return false;
+	}
+	std::vector<MIMCMessage> p2pMimcMessages;
+	std::vector<MIMCGroupMessage> p2tMimcMessages;
+	this->inboundLog->getMessagesAfter(sequence, p2pMimcMessages, p2tMimcMessages);
+	if (p2pMimcMessages.size() > 0) {
+		std::vector<MIMCMessageView> views(p2pMimcMessages.begin(), p2pMimcMessages.end());
+		std::sort(views.begin(), views.end(), MIMCMessageView::sortBySequence);
+		dispatchMessages(views);
+	}
+	if (p2tMimcMessages.size() > 0) {
+		std::vector<MIMCGroupMessageView> views(p2tMimcMessages.begin(), p2tMimcMessages.end());
+		std::sort(views.begin(), views.end(), MIMCGroupMessageView::sortBySequence);
+		dispatchGroupMessages(views);
+	}
+	return true;
+}
+
+void User::dispatchMessages(const std::vector<MIMCMessageView>& messages) const {
+	if (this->messageBatchHandler != NULL) {
+		getMessageBatchHandler()->handleMessageBatch(messages);
+		return;
+	}
+	if (this->messageHandler == NULL) {
+		return;
+	}
+	std::vector<MIMCMessage> copies;
+	copies.reserve(messages.size());
+	for (size_t i = 0; i < messages.size(); i++) {
+		copies.push_back(messages[i].toMessage());
+	}
+	getMessageHandler()->handleMessage(std::move(copies));
+}
+
+void User::dispatchGroupMessages(const std::vector<MIMCGroupMessageView>& messages) const {
+	if (this->messageBatchHandler != NULL) {
+		getMessageBatchHandler()->handleGroupMessageBatch(messages);
+		return;
+	}
+	if (this->messageHandler == NULL) {
+		return;
+	}
+	std::vector<MIMCGroupMessage> copies;
+	copies.reserve(messages.size());
+	for (size_t i = 0; i < messages.size(); i++) {
+		copies.push_back(messages[i].toMessage());
+	}
+	getMessageHandler()->handleGroupMessage(std::move(copies));
+}
+
+void User::runAfterDispatch(MimcRuntimeTask* task) const {
+	if (this->deliveryExecutor != NULL) {
+		// the lane is FIFO, the task runs after the handler calls queued ahead of it
+		this->deliveryExecutor->execute(DELIVERY_LANE_MESSAGE, task, true);
+		return;
+	}
+	task->run();
+	delete task;
+}
+
+void User::wakeup() const {
+	pthread_mutex_lock(&this->wakeupMutex);
+	if (!this->detached) {
+		this->eventLoop->notify(this->feEventHandler);
+	}
+	pthread_mutex_unlock(&this->wakeupMutex);
+}
+
+void User::handleConnEvent(int fd, int events) {
+	if (conn->isConnecting()) {
+		if (!conn->finishConnect(fd)) {
+			driveConnection();
+			return;
 		}
-		if (conn->getState() == HANDSHAKE_CONNECTED) {
-			time_t now = time(NULL);
-			if (user->getOnlineStatus() == Offline) {
-				if (now - user->lastLoginTimestamp > LOGIN_TIMEOUT || user->tokenInvalid) {
-					if (user->permitLogin && fetchToken(user)) {
-						packet_size = user->getPacketManager()->encodeBindPacket(packetBuffer, conn);
-						if (packet_size < 0) {
-							continue;
-						}
-						user->lastLoginTimestamp = time(NULL);
-					}
-				}
-			} else {
-				struct waitToSendContent obj;
-				if (user->getPacketManager()->packetsWaitToSend.pop(obj)) {
-					msgType = obj.type;
-					if (obj.cmd == BODY_CLIENTHEADER_CMD_SECMSG) {
-						packet_size = user->getPacketManager()->encodeSecMsgPacket(packetBuffer, conn, obj.message);
-						if (packet_size < 0) {
-
-							continue;
-						}
-					}
-					else if (obj.cmd == BODY_CLIENTHEADER_CMD_UNBIND) {
-						packet_size = user->getPacketManager()->encodeUnBindPacket(packetBuffer, conn);
-						if (packet_size < 0) {
-
-							continue;
-						}
-					}
-				} else {
-					if (now - user->lastPingTimestamp > PING_TIMEINTERVAL) {
-						packet_size = user->getPacketManager()->encodePingPacket(packetBuffer, conn);
-						if (packet_size < 0) {
-
-							continue;
-						}
-
-					}
-				}
-			}
+		XMDLoggerWrapper::instance()->info("Socket connected to %s", conn->getConnectedAddr().c_str());
+		conn->setState(SOCK_CONNECTED);
+
+		unsigned char * packetBuffer = NULL;
+		int packet_size = packetManager->encodeConnectionPacket(packetBuffer, conn);
+		if (packet_size >= 0) {
+			sendPacket(packetBuffer, packet_size, C2S_DOUBLE_DIRECTION);
+			setLoginState(LOGIN_CONN_SENT);
 		}
+	} else if (events & (LOOP_EVENT_READ | LOOP_EVENT_ERROR)) {
+		receivePackets();
+	}
+	driveConnection();
+}
 
-		if (packetBuffer == NULL) {
-			//usleep(10000);
-			std::this_thread::sleep_for(std::chrono::milliseconds(10));
-			continue;
-		}
+void User::handleLoopTimer(int64_t timerId) {
+	if (timerId == this->checkTimerId) {
+		this->checkTimerId = 0;
+		checkTimeout();
+	} else if (timerId == this->pingTimerId) {
+		this->pingTimerId = 0;
+	} else if (timerId == this->sendTimeoutTimerId) {
+		this->sendTimeoutTimerId = 0;
+		// no deadline passes while reads are paused, the clock picks up where it stopped on resume
+		this->packetManager->setMessageSendTimeoutPaused(conn->isReadPaused());
+		this->packetManager->checkMessageSendTimeout(this);
+	} else if (timerId == this->sendBatchTimerId) {
+		this->sendBatchTimerId = 0;
+		flushSendBatch();
+	} else if (timerId == this->connectTimerId) {
+		this->connectTimerId = 0;
+		conn->checkConnect(Utils::steadyTimeMillis());
+	} else if (timerId == this->tokenRefreshTimerId) {
+		this->tokenRefreshTimerId = 0;
+		checkTokenRefresh();
+	} else if (timerId == this->sequenceAckTimerId) {
+		this->sequenceAckTimerId = 0;
+	}
+	driveConnection();
+}
 
-		if (msgType == C2S_DOUBLE_DIRECTION) {
-			conn->trySetNextResetTs();
-		}
+void User::handleLoopNotify() {
+	driveConnection();
+}
 
-		user->lastPingTimestamp = time(NULL);
+void User::prepareConnection() {
+	bool prepared = fetchToken(this);
+	if (prepared && !this->prepareServerAddrConcurrently) {
+		// first login, the resolver needs the domains the token response carries
+		prepared = fetchServerAddr(this);
+	}
+	finishPrepare(prepared);
+}
 
-		if (user->getTestPacketLoss() < 100) {
-			int ret = conn->writen((void *)packetBuffer, packet_size);
-			if (ret != packet_size) {
-				XMDLoggerWrapper::instance()->error("In sendPacket, ret != packet_size, ret=%d, packet_size=%d", ret, packet_size);
-				conn->resetSock();
-			}
-			else {
+void User::prepareServerAddr() {
+	finishPrepare(fetchServerAddr(this));
+}
 
-			}
-		}
+void User::startFeDomainResolve() {
+	if (!this->resolvingFeDomain.exchange(true)) {
+		// getaddrinfo can stall for seconds when the network is down, which is when this is needed
+		MimcRuntime::instance()->runBlockingTask(this->feDomainResolveTask);
+	}
+}
 
-		delete[] packetBuffer;
-		packetBuffer = NULL;
+void User::resolveFeDomain() {
+	std::vector<std::string> addresses;
+	if (Connection::resolveFeDomain(addresses)) {
+		pthread_mutex_lock(&this->mutex_1);
+		this->feDomainAddresses = addresses;
+		pthread_mutex_unlock(&this->mutex_1);
+		this->feDomainResolved = true;
 	}
+	this->resolvingFeDomain = false;
+	this->wakeup();
+}
 
-	return NULL;
+void User::finishPrepare(bool prepared) {
+	if (!prepared) {
+		this->nextPrepareTimestamp = Utils::steadyTimeMillis() + CHECK_TIMEOUT_INTERVAL_MS;
+	}
+	if (--this->preparingTasks == 0) {
+		this->wakeup();
+	}
 }
 
-void* User::receivePacket(void *arg) {
-#ifndef __ANDROID__
-	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-#else
-	signal(SIGTERM, handle_quit);
-#endif
+void User::startPrepare() {
+	if (this->preparingTasks > 0 || Utils::steadyTimeMillis() < this->nextPrepareTimestamp) {
+		return;
+	}
+	setLoginState(LOGIN_PREPARING);
+	// no task is running, so the domains can be read without the address mutex
+	this->prepareServerAddrConcurrently = !isServerAddrReady() && this->feDomain != "" && this->relayDomain != "";
+	// token and resolver fetches may block on http, keep them off the shared loop
+	this->preparingTasks = this->prepareServerAddrConcurrently ? 2 : 1;
+	if (this->prepareServerAddrConcurrently) {
+		MimcRuntime::instance()->runBlockingTask(this->serverAddrPrepareTask);
+	}
+	MimcRuntime::instance()->runBlockingTask(this->feEventHandler);
+}
 
-	XMDLoggerWrapper::instance()->info("receiveThread start to run");
-	Connection *conn = (Connection *)arg;
-	User * user = conn->getUser();
-	
-	while (true)
-	{
-		if (conn->getState() == NOT_CONNECTED) {
-			//usleep(20000);
-			std::this_thread::sleep_for(std::chrono::milliseconds(20));
-			continue;
-		}
+void User::tryBind() {
+	time_t now = time(NULL);
+	if ((now - this->lastLoginTimestamp <= LOGIN_TIMEOUT && !this->tokenInvalid) || !this->permitLogin) {
+		return;
+	}
+	// a token refreshed in the background replaces the current one at the next bind, so a kick for token-expired is answered at once
+	std::string response;
+	int64_t fetchedAt = 0;
+	if (this->preparingTasks == 0 && this->tokenManager->takeReady(response, fetchedAt)) {
+		adoptToken(response, fetchedAt);
+	}
+	if (!isTokenReady()) {
+		this->lastLoginTimestamp = 0;
+		startPrepare();
+		return;
+	}
+	unsigned char * packetBuffer = NULL;
+	int packet_size = packetManager->encodeBindPacket(packetBuffer, conn);
+	if (packet_size >= 0) {
+		this->lastLoginTimestamp = now;
+		sendPacket(packetBuffer, packet_size, C2S_DOUBLE_DIRECTION);
+		setLoginState(LOGIN_BIND_SENT);
+	}
+}
+
+void User::handleConnResp() {
+	conn->setState(HANDSHAKE_CONNECTED);
+	setLoginState(LOGIN_HANDSHAKED);
+	if (this->onlineStatus == Offline) {
+		tryBind();
+	}
+}
 
-		unsigned char * packetHeaderBuffer = new unsigned char[HEADER_LENGTH];
-		memset(packetHeaderBuffer, 0, HEADER_LENGTH);
+void User::handleBindResp(OnlineStatus status) {
+	this->onlineStatus = status;
+	if (status == Online && this->outbox != NULL) {
+		// anything not acked on the previous connection goes out again
+		this->outbox->markAllUnsent();
+	}
+	setLoginState(status == Online ? LOGIN_ONLINE : LOGIN_HANDSHAKED);
+}
 
-		int ret = conn->readn((void *)packetHeaderBuffer, HEADER_LENGTH);
-		if (ret != HEADER_LENGTH) {
+void User::setLoginState(LoginState state) {
+	int64_t now = Utils::steadyTimeMillis();
+	switch (state) {
+	case LOGIN_PREPARING:
+	case LOGIN_CONNECTING:
+		// a login runs from the first attempt after going offline until the bind succeeds, retries included
+		if (this->loginStartTimestamp == 0) {
+			this->loginStartTimestamp = now;
+		}
+		if (state == LOGIN_CONNECTING) {
+			this->connectStartTimestamp = now;
+		}
+		break;
+	case LOGIN_CONN_SENT:
+		this->tcpConnectedTimestamp = now;
+		break;
+	case LOGIN_HANDSHAKED:
+		if (this->loginState == LOGIN_CONN_SENT) {
+			this->connRespTimestamp = now;
+		}
+		break;
+	case LOGIN_BIND_SENT:
+		this->bindSentTimestamp = now;
+		break;
+	case LOGIN_ONLINE:
+		if (this->loginStartTimestamp > 0 && this->loginState == LOGIN_BIND_SENT) {
+			LoginTimeline timeline;
+			timeline.resolveMs = this->connectStartTimestamp - this->loginStartTimestamp;
+			timeline.tcpMs = this->tcpConnectedTimestamp - this->connectStartTimestamp;
+			timeline.connMs = this->connRespTimestamp - this->tcpConnectedTimestamp;
+			timeline.bindMs = now - this->bindSentTimestamp;
+			timeline.totalMs = now - this->loginStartTimestamp;
+			pthread_mutex_lock(&loginTimelineMutex);
+			this->loginTimeline = timeline;
+			pthread_mutex_unlock(&loginTimelineMutex);
+			XMDLoggerWrapper::instance()->info("In setLoginState, online in %lld ms, resolve %lld ms, tcp %lld ms, conn %lld ms, bind %lld ms, user is %s",
+				timeline.totalMs, timeline.resolveMs, timeline.tcpMs, timeline.connMs, timeline.bindMs, appAccount.c_str());
+		}
+		this->loginStartTimestamp = 0;
+		break;
+	default:
+		break;
+	}
+	this->loginState = state;
+}
+
+LoginTimeline User::getLoginTimeline() const {
+	pthread_mutex_lock(&loginTimelineMutex);
+	LoginTimeline timeline = this->loginTimeline;
+	pthread_mutex_unlock(&loginTimelineMutex);
+	return timeline;
+}
 
+void User::driveConnection() {
+	if (conn->getState() == NOT_CONNECTED) {
+		connectFe();
+	}
+	if (this->feDomainResolved.exchange(false)) {
+		conn->addFeDomainCandidates();
+	}
+	if (conn->getState() != NOT_CONNECTED && conn->hasPendingOutput() && conn->flush() < 0) {
+		XMDLoggerWrapper::instance()->error("In driveConnection, flush failed, user is %s", appAccount.c_str());
+		conn->resetSock();
+	}
+	if (conn->isReadPaused() && !this->deliveryExecutor->isBacklogged(DELIVERY_LANE_MESSAGE)) {
+		resumeReads();
+	}
+	if (conn->getState() == HANDSHAKE_CONNECTED) {
+		if (this->onlineStatus == Offline) {
+			// retries a BIND that timed out or was refused, the first one goes out from handleConnResp
+			tryBind();
+		} else {
+			flushOutbox();
+			sendPacketsWaitToSend();
+		}
+		if (conn->hasPendingOutput() && conn->flush() < 0) {
+			XMDLoggerWrapper::instance()->error("In driveConnection, flush failed, user is %s", appAccount.c_str());
 			conn->resetSock();
+		}
+	}
+	scheduleTimers();
+}
 
-			delete[] packetHeaderBuffer;
-			packetHeaderBuffer = NULL;
+void User::connectFe() {
+	if (conn->isConnecting() || this->preparingTasks > 0) {
+		return;
+	}
+	time_t now = time(NULL);
+	if (now - this->lastCreateConnTimestamp <= CONNECT_TIMEOUT) {
+		return;
+	}
+	if (this->testPacketLoss >= 100) {
+		return;
+	}
+	if (!isTokenReady() || !isServerAddrReady()) {
+		startPrepare();
+		return;
+	}
+	loadServerAddrFromCache();
+	this->lastCreateConnTimestamp = time(NULL);
+	XMDLoggerWrapper::instance()->info("Prepare to connect");
+	if (!conn->connect()) {
+		XMDLoggerWrapper::instance()->error("In connectFe, socket connect failed, user is %s", appAccount.c_str());
+		return;
+	}
+	setLoginState(LOGIN_CONNECTING);
+}
 
-			continue;
-		}
-		else {
-			int body_len = user->getPacketManager()->char2int(packetHeaderBuffer, HEADER_BODYLEN_OFFSET) + BODY_CRC_LEN;
-			unsigned char * packetBodyBuffer = new unsigned char[body_len];
-			memset(packetBodyBuffer, 0, body_len);
-			ret = conn->readn((void *)packetBodyBuffer, body_len);
-			if (ret != body_len) {
+void User::sendPacket(unsigned char* packetBuffer, int packet_size, MessageDirection msgType) {
+	if (msgType == C2S_DOUBLE_DIRECTION) {
+		conn->trySetNextResetTs();
+	}
 
-				conn->resetSock();
+	this->lastPingTimestamp = time(NULL);
 
-				delete[] packetBodyBuffer;
-				packetBodyBuffer = NULL;
+	if (this->testPacketLoss < 100) {
+		conn->queueFrame(packetBuffer, packet_size);
+	} else {
+		delete[] packetBuffer;
+	}
+}
 
+void User::sendPacketsWaitToSend() {
+	int64_t sequenceAckTimestamp = packetManager->nextSequenceAckTimestamp();
+	if (sequenceAckTimestamp >= 0 && (conn->hasPendingOutput() || packetManager->hasPacketsWaitToSend() || Utils::steadyTimeMillis() >= sequenceAckTimestamp)) {
+		// pending SEQUENCE_ACKs ride along with any other frame, on their own only once due
+		packetManager->flushSequenceAcks(this);
+	}
+	if (conn->hasPendingOutput()) {
+		return;
+	}
+	// queued packets are encoded back to back up to a byte budget and flushed with one gather write
+	struct waitToSendContent obj;
+	bool drained = false;
+	while (!drained) {
+		int batch_size = 0;
+		while (batch_size < SEND_BATCH_BYTES) {
+			if (!packetManager->popPacketWaitToSend(obj)) {
+				drained = true;
+				break;
+			}
+			unsigned char * packetBuffer = NULL;
+			int packet_size = -1;
+			if (obj.cmd == BODY_CLIENTHEADER_CMD_SECMSG) {
+				packet_size = packetManager->encodeSecMsgPacket(packetBuffer, conn, obj.message);
+			} else if (obj.cmd == BODY_CLIENTHEADER_CMD_UNBIND) {
+				packet_size = packetManager->encodeUnBindPacket(packetBuffer, conn);
+			}
+			if (packet_size < 0) {
 				continue;
 			}
-			else {
-				if (user->getTestPacketLoss() >= 100) {
-					delete[] packetHeaderBuffer;
-					packetHeaderBuffer = NULL;
+			sendPacket(packetBuffer, packet_size, obj.type);
+			batch_size += packet_size;
+		}
+		if (!conn->hasPendingOutput()) {
+			break;
+		}
 
-					delete[] packetBodyBuffer;
-					packetBodyBuffer = NULL;
+		int ret = conn->flush();
+		if (ret < 0) {
+			XMDLoggerWrapper::instance()->error("In sendPacketsWaitToSend, flush failed, user is %s", appAccount.c_str());
+			conn->resetSock();
+			return;
+		}
+		if (ret == 0) {
+			// socket buffer is full, the rest waits for the writable event
+			return;
+		}
+	}
 
-					continue;
-				}
-				conn->clearNextResetSockTs();
-				int packet_size = HEADER_LENGTH + body_len;
-				unsigned char *packetBuffer = new unsigned char[packet_size];
-				memset(packetBuffer, 0, packet_size);
-				memmove(packetBuffer, packetHeaderBuffer, HEADER_LENGTH);
-				memmove(packetBuffer + HEADER_LENGTH, packetBodyBuffer, body_len);
-
-				delete[] packetHeaderBuffer;
-				packetHeaderBuffer = NULL;
-
-				delete[] packetBodyBuffer;
-				packetBodyBuffer = NULL;
-
-				ret = user->getPacketManager()->decodePacketAndHandle(packetBuffer, conn);
-				delete[] packetBuffer;
-				packetBuffer = NULL;
-				if (ret < 0) {
-					conn->resetSock();
-				}
-			}
+	if (time(NULL) - this->lastPingTimestamp > PING_TIMEINTERVAL) {
+		unsigned char * packetBuffer = NULL;
+		int packet_size = packetManager->encodePingPacket(packetBuffer, conn);
+		if (packet_size >= 0) {
+			sendPacket(packetBuffer, packet_size, C2S_DOUBLE_DIRECTION);
 		}
 	}
+}
 
-	return NULL;
+void User::receivePackets() {
+	int ret = conn->readAvailable();
+	if (!processReceivedFrames()) {
+		return;
+	}
+
+	if (ret < 0) {
+		XMDLoggerWrapper::instance()->info("In receivePackets, connection closed, user is %s", appAccount.c_str());
+		conn->resetSock();
+	}
 }
 
-void* User::checkTimeout(void *arg) {
-#ifndef __ANDROID__
-	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-#else
-	signal(SIGTERM, handle_quit);
-#endif
+bool User::processReceivedFrames() {
+	FrameBuffer& recvBuffer = conn->getRecvBuffer();
+	size_t offset = 0;
+	while (!conn->isReadPaused() && recvBuffer.readableBytes() - offset >= HEADER_LENGTH) {
+		unsigned char * packetBuffer = recvBuffer.peek() + offset;
+		int body_len = packetManager->char2int(packetBuffer, HEADER_BODYLEN_OFFSET);
+		if (body_len < 0 || body_len > MAX_PACKET_BODY_SIZE) {
+			XMDLoggerWrapper::instance()->error("In processReceivedFrames, invalid body_len %d, user is %s", body_len, appAccount.c_str());
+			conn->resetSock();
+			return false;
+		}
+		size_t packet_size = HEADER_LENGTH + body_len + BODY_CRC_LEN;
+		if (recvBuffer.readableBytes() - offset < packet_size) {
+			break;
+		}
+		offset += packet_size;
+		if (this->testPacketLoss >= 100) {
+			continue;
+		}
+		conn->clearNextResetSockTs();
 
-	XMDLoggerWrapper::instance()->info("checkThread start to run");
-	Connection *conn = (Connection *)arg;
-	User * user = conn->getUser();
-	
-	while (true)
-	 {
-		if ((conn->getNextResetSockTs() > 0) && (time(NULL) - conn->getNextResetSockTs() > 0)) {
-			XMDLoggerWrapper::instance()->info("In checkTimeout, packet recv timeout");
+		// the frame is decrypted and parsed where it lies in recvBuffer
+		int result = packetManager->decodePacketAndHandle(packetBuffer, conn);
+		if (result < 0) {
 			conn->resetSock();
+			return false;
+		}
+		if (conn->getState() == NOT_CONNECTED) {
+			return false;
+		}
+		if (this->deliveryExecutor != NULL && this->deliveryExecutor->isBacklogged(DELIVERY_LANE_MESSAGE)) {
+			// the rest waits in recvBuffer and the socket, the server holds off once the window fills
+			XMDLoggerWrapper::instance()->warn("In processReceivedFrames, message handler is backlogged, reading paused, user is %s", appAccount.c_str());
+			conn->setReadPaused(true);
 		}
-		user->getPacketManager()->checkMessageSendTimeout(user);
-		user->rtsScanAndCallBack();
-		user->relayConnScanAndCallBack();
-		RtsSendData::sendPingRelayRequest(user);
-		//sleep(1);
-		std::this_thread::sleep_for(std::chrono::seconds(1));
 	}
+	recvBuffer.retrieve(offset);
+	return true;
+}
 
-	return NULL;
+void User::resumeReads() {
+	conn->setReadPaused(false);
+	// pings went unanswered while nothing was read, the next one arms the recv timeout again
+	conn->clearNextResetSockTs();
+	processReceivedFrames();
+}
+
+void User::checkTimeout() {
+	if (conn->isConnecting() && time(NULL) - this->lastCreateConnTimestamp > CONNECT_TIMEOUT) {
+		XMDLoggerWrapper::instance()->warn("In checkTimeout, socket connect timeout, user is %s", appAccount.c_str());
+		conn->abortConnect();
+	}
+	if (!conn->isReadPaused() && (conn->getNextResetSockTs() > 0) && (time(NULL) - conn->getNextResetSockTs() > 0)) {
+		XMDLoggerWrapper::instance()->info("In checkTimeout, packet recv timeout");
+		conn->resetSock();
+	}
+	this->rtsScanAndCallBack();
+	this->relayConnScanAndCallBack();
+	RtsSendData::sendPingRelayRequest(this);
+}
+
+bool User::needCheckTimeout() {
+	if (conn->getState() != HANDSHAKE_CONNECTED || conn->getNextResetSockTs() > 0) {
+		return true;
+	}
+	if (this->onlineStatus == Offline && this->permitLogin) {
+		return true;
+	}
+	if (this->relayLinkState != NOT_CREATED) {
+		return true;
+	}
+	pthread_rwlock_rdlock(&mutex_0);
+	bool hasCalls = !this->currentCalls->empty();
+	pthread_rwlock_unlock(&mutex_0);
+	return hasCalls;
+}
+
+void User::scheduleTimers() {
+	if (this->checkTimerId == 0 && needCheckTimeout()) {
+		this->checkTimerId = this->eventLoop->addTimer(CHECK_TIMEOUT_INTERVAL_MS, this->feEventHandler);
+	}
+	if (this->pingTimerId == 0 && this->onlineStatus == Online && conn->getState() == HANDSHAKE_CONNECTED) {
+		int64_t delayMs = (int64_t)(this->lastPingTimestamp + PING_TIMEINTERVAL + 1 - time(NULL)) * 1000;
+		this->pingTimerId = this->eventLoop->addTimer(delayMs, this->feEventHandler);
+	}
+	if (this->sendBatchTimerId == 0) {
+		pthread_mutex_lock(&sendBatchMutex);
+		int64_t windowMs = this->sendBatch.empty() ? -1 : this->sendBatchWindowMs;
+		pthread_mutex_unlock(&sendBatchMutex);
+		if (windowMs >= 0) {
+			this->sendBatchTimerId = this->eventLoop->addTimer(windowMs, this->feEventHandler);
+		}
+	}
+	int64_t connectTimeout = conn->nextConnectTimestamp();
+	if (connectTimeout >= 0 && (this->connectTimerId == 0 || connectTimeout < this->connectTimestamp)) {
+		if (this->connectTimerId != 0) {
+			this->eventLoop->cancelTimer(this->connectTimerId);
+		}
+		this->connectTimestamp = connectTimeout;
+		this->connectTimerId = this->eventLoop->addTimer(connectTimeout - Utils::steadyTimeMillis(), this->feEventHandler);
+	}
+	int64_t tokenRefresh = this->tokenRefreshTimestamp;
+	if (this->tokenRefreshTimerId == 0 && tokenRefresh > 0) {
+		this->tokenRefreshTimerId = this->eventLoop->addTimer(tokenRefresh - Utils::currentTimeMillis(), this->feEventHandler);
+	}
+	int64_t sequenceAckTimestamp = this->packetManager->nextSequenceAckTimestamp();
+	if (this->sequenceAckTimerId == 0 && sequenceAckTimestamp >= 0 && conn->getState() == HANDSHAKE_CONNECTED) {
+		this->sequenceAckTimerId = this->eventLoop->addTimer(sequenceAckTimestamp - Utils::steadyTimeMillis(), this->feEventHandler);
+	}
+	// follows every pause and resume, a reset of the connection included
+	this->packetManager->setMessageSendTimeoutPaused(conn->isReadPaused());
+	int64_t sendTimeout = this->packetManager->nextMessageSendTimeout();
+	if (sendTimeout >= 0 && (this->sendTimeoutTimerId == 0 || sendTimeout < this->sendTimeoutTimestamp)) {
+		// a message with a shorter deadline than the armed one pulls the timer in
+		if (this->sendTimeoutTimerId != 0) {
+			this->eventLoop->cancelTimer(this->sendTimeoutTimerId);
+		}
+		this->sendTimeoutTimestamp = sendTimeout;
+		this->sendTimeoutTimerId = this->eventLoop->addTimer(sendTimeout - Utils::steadyTimeMillis(), this->feEventHandler);
+	}
 }
 
 void User::relayConnScanAndCallBack() {
@@ -444,7 +943,7 @@ void User::rtsScanAndCallBack() {
 			if (time(NULL) - callSession.getLatestLegalCallStateTs() >= RTS_CALL_TIMEOUT) {
 				XMDLoggerWrapper::instance()->info("In rtsScanAndCallBack, callId %llu state WAIT_CREATE_RESPONSE is timeout, user is %s", callId, appAccount.c_str());
 				this->currentCalls->erase(iter++);
-				rtsCallEventHandler->onAnswered(callId, false, DIAL_CALL_TIMEOUT);
+				getRTSCallEventHandler()->onAnswered(callId, false, DIAL_CALL_TIMEOUT);
 			} else {
 				iter++;
 			}
@@ -464,7 +963,7 @@ void User::rtsScanAndCallBack() {
 					this->onlaunchCalls->erase(callId);
 				}
 				this->currentCalls->erase(iter++);
-				rtsCallEventHandler->onClosed(callId, INVITE_RESPONSE_TIMEOUT);
+				getRTSCallEventHandler()->onClosed(callId, INVITE_RESPONSE_TIMEOUT);
 			} else {
 				iter++;
 			}
@@ -472,7 +971,7 @@ void User::rtsScanAndCallBack() {
 			XMDLoggerWrapper::instance()->info("In rtsScanAndCallBack, callId %llu state WAIT_UPDATE_RESPONSE is timeout, user is %s", callId, appAccount.c_str());
 			RtsSendSignal::sendByeRequest(this, callId, UPDATE_TIMEOUT);
 			this->currentCalls->erase(iter++);
-			rtsCallEventHandler->onClosed(callId, UPDATE_TIMEOUT);
+			getRTSCallEventHandler()->onClosed(callId, UPDATE_TIMEOUT);
 		} else {
 			iter++;
 		}
@@ -565,97 +1064,53 @@ bool User::fetchToken(User * user) {
 	if (user->tokenFetchSucceed && !user->tokenInvalid) {
 		return true;
 	}
-	const char* str = NULL;
-	int str_size = 0;
-	if (user->cacheExist) {
-		std::ifstream file(user->getCacheFile(), std::ios::in | std::ios::ate);
-		long size = file.tellg();
-		file.seekg(0, std::ios::beg);
+	std::string response;
+	int64_t fetchedAt = 0;
+	if (user->tokenManager->takeReady(response, fetchedAt) && user->adoptToken(response, fetchedAt)) {
+		return true;
+	}
+	if (user->cacheExist && !user->tokenInvalid) {
 		user->tokenRequestStatus = -1;
-		char* localStr = new char[size];
-		file.read(localStr, size);
-		file.close();
-		json_object* pobj_local = NULL;
-		if (!user->tokenInvalid && size>0 && user->parseToken(localStr, pobj_local)) {
-			json_object_put(pobj_local);
-			delete[] localStr;
+		std::string localStr = Utils::readFile(user->cacheFile);
+		// the cached token is used even when it is due, the refresh timer fires at once and replaces it in the background
+		if (!localStr.empty() && user->adoptToken(localStr, 0)) {
 			return true;
-		} else {
-			if (user->getTokenFetcher() == NULL) {
-				json_object_put(pobj_local);
-				delete[] localStr;
-				return false;
-			}
-			user->tokenRequestStatus = 0;
-			std::string remoteStr = user->getTokenFetcher()->fetchToken();
-			user->tokenRequestStatus = 1;
-			json_object* pobj_remote;
-			if (user->parseToken(remoteStr.c_str(), pobj_remote)) {
-				user->tokenInvalid = false;
-				std::ofstream file(user->getCacheFile(), std::ios::out | std::ios::ate);
-				if (file.is_open()) {
-					if (pobj_local == NULL) {
-						str = remoteStr.c_str();
-						str_size = remoteStr.size();
-					} else {
-						json_object* dataobj = json_object_new_object();
-						char s[21] = {0};
-						json_object_object_add(dataobj, "appId", json_object_new_string(Utils::ltoa(user->getAppId(), s)));
-						json_object_object_add(dataobj, "appPackage", json_object_new_string(user->getAppPackage().c_str()));
-						json_object_object_add(dataobj, "appAccount", json_object_new_string(user->getAppAccount().c_str()));
-						json_object_object_add(dataobj, "miChid", json_object_new_int(user->getChid()));
-						json_object_object_add(dataobj, "miUserId", json_object_new_string(Utils::ltoa(user->getUuid(), s)));
-						json_object_object_add(dataobj, "miUserSecurityKey", json_object_new_string(user->getSecurityKey().c_str()));
-						json_object_object_add(dataobj, "token", json_object_new_string(user->getToken().c_str()));
-						json_object_object_add(dataobj, "regionBucket", json_object_new_int(user->getRegionBucket()));
-						json_object_object_add(dataobj, "feDomainName", json_object_new_string(user->getFeDomain().c_str()));
-						json_object_object_add(dataobj, "relayDomainName", json_object_new_string(user->getRelayDomain().c_str()));
-						json_object_object_add(pobj_local, "code", json_object_new_int(200));
-						json_object_object_add(pobj_local, "data", dataobj);
-
-						str = json_object_get_string(pobj_local);
-						str_size = strlen(str);
-					}
-					file.write(str, str_size);
-					file.close();
-				}
-				json_object_put(pobj_local);
-				json_object_put(pobj_remote);
-				delete[] localStr;
-				return true;
-			} else {
-				json_object_put(pobj_local);
-				json_object_put(pobj_remote);
-				delete[] localStr;
-				return false;
-			}
 		}
-	} else {
-		if (user->getTokenFetcher() == NULL) {
-			return false;
-		}
-		user->tokenRequestStatus = 0;
-		std::string remoteStr = user->getTokenFetcher()->fetchToken();
-		user->tokenRequestStatus = 1;
-		json_object* pobj_remote;
-		if (user->parseToken(remoteStr.c_str(), pobj_remote)) {
-			user->tokenInvalid = false;
-			createCacheFileIfNotExist(user);
-			if (user->cacheExist) {
-				std::ofstream file(user->getCacheFile(), std::ios::out | std::ios::ate);
-				if (file.is_open()) {
-					str = remoteStr.c_str();
-					str_size = remoteStr.size();
-					file.write(str, str_size);
-					file.close();
-				}
-			}
-			json_object_put(pobj_remote);
-			return true;
-		} else {
-			json_object_put(pobj_remote);
-			return false;
+	}
+	if (user->getTokenFetcher() == NULL) {
+		return false;
+	}
+	user->tokenRequestStatus = 0;
+	bool fetched = user->tokenManager->fetch(response, fetchedAt);
+	user->tokenRequestStatus = 1;
+	return fetched && user->adoptToken(response, fetchedAt);
+}
+
+bool User::adoptToken(const std::string& response, int64_t fetchedAt) {
+	json_object* pobj = NULL;
+	bool parsed = parseToken(response.c_str(), pobj);
+	if (parsed) {
+		json_object* tsobj = NULL;
+		if (fetchedAt == 0 && json_object_object_get_ex(pobj, "tokenTimestamp", &tsobj)) {
+			fetchedAt = json_object_get_int64(tsobj);
 		}
+		this->tokenRefreshTimestamp = TokenManager::refreshTimestamp(pobj, fetchedAt);
+		this->tokenInvalid = false;
+	}
+	json_object_put(pobj);
+	return parsed;
+}
+
+void User::checkTokenRefresh() {
+	int64_t now = Utils::currentTimeMillis();
+	int64_t tokenRefresh = this->tokenRefreshTimestamp;
+	if (tokenRefresh == 0 || now < tokenRefresh) {
+		return;
+	}
+	// retried until a refreshed token is adopted, which moves the timestamp past its own expiry
+	this->tokenRefreshTimestamp = now + TOKEN_REFRESH_RETRY_MS;
+	if (this->tokenManager->needsRefresh(now)) {
+		this->tokenManager->refresh();
 	}
 }
 
@@ -665,98 +1120,64 @@ bool User::fetchServerAddr(User* user) {
 		pthread_mutex_unlock(&user->mutex_1);
 		return true;
 	}
-	if (user->feDomain == "" || user->relayDomain == "") {
+	// addresses that failed in use are not taken from the cache again
+	bool forced = user->addressInvalid;
+	std::string feDomain = user->feDomain;
+	std::string relayDomain = user->relayDomain;
+	pthread_mutex_unlock(&user->mutex_1);
+	if (feDomain == "" || relayDomain == "") {
 		XMDLoggerWrapper::instance()->error("User::fetchServerAddr, feDomain or relayDomain is empty");
-		pthread_mutex_unlock(&user->mutex_1);
 		return false;
 	}
-	const char* str = NULL;
-	int str_size = 0;
-	if (user->cacheExist) {
-		std::ifstream file(user->getCacheFile(), std::ios::in | std::ios::ate);
-		long size = file.tellg();
-		file.seekg(0, std::ios::beg);
-		char* localStr = new char[size];
-		file.read(localStr, size);
-		file.close();
-		json_object* pobj_local;
-		if (user->parseServerAddr(localStr, pobj_local) && !user->addressInvalid) {
-			json_object_put(pobj_local);
-			pthread_mutex_unlock(&user->mutex_1);
-			delete[] localStr;
-			return true;
-		} else {
-			std::string remoteStr = ServerFetcher::fetchServerAddr(RESOLVER_URL, user->feDomain + "," + user->relayDomain);
-			json_object* pobj_remote;
-			if (user->parseServerAddr(remoteStr.c_str(), pobj_remote)) {
-				user->addressInvalid = false;
-				std::ofstream file(user->getCacheFile(), std::ios::out | std::ios::ate);
-				if (file.is_open()) {
-					if (pobj_local == NULL) {
-						str = remoteStr.c_str();
-						str_size = remoteStr.size();
-					} else {
-						json_object* feAddrArray = json_object_new_array();
-						for (std::vector<std::string>::const_iterator iter = user->feAddresses.begin(); iter != user->feAddresses.end(); iter++) {
-							std::string feAddr = *iter;
-							json_object_array_add(feAddrArray, json_object_new_string(feAddr.c_str()));
-						}
-						json_object* relayAddrArray = json_object_new_array();
-						for (std::vector<std::string>::const_iterator iter = user->relayAddresses.begin(); iter != user->relayAddresses.end(); iter++) {
-							std::string relayAddr = *iter;
-							json_object_array_add(relayAddrArray, json_object_new_string(relayAddr.c_str()));
-						}
-
-						json_object_object_add(pobj_local, user->feDomain.c_str(), feAddrArray);
-						json_object_object_add(pobj_local, user->relayDomain.c_str(), relayAddrArray);
-
-						str = json_object_get_string(pobj_local);
-						str_size = strlen(str);
-					}
-					file.write(str, str_size);
-					file.close();
-				}
-				json_object_put(pobj_local);
-				json_object_put(pobj_remote);
-				pthread_mutex_unlock(&user->mutex_1);
 
-				delete[] localStr;
-				return true;
-			} else {
-				json_object_put(pobj_local);
-				json_object_put(pobj_remote);
-				pthread_mutex_unlock(&user->mutex_1);
-
-				delete[] localStr;
-				return false;
-			}
+	ServerAddrCache* serverAddrCache = ServerAddrCache::instance();
+	std::vector<std::string> feAddresses;
+	std::vector<std::string> relayAddresses;
+	bool fetched = false;
+	if (!forced) {
+		fetched = serverAddrCache->lookup(feDomain, relayDomain, feAddresses, relayAddresses);
+		if (!fetched && user->cacheExist) {
+			serverAddrCache->seed(feDomain, relayDomain, user->cacheFile);
+			fetched = serverAddrCache->lookup(feDomain, relayDomain, feAddresses, relayAddresses);
 		}
-	} else {
-		std::string remoteStr = ServerFetcher::fetchServerAddr(RESOLVER_URL, user->feDomain + "," + user->relayDomain);
-		json_object* pobj_remote;
-		if (user->parseServerAddr(remoteStr.c_str(), pobj_remote)) {
-			user->addressInvalid = false;
-			createCacheFileIfNotExist(user);
-			if (user->cacheExist) {
-				std::ofstream file(user->getCacheFile(), std::ios::out | std::ios::ate);
-				if (file.is_open()) {
-					str = remoteStr.c_str();
-					str_size = remoteStr.size();
-					file.write(str, str_size);
-					file.close();
-				}
-			}
-			json_object_put(pobj_remote);
-			pthread_mutex_unlock(&user->mutex_1);
+	}
+	createCacheFileIfNotExist(user);
+	if (user->cacheExist) {
+		serverAddrCache->attachCacheFile(user->cacheFile, feDomain, relayDomain);
+	}
+	if (!fetched) {
+		fetched = serverAddrCache->fetch(feDomain, relayDomain, feAddresses, relayAddresses);
+	}
+	if (fetched) {
+		pthread_mutex_lock(&user->mutex_1);
+		user->feAddresses = feAddresses;
+		user->relayAddresses = relayAddresses;
+		user->serverFetchSucceed = true;
+		user->addressInvalid = false;
+		pthread_mutex_unlock(&user->mutex_1);
+		XMDLoggerWrapper::instance()->info("User::fetchServerAddr, serverFetchSucceed is true, user is %s", user->appAccount.c_str());
+	}
+	return fetched;
+}
 
-			return true;
-		} else {
-			json_object_put(pobj_remote);
-			pthread_mutex_unlock(&user->mutex_1);
+void User::loadServerAddrFromCache() {
+	pthread_mutex_lock(&mutex_1);
+	std::string feDomain = this->feDomain;
+	std::string relayDomain = this->relayDomain;
+	pthread_mutex_unlock(&mutex_1);
 
-			return false;
-		}
+	// picks up what a background refresh fetched since the last login, and triggers one when the entry is stale
+	std::vector<std::string> feAddresses;
+	std::vector<std::string> relayAddresses;
+	if (!ServerAddrCache::instance()->lookup(feDomain, relayDomain, feAddresses, relayAddresses)) {
+		return;
+	}
+	pthread_mutex_lock(&mutex_1);
+	if (!this->addressInvalid) {
+		this->feAddresses = feAddresses;
+		this->relayAddresses = relayAddresses;
 	}
+	pthread_mutex_unlock(&mutex_1);
 }
 
 bool User::parseToken(const char* str, json_object*& pobj) {
@@ -826,6 +1247,8 @@ bool User::parseToken(const char* str, json_object*& pobj) {
 		return tokenFetchSucceed;
 	} else {
 		this->securityKey = pstr;
+		this->securityKeyBytes.clear();
+		ccb::Base64Util::Decode(this->securityKey, this->securityKeyBytes);
 	}
 	
 	json_object_object_get_ex(dataobj, "token", &dataitem_obj);
@@ -844,7 +1267,10 @@ bool User::parseToken(const char* str, json_object*& pobj) {
 	if (!pstr) {
 		return tokenFetchSucceed;
 	} else {
+		// a concurrent fetchServerAddr reads the domains under the address mutex
+		pthread_mutex_lock(&mutex_1);
 		this->feDomain = pstr;
+		pthread_mutex_unlock(&mutex_1);
 	}
 	
 	json_object_object_get_ex(dataobj, "relayDomainName", &dataitem_obj);
@@ -852,7 +1278,9 @@ bool User::parseToken(const char* str, json_object*& pobj) {
 	if (!pstr) {
 		return tokenFetchSucceed;
 	} else {
+		pthread_mutex_lock(&mutex_1);
 		this->relayDomain = pstr;
+		pthread_mutex_unlock(&mutex_1);
 	}
 	
 	tokenFetchSucceed = true;
@@ -862,59 +1290,6 @@ bool User::parseToken(const char* str, json_object*& pobj) {
 	return tokenFetchSucceed;
 }
 
-bool User::parseServerAddr(const char* str, json_object*& pobj) {
-	serverFetchSucceed = false;
-
-	pobj = json_tokener_parse(str);
-
-	if (pobj == NULL) {
-		XMDLoggerWrapper::instance()->info("User::parseServerAddr, json_tokener_parse failed, pobj is NULL");
-	}
-
-	json_object* dataobj = NULL;
-	json_object_object_get_ex(pobj, this->feDomain.c_str(), &dataobj);
-	if (dataobj && json_object_get_type(dataobj) == json_type_array) {
-		int arraySize = json_object_array_length(dataobj);
-		if (arraySize == 0) {
-			return serverFetchSucceed;
-		}
-		this->feAddresses.clear();
-		for (int i = 0; i < arraySize; i++) {
-			json_object* dataitem_obj = json_object_array_get_idx(dataobj, i);
-			const char* feAddress = json_object_get_string(dataitem_obj);
-			this->feAddresses.push_back(feAddress);
-		}
-	} else {
-		return serverFetchSucceed;
-	}
-
-	json_object_object_get_ex(pobj, this->relayDomain.c_str(), &dataobj);
-	if (dataobj && json_object_get_type(dataobj) == json_type_array) {
-		int arraySize = json_object_array_length(dataobj);
-		if (arraySize == 0) {
-			return serverFetchSucceed;
-		}
-		this->relayAddresses.clear();
-		for (int i = 0; i < arraySize; i++) {
-			json_object* dataitem_obj = json_object_array_get_idx(dataobj, i);
-			const char* relayAddress = json_object_get_string(dataitem_obj);
-			this->relayAddresses.push_back(relayAddress);
-		}
-	} else {
-		return serverFetchSucceed;
-	}
-
-	serverFetchSucceed = true;
-
-	if (serverFetchSucceed) {
-		XMDLoggerWrapper::instance()->info("User::parseServerAddr, serverFetchSucceed is true, user is %s", appAccount.c_str());
-	} else {
-		XMDLoggerWrapper::instance()->info("User::parseServerAddr, serverFetchSucceed is false, user is %s", appAccount.c_str());
-	}
-
-	return serverFetchSucceed;
-}
-
 std::string User::join(const std::map<std::string, std::string>& kvs) const {
 	if (kvs.empty()) {
 		return "";
@@ -933,126 +1308,334 @@ std::string User::join(const std::map<std::string, std::string>& kvs) const {
 	return oss.str();
 }
 
-std::string User::sendMessage(const std::string & toAppAccount, const std::string & payload, const std::string & bizType, const bool isStore) {
+std::string User::sendMessage(const std::string & toAppAccount, const std::string & payload, const std::string & bizType, const bool isStore, const int64_t timeoutMs) {
 	if (this->messageHandler == NULL) {
 		XMDLoggerWrapper::instance()->error("In sendMessage, messageHandler is not registered!");
 		return "";
 	}
 
-	if (this->onlineStatus == Offline || toAppAccount == "" || payload == "" || payload.size() > MIMC_MAX_PAYLOAD_SIZE) {
+	if (toAppAccount == "" || payload == "" || payload.size() > MIMC_MAX_PAYLOAD_SIZE) {
+		return "";
+	}
+	if (this->outbox != NULL) {
+		return addToOutbox(OutgoingMessage(toAppAccount, payload, bizType, isStore, timeoutMs));
+	}
+	if (this->onlineStatus == Offline) {
 		return "";
 	}
 
-	mimc::MIMCUser *from, *to;
-	from = new mimc::MIMCUser();
-	from->set_appid(this->appId);
-	from->set_appaccount(this->appAccount);
-	from->set_uuid(this->uuid);
-	from->set_resource(this->resource);
+	mimc::MIMCPacket * packet = createMessagePacket(OutgoingMessage(toAppAccount, payload, bizType, isStore, timeoutMs));
+	std::string packetId = packet->packetid();
+	return enqueueMessagePacket(packet) ? packetId : "";
+}
 
-	to = new mimc::MIMCUser();
-	to->set_appid(this->appId);
-	to->set_appaccount(toAppAccount);
+std::string User::sendGroupMessage(const int64_t topicId, const std::string & payload, const std::string & bizType, const bool isStore, const int64_t timeoutMs) {
+	if (this->messageHandler == NULL) {
+		XMDLoggerWrapper::instance()->error("In sendGroupMessage, messageHandler is not registered!");
+		return "";
+	}
 
-	mimc::MIMCP2PMessage * message = new mimc::MIMCP2PMessage();
-	message->set_allocated_from(from);
-	message->set_allocated_to(to);
-	message->set_payload(std::string(payload));
-	message->set_biztype(bizType);
-	message->set_isstore(isStore);
+	if (payload == "" || payload.size() > MIMC_MAX_PAYLOAD_SIZE) {
+		return "";
+	}
+	if (this->outbox != NULL) {
+		return addToOutbox(OutgoingMessage(topicId, payload, bizType, isStore, timeoutMs));
+	}
+	if (this->onlineStatus == Offline) {
+		return "";
+	}
 
-	int message_size = message->ByteSize();
-	char * messageBytes = new char[message_size];
-	memset(messageBytes, 0, message_size);
-	message->SerializeToArray(messageBytes, message_size);
-	std::string messageBytesStr(messageBytes, message_size);
+	mimc::MIMCPacket * packet = createMessagePacket(OutgoingMessage(topicId, payload, bizType, isStore, timeoutMs));
+	std::string packetId = packet->packetid();
+	return enqueueMessagePacket(packet) ? packetId : "";
+}
 
-	delete message;
-	message = NULL;
+std::vector<std::string> User::sendMessages(const std::vector<OutgoingMessage>& messages) {
+	std::vector<std::string> packetIds(messages.size());
+	if (this->messageHandler == NULL) {
+		XMDLoggerWrapper::instance()->error("In sendMessages, messageHandler is not registered!");
+		return packetIds;
+	}
+	if (this->outbox != NULL) {
+		for (size_t i = 0; i < messages.size(); i++) {
+			const OutgoingMessage& message = messages[i];
+			if ((!message.isGroupMessage() && message.getToAppAccount() == "") || message.getPayload() == "" || message.getPayload().size() > MIMC_MAX_PAYLOAD_SIZE) {
+				continue;
+			}
+			packetIds[i] = addToOutbox(message);
+		}
+		return packetIds;
+	}
+	if (this->onlineStatus == Offline) {
+		return packetIds;
+	}
 
-	std::string packetId = this->packetManager->createPacketId();
-	mimc::MIMCPacket * packet = new mimc::MIMCPacket();
-	packet->set_packetid(packetId);
-	packet->set_package(this->appPackage);
-	packet->set_type(mimc::P2P_MESSAGE);
-	packet->set_payload(messageBytesStr);
-	packet->set_timestamp(time(NULL));
+	std::vector<mimc::MIMCPacket*> packets;
+	std::vector<size_t> indexes;
+	for (size_t i = 0; i < messages.size(); i++) {
+		const OutgoingMessage& message = messages[i];
+		if ((!message.isGroupMessage() && message.getToAppAccount() == "") || message.getPayload() == "" || message.getPayload().size() > MIMC_MAX_PAYLOAD_SIZE) {
+			continue;
+		}
+		packets.push_back(createMessagePacket(message));
+		indexes.push_back(i);
+	}
 
-	delete[] messageBytes;
-	messageBytes = NULL;
+	size_t begin = 0;
+	while (begin < packets.size()) {
+		size_t end = nextCompoundEnd(packets, begin);
+		std::vector<mimc::MIMCPacket*> chunk(packets.begin() + begin, packets.begin() + end);
+		for (size_t i = begin; i < end; i++) {
+			packetIds[indexes[i]] = packets[i]->packetid();
+		}
+		if (!tryEnqueueCompound(chunk)) {
+			// the queue filled up part way, the rest of the batch reports backpressure as sendMessage does
+			XMDLoggerWrapper::instance()->warn("In sendMessages, send queue is full, %d messages not sent", (int)(packets.size() - begin));
+			for (size_t i = begin; i < end; i++) {
+				packetIds[indexes[i]] = "";
+			}
+			for (size_t i = begin; i < packets.size(); i++) {
+				this->packetManager->removePacketWaitToTimeout(packets[i]->packetid());
+				delete packets[i];
+			}
+			break;
+		}
+		begin = end;
+	}
+	return packetIds;
+}
 
-	MIMCMessage mimcMessage(packetId, packet->sequence(), this->appAccount, this->resource, toAppAccount, "", payload, bizType, packet->timestamp());
-	(this->packetManager->packetsWaitToTimeout).insert(std::pair<std::string, MIMCMessage>(packetId, mimcMessage));
+void User::setSendBatchWindow(int64_t windowMs, unsigned int maxMessages) {
+	pthread_mutex_lock(&sendBatchMutex);
+	this->sendBatchWindowMs = windowMs > 0 ? windowMs : 0;
+	this->sendBatchMaxMessages = maxMessages > 0 && maxMessages < SEND_COMPOUND_MAX_PACKETS ? maxMessages : SEND_COMPOUND_MAX_PACKETS;
+	pthread_mutex_unlock(&sendBatchMutex);
+	this->wakeup();
+}
 
-	struct waitToSendContent mimc_obj;
-	mimc_obj.cmd = BODY_CLIENTHEADER_CMD_SECMSG;
-	mimc_obj.type = C2S_DOUBLE_DIRECTION;
-	mimc_obj.message = packet;
-	(this->packetManager->packetsWaitToSend).push(mimc_obj);
+void User::setConnectRace(int64_t staggerMs, int64_t attemptTimeoutMs) {
+	this->conn->setConnectRace(staggerMs > 0 ? staggerMs : 0, attemptTimeoutMs > 0 ? attemptTimeoutMs : FE_CONNECT_ATTEMPT_TIMEOUT_MS);
+}
 
-	return packetId;
+void User::setPayloadCompression(bool enable, unsigned int threshold) {
+	this->packetManager->setPayloadCompressThreshold(enable ? (threshold > 0 ? threshold : 1) : 0);
 }
 
-std::string User::sendGroupMessage(const int64_t topicId, const std::string & payload, const std::string & bizType, const bool isStore) {
-	if (this->messageHandler == NULL) {
-		XMDLoggerWrapper::instance()->error("In sendGroupMessage, messageHandler is not registered!");
+std::string User::addToOutbox(const OutgoingMessage& message) {
+	// the loop sends it once online, the log keeps it across reconnects and restarts until it is acked
+	std::string packetId = this->packetManager->createPacketId();
+	if (!this->outbox->add(packetId, message)) {
+		XMDLoggerWrapper::instance()->error("In addToOutbox, append failed, user is %s", appAccount.c_str());
 		return "";
 	}
+	this->wakeup();
+	return packetId;
+}
 
-	if (this->onlineStatus == Offline || payload == "" || payload.size() > MIMC_MAX_PAYLOAD_SIZE) {
-		return "";
+void User::flushOutbox() {
+	if (this->outbox == NULL || !this->outbox->hasUnsent()) {
+		return;
 	}
+	std::vector<std::pair<std::string, OutgoingMessage> > messages;
+	while (this->outbox->takeUnsent(messages, SEND_COMPOUND_MAX_PACKETS) > 0) {
+		std::vector<mimc::MIMCPacket*> packets;
+		for (size_t i = 0; i < messages.size(); i++) {
+			packets.push_back(createMessagePacket(messages[i].second, messages[i].first));
+		}
+		messages.clear();
+
+		size_t begin = 0;
+		while (begin < packets.size()) {
+			size_t end = nextCompoundEnd(packets, begin);
+			std::vector<mimc::MIMCPacket*> chunk(packets.begin() + begin, packets.begin() + end);
+			if (!tryEnqueueCompound(chunk)) {
+				break;
+			}
+			begin = end;
+		}
+		if (begin < packets.size()) {
+			// the send queue is full, the rest stays in the outbox for a later pass
+			for (size_t i = begin; i < packets.size(); i++) {
+				this->outbox->markUnsent(packets[i]->packetid());
+				this->packetManager->removePacketWaitToTimeout(packets[i]->packetid());
+				delete packets[i];
+			}
+			return;
+		}
+	}
+}
 
-	mimc::MIMCUser *from;
-	from = new mimc::MIMCUser();
+mimc::MIMCPacket* User::createMessagePacket(const OutgoingMessage& outgoingMessage, const std::string& outboxPacketId) {
+	mimc::MIMCUser * from = new mimc::MIMCUser();
 	from->set_appid(this->appId);
 	from->set_appaccount(this->appAccount);
 	from->set_uuid(this->uuid);
 	from->set_resource(this->resource);
 
-	mimc::MIMCGroup* to = new mimc::MIMCGroup();
-	to->set_appid(this->appId);
-	to->set_topicid(topicId);
-
-	mimc::MIMCP2TMessage* message = new mimc::MIMCP2TMessage();
-	message->set_allocated_from(from);
-	message->set_allocated_to(to);
-	message->set_payload(std::string(payload));
-	message->set_isstore(isStore);
-	message->set_biztype(bizType);
-
-	int message_size = message->ByteSize();
-	char * messageBytes = new char[message_size];
-	memset(messageBytes, 0, message_size);
-	message->SerializeToArray(messageBytes, message_size);
-	std::string messageBytesStr(messageBytes, message_size);
+	std::string messageBytesStr;
+	std::string payloadBuffer;
+	if (outgoingMessage.isGroupMessage()) {
+		mimc::MIMCGroup* to = new mimc::MIMCGroup();
+		to->set_appid(this->appId);
+		to->set_topicid(outgoingMessage.getTopicId());
+
+		mimc::MIMCP2TMessage message;
+		message.set_allocated_from(from);
+		message.set_allocated_to(to);
+		message.set_payload(this->packetManager->encodePayload(outgoingMessage.getPayload(), payloadBuffer));
+		message.set_isstore(outgoingMessage.getIsStore());
+		message.set_biztype(outgoingMessage.getBizType());
+		message.SerializeToString(&messageBytesStr);
+	} else {
+		mimc::MIMCUser * to = new mimc::MIMCUser();
+		to->set_appid(this->appId);
+		to->set_appaccount(outgoingMessage.getToAppAccount());
 
-	delete message;
-	message = NULL;
+		mimc::MIMCP2PMessage message;
+		message.set_allocated_from(from);
+		message.set_allocated_to(to);
+		message.set_payload(this->packetManager->encodePayload(outgoingMessage.getPayload(), payloadBuffer));
+		message.set_biztype(outgoingMessage.getBizType());
+		message.set_isstore(outgoingMessage.getIsStore());
+		message.SerializeToString(&messageBytesStr);
+	}
 
-	std::string packetId = this->packetManager->createPacketId();
+	std::string packetId = outboxPacketId.empty() ? this->packetManager->createPacketId() : outboxPacketId;
 	mimc::MIMCPacket * packet = new mimc::MIMCPacket();
 	packet->set_packetid(packetId);
 	packet->set_package(this->appPackage);
-	packet->set_type(mimc::P2T_MESSAGE);
+	packet->set_type(outgoingMessage.isGroupMessage() ? mimc::P2T_MESSAGE : mimc::P2P_MESSAGE);
 	packet->set_payload(messageBytesStr);
 	packet->set_timestamp(time(NULL));
 
-	delete[] messageBytes;
-	messageBytes = NULL;
+	if (outgoingMessage.isGroupMessage()) {
+		MIMCGroupMessage mimcGroupMessage(packetId, packet->sequence(), this->appAccount, this->resource, outgoingMessage.getTopicId(), outgoingMessage.getPayload(), outgoingMessage.getBizType(), packet->timestamp());
+		this->packetManager->addPacketWaitToTimeout(mimcGroupMessage, outgoingMessage.getTimeoutMs());
+	} else {
+		MIMCMessage mimcMessage(packetId, packet->sequence(), this->appAccount, this->resource, outgoingMessage.getToAppAccount(), "", outgoingMessage.getPayload(), outgoingMessage.getBizType(), packet->timestamp());
+		this->packetManager->addPacketWaitToTimeout(mimcMessage, outgoingMessage.getTimeoutMs());
+	}
+	return packet;
+}
 
-	MIMCGroupMessage mimcGroupMessage(packetId, packet->sequence(), this->appAccount, this->resource,topicId, payload, bizType, packet->timestamp());
-	(this->packetManager->groupPacketWaitToTimeout).insert(std::pair<std::string, MIMCGroupMessage>(packetId, mimcGroupMessage));
+bool User::enqueueMessagePacket(mimc::MIMCPacket* packet) {
+	pthread_mutex_lock(&sendBatchMutex);
+	if (this->sendBatchWindowMs > 0) {
+		if (this->sendBatch.size() >= this->sendBatchMaxMessages) {
+			// the last full batch did not fit in the queue, give it another try before taking more
+			pthread_mutex_unlock(&sendBatchMutex);
+			bool flushed = flushSendBatch();
+			pthread_mutex_lock(&sendBatchMutex);
+			if (!flushed && this->sendBatch.size() >= this->sendBatchMaxMessages) {
+				pthread_mutex_unlock(&sendBatchMutex);
+				XMDLoggerWrapper::instance()->warn("In enqueueMessagePacket, send queue is full, packetId=%s", packet->packetid().c_str());
+				this->packetManager->removePacketWaitToTimeout(packet->packetid());
+				delete packet;
+				return false;
+			}
+		}
+		this->sendBatch.push_back(packet);
+		size_t batchSize = this->sendBatch.size();
+		bool full = batchSize >= this->sendBatchMaxMessages;
+		pthread_mutex_unlock(&sendBatchMutex);
+		if (full) {
+			flushSendBatch();
+		} else if (batchSize == 1) {
+			// the loop arms the batch window timer
+			this->wakeup();
+		}
+		return true;
+	}
+	pthread_mutex_unlock(&sendBatchMutex);
 
+	std::string packetId = packet->packetid();
 	struct waitToSendContent mimc_obj;
 	mimc_obj.cmd = BODY_CLIENTHEADER_CMD_SECMSG;
 	mimc_obj.type = C2S_DOUBLE_DIRECTION;
 	mimc_obj.message = packet;
-	(this->packetManager->packetsWaitToSend).push(mimc_obj);
+	if (!this->tryEnqueuePacket(mimc_obj, SEND_LANE_MESSAGE)) {
+		// the FE connection is not draining, hand the backpressure to the caller instead of stalling it
+		XMDLoggerWrapper::instance()->warn("In enqueueMessagePacket, send queue is full, packetId=%s", packetId.c_str());
+		this->packetManager->removePacketWaitToTimeout(packetId);
+		delete packet;
+		return false;
+	}
+	return true;
+}
 
-	return packetId;
+bool User::tryEnqueueCompound(std::vector<mimc::MIMCPacket*>& packets) {
+	if (packets.size() == 1) {
+		struct waitToSendContent mimc_obj;
+		mimc_obj.cmd = BODY_CLIENTHEADER_CMD_SECMSG;
+		mimc_obj.type = C2S_DOUBLE_DIRECTION;
+		mimc_obj.message = packets[0];
+		return this->tryEnqueuePacket(mimc_obj, SEND_LANE_MESSAGE);
+	}
+
+	// one header, one encryption pass and one write for the whole batch, acks still come per packetId
+	mimc::MIMCPacketList packetList;
+	packetList.set_uuid(this->uuid);
+	packetList.set_resource(this->resource);
+	for (size_t i = 0; i < packets.size(); i++) {
+		packetList.mutable_packets()->AddAllocated(packets[i]);
+	}
+	mimc::MIMCPacket * packet = new mimc::MIMCPacket();
+	packet->set_packetid(this->packetManager->createPacketId());
+	packet->set_package(this->appPackage);
+	packet->set_type(mimc::COMPOUND);
+	packetList.SerializeToString(packet->mutable_payload());
+	packet->set_timestamp(time(NULL));
+
+	struct waitToSendContent mimc_obj;
+	mimc_obj.cmd = BODY_CLIENTHEADER_CMD_SECMSG;
+	mimc_obj.type = C2S_DOUBLE_DIRECTION;
+	mimc_obj.message = packet;
+	if (!this->tryEnqueuePacket(mimc_obj, SEND_LANE_MESSAGE)) {
+		// hand the packets back to the caller untouched
+		packetList.mutable_packets()->ExtractSubrange(0, packetList.packets_size(), &packets[0]);
+		delete packet;
+		return false;
+	}
+	return true;
 }
 
+size_t User::nextCompoundEnd(const std::vector<mimc::MIMCPacket*>& packets, size_t begin) const {
+	size_t end = begin;
+	int batchBytes = 0;
+	while (end < packets.size() && end - begin < SEND_COMPOUND_MAX_PACKETS) {
+		batchBytes += packets[end]->ByteSize();
+		if (end > begin && batchBytes > SEND_BATCH_BYTES) {
+			break;
+		}
+		end++;
+	}
+	return end;
+}
+
+bool User::flushSendBatch() {
+	while (true) {
+		pthread_mutex_lock(&sendBatchMutex);
+		if (this->sendBatch.empty()) {
+			pthread_mutex_unlock(&sendBatchMutex);
+			return true;
+		}
+		size_t end = nextCompoundEnd(this->sendBatch, 0);
+		if (end > this->sendBatchMaxMessages) {
+			end = this->sendBatchMaxMessages;
+		}
+		std::vector<mimc::MIMCPacket*> chunk(this->sendBatch.begin(), this->sendBatch.begin() + end);
+		this->sendBatch.erase(this->sendBatch.begin(), this->sendBatch.begin() + end);
+		pthread_mutex_unlock(&sendBatchMutex);
+
+		if (!tryEnqueueCompound(chunk)) {
+			// keep the batch, in order, for the next flush
+			pthread_mutex_lock(&sendBatchMutex);
+			this->sendBatch.insert(this->sendBatch.begin(), chunk.begin(), chunk.end());
+			pthread_mutex_unlock(&sendBatchMutex);
+			return false;
+		}
+	}
+}
 
 uint64_t User::dialCall(const std::string & toAppAccount, const std::string & appContent, const std::string & toResource) {
 	if (this->rtsCallEventHandler == NULL) {
@@ -1115,17 +1698,20 @@ uint64_t User::dialCall(const std::string & toAppAccount, const std::string & ap
 		}
 		currentCalls->insert(std::pair<uint64_t, P2PCallSession>(callId, P2PCallSession(callId, toUser, mimc::SINGLE_CALL, WAIT_SEND_CREATE_REQUEST, time(NULL), true, appContent)));
 		pthread_rwlock_unlock(&mutex_0);
+		this->wakeup();
 		return callId;
 	} else if (this->relayLinkState == BEING_CREATED) {
 
 		currentCalls->insert(std::pair<uint64_t, P2PCallSession>(callId, P2PCallSession(callId, toUser, mimc::SINGLE_CALL, WAIT_SEND_CREATE_REQUEST, time(NULL), true, appContent)));
 		pthread_rwlock_unlock(&mutex_0);
+		this->wakeup();
 		return callId;
 	} else if (this->relayLinkState == SUCC_CREATED) {
 
 		currentCalls->insert(std::pair<uint64_t, P2PCallSession>(callId, P2PCallSession(callId, toUser, mimc::SINGLE_CALL, WAIT_CREATE_RESPONSE, time(NULL), true, appContent)));
 		RtsSendSignal::sendCreateRequest(this, callId);
 		pthread_rwlock_unlock(&mutex_0);
+		this->wakeup();
 		return callId;
 	} else {
 		pthread_rwlock_unlock(&mutex_0);
@@ -1198,7 +1784,7 @@ void User::closeCall(uint64_t callId, std::string byeReason) {
 	}
 	currentCalls->erase(callId);
 	RtsSendData::closeRelayConnWhenNoCall(this);
-	rtsCallEventHandler->onClosed(callId, "CLOSED_INITIATIVELY");
+	getRTSCallEventHandler()->onClosed(callId, "CLOSED_INITIATIVELY");
 	pthread_rwlock_unlock(&mutex_0);
 }
 
@@ -1215,6 +1801,7 @@ bool User::login() {
 		return false;
 	}
 	permitLogin = true;
+	this->wakeup();
 	return true;
 }
 
@@ -1241,21 +1828,21 @@ bool User::logout() {
 		}
 		if (callSession.getCallState() >= RUNNING) {
 			RtsSendSignal::sendByeRequest(this, callId, "CLIENT LOGOUT");
-			rtsCallEventHandler->onClosed(callId, "CLIENT LOGOUT");
+			getRTSCallEventHandler()->onClosed(callId, "CLIENT LOGOUT");
 		}
 	}
 
+	permitLogin = false;
+
 	struct waitToSendContent logout_obj;
 	logout_obj.cmd = BODY_CLIENTHEADER_CMD_UNBIND;
 	logout_obj.type = C2S_DOUBLE_DIRECTION;
 	logout_obj.message = NULL;
-	packetManager->packetsWaitToSend.push(logout_obj);
+	this->enqueuePacket(logout_obj, SEND_LANE_CONTROL);
 
 	currentCalls->clear();
 	RtsSendData::closeRelayConnWhenNoCall(this);
 
-	permitLogin = false;
-
 	pthread_rwlock_unlock(&mutex_0);
 	return true;
 }
@@ -1320,7 +1907,7 @@ void User::checkAndCloseCalls() {
 			}
 			if (callSession.getCallState() >= RUNNING) {
 				RtsSendSignal::sendByeRequest(this, callId, ALL_DATA_CHANNELS_CLOSED);
-				rtsCallEventHandler->onClosed(callId, ALL_DATA_CHANNELS_CLOSED);
+				getRTSCallEventHandler()->onClosed(callId, ALL_DATA_CHANNELS_CLOSED);
 			}
 			currentCalls->erase(iter++);
 		} else {
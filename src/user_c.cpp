@@ -1,6 +1,7 @@
 #include <mimc/user_c.h>
 #include <mimc/user.h>
 #include <XMDTransceiver.h>
+#include <mimc/http_client.h>
 #include <curl/curl.h>
 
 class CTokenFetcher : public MIMCTokenFetcher {
@@ -35,55 +36,20 @@ public:
 	}
 */
     std::string fetchToken() {
-        CURL *curl = curl_easy_init();
-        CURLcode res;
 #ifndef STAGING
         const std::string url = "https://mimc.chat.xiaomi.net/api/account/token";
 #else
         const std::string url = "http://10.38.162.149/api/account/token";
 #endif
-        const std::string body = "{\"appId\":\"" + _app_id + "\",\"appKey\":\"" + _app_key + "\",\"appSecret\":\"" + _app_secret + "\",\"appAccount\":\"" + _app_account + "\"}";
+        HttpRequest request;
+        request.url = url;
+        request.body = "{\"appId\":\"" + _app_id + "\",\"appKey\":\"" + _app_key + "\",\"appSecret\":\"" + _app_secret + "\",\"appAccount\":\"" + _app_account + "\"}";
+        request.headers.push_back("Content-Type: application/json");
         std::string result;
-        if (curl) {
-            curl_easy_setopt(curl, CURLOPT_POST, 1);
-            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-            curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, false);
-
-            struct curl_slist *headers = NULL;
-            headers = curl_slist_append(headers, "Content-Type: application/json");
-            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, body.size());
-
-            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)(&result));
-
-            char errbuf[CURL_ERROR_SIZE];
-            curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
-             errbuf[0] = 0;
-
-
-
-            res = curl_easy_perform(curl);
-            if (res != CURLE_OK) {
-                XMDLoggerWrapper::instance()->error("curl perform error, error code is %d, error msg is %s", res, errbuf);
-                
-            }
-            curl_slist_free_all(headers);
-            curl_easy_cleanup(curl);
-        }
+        HttpClient::instance()->perform(request, result);
 
         return result;
     }
-
-    static size_t WriteCallback(void *contents, size_t size, size_t nmemb, void *userp) {
-        std::string *bodyp = (std::string *)userp;
-        bodyp->append((const char *)contents, size * nmemb);
-
-        return size * nmemb;
-    }
 private:
     std::string _app_id;
     std::string _app_key;
@@ -1,56 +1,96 @@
 #include <mimc/utils.h>
+#include <json-c/json.h>
 #include <chrono>
+#include <fstream>
+#include <iterator>
 #include <random>
+#include <pthread.h>
 
 #ifdef _WIN32
 #include <winsock.h>
 #pragma comment(lib,"ws2_32.lib")
 #endif // _WIN32
 
+namespace {
+const char DIGIT_PAIRS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+std::mt19937_64& threadRandomEngine() {
+    // the clock and the thread's own address keep threads that start together from sharing a sequence
+    thread_local std::mt19937_64 engine(std::random_device{}() ^ (uint64_t)Utils::currentTimeMicros()
+        ^ (uint64_t)(uintptr_t)&engine);
+    return engine;
+}
+}
+
+uint64_t Utils::nextRandom() {
+    return threadRandomEngine()();
+}
+
 std::string Utils::generateRandomString(int length) {
-    char* s= new char[length + 1];
-    srand(currentTimeMicros());
+    std::string randomString(length, '0');
     for (int i = 0; i < length; i++) {
-        switch (rand() % 3) {
+        uint64_t r = nextRandom();
+        switch (r % 3) {
         case 1:
-            s[i] = 'A' + rand() % 26;
+            randomString[i] = 'A' + (r >> 8) % 26;
             break;
         case 2:
-            s[i] = 'a' + rand() % 26;
+            randomString[i] = 'a' + (r >> 8) % 26;
             break;
         default:
-            s[i] = '0' + rand() % 10;
+            randomString[i] = '0' + (r >> 8) % 10;
             break;
         }
     }
-    s[length] = '\0';
-    std::string randomString = s;
-	delete[] s;
     return randomString;
 }
 
 int64_t Utils::generateRandomLong() {
-#ifdef _WIN32
-	std::random_device rd;
-	std::mt19937_64 mt(rd());
-	std::uniform_int_distribution<uint64_t> dist1(0, UINT64_MAX);
-	return dist1(mt) & 0x7fffffffffffffff;
-#else
-	srand(currentTimeMicros());
-	int64_t l = rand() % 128;
-	for (int i = 0; i < 7; i++) {
-		srand(currentTimeMicros());
-		l = l << 8 | rand() % 256;
-	}
-
-	return l;
-#endif // _WIN32
+	return nextRandom() & 0x7fffffffffffffff;
 }
 
 std::string Utils::int2str(const int64_t& int_temp) {
-    std::stringstream stream;
-    stream << int_temp;
-    return stream.str();
+    char str[INT64_STR_LEN];
+    int len = int2chars(int_temp, str);
+    return std::string(str, len);
+}
+
+int Utils::int2chars(int64_t value, char* str) {
+    // digits are produced two at a time from the back of a scratch buffer, then moved to the front
+    char digits[INT64_STR_LEN];
+    char* p = digits + INT64_STR_LEN;
+    uint64_t v = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    while (v >= 100) {
+        unsigned int pair = (unsigned int)(v % 100) * 2;
+        v /= 100;
+        *--p = DIGIT_PAIRS[pair + 1];
+        *--p = DIGIT_PAIRS[pair];
+    }
+    if (v >= 10) {
+        unsigned int pair = (unsigned int)v * 2;
+        *--p = DIGIT_PAIRS[pair + 1];
+        *--p = DIGIT_PAIRS[pair];
+    } else {
+        *--p = (char)('0' + v);
+    }
+    if (value < 0) {
+        *--p = '-';
+    }
+
+    int len = (int)(digits + INT64_STR_LEN - p);
+    memcpy(str, p, len);
+    str[len] = '\0';
+    return len;
 }
 
 std::string Utils::hexToAscii(const char* src, int srcLen) {
@@ -141,6 +181,18 @@ int64_t Utils::currentTimeMillis() {
 	return ms.count();
 }
 
+int64_t Utils::steadyTimeMicros() {
+	std::chrono::microseconds microS = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch());
+	return microS.count();
+}
+
+int64_t Utils::steadyTimeMillis() {
+	std::chrono::milliseconds ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch());
+	return ms.count();
+}
+
 int64_t Utils::currentTimeMicros() {
 	std::chrono::microseconds microS = std::chrono::duration_cast<std::chrono::microseconds>(
 		std::chrono::system_clock::now().time_since_epoch());
@@ -188,7 +240,60 @@ bool Utils::createDirIfNotExist(const std::string& pDir) {
     return true;
 }
 
+// cache files are shared by the users of a process and the resolver cache, and rewritten rarely
+static pthread_mutex_t fileMutex = PTHREAD_MUTEX_INITIALIZER;
+
+std::string Utils::readFile(const std::string& path) {
+    pthread_mutex_lock(&fileMutex);
+    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    pthread_mutex_unlock(&fileMutex);
+    return content;
+}
+
+bool Utils::mergeJsonFile(const std::string& path, json_object* update) {
+    if (update == NULL || json_object_get_type(update) != json_type_object) {
+        return false;
+    }
+    pthread_mutex_lock(&fileMutex);
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    json_object* pobj = json_tokener_parse(content.c_str());
+    if (pobj == NULL || json_object_get_type(pobj) != json_type_object) {
+        json_object_put(pobj);
+        pobj = json_object_new_object();
+    }
+    struct json_object_iter iter;
+    json_object_object_foreachC(update, iter) {
+        json_object_object_add(pobj, iter.key, json_object_get(iter.val));
+    }
+    const char* str = json_object_get_string(pobj);
+
+    // readers never see a half written file, they get either the old or the new one
+    std::string tmpPath = path + ".tmp";
+    bool written = false;
+    std::ofstream out(tmpPath.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+    if (out.is_open()) {
+        out.write(str, strlen(str));
+        out.close();
+        written = !out.fail();
+    }
+#ifdef _WIN32
+    if (written) {
+        remove(path.c_str());
+    }
+#endif
+    if (!written || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        remove(tmpPath.c_str());
+        written = false;
+    }
+    json_object_put(pobj);
+    pthread_mutex_unlock(&fileMutex);
+    return written;
+}
+
 char* Utils::ltoa(int64_t value, char* str) {
-    sprintf(str, "%llu", value);
+    int2chars(value, str);
     return str;
 }
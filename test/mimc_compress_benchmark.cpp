@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+#include <test/mimc_compress_benchmark.h>
+#include <mimc/constant.h>
+#include <mimc/utils.h>
+#include <stdio.h>
+
+string MimcCompressBenchmark::createJsonPayload(int size) {
+	const char* words[] = {"hello", "meeting", "tomorrow", "photo", "sticker", "location", "ok", "thanks", "see you", "on my way"};
+	string payload = "{\"version\":2,\"messages\":[";
+	for (int i = 0; ; i++) {
+		string entry = string(i > 0 ? "," : "") + "{\"msgId\":\"" + Utils::generateRandomString(12) + "\",\"from\":\"user_" + Utils::int2str((int64_t)(i % 7)) + "\",\"timestamp\":" + Utils::int2str((int64_t)(1560000000000LL + i * 1733)) + ",\"type\":\"text\",\"content\":\"" + words[i % 10] + " " + words[(i * 3) % 10] + "\",\"read\":" + (i % 2 ? "true" : "false") + "}";
+		if (payload.size() + entry.size() + 2 > (size_t)size) {
+			break;
+		}
+		payload += entry;
+	}
+	payload += "]}";
+	return payload;
+}
+
+TEST_F(MimcCompressBenchmark, compressRoundTrip) {
+	packetManager.setPayloadCompressThreshold(PAYLOAD_COMPRESS_THRESHOLD);
+	for (size_t i = 0; i < sizeof(COMPRESS_BENCHMARK_PAYLOAD_SIZES) / sizeof(COMPRESS_BENCHMARK_PAYLOAD_SIZES[0]); i++) {
+		string payload = createJsonPayload(COMPRESS_BENCHMARK_PAYLOAD_SIZES[i]);
+		string encodeBuffer, decodeBuffer;
+		const string& encoded = packetManager.encodePayload(payload, encodeBuffer);
+		ASSERT_EQ(payload.size() >= PAYLOAD_COMPRESS_THRESHOLD, PayloadCodec::isCompressed(encoded));
+		ASSERT_EQ(payload, packetManager.decodePayload(encoded, decodeBuffer));
+	}
+
+	// raw bytes that look like a compressed payload are wrapped, so they survive the trip unchanged
+	string lookalike = string(PAYLOAD_COMPRESS_MAGIC, PAYLOAD_COMPRESS_MAGIC_LENGTH) + "\x00\x00\x00\x05" + "short";
+	string encodeBuffer, decodeBuffer;
+	const string& encoded = packetManager.encodePayload(lookalike, encodeBuffer);
+	ASSERT_NE(lookalike, encoded);
+	ASSERT_EQ(lookalike, packetManager.decodePayload(encoded, decodeBuffer));
+
+	// compression off, even a lookalike leaves unchanged
+	PacketManager disabled;
+	string plainBuffer;
+	ASSERT_EQ(lookalike, disabled.encodePayload(lookalike, plainBuffer));
+	string payload = createJsonPayload(COMPRESS_BENCHMARK_PAYLOAD_SIZES[0]);
+	ASSERT_EQ(payload, disabled.encodePayload(payload, plainBuffer));
+
+	// a corrupt compressed payload is delivered as received
+	string corrupt = encoded.substr(0, PAYLOAD_COMPRESS_HEADER_LENGTH) + "garbage";
+	ASSERT_EQ(corrupt, packetManager.decodePayload(corrupt, decodeBuffer));
+}
+
+TEST_F(MimcCompressBenchmark, compressRatioAndCost) {
+	for (size_t i = 0; i < sizeof(COMPRESS_BENCHMARK_PAYLOAD_SIZES) / sizeof(COMPRESS_BENCHMARK_PAYLOAD_SIZES[0]); i++) {
+		string payload = createJsonPayload(COMPRESS_BENCHMARK_PAYLOAD_SIZES[i]);
+		string compressed, decompressed;
+
+		int64_t begin = Utils::currentTimeMicros();
+		for (int j = 0; j < COMPRESS_BENCHMARK_ITERATIONS; j++) {
+			ASSERT_TRUE(PayloadCodec::compress(payload, compressed));
+		}
+		int64_t compressCost = Utils::currentTimeMicros() - begin;
+
+		begin = Utils::currentTimeMicros();
+		for (int j = 0; j < COMPRESS_BENCHMARK_ITERATIONS; j++) {
+			ASSERT_TRUE(payloadCodec.decompress(compressed, decompressed));
+		}
+		int64_t decompressCost = Utils::currentTimeMicros() - begin;
+		ASSERT_EQ(payload, decompressed);
+
+		printf("json payload %d bytes -> %d bytes (%.1f%% saved), compress %.1f us/msg, decompress %.1f us/msg\n",
+			(int)payload.size(), (int)compressed.size(), 100.0 * (payload.size() - compressed.size()) / payload.size(),
+			(double)compressCost / COMPRESS_BENCHMARK_ITERATIONS, (double)decompressCost / COMPRESS_BENCHMARK_ITERATIONS);
+	}
+}
@@ -0,0 +1,23 @@
+#ifndef MIMC_CPP_TEST_COMPRESSBENCHMARK_H
+#define MIMC_CPP_TEST_COMPRESSBENCHMARK_H
+
+#include <gtest/gtest.h>
+#include <mimc/packet_manager.h>
+#include <mimc/payload_codec.h>
+#include <string>
+
+using namespace std;
+
+const int COMPRESS_BENCHMARK_ITERATIONS = 20000;
+const int COMPRESS_BENCHMARK_PAYLOAD_SIZES[] = {512, 2 * 1024, 8 * 1024};
+
+class MimcCompressBenchmark: public testing::Test {
+protected:
+	// chat style json, the kind of payload the compression is meant for
+	string createJsonPayload(int size);
+
+	PacketManager packetManager;
+	PayloadCodec payloadCodec;
+};
+
+#endif //MIMC_CPP_TEST_COMPRESSBENCHMARK_H
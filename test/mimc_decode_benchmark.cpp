@@ -0,0 +1,271 @@
+#include <gtest/gtest.h>
+#include <test/mimc_decode_benchmark.h>
+#include <mimc/constant.h>
+#include <mimc/utils.h>
+#include <crypto/rc4_crypto.h>
+#include <crypto/base64.h>
+#include <XMDLoggerWrapper.h>
+#include <zlib/zlib.h>
+#include <atomic>
+#include <new>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// every heap allocation of the process, the benchmark reads the difference across a decode
+static std::atomic<uint64_t> allocationCount(0);
+
+void* operator new(size_t size) {
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	return malloc(size > 0 ? size : 1);
+}
+
+void* operator new[](size_t size) {
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	return malloc(size > 0 ? size : 1);
+}
+
+void operator delete(void* ptr) noexcept {
+	free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+	free(ptr);
+}
+
+static void short2char(int16_t data, unsigned char* result, int index) {
+	result[index] = (data >> 8) & 0xFF;
+	result[index + 1] = data & 0xFF;
+}
+
+static void int2char(int32_t data, unsigned char* result, int index) {
+	for (int i = index + 3; i >= index; i--) {
+		result[i] = data & 0xFF;
+		data >>= 8;
+	}
+}
+
+static int32_t char2int(const unsigned char* input, int index) {
+	return (int32_t)((input[index] << 24) | (input[index + 1] << 16) | (input[index + 2] << 8) | input[index + 3]);
+}
+
+static int16_t char2short(const unsigned char* input, int index) {
+	return (int16_t)((input[index] << 8) | input[index + 1]);
+}
+
+static string payloadKey(const string& securityKey, const string& headerId) {
+	string keyBytes;
+	ccb::Base64Util::Decode(securityKey, keyBytes);
+	return keyBytes + "_" + headerId;
+}
+
+void MimcDecodeBenchmark::SetUp() {
+	XMDLoggerWrapper::instance()->externalLog(&quietLog);
+	user = new User(DECODE_BENCHMARK_APPID, "decode_bench", "bench", DECODE_BENCHMARK_CACHE_PATH);
+	user->registerOnlineStatusHandler(&onlineStatusHandler);
+	connection = new Connection();
+	connection->setUser(user);
+	connection->setChallengeAndBodyKey(DECODE_BENCHMARK_CHALLENGE);
+	packetManager = user->getPacketManager();
+	nextSequence = 1000;
+}
+
+void MimcDecodeBenchmark::TearDown() {
+	delete connection;
+	connection = NULL;
+	delete user;
+	user = NULL;
+	XMDLoggerWrapper::instance()->externalLog(NULL);
+}
+
+string MimcDecodeBenchmark::encodeFrame(const mimc::MIMCPacket& packet) {
+	ims::ClientHeader header;
+	header.set_cmd(BODY_CLIENTHEADER_CMD_SECMSG);
+	header.set_server(MIMC_SERVER);
+	header.set_uuid(user->getUuid());
+	header.set_chid(MIMC_CHID);
+	header.set_cipher(BODY_CLIENTHEADER_CIPHER_RC4);
+	header.set_resource(user->getResource());
+	header.set_id(packetManager->createPacketId());
+	header.set_dir_flag(ims::ClientHeader::SC_RESP);
+	string rawHeader = header.SerializeAsString();
+
+	string payload;
+	ccb::CryptoRC4Util::Encrypt(packet.SerializeAsString(), payload, payloadKey(user->getSecurityKey(), header.id()));
+
+	string body(BODY_HEADER_LENGTH, '\0');
+	short2char(BODY_HEADER_PAYLOADTYPE, (unsigned char*)&body[0], BODY_HEADER_PAYLOADTYPE_OFFSET);
+	short2char(rawHeader.size(), (unsigned char*)&body[0], BODY_HEADER_HEADERLEN_OFFSET);
+	int2char(payload.size(), (unsigned char*)&body[0], BODY_HEADER_PAYLOADLEN_OFFSET);
+	body += rawHeader;
+	body += payload;
+	string encryptedBody;
+	ccb::CryptoRC4Util::Encrypt(body, encryptedBody, connection->getBodyKey());
+
+	string frame(HEADER_LENGTH, '\0');
+	short2char(HEADER_MAGIC, (unsigned char*)&frame[0], HEADER_MAGIC_OFFSET);
+	short2char(HEADER_VERSION, (unsigned char*)&frame[0], HEADER_VERSION_OFFSET);
+	int2char(encryptedBody.size(), (unsigned char*)&frame[0], HEADER_BODYLEN_OFFSET);
+	frame += encryptedBody;
+	frame.append(BODY_CRC_LEN, '\0');
+	int2char(adler32(1L, (const unsigned char*)frame.data(), frame.size() - BODY_CRC_LEN), (unsigned char*)&frame[0], frame.size() - BODY_CRC_LEN);
+	return frame;
+}
+
+mimc::MIMCPacket MimcDecodeBenchmark::createAck(int64_t sequence) {
+	mimc::MIMCPacketAck ack;
+	ack.set_packetid(packetManager->createPacketId());
+	ack.set_sequence(sequence);
+	ack.set_timestamp(time(NULL));
+	ack.set_uuid(user->getUuid());
+
+	mimc::MIMCPacket packet;
+	packet.set_packetid(packetManager->createPacketId());
+	packet.set_type(mimc::PACKET_ACK);
+	packet.set_payload(ack.SerializeAsString());
+	return packet;
+}
+
+mimc::MIMCPacket MimcDecodeBenchmark::createCompound(int64_t firstSequence, int messages, const string& bizType) {
+	mimc::MIMCPacketList packetList;
+	packetList.set_uuid(user->getUuid());
+	packetList.set_resource(user->getResource());
+	for (int i = 0; i < messages; i++) {
+		mimc::MIMCP2PMessage message;
+		message.mutable_from()->set_appid(DECODE_BENCHMARK_APPID);
+		message.mutable_from()->set_appaccount("decode_bench_peer");
+		message.mutable_from()->set_resource("peer_resource");
+		message.mutable_to()->set_appid(DECODE_BENCHMARK_APPID);
+		message.mutable_to()->set_appaccount(user->getAppAccount());
+		message.set_payload("payload of a chat message, long enough not to fit a small string " + Utils::int2str(firstSequence + i));
+		if (!bizType.empty()) {
+			message.set_biztype(bizType);
+		}
+
+		mimc::MIMCPacket* packet = packetList.add_packets();
+		packet->set_packetid(packetManager->createPacketId());
+		packet->set_sequence(firstSequence + i);
+		packet->set_timestamp(time(NULL));
+		packet->set_type(mimc::P2P_MESSAGE);
+		packet->set_payload(message.SerializeAsString());
+	}
+	packetList.set_maxsequence(firstSequence + messages - 1);
+
+	mimc::MIMCPacket packet;
+	packet.set_packetid(packetManager->createPacketId());
+	packet.set_type(mimc::COMPOUND);
+	packet.set_payload(packetList.SerializeAsString());
+	return packet;
+}
+
+bool MimcDecodeBenchmark::legacyDecode(unsigned char* frame) {
+	int body_size = char2int(frame, HEADER_BODYLEN_OFFSET);
+	if ((uint32_t)char2int(frame, HEADER_LENGTH + body_size) != adler32(1L, frame, HEADER_LENGTH + body_size)) {
+		return false;
+	}
+	ccb::CryptoRC4Util::CryptInPlace(frame + HEADER_LENGTH, body_size, *connection->getBodyKeySchedule());
+	short body_head_size = char2short(frame, HEADER_LENGTH + BODY_HEADER_HEADERLEN_OFFSET);
+	int body_message_size = char2int(frame, HEADER_LENGTH + BODY_HEADER_PAYLOADLEN_OFFSET);
+
+	ims::ClientHeader header;
+	if (!header.ParseFromArray(frame + HEADER_LENGTH + BODY_HEADER_LENGTH, body_head_size)) {
+		return false;
+	}
+	std::string cmd = header.cmd();
+	std::string payload_key = payloadKey(user->getSecurityKey(), header.id());
+	unsigned char* body_message = frame + HEADER_LENGTH + BODY_HEADER_LENGTH + body_head_size;
+	ccb::CryptoRC4Util::CryptInPlace(body_message, body_message_size, payload_key);
+	mimc::MIMCPacket mimcPacket;
+	if (!mimcPacket.ParseFromArray(body_message, body_message_size)) {
+		return false;
+	}
+	if (mimcPacket.type() == mimc::PACKET_ACK) {
+		mimc::MIMCPacketAck mimcPacketAck;
+		return mimcPacketAck.ParseFromString(mimcPacket.payload());
+	}
+	mimc::MIMCPacketList mimcPacketList;
+	if (!mimcPacketList.ParseFromString(mimcPacket.payload())) {
+		return false;
+	}
+	for (int i = 0; i < mimcPacketList.packets_size(); i++) {
+		mimc::MIMCP2PMessage p2pMessage;
+		if (!p2pMessage.ParseFromString(mimcPacketList.packets(i).payload())) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void MimcDecodeBenchmark::measure(bool legacy, int compoundSize, double& framesPerSecond, double& allocationsPerFrame) {
+	int64_t cost = 0;
+	uint64_t allocations = 0;
+	string frame;
+	for (int i = 0; i < DECODE_BENCHMARK_WARMUP + DECODE_BENCHMARK_ITERATIONS; i++) {
+		// every compound carries sequences not seen before, or the dedupe would skip its messages
+		if (compoundSize == 0) {
+			if (frame.empty()) {
+				frame = encodeFrame(createAck(nextSequence++));
+			}
+		} else {
+			frame = encodeFrame(createCompound(nextSequence, compoundSize, "bench"));
+			nextSequence += compoundSize;
+		}
+		// decoding decrypts in place, so every round starts from a copy
+		frameBuffer.assign(frame.begin(), frame.end());
+
+		uint64_t allocationsBefore = allocationCount.load(std::memory_order_relaxed);
+		int64_t begin = Utils::steadyTimeMicros();
+		bool decoded = legacy ? legacyDecode(&frameBuffer[0]) : packetManager->decodePacketAndHandle(&frameBuffer[0], connection) == 0;
+		int64_t end = Utils::steadyTimeMicros();
+		uint64_t allocationsAfter = allocationCount.load(std::memory_order_relaxed);
+		ASSERT_TRUE(decoded);
+		if (i >= DECODE_BENCHMARK_WARMUP) {
+			cost += end - begin;
+			allocations += allocationsAfter - allocationsBefore;
+		}
+	}
+	framesPerSecond = (double)DECODE_BENCHMARK_ITERATIONS * 1000000 / (cost > 0 ? cost : 1);
+	allocationsPerFrame = (double)allocations / DECODE_BENCHMARK_ITERATIONS;
+}
+
+TEST_F(MimcDecodeBenchmark, decodeReusesMessages) {
+	DecodeCaptureHandler captureHandler;
+	user->registerMessageBatchHandler(&captureHandler);
+
+	// a message with a biztype, then one without, must not inherit it from the reused objects
+	string frame = encodeFrame(createCompound(nextSequence, 4, "first"));
+	frameBuffer.assign(frame.begin(), frame.end());
+	ASSERT_EQ(0, packetManager->decodePacketAndHandle(&frameBuffer[0], connection));
+	frame = encodeFrame(createCompound(nextSequence + 4, 2, ""));
+	frameBuffer.assign(frame.begin(), frame.end());
+	ASSERT_EQ(0, packetManager->decodePacketAndHandle(&frameBuffer[0], connection));
+
+	ASSERT_EQ(6u, captureHandler.messages.size());
+	for (size_t i = 0; i < captureHandler.messages.size(); i++) {
+		const MIMCMessage& message = captureHandler.messages[i];
+		ASSERT_EQ(nextSequence + (int64_t)i, message.getSequence());
+		ASSERT_EQ("decode_bench_peer", message.getFromAccount());
+		ASSERT_EQ("payload of a chat message, long enough not to fit a small string " + Utils::int2str(nextSequence + i), message.getPayload());
+		ASSERT_EQ(i < 4 ? "first" : "", message.getBizType());
+	}
+	user->registerMessageBatchHandler(NULL);
+}
+
+TEST_F(MimcDecodeBenchmark, decodeAllocations) {
+	double legacyRate, legacyAllocations, rate, allocations;
+	measure(true, 0, legacyRate, legacyAllocations);
+	measure(false, 0, rate, allocations);
+	printf("PACKET_ACK decode: fresh messages %.0f frames/s %.1f allocations/frame, decode context %.0f frames/s %.1f allocations/frame\n",
+		legacyRate, legacyAllocations, rate, allocations);
+	EXPECT_LT(allocations, legacyAllocations);
+
+	for (size_t i = 0; i < sizeof(DECODE_BENCHMARK_COMPOUND_SIZES) / sizeof(DECODE_BENCHMARK_COMPOUND_SIZES[0]); i++) {
+		int compoundSize = DECODE_BENCHMARK_COMPOUND_SIZES[i];
+		measure(true, compoundSize, legacyRate, legacyAllocations);
+		measure(false, compoundSize, rate, allocations);
+		printf("COMPOUND of %d decode: fresh messages %.0f frames/s %.1f allocations/frame, decode context %.0f frames/s %.1f allocations/frame\n",
+			compoundSize, legacyRate, legacyAllocations, rate, allocations);
+		EXPECT_LT(allocations, legacyAllocations);
+	}
+}
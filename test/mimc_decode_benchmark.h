@@ -0,0 +1,70 @@
+#ifndef MIMC_CPP_TEST_DECODEBENCHMARK_H
+#define MIMC_CPP_TEST_DECODEBENCHMARK_H
+
+#include <gtest/gtest.h>
+#include <mimc/user.h>
+#include <mimc/connection.h>
+#include <mimc/packet_manager.h>
+#include <mimc/message_batch_handler.h>
+#include <test/mimc_onlinestatus_handler.h>
+#include <ExternalLog.h>
+#include <vector>
+
+using namespace std;
+
+const int64_t DECODE_BENCHMARK_APPID = 2882303761517669588;
+const string DECODE_BENCHMARK_CHALLENGE = "challenge0123456789";
+const string DECODE_BENCHMARK_CACHE_PATH = "/tmp/mimc_decode_benchmark";
+const int DECODE_BENCHMARK_WARMUP = 1000;
+const int DECODE_BENCHMARK_ITERATIONS = 50000;
+const int DECODE_BENCHMARK_COMPOUND_SIZES[] = {1, 16};
+
+class DecodeQuietLog : public ExternalLog {
+public:
+	void info(const char *msg) {}
+	void debug(const char *msg) {}
+	void warn(const char *msg) {}
+	void error(const char *msg) {}
+};
+
+class DecodeCaptureHandler : public MessageBatchHandler {
+public:
+	void handleMessageBatch(const vector<MIMCMessageView>& messages) {
+		for (size_t i = 0; i < messages.size(); i++) {
+			this->messages.push_back(messages[i].toMessage());
+		}
+	}
+	void handleGroupMessageBatch(const vector<MIMCGroupMessageView>& messages) {}
+
+	vector<MIMCMessage> messages;
+};
+
+class MimcDecodeBenchmark: public testing::Test {
+protected:
+	void SetUp();
+
+	void TearDown();
+
+	// a SECMSG frame the way the FE sends it, body and payload encrypted
+	string encodeFrame(const mimc::MIMCPacket& packet);
+
+	mimc::MIMCPacket createAck(int64_t sequence);
+
+	mimc::MIMCPacket createCompound(int64_t firstSequence, int messages, const string& bizType);
+
+	// decodes the way decodePacketAndHandle did before the decode contexts, into fresh messages for every frame
+	bool legacyDecode(unsigned char* frame);
+
+	// frames per second and heap allocations per frame, compoundSize 0 decodes PACKET_ACKs
+	void measure(bool legacy, int compoundSize, double& framesPerSecond, double& allocationsPerFrame);
+
+	DecodeQuietLog quietLog;
+	TestOnlineStatusHandler onlineStatusHandler;
+	User* user;
+	Connection* connection;
+	PacketManager* packetManager;
+	int64_t nextSequence;
+	vector<unsigned char> frameBuffer;
+};
+
+#endif //MIMC_CPP_TEST_DECODEBENCHMARK_H
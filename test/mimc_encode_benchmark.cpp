@@ -0,0 +1,210 @@
+#include <gtest/gtest.h>
+#include <test/mimc_encode_benchmark.h>
+#include <mimc/constant.h>
+#include <mimc/utils.h>
+#include <crypto/rc4_crypto.h>
+#include <crypto/base64.h>
+#include <XMDLoggerWrapper.h>
+#include <zlib/zlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+static void short2char(int16_t data, unsigned char* result, int index) {
+	result[index] = (data >> 8) & 0xFF;
+	result[index + 1] = data & 0xFF;
+}
+
+static void int2char(int32_t data, unsigned char* result, int index) {
+	for (int i = index + 3; i >= index; i--) {
+		result[i] = data & 0xFF;
+		data >>= 8;
+	}
+}
+
+static int32_t char2int(const unsigned char* input, int index) {
+	return (int32_t)((input[index] << 24) | (input[index + 1] << 16) | (input[index + 2] << 8) | input[index + 3]);
+}
+
+static int16_t char2short(const unsigned char* input, int index) {
+	return (int16_t)((input[index] << 8) | input[index + 1]);
+}
+
+static string payloadKey(const string& securityKey, const string& headerId) {
+	string keyBytes;
+	ccb::Base64Util::Decode(securityKey, keyBytes);
+	return keyBytes + "_" + headerId;
+}
+
+void MimcEncodeBenchmark::SetUp() {
+	XMDLoggerWrapper::instance()->externalLog(&quietLog);
+	user = new User(ENCODE_BENCHMARK_APPID, "encode_bench", "bench", ENCODE_BENCHMARK_CACHE_PATH);
+	user->registerOnlineStatusHandler(&onlineStatusHandler);
+	connection = new Connection();
+	connection->setUser(user);
+	connection->setChallengeAndBodyKey(ENCODE_BENCHMARK_CHALLENGE);
+	packetManager = user->getPacketManager();
+}
+
+void MimcEncodeBenchmark::TearDown() {
+	delete connection;
+	connection = NULL;
+	delete user;
+	user = NULL;
+	XMDLoggerWrapper::instance()->externalLog(NULL);
+}
+
+mimc::MIMCPacket* MimcEncodeBenchmark::createMessage(int payloadSize) {
+	mimc::MIMCP2PMessage message;
+	mimc::MIMCUser* from = message.mutable_from();
+	from->set_appid(ENCODE_BENCHMARK_APPID);
+	from->set_appaccount(user->getAppAccount());
+	from->set_uuid(user->getUuid());
+	from->set_resource(user->getResource());
+	mimc::MIMCUser* to = message.mutable_to();
+	to->set_appid(ENCODE_BENCHMARK_APPID);
+	to->set_appaccount("encode_bench_peer");
+	message.set_payload(string(payloadSize, 'p'));
+	message.set_biztype("bench");
+	message.set_isstore(true);
+
+	mimc::MIMCPacket* packet = new mimc::MIMCPacket();
+	packet->set_packetid(packetManager->createPacketId());
+	packet->set_package(user->getAppPackage());
+	packet->set_type(mimc::P2P_MESSAGE);
+	packet->set_payload(message.SerializeAsString());
+	packet->set_timestamp(time(NULL));
+	return packet;
+}
+
+ims::ClientHeader* MimcEncodeBenchmark::createHeader() {
+	ims::ClientHeader* header = new ims::ClientHeader();
+	header->set_cmd(BODY_CLIENTHEADER_CMD_SECMSG);
+	header->set_server(MIMC_SERVER);
+	header->set_uuid(user->getUuid());
+	header->set_chid(user->getChid());
+	header->set_cipher(BODY_CLIENTHEADER_CIPHER_RC4);
+	header->set_resource(user->getResource());
+	header->set_id(packetManager->createPacketId());
+	header->set_dir_flag(ims::ClientHeader::CS_REQ);
+	return header;
+}
+
+int MimcEncodeBenchmark::legacyEncodeSecMsgPacket(unsigned char * &packet, const google::protobuf::MessageLite * message) {
+	ims::ClientHeader* header = createHeader();
+	string body_key = connection->getBodyKey();
+	string payload_key = payloadKey(user->getSecurityKey(), header->id());
+
+	short body_head_size = header->ByteSize();
+	char * raw_header = new char[body_head_size];
+	memset(raw_header, 0, body_head_size);
+	header->SerializeToArray(raw_header, body_head_size);
+
+	int body_message_size = message->ByteSize();
+	char * raw_message = new char[body_message_size];
+	memset(raw_message, 0, body_message_size);
+	message->SerializeToArray(raw_message, body_message_size);
+	char * final_message = new char[body_message_size];
+	memset(final_message, 0, body_message_size);
+	string raw_message_str(raw_message, body_message_size);
+	string message_cipher;
+	ccb::CryptoRC4Util::Encrypt(raw_message_str, message_cipher, payload_key);
+	memmove(final_message, message_cipher.c_str(), body_message_size);
+	delete[] raw_message;
+
+	int body_size = BODY_HEADER_LENGTH + body_head_size + body_message_size;
+	unsigned char * raw_body = new unsigned char[body_size];
+	memset(raw_body, 0, body_size);
+	short2char(BODY_HEADER_PAYLOADTYPE, raw_body, BODY_HEADER_PAYLOADTYPE_OFFSET);
+	short2char(body_head_size, raw_body, BODY_HEADER_HEADERLEN_OFFSET);
+	int2char(body_message_size, raw_body, BODY_HEADER_PAYLOADLEN_OFFSET);
+	memmove(raw_body + BODY_HEADER_LENGTH, raw_header, body_head_size);
+	memmove(raw_body + BODY_HEADER_LENGTH + body_head_size, final_message, body_message_size);
+
+	char * final_body = new char[body_size];
+	memset(final_body, 0, body_size);
+	string raw_body_str((char *)raw_body, body_size);
+	string body_cipher;
+	ccb::CryptoRC4Util::Encrypt(raw_body_str, body_cipher, body_key);
+	memmove(final_body, body_cipher.c_str(), body_size);
+
+	delete[] raw_header;
+	delete[] final_message;
+	delete[] raw_body;
+
+	int packet_size = HEADER_LENGTH + body_size + BODY_CRC_LEN;
+	packet = new unsigned char[packet_size];
+	memset(packet, 0, packet_size);
+	short2char(HEADER_MAGIC, packet, HEADER_MAGIC_OFFSET);
+	short2char(HEADER_VERSION, packet, HEADER_VERSION_OFFSET);
+	int2char(body_size, packet, HEADER_BODYLEN_OFFSET);
+	memmove(packet + HEADER_LENGTH, final_body, body_size);
+	int2char(adler32(1L, packet, packet_size - BODY_CRC_LEN), packet, packet_size - BODY_CRC_LEN);
+
+	delete[] final_body;
+	delete header;
+	delete message;
+	return packet_size;
+}
+
+bool MimcEncodeBenchmark::decodeSecMsgPacket(const unsigned char* packet, int packetSize, mimc::MIMCPacket& message) {
+	if (char2short(packet, HEADER_MAGIC_OFFSET) != HEADER_MAGIC || char2short(packet, HEADER_VERSION_OFFSET) != HEADER_VERSION) {
+		return false;
+	}
+	int body_size = char2int(packet, HEADER_BODYLEN_OFFSET);
+	if (HEADER_LENGTH + body_size + BODY_CRC_LEN != packetSize
+		|| (uint32_t)char2int(packet, HEADER_LENGTH + body_size) != adler32(1L, packet, HEADER_LENGTH + body_size)) {
+		return false;
+	}
+	string body;
+	ccb::CryptoRC4Util::Decrypt(string((const char*)packet + HEADER_LENGTH, body_size), body, connection->getBodyKey());
+	int body_head_size = char2short((const unsigned char*)body.data(), BODY_HEADER_HEADERLEN_OFFSET);
+	int body_message_size = char2int((const unsigned char*)body.data(), BODY_HEADER_PAYLOADLEN_OFFSET);
+	ims::ClientHeader header;
+	if (!header.ParseFromArray(body.data() + BODY_HEADER_LENGTH, body_head_size) || header.cmd() != BODY_CLIENTHEADER_CMD_SECMSG) {
+		return false;
+	}
+	string plain;
+	ccb::CryptoRC4Util::Decrypt(body.substr(BODY_HEADER_LENGTH + body_head_size, body_message_size), plain, payloadKey(user->getSecurityKey(), header.id()));
+	return message.ParseFromString(plain);
+}
+
+double MimcEncodeBenchmark::measure(bool legacy, int payloadSize) {
+	mimc::MIMCPacket* prototype = createMessage(payloadSize);
+	int64_t begin = Utils::currentTimeMicros();
+	for (int i = 0; i < ENCODE_BENCHMARK_ITERATIONS; i++) {
+		// the encoder takes ownership of the message, as it does for queued packets
+		mimc::MIMCPacket* message = new mimc::MIMCPacket(*prototype);
+		unsigned char* packet = NULL;
+		int packetSize = legacy ? legacyEncodeSecMsgPacket(packet, message) : packetManager->encodeSecMsgPacket(packet, connection, message);
+		EXPECT_GT(packetSize, 0);
+		delete[] packet;
+	}
+	int64_t cost = Utils::currentTimeMicros() - begin;
+	delete prototype;
+	return (double)ENCODE_BENCHMARK_ITERATIONS * 1000000 / (cost > 0 ? cost : 1);
+}
+
+TEST_F(MimcEncodeBenchmark, encodeRoundTrip) {
+	for (size_t i = 0; i < sizeof(ENCODE_BENCHMARK_PAYLOAD_SIZES) / sizeof(ENCODE_BENCHMARK_PAYLOAD_SIZES[0]); i++) {
+		mimc::MIMCPacket* message = createMessage(ENCODE_BENCHMARK_PAYLOAD_SIZES[i]);
+		string expected = message->SerializeAsString();
+		unsigned char* packet = NULL;
+		int packetSize = packetManager->encodeSecMsgPacket(packet, connection, message);
+		ASSERT_GT(packetSize, 0);
+		mimc::MIMCPacket decoded;
+		ASSERT_TRUE(decodeSecMsgPacket(packet, packetSize, decoded));
+		ASSERT_EQ(expected, decoded.SerializeAsString());
+		delete[] packet;
+	}
+}
+
+TEST_F(MimcEncodeBenchmark, encodeThroughput) {
+	for (size_t i = 0; i < sizeof(ENCODE_BENCHMARK_PAYLOAD_SIZES) / sizeof(ENCODE_BENCHMARK_PAYLOAD_SIZES[0]); i++) {
+		int payloadSize = ENCODE_BENCHMARK_PAYLOAD_SIZES[i];
+		double before = measure(true, payloadSize);
+		double after = measure(false, payloadSize);
+		printf("SECMSG encode, payload %d bytes: legacy %.0f msg/s, single pass %.0f msg/s per core (x%.2f)\n",
+			payloadSize, before, after, after / before);
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef MIMC_CPP_TEST_ENCODEBENCHMARK_H
+#define MIMC_CPP_TEST_ENCODEBENCHMARK_H
+
+#include <gtest/gtest.h>
+#include <mimc/user.h>
+#include <mimc/connection.h>
+#include <mimc/packet_manager.h>
+#include <test/mimc_onlinestatus_handler.h>
+#include <ExternalLog.h>
+
+using namespace std;
+
+const int64_t ENCODE_BENCHMARK_APPID = 2882303761517669588;
+const string ENCODE_BENCHMARK_CACHE_PATH = "/tmp/mimc_encode_benchmark";
+const string ENCODE_BENCHMARK_CHALLENGE = "challenge0123456789";
+const int ENCODE_BENCHMARK_ITERATIONS = 200000;
+const int ENCODE_BENCHMARK_PAYLOAD_SIZES[] = {64, 1024, 8 * 1024};
+
+class EncodeQuietLog : public ExternalLog {
+public:
+	void info(const char *msg) {}
+	void debug(const char *msg) {}
+	void warn(const char *msg) {}
+	void error(const char *msg) {}
+};
+
+class MimcEncodeBenchmark: public testing::Test {
+protected:
+	void SetUp();
+
+	void TearDown();
+
+	mimc::MIMCPacket* createMessage(int payloadSize);
+
+	ims::ClientHeader* createHeader();
+
+	// the encoder as it was before the single pass rewrite, kept as the baseline
+	int legacyEncodeSecMsgPacket(unsigned char * &packet, const google::protobuf::MessageLite * message);
+
+	bool decodeSecMsgPacket(const unsigned char* packet, int packetSize, mimc::MIMCPacket& message);
+
+	double measure(bool legacy, int payloadSize);
+
+	EncodeQuietLog quietLog;
+	TestOnlineStatusHandler onlineStatusHandler;
+	User* user;
+	Connection* connection;
+	PacketManager* packetManager;
+};
+
+#endif //MIMC_CPP_TEST_ENCODEBENCHMARK_H
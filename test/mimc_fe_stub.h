@@ -0,0 +1,412 @@
+#ifndef MIMC_CPP_TEST_FESTUB_H
+#define MIMC_CPP_TEST_FESTUB_H
+
+#include <mimc/ims_push_service.pb.h>
+#include <mimc/mimc.pb.h>
+#include <mimc/constant.h>
+#include <mimc/utils.h>
+#include <crypto/rc4_crypto.h>
+#include <crypto/base64.h>
+#include <zlib/zlib.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+
+// base64 of "secretkey123456", handed out as miUserSecurityKey by stubToken()
+const std::string FE_STUB_SECURITY_KEY = "c2VjcmV0a2V5MTIzNDU2";
+const std::string FE_STUB_CHALLENGE = "challenge0123456789";
+const std::string FE_STUB_DOMAIN = "fe.stub";
+const int FE_STUB_MAX_EVENTS = 256;
+
+/*
+ * Minimal local FE speaking just enough of the protocol for load tests:
+ * CONN, BIND (the token is taken as the account), PING, UBND and SECMSG
+ * P2P messages, which are acked and delivered to the peer as COMPOUND.
+ * One epoll thread serves every client.
+ */
+class MimcFeStub {
+public:
+	MimcFeStub() : listenFd(-1), epollFd(-1), port(0), running(false), sequence(1000), receivedMessages(0), deliveredMessages(0) {}
+	~MimcFeStub() { stop(); }
+
+	bool start() {
+		listenFd = socket(AF_INET, SOCK_STREAM, 0);
+		int on = 1;
+		setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd, 4096) != 0) {
+			return false;
+		}
+		socklen_t len = sizeof(addr);
+		getsockname(listenFd, (struct sockaddr*)&addr, &len);
+		port = ntohs(addr.sin_port);
+		fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+
+		epollFd = epoll_create1(0);
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = listenFd;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+
+		running = true;
+		loopThread = std::thread(&MimcFeStub::loop, this);
+		return true;
+	}
+
+	void stop() {
+		if (!running) {
+			return;
+		}
+		running = false;
+		loopThread.join();
+		for (std::map<int, StubClient*>::iterator iter = clients.begin(); iter != clients.end(); iter++) {
+			close(iter->first);
+			delete iter->second;
+		}
+		clients.clear();
+		accounts.clear();
+		close(epollFd);
+		close(listenFd);
+	}
+
+	int getPort() const { return port; }
+	int64_t getReceivedMessages() const { return receivedMessages; }
+	int64_t getDeliveredMessages() const { return deliveredMessages; }
+
+	// cpu time burnt by the stub thread, so that load tests can leave it out of the process total
+	int64_t getCpuMicros() {
+		clockid_t clockId;
+		struct timespec ts;
+		if (!running || pthread_getcpuclockid(loopThread.native_handle(), &clockId) != 0 || clock_gettime(clockId, &ts) != 0) {
+			return 0;
+		}
+		return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	}
+
+	// token json for appAccount, also carrying the stub address so that the cache file resolves FE_STUB_DOMAIN
+	std::string stubToken(int64_t appId, const std::string& appAccount, int64_t uuid) const {
+		char buf[1024];
+		snprintf(buf, sizeof(buf), "{\"code\":200,\"message\":\"success\",\"data\":{\"appId\":\"%lld\",\"appAccount\":\"%s\",\"appPackage\":\"com.xiaomi.stub\","
+			"\"miChid\":9,\"miUserId\":\"%lld\",\"miUserSecurityKey\":\"%s\",\"token\":\"%s\",\"regionBucket\":1,\"feDomainName\":\"%s\",\"relayDomainName\":\"relay.stub\"},"
+			"\"%s\":[\"127.0.0.1:%d\"],\"relay.stub\":[\"127.0.0.1:1\"]}",
+			(long long)appId, appAccount.c_str(), (long long)uuid, FE_STUB_SECURITY_KEY.c_str(), appAccount.c_str(), FE_STUB_DOMAIN.c_str(),
+			FE_STUB_DOMAIN.c_str(), port);
+		return buf;
+	}
+
+private:
+	struct StubClient {
+		int fd;
+		int64_t uuid;
+		std::string resource;
+		std::string account;
+		std::string bodyKey;
+		std::string recvBuffer;
+		std::string sendBuffer;
+	};
+
+	void loop() {
+		struct epoll_event events[FE_STUB_MAX_EVENTS];
+		while (running) {
+			int n = epoll_wait(epollFd, events, FE_STUB_MAX_EVENTS, 100);
+			for (int i = 0; i < n; i++) {
+				int fd = events[i].data.fd;
+				if (fd == listenFd) {
+					acceptClients();
+					continue;
+				}
+				std::map<int, StubClient*>::iterator iter = clients.find(fd);
+				if (iter == clients.end()) {
+					continue;
+				}
+				StubClient* client = iter->second;
+				bool alive = true;
+				if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+					alive = readClient(client);
+				}
+				if (alive && (events[i].events & EPOLLOUT)) {
+					alive = flushClient(client);
+				}
+				if (!alive) {
+					closeClient(client);
+				}
+			}
+		}
+	}
+
+	void acceptClients() {
+		while (true) {
+			int fd = accept(listenFd, NULL, NULL);
+			if (fd < 0) {
+				return;
+			}
+			int on = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+			StubClient* client = new StubClient();
+			client->fd = fd;
+			client->uuid = 0;
+			clients[fd] = client;
+			struct epoll_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.fd = fd;
+			epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+		}
+	}
+
+	void closeClient(StubClient* client) {
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, client->fd, NULL);
+		close(client->fd);
+		std::map<std::string, StubClient*>::iterator iter = accounts.find(client->account);
+		if (iter != accounts.end() && iter->second == client) {
+			accounts.erase(iter);
+		}
+		clients.erase(client->fd);
+		delete client;
+	}
+
+	bool readClient(StubClient* client) {
+		char buf[16 * 1024];
+		while (true) {
+			ssize_t n = read(client->fd, buf, sizeof(buf));
+			if (n > 0) {
+				client->recvBuffer.append(buf, n);
+				continue;
+			}
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				break;
+			}
+			return false;
+		}
+		size_t offset = 0;
+		while (client->recvBuffer.size() - offset >= HEADER_LENGTH) {
+			const unsigned char* header = (const unsigned char*)client->recvBuffer.data() + offset;
+			int bodyLen = char2int(header, HEADER_BODYLEN_OFFSET);
+			size_t frameLen = HEADER_LENGTH + bodyLen + BODY_CRC_LEN;
+			if (client->recvBuffer.size() - offset < frameLen) {
+				break;
+			}
+			std::string body = client->recvBuffer.substr(offset + HEADER_LENGTH, bodyLen);
+			offset += frameLen;
+			if (!handleFrame(client, body)) {
+				return false;
+			}
+		}
+		client->recvBuffer.erase(0, offset);
+		return flushClient(client);
+	}
+
+	bool flushClient(StubClient* client) {
+		while (!client->sendBuffer.empty()) {
+			ssize_t n = write(client->fd, client->sendBuffer.data(), client->sendBuffer.size());
+			if (n > 0) {
+				client->sendBuffer.erase(0, n);
+				continue;
+			}
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				break;
+			}
+			return false;
+		}
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = client->sendBuffer.empty() ? EPOLLIN : (EPOLLIN | EPOLLOUT);
+		ev.data.fd = client->fd;
+		epoll_ctl(epollFd, EPOLL_CTL_MOD, client->fd, &ev);
+		return true;
+	}
+
+	bool handleFrame(StubClient* client, std::string& body) {
+		if (body.empty()) {
+			appendFrame(client, body);
+			return true;
+		}
+		if (!client->bodyKey.empty()) {
+			std::string plain;
+			ccb::CryptoRC4Util::Encrypt(body, plain, client->bodyKey);
+			body.swap(plain);
+		}
+		int headerLen = char2short((const unsigned char*)body.data(), BODY_HEADER_HEADERLEN_OFFSET);
+		int payloadLen = char2int((const unsigned char*)body.data(), BODY_HEADER_PAYLOADLEN_OFFSET);
+		ims::ClientHeader header;
+		header.ParseFromArray(body.data() + BODY_HEADER_LENGTH, headerLen);
+		std::string payload = body.substr(BODY_HEADER_LENGTH + headerLen, payloadLen);
+
+		if (header.cmd() == BODY_CLIENTHEADER_CMD_CONN) {
+			ims::XMMsgConn conn;
+			conn.ParseFromString(payload);
+			client->uuid = header.uuid();
+			client->resource = header.resource();
+			ims::XMMsgConnResp resp;
+			resp.set_challenge(FE_STUB_CHALLENGE);
+			sendCmd(client, BODY_CLIENTHEADER_CMD_CONN, resp.SerializeAsString(), false);
+			std::string udid = conn.udid();
+			std::string tmp = FE_STUB_CHALLENGE.substr(FE_STUB_CHALLENGE.size() / 2) + udid.substr(udid.size() / 2);
+			ccb::CryptoRC4Util::Encrypt(tmp, client->bodyKey, FE_STUB_CHALLENGE);
+		} else if (header.cmd() == BODY_CLIENTHEADER_CMD_BIND) {
+			ims::XMMsgBind bind;
+			bind.ParseFromString(payload);
+			client->account = bind.token();
+			accounts[client->account] = client;
+			ims::XMMsgBindResp resp;
+			resp.set_result(true);
+			sendCmd(client, BODY_CLIENTHEADER_CMD_BIND, resp.SerializeAsString(), false);
+		} else if (header.cmd() == BODY_CLIENTHEADER_CMD_UNBIND) {
+			return false;
+		} else if (header.cmd() == BODY_CLIENTHEADER_CMD_SECMSG) {
+			std::string plain;
+			ccb::CryptoRC4Util::Encrypt(payload, plain, payloadKey(header.id()));
+			mimc::MIMCPacket packet;
+			if (packet.ParseFromString(plain)) {
+				handlePacket(client, packet);
+			}
+		}
+		return true;
+	}
+
+	void handlePacket(StubClient* client, const mimc::MIMCPacket& packet) {
+		if (packet.type() == mimc::COMPOUND) {
+			mimc::MIMCPacketList packetList;
+			packetList.ParseFromString(packet.payload());
+			for (int i = 0; i < packetList.packets_size(); i++) {
+				handlePacket(client, packetList.packets(i));
+			}
+			return;
+		}
+		if (packet.type() != mimc::P2P_MESSAGE) {
+			return;
+		}
+		receivedMessages++;
+		int64_t seq = sequence++;
+
+		mimc::MIMCPacketAck ack;
+		ack.set_packetid(packet.packetid());
+		ack.set_sequence(seq);
+		ack.set_timestamp(time(NULL));
+		ack.set_uuid(client->uuid);
+		mimc::MIMCPacket ackPacket;
+		ackPacket.set_packetid(Utils::int2str(seq));
+		ackPacket.set_type(mimc::PACKET_ACK);
+		ackPacket.set_payload(ack.SerializeAsString());
+		sendCmd(client, BODY_CLIENTHEADER_CMD_SECMSG, ackPacket.SerializeAsString(), true);
+
+		mimc::MIMCP2PMessage message;
+		message.ParseFromString(packet.payload());
+		std::map<std::string, StubClient*>::iterator iter = accounts.find(message.to().appaccount());
+		if (iter == accounts.end()) {
+			return;
+		}
+		StubClient* peer = iter->second;
+		mimc::MIMCPacketList packetList;
+		packetList.set_uuid(peer->uuid);
+		packetList.set_resource(peer->resource);
+		packetList.set_maxsequence(seq);
+		mimc::MIMCPacket* delivered = packetList.add_packets();
+		*delivered = packet;
+		delivered->set_sequence(seq);
+		mimc::MIMCPacket compound;
+		compound.set_packetid(Utils::int2str(seq));
+		compound.set_type(mimc::COMPOUND);
+		compound.set_payload(packetList.SerializeAsString());
+		sendCmd(peer, BODY_CLIENTHEADER_CMD_SECMSG, compound.SerializeAsString(), true);
+		if (peer != client) {
+			flushClient(peer);
+		}
+		deliveredMessages++;
+	}
+
+	std::string payloadKey(const std::string& packetId) const {
+		std::string key;
+		ccb::Base64Util::Decode(FE_STUB_SECURITY_KEY, key);
+		return key + "_" + packetId;
+	}
+
+	void sendCmd(StubClient* client, const std::string& cmd, const std::string& payload, bool securePayload) {
+		ims::ClientHeader header;
+		header.set_cmd(cmd);
+		header.set_chid(MIMC_CHID);
+		header.set_uuid(client->uuid);
+		header.set_id(Utils::int2str(sequence++));
+		header.set_server("xiaomi.com");
+		std::string headerBin = header.SerializeAsString();
+		std::string payloadBin = payload;
+		if (securePayload) {
+			ccb::CryptoRC4Util::Encrypt(payload, payloadBin, payloadKey(header.id()));
+		}
+
+		std::string body(BODY_HEADER_LENGTH, '\0');
+		short2char(BODY_HEADER_PAYLOADTYPE, (unsigned char*)&body[0], BODY_HEADER_PAYLOADTYPE_OFFSET);
+		short2char(headerBin.size(), (unsigned char*)&body[0], BODY_HEADER_HEADERLEN_OFFSET);
+		int2char(payloadBin.size(), (unsigned char*)&body[0], BODY_HEADER_PAYLOADLEN_OFFSET);
+		body += headerBin;
+		body += payloadBin;
+		if (cmd != BODY_CLIENTHEADER_CMD_CONN) {
+			std::string encrypted;
+			ccb::CryptoRC4Util::Encrypt(body, encrypted, client->bodyKey);
+			body.swap(encrypted);
+		}
+		appendFrame(client, body);
+	}
+
+	void appendFrame(StubClient* client, const std::string& body) {
+		std::string frame(HEADER_LENGTH, '\0');
+		short2char(HEADER_MAGIC, (unsigned char*)&frame[0], HEADER_MAGIC_OFFSET);
+		short2char(HEADER_VERSION, (unsigned char*)&frame[0], HEADER_VERSION_OFFSET);
+		int2char(body.size(), (unsigned char*)&frame[0], HEADER_BODYLEN_OFFSET);
+		frame += body;
+		std::string crc(BODY_CRC_LEN, '\0');
+		int2char(adler32(1L, (const unsigned char*)frame.data(), frame.size()), (unsigned char*)&crc[0], 0);
+		client->sendBuffer += frame;
+		client->sendBuffer += crc;
+	}
+
+	static int16_t char2short(const unsigned char* input, int index) {
+		return (int16_t)((input[index] << 8) | input[index + 1]);
+	}
+
+	static int32_t char2int(const unsigned char* input, int index) {
+		return (int32_t)((input[index] << 24) | (input[index + 1] << 16) | (input[index + 2] << 8) | input[index + 3]);
+	}
+
+	static void short2char(int16_t data, unsigned char* result, int index) {
+		result[index] = (data >> 8) & 0xFF;
+		result[index + 1] = data & 0xFF;
+	}
+
+	static void int2char(int32_t data, unsigned char* result, int index) {
+		for (int i = index + 3; i >= index; i--) {
+			result[i] = data & 0xFF;
+			data >>= 8;
+		}
+	}
+
+	int listenFd;
+	int epollFd;
+	int port;
+	std::atomic<bool> running;
+	std::thread loopThread;
+	std::atomic<int64_t> sequence;
+	std::atomic<int64_t> receivedMessages;
+	std::atomic<int64_t> deliveredMessages;
+	std::map<int, StubClient*> clients;
+	std::map<std::string, StubClient*> accounts;
+};
+
+#endif //MIMC_CPP_TEST_FESTUB_H
@@ -0,0 +1,226 @@
+#include <gtest/gtest.h>
+#include <test/mimc_message_outbox_test.h>
+#include <stdio.h>
+#include <sched.h>
+#include <unistd.h>
+
+static vector<string> readAll(const MappedLog& log) {
+	vector<string> records;
+	string record;
+	for (int64_t offset = log.begin(), next = 0; (next = log.next(offset, record)) >= 0; offset = next) {
+		records.push_back(record);
+	}
+	return records;
+}
+
+static void overwrite(const string& path, int64_t offset, const void* data, size_t size) {
+	FILE* file = fopen(path.c_str(), "r+b");
+	ASSERT_TRUE(file != NULL);
+	ASSERT_EQ(0, fseek(file, (long)offset, SEEK_SET));
+	ASSERT_EQ(size, fwrite(data, 1, size, file));
+	fclose(file);
+}
+
+void MessageOutboxTest::SetUp() {
+	remove(OUTBOX_TEST_FILE.c_str());
+	remove((OUTBOX_TEST_FILE + ".compact").c_str());
+	remove(MAPPED_LOG_TEST_FILE.c_str());
+	compacting = NULL;
+	started = false;
+	nextId = 0;
+}
+
+void MessageOutboxTest::TearDown() {
+	remove(OUTBOX_TEST_FILE.c_str());
+	remove((OUTBOX_TEST_FILE + ".compact").c_str());
+	remove(MAPPED_LOG_TEST_FILE.c_str());
+}
+
+void* MessageOutboxTest::compact(void* arg) {
+	MessageOutboxTest* test = (MessageOutboxTest*)arg;
+	test->started = true;
+	test->compacting->run();
+	return NULL;
+}
+
+void MessageOutboxTest::startCompaction(MessageOutbox& outbox) {
+	compacting = &outbox;
+	started = false;
+	pthread_create(&compactThread, NULL, compact, this);
+	while (!started.load()) {
+		sched_yield();
+	}
+}
+
+void MessageOutboxTest::joinCompaction() {
+	pthread_join(compactThread, NULL);
+	compacting = NULL;
+}
+
+string MessageOutboxTest::addMessage(MessageOutbox& outbox) {
+	char packetId[32];
+	snprintf(packetId, sizeof(packetId), "outbox-test-%d", nextId++);
+	// the payload names its packet id, so a record carried to the wrong place is caught
+	string payload = string(OUTBOX_TEST_PAYLOAD_SIZE, 'a' + nextId % 26) + packetId;
+	EXPECT_TRUE(outbox.add(packetId, OutgoingMessage("outbox-test-peer", payload)));
+	return packetId;
+}
+
+vector<string> MessageOutboxTest::pendingIds(MessageOutbox& outbox) {
+	vector<string> ids;
+	vector<pair<string, OutgoingMessage> > messages;
+	outbox.markAllUnsent();
+	while (outbox.takeUnsent(messages, OUTBOX_TEST_PENDING) > 0) {
+		for (size_t i = 0; i < messages.size(); i++) {
+			const string& payload = messages[i].second.getPayload();
+			EXPECT_EQ(messages[i].first, payload.substr(OUTBOX_TEST_PAYLOAD_SIZE));
+			ids.push_back(messages[i].first);
+		}
+		messages.clear();
+	}
+	return ids;
+}
+
+TEST_F(MessageOutboxTest, ackDuringCompaction) {
+	vector<string> expected;
+	for (int round = 0; round < OUTBOX_TEST_ROUNDS; round++) {
+		// every round starts from a restart, an ack that landed during the last compaction must not be undone
+		MessageOutbox outbox;
+		ASSERT_TRUE(outbox.open(OUTBOX_TEST_FILE));
+		ASSERT_EQ(expected.size(), outbox.getPendingCount());
+		ASSERT_EQ(expected, pendingIds(outbox));
+		while ((int)expected.size() < OUTBOX_TEST_PENDING) {
+			expected.push_back(addMessage(outbox));
+		}
+
+		// the oldest go while the copy runs, some of them before its snapshot, some after
+		startCompaction(outbox);
+		for (int i = 0; i < OUTBOX_TEST_CONCURRENT_OPS; i++) {
+			outbox.ack(expected[i]);
+			usleep(OUTBOX_TEST_OP_INTERVAL_US);
+		}
+		joinCompaction();
+		expected.erase(expected.begin(), expected.begin() + OUTBOX_TEST_CONCURRENT_OPS);
+		ASSERT_EQ(expected.size(), outbox.getPendingCount());
+		ASSERT_EQ(expected, pendingIds(outbox));
+
+		// acking again after the offsets moved is harmless
+		outbox.ack(expected.front());
+		expected.erase(expected.begin());
+		ASSERT_EQ(expected, pendingIds(outbox));
+	}
+}
+
+TEST_F(MessageOutboxTest, addDuringCompaction) {
+	vector<string> expected;
+	for (int round = 0; round < OUTBOX_TEST_ROUNDS / 10; round++) {
+		MessageOutbox outbox;
+		ASSERT_TRUE(outbox.open(OUTBOX_TEST_FILE));
+		ASSERT_EQ(expected, pendingIds(outbox));
+		while ((int)expected.size() < OUTBOX_TEST_PENDING) {
+			expected.push_back(addMessage(outbox));
+		}
+
+		startCompaction(outbox);
+		for (int i = 0; i < OUTBOX_TEST_CONCURRENT_OPS; i++) {
+			expected.push_back(addMessage(outbox));
+			usleep(OUTBOX_TEST_OP_INTERVAL_US);
+		}
+		joinCompaction();
+		// messages added meanwhile are carried over behind the snapshot, in the order they came
+		ASSERT_EQ(expected.size(), outbox.getPendingCount());
+		ASSERT_EQ(expected, pendingIds(outbox));
+
+		// and are acked at their new offsets
+		for (int i = 0; i < OUTBOX_TEST_CONCURRENT_OPS; i++) {
+			outbox.ack(expected.back());
+			expected.pop_back();
+		}
+		ASSERT_EQ(expected, pendingIds(outbox));
+	}
+}
+
+TEST_F(MessageOutboxTest, expireRemovesForGood) {
+	vector<string> expected;
+	{
+		MessageOutbox outbox;
+		ASSERT_TRUE(outbox.open(OUTBOX_TEST_FILE));
+		for (int i = 0; i < 3; i++) {
+			expected.push_back(addMessage(outbox));
+		}
+		outbox.expire(expected[1]);
+		outbox.expire("outbox-test-unknown");
+		expected.erase(expected.begin() + 1);
+		ASSERT_EQ(expected, pendingIds(outbox));
+	}
+
+	// a timed out message is not resent after a restart either
+	MessageOutbox reopened;
+	ASSERT_TRUE(reopened.open(OUTBOX_TEST_FILE));
+	ASSERT_EQ(expected, pendingIds(reopened));
+}
+
+TEST_F(MessageOutboxTest, fullOutboxRefusesAdd) {
+	MessageOutbox outbox;
+	ASSERT_TRUE(outbox.open(OUTBOX_TEST_FILE));
+	OutgoingMessage message("outbox-test-peer", "outbox-test-payload");
+	char packetId[32];
+	for (unsigned int i = 0; i < OUTBOX_MAX_PENDING_MESSAGES; i++) {
+		snprintf(packetId, sizeof(packetId), "outbox-test-%u", i);
+		ASSERT_TRUE(outbox.add(packetId, message));
+	}
+	ASSERT_FALSE(outbox.add("outbox-test-over", message));
+	ASSERT_EQ(OUTBOX_MAX_PENDING_MESSAGES, outbox.getPendingCount());
+
+	outbox.ack("outbox-test-0");
+	ASSERT_TRUE(outbox.add("outbox-test-over", message));
+	ASSERT_FALSE(outbox.add("outbox-test-over-again", message));
+}
+
+TEST_F(MessageOutboxTest, reopenAfterTornRecord) {
+	vector<string> records;
+	records.push_back("first record");
+	records.push_back("second record");
+	string torn = "third record, torn by a crash part way through its append";
+	int64_t tornOffset = 0;
+	{
+		MappedLog log;
+		ASSERT_TRUE(log.open(MAPPED_LOG_TEST_FILE));
+		ASSERT_GE(log.append(records[0]), 0);
+		ASSERT_GE(log.append(records[1]), 0);
+		tornOffset = log.append(torn);
+		ASSERT_GE(tornOffset, 0);
+	}
+	// a body byte that does not match the crc stands for a record only partly on disk
+	char garbage = 'X';
+	overwrite(MAPPED_LOG_TEST_FILE, tornOffset + 8 + 4, &garbage, 1);
+
+	{
+		MappedLog log;
+		ASSERT_TRUE(log.open(MAPPED_LOG_TEST_FILE));
+		ASSERT_EQ(records, readAll(log));
+		ASSERT_EQ(tornOffset, log.end());
+
+		// the next append takes the place of the torn record, whose tail must not come back
+		records.push_back("fourth");
+		ASSERT_EQ(tornOffset, log.append(records[2]));
+		ASSERT_EQ(records, readAll(log));
+	}
+
+	int64_t lastOffset = 0;
+	{
+		MappedLog log;
+		ASSERT_TRUE(log.open(MAPPED_LOG_TEST_FILE));
+		ASSERT_EQ(records, readAll(log));
+		lastOffset = log.end();
+		ASSERT_EQ(lastOffset, log.append(torn));
+	}
+	// a length pointing past the file is dropped the same way
+	uint32_t length = 0xFFFFFFF0;
+	overwrite(MAPPED_LOG_TEST_FILE, lastOffset, &length, sizeof(length));
+
+	MappedLog log;
+	ASSERT_TRUE(log.open(MAPPED_LOG_TEST_FILE));
+	ASSERT_EQ(records, readAll(log));
+	ASSERT_EQ(lastOffset, log.end());
+}
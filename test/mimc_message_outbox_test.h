@@ -0,0 +1,46 @@
+#ifndef MIMC_CPP_TEST_MESSAGEOUTBOXTEST_H
+#define MIMC_CPP_TEST_MESSAGEOUTBOXTEST_H
+
+#include <gtest/gtest.h>
+#include <mimc/mapped_log.h>
+#include <mimc/message_outbox.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+const string OUTBOX_TEST_FILE = "/tmp/mimc_message_outbox_test.outbox";
+const string MAPPED_LOG_TEST_FILE = "/tmp/mimc_mapped_log_test.log";
+// pending before each compaction, and how many the main thread adds or acks while it runs
+const int OUTBOX_TEST_PENDING = 200;
+const int OUTBOX_TEST_CONCURRENT_OPS = 50;
+const int OUTBOX_TEST_ROUNDS = 100;
+const size_t OUTBOX_TEST_PAYLOAD_SIZE = 512;
+// spreads those operations over the whole compaction, before its snapshot and after
+const useconds_t OUTBOX_TEST_OP_INTERVAL_US = 10;
+
+class MessageOutboxTest: public testing::Test {
+protected:
+	void SetUp();
+
+	void TearDown();
+
+	// runs one compaction of outbox on its own thread, started tells the main thread to go ahead
+	static void* compact(void* arg);
+	void startCompaction(MessageOutbox& outbox);
+	void joinCompaction();
+
+	string addMessage(MessageOutbox& outbox);
+	// the pending ids oldest first, as takeUnsent hands them out after markAllUnsent
+	static vector<string> pendingIds(MessageOutbox& outbox);
+
+	MessageOutbox* compacting;
+	pthread_t compactThread;
+	std::atomic<bool> started;
+	int nextId;
+};
+
+#endif //MIMC_CPP_TEST_MESSAGEOUTBOXTEST_H
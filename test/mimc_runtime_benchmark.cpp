@@ -0,0 +1,152 @@
+#include <gtest/gtest.h>
+#include <test/mimc_runtime_benchmark.h>
+#include <mimc/mimc_runtime.h>
+#include <XMDLoggerWrapper.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <chrono>
+
+void MimcRuntimeBenchmark::SetUp() {
+	onlineUsers = 0;
+	receivedMessages = 0;
+	serverAcks = 0;
+	XMDLoggerWrapper::instance()->externalLog(&quietLog);
+	// cache files of an earlier run point at a stub port that is gone
+	ASSERT_EQ(0, system(("rm -rf " + BENCHMARK_CACHE_PATH).c_str()));
+	Utils::createDirIfNotExist(BENCHMARK_CACHE_PATH);
+
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	ASSERT_TRUE(feStub.start());
+}
+
+void MimcRuntimeBenchmark::TearDown() {
+	logoutAccounts();
+	feStub.stop();
+	XMDLoggerWrapper::instance()->externalLog(NULL);
+}
+
+int64_t MimcRuntimeBenchmark::residentBytes() {
+	long pages = 0;
+	long residentPages = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm == NULL) {
+		return 0;
+	}
+	if (fscanf(statm, "%ld %ld", &pages, &residentPages) != 2) {
+		residentPages = 0;
+	}
+	fclose(statm);
+	return (int64_t)residentPages * sysconf(_SC_PAGESIZE);
+}
+
+int64_t MimcRuntimeBenchmark::processCpuMicros() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (int64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+bool MimcRuntimeBenchmark::loginAccounts(int accountCount) {
+	for (int i = 0; i < accountCount; i++) {
+		BenchmarkAccount account;
+		string appAccount = "bench_" + Utils::int2str(i);
+		account.user = new User(BENCHMARK_APPID, appAccount, "bench", BENCHMARK_CACHE_PATH);
+		account.tokenFetcher = new StubTokenFetcher(&feStub, appAccount, 100000 + i);
+		account.statusHandler = new CountingOnlineStatusHandler(&onlineUsers);
+		account.messageHandler = new CountingMessageHandler(&receivedMessages, &serverAcks);
+		account.user->registerTokenFetcher(account.tokenFetcher);
+		account.user->registerOnlineStatusHandler(account.statusHandler);
+		account.user->registerMessageHandler(account.messageHandler);
+		accounts.push_back(account);
+		account.user->login();
+	}
+
+	int64_t deadline = Utils::steadyTimeMillis() + BENCHMARK_ONLINE_TIMEOUT_S * 1000;
+	while (onlineUsers < accountCount && Utils::steadyTimeMillis() < deadline) {
+		this_thread::sleep_for(chrono::milliseconds(10));
+	}
+	return onlineUsers == accountCount;
+}
+
+void MimcRuntimeBenchmark::logoutAccounts() {
+	for (size_t i = 0; i < accounts.size(); i++) {
+		accounts[i].user->logout();
+	}
+	for (size_t i = 0; i < accounts.size(); i++) {
+		delete accounts[i].user;
+		delete accounts[i].tokenFetcher;
+		delete accounts[i].statusHandler;
+		delete accounts[i].messageHandler;
+	}
+	accounts.clear();
+}
+
+void MimcRuntimeBenchmark::sendMessages(int durationS) {
+	// spread the sends of one interval evenly over its ticks instead of bursting every account at once
+	int ticksPerInterval = BENCHMARK_SEND_INTERVAL_MS / BENCHMARK_SEND_TICK_MS;
+	size_t next = 0;
+	int64_t begin = Utils::steadyTimeMillis();
+	for (int64_t tick = 0; tick < (int64_t)durationS * 1000 / BENCHMARK_SEND_TICK_MS; tick++) {
+		size_t quota = accounts.size() * (tick % ticksPerInterval + 1) / ticksPerInterval - accounts.size() * (tick % ticksPerInterval) / ticksPerInterval;
+		for (size_t i = 0; i < quota; i++, next = (next + 1) % accounts.size()) {
+			const BenchmarkAccount& from = accounts[next];
+			const BenchmarkAccount& to = accounts[(next ^ 1) < accounts.size() ? (next ^ 1) : next];
+			from.user->sendMessage(to.user->getAppAccount(), "benchmark payload");
+		}
+		int64_t wakeAt = begin + (tick + 1) * BENCHMARK_SEND_TICK_MS;
+		int64_t now = Utils::steadyTimeMillis();
+		if (wakeAt > now) {
+			this_thread::sleep_for(chrono::milliseconds(wakeAt - now));
+		}
+	}
+}
+
+void MimcRuntimeBenchmark::runBenchmark(int accountCount) {
+	struct rlimit limit;
+	getrlimit(RLIMIT_NOFILE, &limit);
+	if (limit.rlim_cur < (rlim_t)accountCount * 2 + 256) {
+		printf("skip %d accounts, RLIMIT_NOFILE %lu is too low\n", accountCount, (unsigned long)limit.rlim_cur);
+		return;
+	}
+
+	int64_t baseRss = residentBytes();
+	int64_t loginBegin = Utils::steadyTimeMillis();
+	ASSERT_TRUE(loginAccounts(accountCount));
+	int64_t loginCost = Utils::steadyTimeMillis() - loginBegin;
+	int64_t onlineRss = residentBytes();
+
+	int64_t cpuBegin = processCpuMicros() - feStub.getCpuMicros();
+	this_thread::sleep_for(chrono::seconds(BENCHMARK_IDLE_WINDOW_S));
+	int64_t idleCpu = processCpuMicros() - feStub.getCpuMicros() - cpuBegin;
+	int64_t idleRss = residentBytes();
+
+	int64_t sentBefore = feStub.getReceivedMessages();
+	cpuBegin = processCpuMicros() - feStub.getCpuMicros();
+	sendMessages(BENCHMARK_ACTIVE_WINDOW_S);
+	int64_t activeCpu = processCpuMicros() - feStub.getCpuMicros() - cpuBegin;
+	int64_t activeRss = residentBytes();
+	int64_t sent = feStub.getReceivedMessages() - sentBefore;
+
+	printf("MimcRuntime benchmark, %d accounts on %u event loops, all online in %lld ms\n",
+		accountCount, MimcRuntime::instance()->getWorkerCount(), (long long)loginCost);
+	printf("  idle:   rss %lld bytes/account, cpu %.2f us/s per account\n",
+		(long long)(idleRss - baseRss) / accountCount, (double)idleCpu / BENCHMARK_IDLE_WINDOW_S / accountCount);
+	printf("  active: rss %lld bytes/account, cpu %.2f us/s per account, %lld messages at %.1f msg/s, %lld acked, %lld received\n",
+		(long long)(activeRss - baseRss) / accountCount, (double)activeCpu / BENCHMARK_ACTIVE_WINDOW_S / accountCount,
+		(long long)sent, (double)sent / BENCHMARK_ACTIVE_WINDOW_S, (long long)serverAcks, (long long)receivedMessages);
+	printf("  rss right after login %lld bytes/account (stub side state included)\n", (long long)(onlineRss - baseRss) / accountCount);
+}
+
+TEST_F(MimcRuntimeBenchmark, thousandAccounts) {
+	runBenchmark(1000);
+}
+
+TEST_F(MimcRuntimeBenchmark, tenThousandAccounts) {
+	runBenchmark(10000);
+}
@@ -0,0 +1,115 @@
+#ifndef MIMC_CPP_TEST_RUNTIMEBENCHMARK_H
+#define MIMC_CPP_TEST_RUNTIMEBENCHMARK_H
+
+#include <gtest/gtest.h>
+#include <mimc/user.h>
+#include <mimc/utils.h>
+#include <mimc/tokenfetcher.h>
+#include <mimc/message_handler.h>
+#include <mimc/onlinestatus_handler.h>
+#include <test/mimc_fe_stub.h>
+#include <ExternalLog.h>
+#include <atomic>
+#include <vector>
+
+using namespace std;
+
+const int64_t BENCHMARK_APPID = 2882303761517669588;
+const string BENCHMARK_CACHE_PATH = "/tmp/mimc_runtime_benchmark";
+const int BENCHMARK_ONLINE_TIMEOUT_S = 300;
+const int BENCHMARK_IDLE_WINDOW_S = 10;
+const int BENCHMARK_ACTIVE_WINDOW_S = 10;
+// every account sends one message to its peer per interval during the active window
+const int BENCHMARK_SEND_INTERVAL_MS = 1000;
+const int BENCHMARK_SEND_TICK_MS = 10;
+
+class StubTokenFetcher : public MIMCTokenFetcher {
+public:
+	StubTokenFetcher(const MimcFeStub* stub, const string& appAccount, int64_t uuid)
+		: stub(stub), appAccount(appAccount), uuid(uuid) {}
+	string fetchToken() {
+		return stub->stubToken(BENCHMARK_APPID, appAccount, uuid);
+	}
+private:
+	const MimcFeStub* stub;
+	string appAccount;
+	int64_t uuid;
+};
+
+class CountingOnlineStatusHandler : public OnlineStatusHandler {
+public:
+	CountingOnlineStatusHandler(atomic<int>* onlineUsers) : onlineUsers(onlineUsers), online(false) {}
+	void statusChange(OnlineStatus status, string type, string reason, string desc) {
+		if (status == Online && !online) {
+			online = true;
+			(*onlineUsers)++;
+		} else if (status == Offline && online) {
+			online = false;
+			(*onlineUsers)--;
+		}
+	}
+private:
+	atomic<int>* onlineUsers;
+	bool online;
+};
+
+class CountingMessageHandler : public MessageHandler {
+public:
+	CountingMessageHandler(atomic<int64_t>* receivedMessages, atomic<int64_t>* serverAcks)
+		: receivedMessages(receivedMessages), serverAcks(serverAcks) {}
+	void handleMessage(vector<MIMCMessage> packets) {
+		(*receivedMessages) += packets.size();
+	}
+	void handleGroupMessage(vector<MIMCGroupMessage> packets) {}
+	void handleServerAck(string packetId, int64_t sequence, time_t timestamp, string desc) {
+		(*serverAcks)++;
+	}
+	void handleSendMsgTimeout(MIMCMessage message) {}
+	void handleSendGroupMsgTimeout(MIMCGroupMessage groupMessage) {}
+private:
+	atomic<int64_t>* receivedMessages;
+	atomic<int64_t>* serverAcks;
+};
+
+class QuietLog : public ExternalLog {
+public:
+	void info(const char *msg) {}
+	void debug(const char *msg) {}
+	void warn(const char *msg) {}
+	void error(const char *msg) {}
+};
+
+struct BenchmarkAccount {
+	User* user;
+	StubTokenFetcher* tokenFetcher;
+	CountingOnlineStatusHandler* statusHandler;
+	CountingMessageHandler* messageHandler;
+};
+
+class MimcRuntimeBenchmark: public testing::Test {
+protected:
+	void SetUp();
+
+	void TearDown();
+
+	void runBenchmark(int accountCount);
+
+	bool loginAccounts(int accountCount);
+
+	void logoutAccounts();
+
+	void sendMessages(int durationS);
+
+	static int64_t residentBytes();
+
+	static int64_t processCpuMicros();
+
+	MimcFeStub feStub;
+	QuietLog quietLog;
+	vector<BenchmarkAccount> accounts;
+	atomic<int> onlineUsers;
+	atomic<int64_t> receivedMessages;
+	atomic<int64_t> serverAcks;
+};
+
+#endif //MIMC_CPP_TEST_RUNTIMEBENCHMARK_H
@@ -0,0 +1,150 @@
+#include <gtest/gtest.h>
+#include <test/mimc_send_timeout_wheel_test.h>
+#include <mimc/utils.h>
+#include <unistd.h>
+
+MIMCMessage SendTimeoutWheelTest::createMessage(const string& packetId) {
+	return MIMCMessage(packetId, 0, "wheel_from", "from_resource", "wheel_to", "to_resource", "payload", "", 0);
+}
+
+MIMCGroupMessage SendTimeoutWheelTest::createGroupMessage(const string& packetId) {
+	return MIMCGroupMessage(packetId, 0, "wheel_from", "from_resource", 1, "payload", "", 0);
+}
+
+vector<string> SendTimeoutWheelTest::expire(int64_t nowMs) {
+	vector<MIMCMessage> messages;
+	vector<MIMCGroupMessage> groupMessages;
+	wheel.expire(nowMs, messages, groupMessages);
+	vector<string> packetIds;
+	for (size_t i = 0; i < messages.size(); i++) {
+		packetIds.push_back(messages[i].getPacketId());
+	}
+	for (size_t i = 0; i < groupMessages.size(); i++) {
+		packetIds.push_back(groupMessages[i].getPacketId());
+	}
+	return packetIds;
+}
+
+TEST_F(SendTimeoutWheelTest, expireOnDeadline) {
+	wheel.add(createMessage("p2p"), WHEEL_TEST_START_MS, 100);
+	wheel.add(createGroupMessage("p2t"), WHEEL_TEST_START_MS, 200);
+	ASSERT_EQ(2u, wheel.size());
+	ASSERT_EQ(WHEEL_TEST_START_MS + 100, wheel.nextExpireTimestamp());
+
+	// never before the deadline, at the deadline tick exactly
+	ASSERT_TRUE(expire(WHEEL_TEST_START_MS + 99).empty());
+	vector<string> expired = expire(WHEEL_TEST_START_MS + 100);
+	ASSERT_EQ(1u, expired.size());
+	ASSERT_EQ("p2p", expired[0]);
+	ASSERT_EQ(WHEEL_TEST_START_MS + 200, wheel.nextExpireTimestamp());
+
+	expired = expire(WHEEL_TEST_START_MS + 250);
+	ASSERT_EQ(1u, expired.size());
+	ASSERT_EQ("p2t", expired[0]);
+	ASSERT_TRUE(wheel.empty());
+	ASSERT_EQ(-1, wheel.nextExpireTimestamp());
+}
+
+TEST_F(SendTimeoutWheelTest, expireAcrossSlotWrap) {
+	// a turn and a half out, it hangs in the same slot as near, one turn later
+	int64_t farTimeout = WHEEL_TEST_TURN_MS + WHEEL_TEST_TURN_MS / 2;
+	wheel.add(createMessage("far"), WHEEL_TEST_START_MS, farTimeout);
+	wheel.add(createMessage("near"), WHEEL_TEST_START_MS, WHEEL_TEST_TURN_MS / 2);
+
+	// the shared slot comes due for near, far stays in it
+	vector<string> expired = expire(WHEEL_TEST_START_MS + WHEEL_TEST_TURN_MS / 2);
+	ASSERT_EQ(1u, expired.size());
+	ASSERT_EQ("near", expired[0]);
+	ASSERT_EQ(1u, wheel.size());
+
+	// the wheel wraps while far waits, one tick at a time
+	for (int64_t now = WHEEL_TEST_START_MS + WHEEL_TEST_TURN_MS / 2 + SEND_TIMEOUT_WHEEL_TICK_MS; now < WHEEL_TEST_START_MS + farTimeout; now += SEND_TIMEOUT_WHEEL_TICK_MS) {
+		ASSERT_TRUE(expire(now).empty());
+	}
+	expired = expire(WHEEL_TEST_START_MS + farTimeout);
+	ASSERT_EQ(1u, expired.size());
+	ASSERT_EQ("far", expired[0]);
+	ASSERT_TRUE(wheel.empty());
+}
+
+TEST_F(SendTimeoutWheelTest, expireAfterLongGap) {
+	// the loop was busy for several turns, every overdue entry fires at once
+	wheel.add(createMessage("a"), WHEEL_TEST_START_MS, 100);
+	wheel.add(createMessage("b"), WHEEL_TEST_START_MS, WHEEL_TEST_TURN_MS + 100);
+	wheel.add(createGroupMessage("c"), WHEEL_TEST_START_MS, WHEEL_TEST_TURN_MS * 3);
+	wheel.add(createMessage("d"), WHEEL_TEST_START_MS, WHEEL_TEST_TURN_MS * 5);
+
+	vector<string> expired = expire(WHEEL_TEST_START_MS + WHEEL_TEST_TURN_MS * 4);
+	ASSERT_EQ(3u, expired.size());
+	ASSERT_EQ(1u, wheel.size());
+	ASSERT_TRUE(expire(WHEEL_TEST_START_MS + WHEEL_TEST_TURN_MS * 5 - 1).empty());
+	expired = expire(WHEEL_TEST_START_MS + WHEEL_TEST_TURN_MS * 5);
+	ASSERT_EQ(1u, expired.size());
+	ASSERT_EQ("d", expired[0]);
+}
+
+TEST_F(SendTimeoutWheelTest, removeOnAck) {
+	wheel.add(createMessage("acked"), WHEEL_TEST_START_MS, 100);
+	wheel.add(createMessage("pending"), WHEEL_TEST_START_MS, 100);
+	wheel.add(createGroupMessage("groupAcked"), WHEEL_TEST_START_MS, 100);
+
+	ASSERT_TRUE(wheel.cancel("acked"));
+	ASSERT_TRUE(wheel.cancel("groupAcked"));
+	// a second ack, or one for a packet never added, finds nothing
+	ASSERT_FALSE(wheel.cancel("acked"));
+	ASSERT_FALSE(wheel.cancel("unknown"));
+	ASSERT_EQ(1u, wheel.size());
+
+	vector<string> expired = expire(WHEEL_TEST_START_MS + 100);
+	ASSERT_EQ(1u, expired.size());
+	ASSERT_EQ("pending", expired[0]);
+
+	// the last ack of a slot empties it, nothing is left to come due
+	wheel.add(createMessage("alone"), WHEEL_TEST_START_MS + 100, 500);
+	ASSERT_TRUE(wheel.cancel("alone"));
+	ASSERT_EQ(-1, wheel.nextExpireTimestamp());
+	ASSERT_TRUE(expire(WHEEL_TEST_START_MS + WHEEL_TEST_TURN_MS * 2).empty());
+}
+
+TEST_F(SendTimeoutWheelTest, resendTakesOverDeadline) {
+	wheel.add(createMessage("resent"), WHEEL_TEST_START_MS, 100);
+	wheel.add(createMessage("resent"), WHEEL_TEST_START_MS + 50, 1000);
+	ASSERT_EQ(1u, wheel.size());
+
+	ASSERT_TRUE(expire(WHEEL_TEST_START_MS + 1000).empty());
+	vector<string> expired = expire(WHEEL_TEST_START_MS + 1050);
+	ASSERT_EQ(1u, expired.size());
+	ASSERT_EQ("resent", expired[0]);
+	ASSERT_TRUE(wheel.empty());
+}
+
+TEST_F(SendTimeoutWheelTest, pausedClockMovesDeadlines) {
+	PacketManager packetManager;
+	int64_t begin = Utils::steadyTimeMillis();
+	packetManager.addPacketWaitToTimeout(createMessage("paused"), 200);
+	int64_t deadline = packetManager.nextMessageSendTimeout();
+	ASSERT_GE(deadline, begin + 200);
+	ASSERT_LT(deadline, begin + 200 + WHEEL_TEST_SLACK_MS);
+
+	// nothing comes due while paused, a second pause changes nothing
+	packetManager.setMessageSendTimeoutPaused(true);
+	ASSERT_EQ(-1, packetManager.nextMessageSendTimeout());
+	usleep(WHEEL_TEST_PAUSE_MS * 1000);
+	packetManager.setMessageSendTimeoutPaused(true);
+	ASSERT_EQ(-1, packetManager.nextMessageSendTimeout());
+
+	// the deadline moved out by the time spent paused
+	packetManager.setMessageSendTimeoutPaused(false);
+	int64_t moved = packetManager.nextMessageSendTimeout();
+	ASSERT_GE(moved, deadline + WHEEL_TEST_PAUSE_MS);
+	ASSERT_LT(moved, deadline + WHEEL_TEST_PAUSE_MS + WHEEL_TEST_SLACK_MS);
+
+	// a message sent while paused gets its whole timeout once the clock runs again
+	packetManager.removePacketWaitToTimeout("paused");
+	packetManager.setMessageSendTimeoutPaused(true);
+	packetManager.addPacketWaitToTimeout(createMessage("sentWhilePaused"), 100);
+	usleep(WHEEL_TEST_PAUSE_MS * 1000);
+	int64_t resumed = Utils::steadyTimeMillis();
+	packetManager.setMessageSendTimeoutPaused(false);
+	ASSERT_GE(packetManager.nextMessageSendTimeout(), resumed + 100 - SEND_TIMEOUT_WHEEL_TICK_MS);
+}
@@ -0,0 +1,31 @@
+#ifndef MIMC_CPP_TEST_SENDTIMEOUTWHEELTEST_H
+#define MIMC_CPP_TEST_SENDTIMEOUTWHEELTEST_H
+
+#include <gtest/gtest.h>
+#include <mimc/send_timeout_wheel.h>
+#include <mimc/packet_manager.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+const int64_t WHEEL_TEST_START_MS = 1000000;
+// one full turn of the wheel
+const int64_t WHEEL_TEST_TURN_MS = (int64_t)SEND_TIMEOUT_WHEEL_SLOTS * SEND_TIMEOUT_WHEEL_TICK_MS;
+// the paused clock runs on steady time, these leave room for a slow scheduler
+const int64_t WHEEL_TEST_PAUSE_MS = 300;
+const int64_t WHEEL_TEST_SLACK_MS = 100;
+
+class SendTimeoutWheelTest: public testing::Test {
+protected:
+	MIMCMessage createMessage(const string& packetId);
+
+	MIMCGroupMessage createGroupMessage(const string& packetId);
+
+	// expires up to nowMs and returns the packetIds that came due, group messages after P2P ones
+	vector<string> expire(int64_t nowMs);
+
+	SendTimeoutWheel wheel;
+};
+
+#endif //MIMC_CPP_TEST_SENDTIMEOUTWHEELTEST_H
@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+#include <test/mimc_sequence_window_test.h>
+#include <fstream>
+#include <stdio.h>
+
+void SequenceWindowTest::SetUp() {
+	remove(SEQUENCE_TEST_FILE.c_str());
+}
+
+void SequenceWindowTest::TearDown() {
+	remove(SEQUENCE_TEST_FILE.c_str());
+}
+
+TEST_F(SequenceWindowTest, duplicateInsideWindow) {
+	ASSERT_TRUE(window.checkAndMark(SEQUENCE_TEST_START));
+	ASSERT_FALSE(window.checkAndMark(SEQUENCE_TEST_START));
+
+	// out of order arrivals below the highest are still told apart
+	ASSERT_TRUE(window.checkAndMark(SEQUENCE_TEST_START + 10));
+	ASSERT_TRUE(window.checkAndMark(SEQUENCE_TEST_START + 5));
+	ASSERT_FALSE(window.checkAndMark(SEQUENCE_TEST_START + 5));
+	ASSERT_FALSE(window.checkAndMark(SEQUENCE_TEST_START + 10));
+
+	// the oldest sequence still inside the window
+	int64_t oldest = SEQUENCE_TEST_START + 10 - (SEQUENCE_WINDOW_SIZE - 1);
+	ASSERT_TRUE(window.checkAndMark(oldest));
+	ASSERT_FALSE(window.checkAndMark(oldest));
+}
+
+TEST_F(SequenceWindowTest, olderThanWindow) {
+	ASSERT_TRUE(window.checkAndMark(SEQUENCE_TEST_START));
+	ASSERT_TRUE(window.checkAndMark(SEQUENCE_TEST_START + SEQUENCE_WINDOW_SIZE));
+
+	// slid out of the window, treated as delivered whether it was seen or not
+	ASSERT_FALSE(window.checkAndMark(SEQUENCE_TEST_START));
+	ASSERT_FALSE(window.checkAndMark(SEQUENCE_TEST_START - 1));
+	ASSERT_FALSE(window.checkAndMark(SEQUENCE_TEST_START - SEQUENCE_WINDOW_SIZE * 4));
+	// the oldest sequence the window still covers
+	ASSERT_TRUE(window.checkAndMark(SEQUENCE_TEST_START + 1));
+}
+
+TEST_F(SequenceWindowTest, jumpPastWindow) {
+	for (int64_t sequence = SEQUENCE_TEST_START; sequence < SEQUENCE_TEST_START + 64; sequence++) {
+		ASSERT_TRUE(window.checkAndMark(sequence));
+	}
+
+	// a jump of more than a window clears every bit, the slots now belong to new sequences
+	int64_t jumped = SEQUENCE_TEST_START + 63 + SEQUENCE_WINDOW_SIZE + 1;
+	ASSERT_TRUE(window.checkAndMark(jumped));
+	for (int64_t sequence = SEQUENCE_TEST_START + SEQUENCE_WINDOW_SIZE; sequence < SEQUENCE_TEST_START + SEQUENCE_WINDOW_SIZE + 64; sequence++) {
+		ASSERT_TRUE(window.checkAndMark(sequence));
+	}
+	ASSERT_FALSE(window.checkAndMark(jumped));
+	ASSERT_FALSE(window.checkAndMark(SEQUENCE_TEST_START + 63));
+
+	// clear forgets the floor and the highest, the next sequence starts a new window
+	window.clear();
+	ASSERT_TRUE(window.checkAndMark(SEQUENCE_TEST_START));
+}
+
+TEST_F(SequenceWindowTest, floorRestoredFromFile) {
+	{
+		std::ofstream out(SEQUENCE_TEST_FILE.c_str(), std::ios::out | std::ios::trunc);
+		out << (long long)SEQUENCE_TEST_START;
+	}
+	PacketManager packetManager;
+	packetManager.enableSequencePersistence(SEQUENCE_TEST_FILE);
+	ASSERT_EQ(SEQUENCE_TEST_START, packetManager.sequenceHighWaterMark);
+
+	// everything up to the mark was delivered by the previous run, even far below the window
+	ASSERT_FALSE(packetManager.sequencesReceived.checkAndMark(SEQUENCE_TEST_START));
+	ASSERT_FALSE(packetManager.sequencesReceived.checkAndMark(SEQUENCE_TEST_START - 1));
+	ASSERT_FALSE(packetManager.sequencesReceived.checkAndMark(SEQUENCE_TEST_START - SEQUENCE_WINDOW_SIZE * 4));
+	ASSERT_TRUE(packetManager.sequencesReceived.checkAndMark(SEQUENCE_TEST_START + 1));
+	ASSERT_FALSE(packetManager.sequencesReceived.checkAndMark(SEQUENCE_TEST_START + 1));
+
+	// the saved mark is what the next run restores
+	packetManager.saveSequenceHighWaterMark(SEQUENCE_TEST_START + 1);
+	PacketManager restarted;
+	restarted.enableSequencePersistence(SEQUENCE_TEST_FILE);
+	ASSERT_FALSE(restarted.sequencesReceived.checkAndMark(SEQUENCE_TEST_START + 1));
+	ASSERT_TRUE(restarted.sequencesReceived.checkAndMark(SEQUENCE_TEST_START + 2));
+
+	// a missing or empty file leaves the window without a floor
+	remove(SEQUENCE_TEST_FILE.c_str());
+	PacketManager fresh;
+	fresh.enableSequencePersistence(SEQUENCE_TEST_FILE);
+	ASSERT_EQ(0, fresh.sequenceHighWaterMark);
+	ASSERT_TRUE(fresh.sequencesReceived.checkAndMark(1));
+}
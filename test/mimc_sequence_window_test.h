@@ -0,0 +1,23 @@
+#ifndef MIMC_CPP_TEST_SEQUENCEWINDOWTEST_H
+#define MIMC_CPP_TEST_SEQUENCEWINDOWTEST_H
+
+#include <gtest/gtest.h>
+#include <mimc/sequence_window.h>
+#include <mimc/packet_manager.h>
+#include <string>
+
+using namespace std;
+
+const int64_t SEQUENCE_TEST_START = 100000;
+const string SEQUENCE_TEST_FILE = "/tmp/mimc_sequence_window_test.seq";
+
+class SequenceWindowTest: public testing::Test {
+protected:
+	void SetUp();
+
+	void TearDown();
+
+	SequenceWindow window;
+};
+
+#endif //MIMC_CPP_TEST_SEQUENCEWINDOWTEST_H
@@ -0,0 +1,181 @@
+#include <gtest/gtest.h>
+#include <test/mimc_threadsafe_queue_test.h>
+#include <mimc/utils.h>
+#include <unistd.h>
+
+void* ThreadSafeQueueTest::produce(void* arg) {
+	Worker* worker = (Worker*)arg;
+	for (int i = 0; i < QUEUE_TEST_ITEMS_PER_PRODUCER; i++) {
+		// alternate the blocking and the back-off paths, both have to hand items over
+		int64_t item = encodeItem(worker->id, i);
+		if (i % 2 == 0) {
+			worker->test->queue->push(item);
+		} else {
+			while (worker->test->queue->tryPush(item) == QUEUE_WOULD_BLOCK) {
+				sched_yield();
+			}
+		}
+	}
+	return NULL;
+}
+
+void* ThreadSafeQueueTest::consume(void* arg) {
+	Worker* worker = (Worker*)arg;
+	int64_t item = 0;
+	while (worker->test->remaining.load() > 0) {
+		if (!worker->test->queue->pop(1, item)) {
+			continue;
+		}
+		worker->test->remaining--;
+		worker->popped++;
+		int producer = (int)(item >> 32);
+		int64_t index = item & 0xFFFFFFFF;
+		// one consumer sees the items of one producer in the order they were pushed
+		if (index <= worker->lastIndex[producer]) {
+			worker->ordered = false;
+		}
+		worker->lastIndex[producer] = index;
+		if (worker->test->popCounts != NULL) {
+			worker->test->popCounts[producer * QUEUE_TEST_ITEMS_PER_PRODUCER + index]++;
+		}
+	}
+	return NULL;
+}
+
+TEST_F(ThreadSafeQueueTest, fullAndEmpty) {
+	ThreadSafeQueue<int64_t> ring(QUEUE_TEST_CAPACITY);
+	int64_t item = 0;
+	ASSERT_TRUE(ring.empty());
+	ASSERT_FALSE(ring.pop(item));
+
+	for (unsigned int i = 0; i < QUEUE_TEST_CAPACITY; i++) {
+		ASSERT_EQ(QUEUE_PUSHED, ring.tryPush(i));
+	}
+	ASSERT_EQ(QUEUE_TEST_CAPACITY, ring.size());
+	ASSERT_EQ(QUEUE_WOULD_BLOCK, ring.tryPush(QUEUE_TEST_CAPACITY));
+	ASSERT_EQ(QUEUE_TEST_CAPACITY, ring.size());
+
+	// one slot freed takes exactly one more item, and the ring wraps in order
+	ASSERT_TRUE(ring.pop(item));
+	ASSERT_EQ(0, item);
+	ASSERT_EQ(QUEUE_PUSHED, ring.tryPush(QUEUE_TEST_CAPACITY));
+	ASSERT_EQ(QUEUE_WOULD_BLOCK, ring.tryPush(QUEUE_TEST_CAPACITY + 1));
+	for (unsigned int i = 1; i <= QUEUE_TEST_CAPACITY; i++) {
+		ASSERT_TRUE(ring.pop(item));
+		ASSERT_EQ((int64_t)i, item);
+	}
+	ASSERT_TRUE(ring.empty());
+	ASSERT_FALSE(ring.pop(item));
+
+	// a timed pop on an empty ring gives up after its timeout
+	int64_t begin = Utils::steadyTimeMillis();
+	ASSERT_FALSE(ring.pop(1, item));
+	ASSERT_GE(Utils::steadyTimeMillis() - begin, 900);
+
+	// a ring asked for a single slot still tells full from empty
+	ThreadSafeQueue<int64_t> single(1);
+	ASSERT_EQ(2u, single.capacity());
+	ASSERT_EQ(QUEUE_PUSHED, single.tryPush(1));
+	ASSERT_EQ(QUEUE_PUSHED, single.tryPush(2));
+	ASSERT_EQ(QUEUE_WOULD_BLOCK, single.tryPush(3));
+	ASSERT_TRUE(single.pop(item));
+	ASSERT_EQ(1, item);
+	ASSERT_TRUE(single.pop(item));
+	ASSERT_EQ(2, item);
+	ASSERT_FALSE(single.pop(item));
+
+	ring.tryPush(1);
+	ring.tryPush(2);
+	ring.clear();
+	ASSERT_TRUE(ring.empty());
+	ASSERT_EQ(QUEUE_PUSHED, ring.tryPush(3));
+	ASSERT_TRUE(ring.pop(item));
+	ASSERT_EQ(3, item);
+}
+
+TEST_F(ThreadSafeQueueTest, wakeupHandshake) {
+	// the smallest ring, so the producer below is full and asleep nearly all the time
+	ThreadSafeQueue<int64_t> ring(2);
+	queue = &ring;
+	remaining = 1;
+	popCounts = NULL;
+
+	// a consumer asleep on the empty ring is woken by a push from another thread
+	Worker consumer;
+	consumer.test = this;
+	consumer.id = 0;
+	consumer.lastIndex.assign(1, -1);
+	consumer.popped = 0;
+	consumer.ordered = true;
+	int64_t begin = Utils::steadyTimeMillis();
+	pthread_create(&consumer.thread, NULL, consume, &consumer);
+	usleep(200 * 1000);
+	ring.push(encodeItem(0, 0));
+	pthread_join(consumer.thread, NULL);
+	ASSERT_EQ(1, consumer.popped);
+	ASSERT_LT(Utils::steadyTimeMillis() - begin, QUEUE_TEST_WAKEUP_LIMIT_MS);
+
+	// a producer asleep on the full ring is woken by a pop from another thread
+	ASSERT_EQ(QUEUE_PUSHED, ring.tryPush(encodeItem(0, 0)));
+	ASSERT_EQ(QUEUE_PUSHED, ring.tryPush(encodeItem(0, 1)));
+	Worker producer;
+	producer.test = this;
+	producer.id = 0;
+	begin = Utils::steadyTimeMillis();
+	pthread_create(&producer.thread, NULL, produce, &producer);
+	int64_t item = 0;
+	for (int i = 0; i < QUEUE_TEST_ITEMS_PER_PRODUCER + 2; i++) {
+		ASSERT_TRUE(ring.pop(QUEUE_TEST_WAIT_SECONDS, item));
+	}
+	pthread_join(producer.thread, NULL);
+	ASSERT_TRUE(ring.empty());
+	ASSERT_LT(Utils::steadyTimeMillis() - begin, QUEUE_TEST_WAIT_SECONDS * 1000);
+}
+
+TEST_F(ThreadSafeQueueTest, multiProducerConsumer) {
+	ThreadSafeQueue<int64_t> ring(QUEUE_TEST_CAPACITY);
+	queue = &ring;
+	remaining = (int64_t)QUEUE_TEST_PRODUCERS * QUEUE_TEST_ITEMS_PER_PRODUCER;
+	vector<std::atomic<int> > counts(QUEUE_TEST_PRODUCERS * QUEUE_TEST_ITEMS_PER_PRODUCER);
+	for (size_t i = 0; i < counts.size(); i++) {
+		counts[i] = 0;
+	}
+	popCounts = &counts[0];
+
+	Worker producers[QUEUE_TEST_PRODUCERS];
+	Worker consumers[QUEUE_TEST_CONSUMERS];
+	for (int i = 0; i < QUEUE_TEST_CONSUMERS; i++) {
+		consumers[i].test = this;
+		consumers[i].id = i;
+		consumers[i].lastIndex.assign(QUEUE_TEST_PRODUCERS, -1);
+		consumers[i].popped = 0;
+		consumers[i].ordered = true;
+		pthread_create(&consumers[i].thread, NULL, consume, &consumers[i]);
+	}
+	for (int i = 0; i < QUEUE_TEST_PRODUCERS; i++) {
+		producers[i].test = this;
+		producers[i].id = i;
+		pthread_create(&producers[i].thread, NULL, produce, &producers[i]);
+	}
+	for (int i = 0; i < QUEUE_TEST_PRODUCERS; i++) {
+		pthread_join(producers[i].thread, NULL);
+	}
+	for (int i = 0; i < QUEUE_TEST_CONSUMERS; i++) {
+		pthread_join(consumers[i].thread, NULL);
+	}
+
+	// every item came out exactly once: none is left, none was popped twice
+	for (size_t i = 0; i < counts.size(); i++) {
+		ASSERT_EQ(1, counts[i].load());
+	}
+	int64_t popped = 0;
+	for (int i = 0; i < QUEUE_TEST_CONSUMERS; i++) {
+		ASSERT_TRUE(consumers[i].ordered);
+		popped += consumers[i].popped;
+	}
+	ASSERT_EQ((int64_t)QUEUE_TEST_PRODUCERS * QUEUE_TEST_ITEMS_PER_PRODUCER, popped);
+	ASSERT_EQ(0, remaining.load());
+	ASSERT_TRUE(ring.empty());
+	int64_t item = 0;
+	ASSERT_FALSE(ring.pop(item));
+}
@@ -0,0 +1,45 @@
+#ifndef MIMC_CPP_TEST_THREADSAFEQUEUETEST_H
+#define MIMC_CPP_TEST_THREADSAFEQUEUETEST_H
+
+#include <gtest/gtest.h>
+#include <mimc/threadsafe_queue.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+using namespace std;
+
+const unsigned int QUEUE_TEST_CAPACITY = 8;
+const int QUEUE_TEST_PRODUCERS = 4;
+const int QUEUE_TEST_CONSUMERS = 4;
+const int QUEUE_TEST_ITEMS_PER_PRODUCER = 100000;
+// a sleeper that is woken returns far sooner than this, one that is missed waits it out
+const long QUEUE_TEST_WAIT_SECONDS = 10;
+const int64_t QUEUE_TEST_WAKEUP_LIMIT_MS = 2000;
+
+class ThreadSafeQueueTest: public testing::Test {
+protected:
+	// producer in the upper 32 bits, its running number in the lower ones
+	static int64_t encodeItem(int producer, int index) {return ((int64_t)producer << 32) | index;}
+
+	static void* produce(void* arg);
+	static void* consume(void* arg);
+
+	struct Worker {
+		ThreadSafeQueueTest* test;
+		int id;
+		pthread_t thread;
+		// consumer only, the last index seen of every producer and how many items it popped
+		vector<int64_t> lastIndex;
+		int64_t popped;
+		bool ordered;
+	};
+
+	ThreadSafeQueue<int64_t>* queue;
+	std::atomic<int64_t> remaining;
+	// how often each item was popped, indexed like encodeItem without the shift
+	std::atomic<int>* popCounts;
+};
+
+#endif //MIMC_CPP_TEST_THREADSAFEQUEUETEST_H
@@ -14,9 +14,6 @@ public:
 
 	string fetchToken(); 
 
-	static size_t WriteCallback(void *contents, size_t size, size_t nmemb, void *userp);
-	
-
 	TestTokenFetcher(string appId, string appKey, string appSecret, string appAccount);
 
 private: